@@ -0,0 +1,303 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralBenchmark.h"
+#include "NeuralThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+namespace tgr {
+typedef std::chrono::high_resolution_clock Clock;
+#define O true
+#define X false
+static const bool MNIST_TABLE[] = {
+O, X, X, X, O, O, O, X, X, O, O, O, O, X, O, O,
+O, O, X, X, X, O, O, O, X, X, O, O, O, O, X, O,
+O, O, O, X, X, X, O, O, O, X, X, O, X, O, O, O,
+X, O, O, O, X, X, O, O, O, O, X, X, O, X, O, O,
+X, X, O, O, O, X, X, O, O, O, O, X, O, O, X, O,
+X, X, X, O, O, O, X, X, O, O, O, O, X, O, O, O };
+#undef O
+#undef X
+static std::string EscapeJSON(const std::string& str) {
+	std::string out;
+	for (char c : str) {
+		switch (c) {
+		case '"':
+			out += "\\\"";
+			break;
+		case '\\':
+			out += "\\\\";
+			break;
+		case '\n':
+			out += "\\n";
+			break;
+		default:
+			out += c;
+		}
+	}
+	return out;
+}
+NeuralBenchmark::NeuralBenchmark(const BenchmarkOptions& options) :
+		options(options) {
+}
+bool NeuralBenchmark::isEnabled(const std::string& name) const {
+	return (options.filter.size() == 0
+			|| name.find(options.filter) != std::string::npos);
+}
+const BenchmarkResult& NeuralBenchmark::run(const std::string& name,
+		const std::string& phase, BackendType backend,
+		const std::string& shape, int batchSize,
+		const std::function<void()>& func) {
+	for (int i = 0; i < options.warmup; i++) {
+		func();
+	}
+	std::vector<double> times;
+	double elapsed = 0.0;
+	while ((int) times.size() < options.maxIterations
+			&& ((int) times.size() < options.minIterations
+					|| elapsed < options.minTime)) {
+		auto start = Clock::now();
+		func();
+		double t = std::chrono::duration<double>(Clock::now() - start).count();
+		elapsed += t;
+		times.push_back(1000.0 * t);
+	}
+	BenchmarkResult result;
+	result.name = name;
+	result.phase = phase;
+	std::stringstream ss;
+	ss << backend;
+	result.backend = ss.str();
+	result.shape = shape;
+	result.batchSize = batchSize;
+	result.iterations = (int) times.size();
+	double sum = 0.0;
+	for (double t : times) {
+		sum += t;
+	}
+	result.mean = sum / times.size();
+	double var = 0.0;
+	for (double t : times) {
+		var += (t - result.mean) * (t - result.mean);
+	}
+	result.stddev = std::sqrt(var / times.size());
+	std::sort(times.begin(), times.end());
+	result.min = times.front();
+	result.max = times.back();
+	size_t mid = times.size() / 2;
+	result.median =
+			(times.size() % 2 == 0) ?
+					0.5 * (times[mid - 1] + times[mid]) : times[mid];
+	results.push_back(result);
+	print(std::cout, result);
+	return results.back();
+}
+void NeuralBenchmark::print(std::ostream& out,
+		const BenchmarkResult& r) const {
+	out << std::left << std::setw(28) << r.name << std::setw(10) << r.phase
+			<< std::setw(10) << r.backend << std::setw(24) << r.shape
+			<< " batch=" << std::setw(4) << r.batchSize << std::right
+			<< std::fixed << std::setprecision(4) << " median="
+			<< std::setw(10) << r.median << " ms  mean=" << std::setw(10)
+			<< r.mean << " ms  stddev=" << std::setw(8) << r.stddev
+			<< " ms  n=" << r.iterations << std::endl;
+	out.unsetf(std::ios_base::floatfield);
+}
+void NeuralBenchmark::writeJSON(std::ostream& out) const {
+	out << "{\n";
+	out << "  \"version\": 1,\n";
+	out << "  \"config\": {\n";
+	out << "    \"seed\": " << options.seed << ",\n";
+	out << "    \"warmup\": " << options.warmup << ",\n";
+	out << "    \"min_iterations\": " << options.minIterations << ",\n";
+	out << "    \"max_iterations\": " << options.maxIterations << ",\n";
+	out << "    \"min_time\": " << options.minTime << ",\n";
+	out << "    \"parallelize\": " << (options.parallelize ? "true" : "false")
+			<< ",\n";
+	out << "    \"hardware_threads\": " << std::thread::hardware_concurrency()
+			<< ",\n";
+	out << "    \"pool_threads\": " << NeuralThreadPool::getThreadCount()
+			<< ",\n";
+	out << "    \"isa\": \"" << NeuralKernels::getIsa() << "\"\n";
+	out << "  },\n";
+	out << "  \"results\": [";
+	out << std::setprecision(6);
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchmarkResult& r = results[i];
+		out << ((i == 0) ? "\n" : ",\n");
+		out << "    {\"name\": \"" << EscapeJSON(r.name) << "\", \"phase\": \""
+				<< EscapeJSON(r.phase) << "\", \"backend\": \""
+				<< EscapeJSON(r.backend) << "\", \"shape\": \""
+				<< EscapeJSON(r.shape) << "\", \"batch\": " << r.batchSize
+				<< ", \"iterations\": " << r.iterations << ", \"mean_ms\": "
+				<< r.mean << ", \"median_ms\": " << r.median
+				<< ", \"min_ms\": " << r.min << ", \"max_ms\": " << r.max
+				<< ", \"stddev_ms\": " << r.stddev << "}";
+	}
+	out << "\n  ]\n}\n";
+}
+void NeuralBenchmark::writeJSON(const std::string& file) const {
+	std::ofstream out(file);
+	if (!out.is_open()) {
+		throw std::runtime_error(
+				std::string("Could not open ") + file + " for writing.");
+	}
+	writeJSON(out);
+}
+std::string MakeShapeString(const std::vector<aly::dim3>& dims) {
+	std::stringstream ss;
+	for (size_t i = 0; i < dims.size(); i++) {
+		if (i > 0) {
+			ss << "+";
+		}
+		ss << dims[i].x << "x" << dims[i].y << "x" << dims[i].z;
+	}
+	return ss.str();
+}
+void FillRandom(Storage& data, std::mt19937& gen, float minValue,
+		float maxValue) {
+	std::uniform_real_distribution<float> dist(minValue, maxValue);
+	for (float& val : data) {
+		val = dist(gen);
+	}
+}
+void FillRandom(Tensor& data, std::mt19937& gen, float minValue,
+		float maxValue) {
+	for (Storage& s : data) {
+		FillRandom(s, gen, minValue, maxValue);
+	}
+}
+std::shared_ptr<NeuralSystem> MakeLayerSystem(const NeuralLayerPtr& layer) {
+	std::shared_ptr<NeuralSystem> sys(
+			new NeuralSystem(layer->getName(), nullptr));
+	std::vector<NeuralLayerPtr> inputs;
+	std::vector<ChannelType> types = layer->getInputTypes();
+	for (int i = 0; i < (int) types.size(); i++) {
+		if (types[i] == ChannelType::data) {
+			NeuralLayerPtr input = std::make_shared<InputLayer>(
+					layer->getInputDimensions(i));
+			Connect(input, layer, 0, i);
+			inputs.push_back(input);
+		}
+	}
+	sys->build(inputs, { layer });
+	return sys;
+}
+/**
+ * LeNet-5 with the partially connected deconvolution used by the MNIST
+ * example in TigerApp.
+ */
+std::shared_ptr<NeuralSystem> MakeLeNet5() {
+	std::shared_ptr<NeuralSystem> sys(new NeuralSystem("LeNet5", nullptr));
+	InputLayerPtr i1 = std::make_shared<InputLayer>(aly::dim3(32, 32, 1));
+	ConvolutionLayerPtr c1 = std::make_shared<ConvolutionLayer>(32, 32, 5, 1,
+			6);
+	TanhLayerPtr c1_tanh = std::make_shared<TanhLayer>(28, 28, 6);
+	AveragePoolingLayerPtr p1 = std::make_shared<AveragePoolingLayer>(28, 28,
+			6, 2);
+	TanhLayerPtr p1_tanh = std::make_shared<TanhLayer>(14, 14, 6);
+	DeconvolutionLayerPtr d1 = std::make_shared<DeconvolutionLayer>(14, 14, 5,
+			6, 16, tiny_dnn::core::ConnectionTable(MNIST_TABLE, 6, 16));
+	TanhLayerPtr d1_tanh = std::make_shared<TanhLayer>(18, 18, 16);
+	AveragePoolingLayerPtr p2 = std::make_shared<AveragePoolingLayer>(18, 18,
+			16, 2);
+	TanhLayerPtr p2_tanh = std::make_shared<TanhLayer>(9, 9, 16);
+	ConvolutionLayerPtr c2 = std::make_shared<ConvolutionLayer>(9, 9, 9, 16,
+			120);
+	TanhLayerPtr c2_tanh = std::make_shared<TanhLayer>(1, 1, 120);
+	FullyConnectedLayerPtr fc1 = std::make_shared<FullyConnectedLayer>(120,
+			10);
+	TanhLayerPtr fc1_tanh = std::make_shared<TanhLayer>(10);
+	i1 << c1 << c1_tanh << p1 << p1_tanh << d1 << d1_tanh
+			<< p2 << p2_tanh << c2 << c2_tanh << fc1 << fc1_tanh;
+	sys->build(i1, fc1_tanh);
+	return sys;
+}
+/**
+ * ENet style encoder/decoder from train.cpp, with the decoder shapes fixed so
+ * the strided deconvolutions line up with the fully connected classifier.
+ */
+std::shared_ptr<NeuralSystem> MakeENet() {
+	std::shared_ptr<NeuralSystem> sys(new NeuralSystem("ENet", nullptr));
+	//initial module
+	InputLayerPtr ii0 = std::make_shared<InputLayer>(aly::dim3(32, 32, 1));
+	ConvolutionLayerPtr ic1 = std::make_shared<ConvolutionLayer>(32, 32, 3, 1,
+			8, Padding::Same, true, 2, 2);
+	TanhLayerPtr ic1_tanh = std::make_shared<TanhLayer>(16, 16, 8);
+	MaxPoolingLayerPtr ip1 = std::make_shared<MaxPoolingLayer>(32, 32, 1, 2, 2,
+			2, 2);
+	TanhLayerPtr ip1_tanh = std::make_shared<TanhLayer>(16, 16, 1);
+	ConvolutionLayerPtr ic2 = std::make_shared<ConvolutionLayer>(16, 16, 1, 1,
+			8, Padding::Same);
+	TanhLayerPtr ic2_tanh = std::make_shared<TanhLayer>(16, 16, 8);
+	ConcatLayerPtr icc1 = std::make_shared<ConcatLayer>(
+			std::vector<aly::dim3> { aly::dim3(16, 16, 8), aly::dim3(16, 16, 8) });
+	ii0 << ip1 << ip1_tanh << ic2 << ic2_tanh;
+	ii0 << ic1 << ic1_tanh;
+	Connect(ic2_tanh, icc1, 0, 0);
+	Connect(ic1_tanh, icc1, 0, 1);
+
+	//bottle neck module 1
+	MaxPoolingLayerPtr b1p1 = std::make_shared<MaxPoolingLayer>(16, 16, 16, 2,
+			2, 2, 2);
+	TanhLayerPtr b1p1_tanh = std::make_shared<TanhLayer>(8, 8, 16);
+	ConvolutionLayerPtr b1c2 = std::make_shared<ConvolutionLayer>(8, 8, 1, 16,
+			32, Padding::Same);
+	TanhLayerPtr b1c2_tanh = std::make_shared<TanhLayer>(8, 8, 32);
+	ConvolutionLayerPtr b1c1 = std::make_shared<ConvolutionLayer>(16, 16, 1,
+			16, 32, Padding::Same);
+	TanhLayerPtr b1c1_tanh = std::make_shared<TanhLayer>(16, 16, 32);
+	ConvolutionLayerPtr b1c3 = std::make_shared<ConvolutionLayer>(16, 16, 2,
+			32, 32, Padding::Same, true, 2, 2);
+	TanhLayerPtr b1c3_tanh = std::make_shared<TanhLayer>(8, 8, 32);
+	ConvolutionLayerPtr b1c4 = std::make_shared<ConvolutionLayer>(8, 8, 1, 32,
+			32, Padding::Same);
+	TanhLayerPtr b1c4_tanh = std::make_shared<TanhLayer>(8, 8, 32);
+	ConcatLayerPtr b1cc1 = std::make_shared<ConcatLayer>(
+			std::vector<aly::dim3> { aly::dim3(8, 8, 32), aly::dim3(8, 8, 32) });
+	icc1 << b1p1 << b1p1_tanh << b1c2 << b1c2_tanh;
+	icc1 << b1c1 << b1c1_tanh << b1c3 << b1c3_tanh << b1c4
+			<< b1c4_tanh;
+	Connect(b1c2_tanh, b1cc1, 0, 0);
+	Connect(b1c4_tanh, b1cc1, 0, 1);
+
+	//bottle neck module 2
+	DeconvolutionLayerPtr b2d1 = std::make_shared<DeconvolutionLayer>(8, 8, 1,
+			64, 16, tiny_dnn::core::ConnectionTable(), Padding::Same, true, 2,
+			2);
+	TanhLayerPtr b2d1_tanh = std::make_shared<TanhLayer>(16, 16, 16);
+	DeconvolutionLayerPtr b2d2 = std::make_shared<DeconvolutionLayer>(16, 16,
+			1, 16, 1, tiny_dnn::core::ConnectionTable(), Padding::Same, true, 2,
+			2);
+	TanhLayerPtr b2d2_tanh = std::make_shared<TanhLayer>(32, 32, 1);
+	FullyConnectedLayerPtr fc1 = std::make_shared<FullyConnectedLayer>(32 * 32,
+			10);
+	TanhLayerPtr fc1_tanh = std::make_shared<TanhLayer>(10);
+	b1cc1 << b2d1 << b2d1_tanh << b2d2 << b2d2_tanh << fc1
+			<< fc1_tanh;
+	sys->build(ii0, fc1_tanh);
+	return sys;
+}
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALBENCHMARK_H_
+#define NEURALBENCHMARK_H_
+#include "NeuralSystem.h"
+#include <functional>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+namespace tgr {
+struct BenchmarkOptions {
+	int warmup = 3;
+	int minIterations = 5;
+	int maxIterations = 1000;
+	double minTime = 0.25; //seconds spent timing each case
+	unsigned int seed = 1234;
+	bool parallelize = true;
+	std::vector<int> batchSizes = { 1, 16, 64 };
+	std::string filter; //only run cases whose name contains this string
+};
+struct BenchmarkResult {
+	std::string name;
+	std::string phase;
+	std::string backend;
+	std::string shape;
+	int batchSize = 0;
+	int iterations = 0;
+	//milliseconds per iteration
+	double mean = 0;
+	double median = 0;
+	double min = 0;
+	double max = 0;
+	double stddev = 0;
+};
+/**
+ * Runs timed cases and collects their statistics. Every case is warmed up
+ * and then repeated until both minIterations and minTime are reached (or
+ * maxIterations is hit), so short kernels get enough samples to be stable.
+ */
+class NeuralBenchmark {
+protected:
+	BenchmarkOptions options;
+	std::vector<BenchmarkResult> results;
+public:
+	NeuralBenchmark(const BenchmarkOptions& options);
+	const BenchmarkOptions& getOptions() const {
+		return options;
+	}
+	const std::vector<BenchmarkResult>& getResults() const {
+		return results;
+	}
+	bool isEnabled(const std::string& name) const;
+	const BenchmarkResult& run(const std::string& name,
+			const std::string& phase, BackendType backend,
+			const std::string& shape, int batchSize,
+			const std::function<void()>& func);
+	void writeJSON(std::ostream& out) const;
+	void writeJSON(const std::string& file) const;
+	void print(std::ostream& out, const BenchmarkResult& result) const;
+};
+std::string MakeShapeString(const std::vector<aly::dim3>& dims);
+void FillRandom(Storage& data, std::mt19937& gen, float minValue = -1.0f,
+		float maxValue = 1.0f);
+void FillRandom(Tensor& data, std::mt19937& gen, float minValue = -1.0f,
+		float maxValue = 1.0f);
+/**
+ * Wires one InputLayer to every data input of the layer and builds a system
+ * around it, so the layer can be benchmarked in isolation.
+ */
+std::shared_ptr<NeuralSystem> MakeLayerSystem(const NeuralLayerPtr& layer);
+std::shared_ptr<NeuralSystem> MakeLeNet5();
+std::shared_ptr<NeuralSystem> MakeENet();
+}
+#endif
@@ -0,0 +1,347 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralBenchmark.h"
+#include "NeuralCostModel.h"
+#include "DropOutLayer.h"
+#include "GlobalAveragePoolingLayer.h"
+#include "LocalResponseNormLayer.h"
+#include "MaxUnpoolingLayer.h"
+#include "PowerLayer.h"
+#include "tiny_dnn/util/random.h"
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+using namespace tgr;
+using namespace aly;
+struct LayerCase {
+	std::string name;
+	std::function<NeuralLayerPtr()> create;
+};
+static std::vector<LayerCase> MakeLayerCases() {
+	std::vector<LayerCase> cases;
+	for (int c : { 8, 32 }) {
+		cases.push_back( { "ConvolutionLayer", [=]() {
+			return std::make_shared<ConvolutionLayer>(32, 32, 5, c, c);
+		} });
+		cases.push_back( { "ConvolutionLayer", [=]() {
+			return std::make_shared<ConvolutionLayer>(32, 32, 3, c, c,
+					Padding::Same);
+		} });
+		cases.push_back( { "ConvolutionLayer", [=]() {
+			return std::make_shared<ConvolutionLayer>(32, 32, 1, c, 2 * c,
+					Padding::Valid, true, 1, 1);
+		} });
+		cases.push_back( { "DeconvolutionLayer", [=]() {
+			return std::make_shared<DeconvolutionLayer>(14, 14, 5, c, c,
+					tiny_dnn::core::ConnectionTable());
+		} });
+		cases.push_back( { "DeconvolutionLayer", [=]() {
+			return std::make_shared<DeconvolutionLayer>(16, 16, 3, c, c,
+					tiny_dnn::core::ConnectionTable(), Padding::Same, true, 2,
+					2);
+		} });
+	}
+	for (int n : { 120, 1024 }) {
+		cases.push_back( { "FullyConnectedLayer", [=]() {
+			return std::make_shared<FullyConnectedLayer>(n, n / 2);
+		} });
+	}
+	for (int c : { 6, 32 }) {
+		cases.push_back( { "AveragePoolingLayer", [=]() {
+			return std::make_shared<AveragePoolingLayer>(28, 28, c, 2);
+		} });
+		cases.push_back( { "AverageUnpoolingLayer", [=]() {
+			return std::make_shared<AverageUnpoolingLayer>(14, 14, c, 2);
+		} });
+		cases.push_back( { "MaxPoolingLayer", [=]() {
+			return std::make_shared<MaxPoolingLayer>(28, 28, c, 2, 2, 2, 2);
+		} });
+		cases.push_back( { "MaxUnpoolingLayer", [=]() {
+			return std::make_shared<MaxUnpoolingLayer>(14, 14, c, 2, 2);
+		} });
+		cases.push_back( { "GlobalAveragePoolingLayer", [=]() {
+			return std::make_shared<GlobalAveragePoolingLayer>(28, 28, c);
+		} });
+		cases.push_back( { "TanhLayer", [=]() {
+			return std::make_shared<TanhLayer>(28, 28, c);
+		} });
+		cases.push_back( { "ReLULayer", [=]() {
+			return std::make_shared<ReLULayer>(28, 28, c);
+		} });
+		cases.push_back( { "ReLULayer", [=]() {
+			return std::make_shared<ReLULayer>(28, 28, c, 0.1f);
+		} });
+		cases.push_back( { "PowerLayer", [=]() {
+			return std::make_shared<PowerLayer>(dim3(28, 28, c), 2.0f);
+		} });
+		cases.push_back( { "LocalResponseNormLayer", [=]() {
+			return std::make_shared<LocalResponseNormLayer>(dim3(28, 28, c), 5);
+		} });
+		cases.push_back( { "BatchNormalizationLayer", [=]() {
+			InputLayer prev(dim3(28, 28, c));
+			return std::make_shared<BatchNormalizationLayer>(prev);
+		} });
+		cases.push_back( { "ConcatLayer", [=]() {
+			return std::make_shared<ConcatLayer>(
+					std::vector<dim3> {dim3(28, 28, c), dim3(28, 28, c)});
+		} });
+		cases.push_back( { "SliceLayer", [=]() {
+			return std::make_shared<SliceLayer>(dim3(28, 28, 2 * c),
+					SliceType::slice_channels, 2);
+		} });
+	}
+	for (int n : { 1024, 65536 }) {
+		cases.push_back( { "LinearLayer", [=]() {
+			return std::make_shared<LinearLayer>(n, 0.5f, 0.1f);
+		} });
+		cases.push_back( { "DropOutLayer", [=]() {
+			return std::make_shared<DropOutLayer>(n, 0.5f);
+		} });
+		cases.push_back( { "AddElementsLayer", [=]() {
+			return std::make_shared<AddElementsLayer>(2, n);
+		} });
+	}
+	return cases;
+}
+//internal and avx run the same run time selected kernels, so only the
+//default is timed; use --isa to compare instruction sets
+static std::vector<BackendType> GetBackends() {
+	return {DefaultEngine()};
+}
+static std::vector<Tensor> MakeBatch(const NeuralSystem& sys, int batch,
+		std::mt19937& gen) {
+	const std::vector<NeuralLayerPtr>& inputs = sys.getInputLayers();
+	std::vector<Tensor> data(batch, Tensor(inputs.size()));
+	for (Tensor& sample : data) {
+		for (size_t i = 0; i < inputs.size(); i++) {
+			dim3 dims = inputs[i]->getOutputDimensions(0);
+			sample[i].resize(dims.x * dims.y * dims.z);
+			FillRandom(sample[i], gen);
+		}
+	}
+	return data;
+}
+static void BenchmarkLayers(NeuralBenchmark& bench) {
+	const BenchmarkOptions& options = bench.getOptions();
+	for (const LayerCase& lcase : MakeLayerCases()) {
+		if (!bench.isEnabled(lcase.name)) {
+			continue;
+		}
+		for (BackendType backend : GetBackends()) {
+			for (int batch : options.batchSizes) {
+				tiny_dnn::set_random_seed(options.seed);
+				std::mt19937 gen(options.seed);
+				NeuralLayerPtr layer = lcase.create();
+				std::string shape = MakeShapeString(
+						layer->getInputDimensions());
+				std::shared_ptr<NeuralSystem> sys = MakeLayerSystem(layer);
+				layer->setBackendType(backend);
+				for (NeuralLayerPtr l : *sys) {
+					l->setParallelize(options.parallelize);
+				}
+				sys->forward(MakeBatch(*sys, batch, gen));
+				bench.run(lcase.name, "forward", backend, shape, batch,
+						[&]() {
+							layer->forward();
+						});
+				for (SignalPtr out : layer->getOutputSignals()) {
+					if (out->type == ChannelType::data) {
+						FillRandom(out->change, gen);
+					}
+				}
+				bench.run(lcase.name, "backward", backend, shape, batch,
+						[&]() {
+							layer->backward();
+						});
+			}
+		}
+	}
+}
+static void BenchmarkSystem(NeuralBenchmark& bench, const std::string& name,
+		const std::function<std::shared_ptr<NeuralSystem>()>& create,
+		const MachinePeak* peak) {
+	if (!bench.isEnabled(name)) {
+		return;
+	}
+	const BenchmarkOptions& options = bench.getOptions();
+	for (BackendType backend : GetBackends()) {
+		for (int batch : options.batchSizes) {
+			tiny_dnn::set_random_seed(options.seed);
+			std::mt19937 gen(options.seed);
+			std::shared_ptr<NeuralSystem> sys = create();
+			for (NeuralLayerPtr l : *sys) {
+				l->setBackendType(backend);
+				l->setParallelize(options.parallelize);
+			}
+			std::string shape = MakeShapeString(
+					sys->getInputLayers().front()->getOutputDimensions());
+			std::vector<Tensor> data = MakeBatch(*sys, batch, gen);
+			std::uniform_int_distribution<int> labelDist(0, 9);
+			std::vector<int> labels(batch);
+			for (int& label : labels) {
+				label = labelDist(gen);
+			}
+			NeuralLossFunction loss = SoftmaxCrossEntropyLossFunction();
+			GradientDescentOptimizer optimizer;
+			NeuralOptimizer opt = optimizer;
+			SystemCost cost;
+			if (peak != nullptr) {
+				cost = NeuralCostModel::analyze(*sys, batch);
+				std::cout << name << " (" << backend << "): ";
+				NeuralCostModel::print(std::cout, cost);
+			}
+			uint64_t startTime = NeuralProfiler::now();
+			sys->setPhase(NetPhase::Test);
+			bench.run(name, "inference", backend, shape, batch, [&]() {
+				sys->forward(data);
+			});
+			sys->setPhase(NetPhase::Train);
+			bench.run(name, "train", backend, shape, batch, [&]() {
+				sys->forward(data);
+				sys->bprop(loss, labels.data());
+				sys->updateWeights(opt, batch);
+			});
+			//timings are only recorded with --profile
+			if (peak != nullptr && NeuralProfiler::isEnabled()) {
+				std::vector<RooflinePoint> points = NeuralCostModel::roofline(
+						cost,
+						NeuralProfiler::getSummary(startTime,
+								NeuralProfiler::now()), *peak);
+				std::cout << name << " (" << backend << "), batch size "
+						<< batch << ": ";
+				NeuralCostModel::print(std::cout, *peak, points);
+			}
+		}
+	}
+}
+static void PrintUsage() {
+	std::cout << "Usage: bench [options]\n"
+			<< "  --output <file>     JSON results file (default bench.json)\n"
+			<< "  --filter <string>   only run cases containing <string>\n"
+			<< "  --batch <n,n,...>   batch sizes (default 1,16,64)\n"
+			<< "  --min-time <sec>    minimum timed seconds per case\n"
+			<< "  --iterations <n>    maximum timed iterations per case\n"
+			<< "  --warmup <n>        untimed iterations per case\n"
+			<< "  --seed <n>          random seed for weights and data\n"
+			<< "  --serial            disable parallel kernels\n"
+			<< "  --threads <n>       thread pool size, including the main thread\n"
+			<< "  --pin               pin thread pool workers to cores\n"
+			<< "  --isa <level>       cap kernels at generic, sse42, avx2 or avx512\n"
+			<< "  --profile <file>    write a per-layer Chrome trace\n"
+			<< "  --counters          add hardware counters to the profile (Linux,\n"
+			<< "                      requires --profile)\n"
+			<< "  --cost              print the FLOP/byte model of each network,\n"
+			<< "                      and a roofline of its layers with --profile\n";
+}
+int main(int argc, char *argv[]) {
+	BenchmarkOptions options;
+	std::string output = "bench.json";
+	std::string traceFile;
+	bool reportCost = false;
+	bool counters = false;
+	std::string isa;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = (i + 1 < argc);
+		if (arg == "--output" && hasValue) {
+			output = argv[++i];
+		} else if (arg == "--filter" && hasValue) {
+			options.filter = argv[++i];
+		} else if (arg == "--batch" && hasValue) {
+			options.batchSizes.clear();
+			std::stringstream ss(argv[++i]);
+			std::string token;
+			while (std::getline(ss, token, ',')) {
+				options.batchSizes.push_back(std::max(1, std::atoi(token.c_str())));
+			}
+		} else if (arg == "--min-time" && hasValue) {
+			options.minTime = std::atof(argv[++i]);
+		} else if (arg == "--iterations" && hasValue) {
+			options.maxIterations = std::max(1, std::atoi(argv[++i]));
+			options.minIterations = std::min(options.minIterations,
+					options.maxIterations);
+		} else if (arg == "--warmup" && hasValue) {
+			options.warmup = std::max(0, std::atoi(argv[++i]));
+		} else if (arg == "--seed" && hasValue) {
+			options.seed = (unsigned int) std::atoi(argv[++i]);
+		} else if (arg == "--profile" && hasValue) {
+			traceFile = argv[++i];
+		} else if (arg == "--counters") {
+			counters = true;
+		} else if (arg == "--cost") {
+			reportCost = true;
+		} else if (arg == "--serial") {
+			options.parallelize = false;
+		} else if (arg == "--threads" && hasValue) {
+			NeuralThreadPool::setThreadCount(std::max(1, std::atoi(argv[++i])));
+		} else if (arg == "--pin") {
+			NeuralThreadPool::setPinning(true);
+		} else if (arg == "--isa" && hasValue) {
+			isa = argv[++i];
+		} else {
+			PrintUsage();
+			return (arg == "--help") ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (counters && traceFile.size() == 0) {
+		std::cerr << "--counters requires --profile <file>." << std::endl;
+		return EXIT_FAILURE;
+	}
+	try {
+		if (isa.size() > 0) {
+			NeuralKernels::setIsa(ParseIsaLevel(isa));
+		}
+		std::cout << "Kernels: " << NeuralKernels::getIsa() << ", threads: "
+				<< NeuralThreadPool::getThreadCount() << std::endl;
+		NeuralBenchmark bench(options);
+		NeuralProfiler::setEnabled(traceFile.size() > 0);
+		if (counters && !NeuralCounters::setEnabled(true)) {
+			std::cerr << "Hardware counters unavailable." << std::endl;
+		}
+		MachinePeak peak;
+		if (reportCost) {
+			peak = NeuralCostModel::measureMachine();
+			std::streamsize precision = std::cout.precision();
+			std::cout << std::fixed << std::setprecision(2) << "Machine peak: "
+					<< peak.gflops << " GFLOP/s, " << peak.bandwidth
+					<< " GB/s, ridge " << peak.getRidgePoint()
+					<< " flop/byte" << std::endl;
+			std::cout.unsetf(std::ios_base::floatfield);
+			std::cout.precision(precision);
+		}
+		BenchmarkLayers(bench);
+		BenchmarkSystem(bench, "LeNet5", MakeLeNet5,
+				reportCost ? &peak : nullptr);
+		BenchmarkSystem(bench, "ENet", MakeENet, reportCost ? &peak : nullptr);
+		bench.writeJSON(output);
+		std::cout << "Wrote " << bench.getResults().size() << " results to "
+				<< output << std::endl;
+		if (traceFile.size() > 0) {
+			NeuralProfiler::printSummary(std::cout);
+			NeuralProfiler::writeChromeTrace(traceFile);
+		}
+	} catch (std::exception& e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
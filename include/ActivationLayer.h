@@ -116,6 +116,21 @@ public:
 	 **/
 	virtual void backward_activation(const Storage &x, const Storage &y,
 			Storage &dx, const Storage &dy) = 0;
+	/**
+	 * Activations that treat every element independently return true and
+	 * implement forward_elements/backward_elements over n elements, which
+	 * lets a small batch be split inside each sample across threads.
+	 */
+	virtual bool isElementwise() const {
+		return false;
+	}
+	virtual void forward_elements(const float* x, float* y, size_t n) {
+		throw std::runtime_error("Activation is not element wise.");
+	}
+	virtual void backward_elements(const float* x, const float* y, float* dx,
+			const float* dy, size_t n) {
+		throw std::runtime_error("Activation is not element wise.");
+	}
 	/**
 	 * Target value range for learning.
 	 */
@@ -47,6 +47,7 @@ public:
 
 	virtual std::vector<aly::dim3> getInputDimensions() const override;
 	virtual std::vector<aly::dim3> getOutputDimensions() const override;
+	virtual std::string getTableKey() const override;
 	virtual void forwardPropagation(const std::vector<Tensor*>&in_data,
 			std::vector<Tensor*> &out_data) override;
 	virtual void backwardPropagation(const std::vector<Tensor*> &in_data,
@@ -66,16 +66,13 @@ public:
 			const std::vector<Tensor*> &out_data,
 			std::vector<Tensor*> &out_grad, std::vector<Tensor*> &in_grad)
 					override;
-	virtual void setSampleCount(size_t sample_count) override;
 	virtual int getFanInSize() const override;
 	virtual int getFanOutSize() const override;
+	virtual uint64_t getMultiplyAdds() const override;
 private:
 	/* The convolution parameters */
 	tiny_dnn::core::conv_params params;
 
-	/* Padding operation */
-	tiny_dnn::core::Conv2dPadding padding_op;
-
 	/* forward op context */
 	tiny_dnn::core::OpKernelContext fwd_ctx;
 	/* backward op context */
@@ -84,21 +81,11 @@ private:
 	/* Forward and backward ops */
 	std::shared_ptr<tiny_dnn::core::OpKernel> kernel_fwd;
 	std::shared_ptr<tiny_dnn::core::OpKernel> kernel_back;
-	std::vector<Tensor *> fwd_in_data;
-	std::vector<Tensor *> bwd_in_data;
-	std::vector<Tensor *> bwd_in_grad;
-	/* Buffer to store padded data */
-	struct conv_layer_worker_specific_storage {
-		Tensor prev_out_padded;
-		Tensor prev_delta_padded;
-	} cws_;
-	Tensor* in_data_padded(const std::vector<Tensor*> &in);
 	void conv_set_params(const tiny_dnn::shape3d &in, int w_width, int w_height, int outc,
 			tiny_dnn::padding ptype, bool has_bias, int w_stride, int h_stride,
-			const ConnectionTable &tbl = ConnectionTable());
+			const tiny_dnn::core::ConnectionTable &tbl =
+					tiny_dnn::core::ConnectionTable());
 
-	int in_length(int in_length, int window_size,
-			tiny_dnn::padding pad_type) const;
 	static int conv_out_dim(int in_width, int in_height, int window_size,
 			int w_stride, int h_stride, Padding pad_type);
 	void init_backend(const backend_t backend_type);
@@ -64,6 +64,7 @@ public:
 
 	///< number of outgoing connections for each input unit
 	virtual int getFanOutSize() const override;
+	virtual uint64_t getMultiplyAdds() const override;
 	virtual void forwardPropagation(const std::vector<Tensor *> &in_data,
 			std::vector<Tensor *> &out_data) override;
 	/**
@@ -93,7 +94,6 @@ private:
 			int w_height, int outc, tiny_dnn::padding ptype, bool has_bias,
 			int w_stride, int h_stride,
 			const tiny_dnn::core::ConnectionTable &tbl);
-	void init_workers(int sample_count);
 	int in_length(int in_length, int window_size,
 			tiny_dnn::padding pad_type) const;
 	static int deconv_out_length(int in_length, int window_size, int stride);
@@ -104,13 +104,10 @@ private:
 	int deconv_out_dim(int in_width, int in_height, int window_width,
 			int window_height, int w_stride, int h_stride,
 			tiny_dnn::padding pad_type) const;
-	void copy_and_pad_delta(const Tensor &delta, Tensor &delta_padded);
-	void copy_and_unpad_output(const Tensor &out);
 	/* The convolution parameters */
 	std::vector<std::vector<aly::int2>> out2in;
 	tiny_dnn::core::deconv_params params;
 	//std::shared_ptr<tiny_dnn::core::backend> backend;
-	tiny_dnn::core::deconv_layer_worker_specific_storage deconv_layer_worker_storage;
 };
 typedef std::shared_ptr<DeconvolutionLayer> DeconvolutionLayerPtr;
 }
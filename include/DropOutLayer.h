@@ -27,6 +27,18 @@ public:
 	}
 	void setDropOutRate(float rate);
 	float getDropOutRate() const;
+	virtual void getStencilInput(const aly::int3& pos,
+			std::vector<aly::int3>& stencil) const override {
+		stencil = std::vector<aly::int3> { pos };
+	}
+	virtual void getStencilWeight(const aly::int3& pos,
+			std::vector<aly::int3>& stencil) const override {
+		stencil.clear();
+	}
+	virtual bool getStencilBias(const aly::int3& pos, aly::int3& stencil) const
+			override {
+		return false;
+	}
 	///< number of incoming connections for each output unit
 	virtual int getFanInSize() const override;
 	///< number of outgoing connections for each input unit
@@ -34,6 +34,9 @@ public:
 	virtual int getFanOutSize() const override {
 		return params.out_size;
 	}
+	virtual uint64_t getMultiplyAdds() const override {
+		return (uint64_t) params.in_size * params.out_size;
+	}
 
 	virtual std::vector<aly::dim3> getInputDimensions() const override {
 		if (params.has_bias) {
@@ -34,6 +34,9 @@ public:
 	virtual int getFanOutSize() const override {
 		return 1;
 	}
+	virtual uint64_t getMultiplyAdds() const override {
+		return (uint64_t) params.in.size();
+	}
 	void forwardPropagation(const std::vector<Tensor *> &in_data,
 			std::vector<Tensor *> &out_data) override;
 	void backwardPropagation(const std::vector<Tensor *> &in_data,
@@ -43,6 +46,9 @@ public:
 	std::vector<aly::dim3> getInputDimensions() const override;
 	std::vector<aly::dim3> getOutputDimensions() const override;
 	std::pair<int, int> pool_size() const;
+	virtual void getStencilInput(const aly::int3& pos,std::vector<aly::int3>& stencil) const override;
+	virtual void getStencilWeight(const aly::int3& pos,std::vector<aly::int3>& stencil) const override;
+	virtual bool getStencilBias(const aly::int3& pos,aly::int3& stencil) const override;
 private:
 	tiny_dnn::core::global_avepool_params params;
 
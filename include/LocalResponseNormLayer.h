@@ -48,12 +48,25 @@ public:
 	int getFanOutSize() const override {
 		return size;
 	}
+	uint64_t getMultiplyAdds() const override {
+		return (uint64_t) in_shape.x * in_shape.y * in_shape.z * size;
+	}
 	std::vector<aly::dim3> getInputDimensions() const override {
 		return {in_shape};
 	}
 	std::vector<aly::dim3> getOutputDimensions() const override {
 		return {in_shape};
 	}
+	void getStencilInput(const aly::int3& pos,
+			std::vector<aly::int3>& stencil) const override;
+	void getStencilWeight(const aly::int3& pos,
+			std::vector<aly::int3>& stencil) const override {
+		stencil.clear();
+	}
+	bool getStencilBias(const aly::int3& pos, aly::int3& stencil) const
+			override {
+		return false;
+	}
 	void forwardPropagation(const std::vector<Tensor *> &in_data,
 			std::vector<Tensor *> &out_data);
 	void backwardPropagation(const std::vector<Tensor *> &in_data,
@@ -13,6 +13,7 @@
 #include "tiny_dnn/tiny_dnn.h"
 namespace tgr {
 class MaxPoolingLayer: public NeuralLayer {
+public:
 	MaxPoolingLayer(int in_width, int in_height, int in_channels,
 			int pooling_size_x, int pooling_size_y, int stride_x, int stride_y,
 			Padding pad_type = Padding::Valid, BackendType backend_type =
@@ -25,9 +26,16 @@ class MaxPoolingLayer: public NeuralLayer {
 					override;
 	virtual int getFanInSize() const override;
 	virtual int getFanOutSize() const override;
+	virtual uint64_t getMultiplyAdds() const override;
 	virtual std::vector<aly::dim3> getInputDimensions() const override;
 	virtual std::vector<aly::dim3> getOutputDimensions() const override;
 	virtual void setSampleCount(size_t sample_count) override;
+	virtual std::string getTableKey() const override;
+	virtual void getTables(PlanTable& table) const override;
+	virtual void setTables(const PlanTable& table) override;
+	virtual void getStencilInput(const aly::int3& pos,std::vector<aly::int3>& stencil) const override;
+	virtual void getStencilWeight(const aly::int3& pos,std::vector<aly::int3>& stencil) const override;
+	virtual bool getStencilBias(const aly::int3& pos,aly::int3& stencil) const override;
 private:
 	/* The Max Poling operation params */
 	tiny_dnn::core::maxpool_params params;
@@ -33,6 +33,12 @@ public:
 			int unpooling_size, int stride);
 	virtual int getFanInSize() const override;
 	virtual int getFanOutSize() const override;
+	virtual void getStencilInput(const aly::int3& pos,std::vector<aly::int3>& stencil) const override;
+	virtual void getStencilWeight(const aly::int3& pos,std::vector<aly::int3>& stencil) const override;
+	virtual bool getStencilBias(const aly::int3& pos,aly::int3& stencil) const override;
+	virtual std::string getTableKey() const override;
+	virtual void getTables(PlanTable& table) const override;
+	virtual void setTables(const PlanTable& table) override;
 
 	virtual void forwardPropagation(
 			const std::vector<Tensor *> &in_data,
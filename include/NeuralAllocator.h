@@ -0,0 +1,96 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALALLOCATOR_H_
+#define NEURALALLOCATOR_H_
+#include "NeuralMemory.h"
+#include <cstddef>
+#include <type_traits>
+namespace tgr {
+/**
+ * Aligned allocator for signal storage. By default memory comes from the
+ * NeuralMemory pool, but an allocator can also be constructed as a view onto a
+ * range owned by another buffer. Vectors built with a view allocator read and
+ * write that range in place, which lets concat/slice outputs share memory with
+ * their producers.
+ *
+ * Copies never inherit the view (a copied vector gets its own pool memory), and
+ * copy/move assignment writes through the view instead of stealing it.
+ */
+template<typename T, size_t Alignment = 64>
+class StorageAllocator {
+public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef std::false_type propagate_on_container_copy_assignment;
+	typedef std::false_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+	template<typename U> struct rebind {
+		typedef StorageAllocator<U, Alignment> other;
+	};
+	StorageAllocator() :
+			view(nullptr), viewSize(0) {
+	}
+	StorageAllocator(T* view, size_t viewSize) :
+			view(view), viewSize(viewSize) {
+	}
+	template<typename U> StorageAllocator(
+			const StorageAllocator<U, Alignment>& other) :
+			view(nullptr), viewSize(0) {
+	}
+	T* allocate(size_t n) {
+		if (view != nullptr && n <= viewSize) {
+			return view;
+		}
+		return static_cast<T*>(NeuralMemory::allocate(n * sizeof(T)));
+	}
+	void deallocate(T* ptr, size_t n) {
+		if (ptr != view) {
+			NeuralMemory::deallocate(ptr);
+		}
+	}
+	StorageAllocator select_on_container_copy_construction() const {
+		return StorageAllocator();
+	}
+	bool isView() const {
+		return (view != nullptr);
+	}
+	T* getView() const {
+		return view;
+	}
+	bool operator==(const StorageAllocator& other) const {
+		return (view == other.view);
+	}
+	bool operator!=(const StorageAllocator& other) const {
+		return (view != other.view);
+	}
+private:
+	static_assert(Alignment <= NeuralMemory::ALIGNMENT,
+			"NeuralMemory blocks are 64 byte aligned.");
+	T* view;
+	size_t viewSize;
+};
+}
+#endif
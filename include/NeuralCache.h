@@ -1,50 +1,142 @@
 #ifndef _NEURAL_CACHE_H_
 #define _NEURAL_CACHE_H_
 #include "NeuralKnowledge.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
 #include <map>
+#include <memory>
 #include <mutex>
-#include <tuple>
-#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 namespace tgr {
+	class NeuralCache;
+	enum class CacheState {
+		Unloaded, Loading, Loaded, Failed
+	};
+	/**
+	 * One snapshot of the weights, resident or on disk. Only NeuralCache
+	 * changes its state; getKnowledge() never touches the disk.
+	 */
 	class CacheElement {
+		friend class NeuralCache;
 	protected:
-		bool loaded;
-		bool writeOnce;
+		int frame;
+		CacheState state;
+		bool ownsFile; //file was written by the cache and is deleted with it
+		bool dirty; //resident copy has not been written to the file yet
+		int queued; //0, or 1 when waiting for a prefetch and 2 for a demand load
+		uint64_t bytes;
 		std::string knowledgeFile;
 		std::shared_ptr<NeuralKnowledge> neuralKnowledge;
-		std::mutex accessLock;
+		std::list<int>::iterator lruPosition;
+		mutable std::mutex accessLock;
 	public:
-		bool isLoaded() {
-			std::lock_guard<std::mutex> lockMe(accessLock);
-			return loaded;
-		}
-		CacheElement() :loaded(false), writeOnce(true) {
+		CacheElement(int frame) :
+				frame(frame), state(CacheState::Unloaded), ownsFile(false), dirty(false), queued(0), bytes(0) {
 		}
 		~CacheElement();
+		int getFrame() const {
+			return frame;
+		}
 		std::string getFile() const {
+			std::lock_guard<std::mutex> lockMe(accessLock);
 			return knowledgeFile;
 		}
-		void load();
-		void unload();
-		void set(const NeuralKnowledge& neuralKnowledge);
-		std::shared_ptr<NeuralKnowledge> getKnowledge();
-	};
-	struct CacheCompare {
-		inline bool operator() (const std::pair<uint64_t, int>& lhs, const std::pair<uint64_t, int>& rhs) const {
-			return lhs.first < rhs.first;
+		CacheState getState() const {
+			std::lock_guard<std::mutex> lockMe(accessLock);
+			return state;
+		}
+		bool isLoaded() const {
+			return (getState() == CacheState::Loaded);
+		}
+		//nullptr unless loaded
+		std::shared_ptr<NeuralKnowledge> getKnowledge() const {
+			std::lock_guard<std::mutex> lockMe(accessLock);
+			return neuralKnowledge;
 		}
 	};
+	struct CacheStats {
+		uint64_t residentBytes = 0;
+		uint64_t budgetBytes = 0;
+		int residentElements = 0;
+		int elements = 0;
+		uint64_t hits = 0; //get() found the element resident
+		uint64_t misses = 0;
+		uint64_t loads = 0;
+		uint64_t evictions = 0;
+		uint64_t writes = 0;
+	};
+	/**
+	 * Weight snapshots keyed by frame, kept resident under a byte budget with
+	 * least recently used eviction. get() and prefetch() only queue work; a
+	 * background worker loads files and writes evicted snapshots that were
+	 * never saved, so lookups never wait on the disk. Requested frames are
+	 * loaded before prefetched ones.
+	 */
 	class NeuralCache {
 	protected:
-		std::map<int, std::shared_ptr<CacheElement>> cache;
-		std::set<std::pair<uint64_t, int>, CacheCompare> loadedList;
+		std::unordered_map<int, std::shared_ptr<CacheElement>> cache;
+		std::list<int> lruList; //resident frames, most recently used first
+		std::deque<int> demandQueue;
+		std::deque<int> prefetchQueue;
+		//evicted snapshots waiting to be written, still usable until then
+		std::map<int, std::shared_ptr<NeuralKnowledge>> writeBacks;
 		std::mutex accessLock;
-		int maxElements = 32;
-		uint64_t counter = 0;
+		std::condition_variable workChanged;
+		std::condition_variable loaded;
+		std::thread worker;
+		uint64_t budget;
+		uint64_t residentBytes = 0;
+		CacheStats stats;
+		bool stopping = false;
+		std::function<void(int frame, const std::string& file, NeuralKnowledge& knowledge)> loader;
+		std::shared_ptr<CacheElement> getElement(int frame);
+		static void setState(CacheElement& elem, CacheState state, const std::shared_ptr<NeuralKnowledge>& knowledge);
+		void touch(CacheElement& elem);
+		void makeResident(CacheElement& elem, const std::shared_ptr<NeuralKnowledge>& knowledge, bool dirty);
+		void evict();
+		void request(CacheElement& elem, bool demand);
+		void run();
 	public:
-		std::shared_ptr<CacheElement> set(int frame, const NeuralKnowledge& springl);
+		//called on the worker thread when a requested frame has loaded
+		std::function<void(int frame)> onLoaded;
+		NeuralCache(uint64_t budgetBytes = 512ULL << 20);
+		~NeuralCache();
+		NeuralCache(const NeuralCache&) = delete;
+		NeuralCache& operator=(const NeuralCache&) = delete;
+		void setBudget(uint64_t bytes);
+		uint64_t getBudget() const {
+			return budget;
+		}
+		/**
+		 * Stores a snapshot. It is written to nknow.getFile() if it is ever
+		 * evicted, and that file is deleted with the cache.
+		 */
+		std::shared_ptr<CacheElement> set(int frame, const NeuralKnowledge& nknow);
+		//registers a snapshot already on disk without loading it
+		std::shared_ptr<CacheElement> setFile(int frame, const std::string& file);
+		/**
+		 * Returns the element for a frame, or nullptr if the frame is unknown.
+		 * If it is not resident a load is queued and the element reports
+		 * Loading until the worker is done.
+		 */
 		std::shared_ptr<CacheElement> get(int frame);
+		//like get(), but waits for the load
+		std::shared_ptr<NeuralKnowledge> load(int frame);
+		//queues frames likely to be needed soon, nearest first
+		void prefetch(const std::vector<int>& frames);
+		void prefetch(int frame, int radius);
+		/**
+		 * Replaces how the worker reads a frame, for frames stored in something
+		 * other than a plain file. Unset, ReadNeuralKnowledgeFromFile is used.
+		 */
+		void setLoader(const std::function<void(int frame, const std::string& file, NeuralKnowledge& knowledge)>& f);
+		std::vector<int> getFrames();
+		CacheStats getStats();
 		void clear();
 	};
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALCAFFE_H_
+#define NEURALCAFFE_H_
+#include "NeuralSystem.h"
+#include <memory>
+#include <string>
+namespace tgr {
+/**
+ * Builds a NeuralSystem from a Caffe network definition and, if given, the
+ * trained weights in a .caffemodel file. The prototxt supplies the layers
+ * and input shape (a deploy prototxt with an Input layer or input_dim
+ * lines); without one the layer definitions stored in the caffemodel are
+ * used. Both the current and the V1 layer formats are read, with no
+ * protobuf library needed.
+ *
+ * Convolution, InnerProduct, Pooling, LRN, ReLU, TanH, Dropout, BatchNorm,
+ * Power, Concat and Eltwise sum map onto the matching tgr layers; Split and
+ * Flatten are dropped, and Softmax, Accuracy and loss layers are left to
+ * NeuralLossFunction. The caffemodel is mapped into memory and each weight
+ * blob is copied once, in parallel, from the mapping into its layer's
+ * signal buffer. Anything tgr cannot represent (other padding amounts,
+ * Caffe's rounded-up pooling sizes, dilation) throws instead of importing
+ * a network that computes something else.
+ */
+std::shared_ptr<NeuralSystem> ReadCaffeModel(const std::string& prototxt,
+		const std::string& caffemodel = "", BackendType backend =
+				DefaultEngine());
+}
+#endif
@@ -0,0 +1,111 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALCHECKPOINT_H_
+#define NEURALCHECKPOINT_H_
+#include "NeuralKnowledge.h"
+#include "NeuralOptimizer.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+namespace tgr {
+class NeuralSystem;
+struct CheckpointOptions {
+	std::string directory = ".";
+	std::string prefix = "checkpoint"; //files are <prefix>_<iteration>.tgw
+	int interval = 1; //iterations between checkpoints, 0 disables them
+	int keep = 0; //newest files kept on disk, 0 keeps all of them
+	//snapshots captured but not yet on disk before checkpoint() waits
+	int maxPending = 2;
+	//skip checkpoints while the writer is behind instead of waiting
+	bool dropWhenBusy = false;
+};
+struct CheckpointStats {
+	int captured = 0;
+	int written = 0;
+	int dropped = 0;
+	uint64_t bytes = 0;
+	double captureTime = 0.0; //seconds the training thread spent copying
+	double stallTime = 0.0; //seconds the training thread waited for the disk
+	double writeTime = 0.0; //seconds the writer thread spent writing
+};
+struct CheckpointSnapshot;
+/**
+ * Checkpoints a network without stalling training on disk I/O. At an
+ * iteration boundary checkpoint() copies every trainable weight into a
+ * recycled snapshot buffer with one parallel copy, then returns; a
+ * background thread writes the snapshot as a weight container (see
+ * NeuralKnowledge::mapContainer) and deletes files beyond the retention
+ * count. When maxPending snapshots are waiting, checkpoint() blocks until
+ * the writer catches up, or skips the checkpoint if dropWhenBusy is set.
+ *
+ * Write errors are rethrown from the next checkpoint() or flush().
+ */
+class NeuralCheckpointer {
+protected:
+	CheckpointOptions options;
+	std::thread writer;
+	mutable std::mutex lock;
+	std::condition_variable changed;
+	std::deque<std::shared_ptr<CheckpointSnapshot>> pending;
+	std::vector<std::shared_ptr<CheckpointSnapshot>> spare;
+	std::deque<std::string> files;
+	std::exception_ptr error;
+	CheckpointStats stats;
+	bool writing;
+	bool stopping;
+	void run();
+	void throwError();
+public:
+	//called on the writer thread after each file is on disk
+	std::function<void(int iteration, const std::string& file)> onWritten;
+	NeuralCheckpointer(const CheckpointOptions& options = CheckpointOptions());
+	~NeuralCheckpointer();
+	NeuralCheckpointer(const NeuralCheckpointer&) = delete;
+	NeuralCheckpointer& operator=(const NeuralCheckpointer&) = delete;
+	const CheckpointOptions& getOptions() const {
+		return options;
+	}
+	bool isDue(int iteration) const;
+	std::string getFile(int iteration) const;
+	/**
+	 * Snapshots the weights if a checkpoint is due at this iteration, or
+	 * always when force is set. Returns false if nothing was captured. With
+	 * an optimizer, its moments and scalars are saved in the same file; see
+	 * NeuralSystem::setOptimizerState() to restore them.
+	 */
+	bool checkpoint(const NeuralSystem& sys, int iteration, bool force =
+			false, NeuralOptimizer* optimizer = nullptr);
+	//waits until every captured snapshot is on disk
+	void flush();
+	//retained files, oldest first
+	std::vector<std::string> getFiles() const;
+	CheckpointStats getStats() const;
+	void printStats(std::ostream& out) const;
+};
+}
+#endif
@@ -0,0 +1,110 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALCOSTMODEL_H_
+#define NEURALCOSTMODEL_H_
+#include "NeuralProfiler.h"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+namespace tgr {
+class NeuralSystem;
+/**
+ * Static cost of one layer for a whole batch. Byte counts assume 32-bit
+ * floats. Weight gradients are kept per sample by the runtime, so they scale
+ * with the batch size.
+ */
+struct LayerCost {
+	int layerId;
+	std::string name;
+	uint64_t forwardMACs;
+	uint64_t backwardMACs;
+	uint64_t parameterBytes;
+	uint64_t inputBytes;
+	uint64_t outputBytes;
+	uint64_t forwardBytes;
+	uint64_t backwardBytes;
+	double getForwardIntensity() const { //flops per byte
+		return (forwardBytes > 0) ? (2.0 * forwardMACs) / forwardBytes : 0.0;
+	}
+	double getBackwardIntensity() const {
+		return (backwardBytes > 0) ? (2.0 * backwardMACs) / backwardBytes : 0.0;
+	}
+};
+struct SystemCost {
+	int batchSize;
+	std::vector<LayerCost> layers;
+	uint64_t forwardMACs;
+	uint64_t backwardMACs;
+	uint64_t parameterBytes;
+	uint64_t activationBytes;
+	//bytes the runtime allocates for this batch (values and gradients)
+	uint64_t residentBytes;
+	//peak live bytes if buffers were released after their last use
+	uint64_t peakInferenceBytes;
+	uint64_t peakTrainingBytes;
+};
+struct MachinePeak {
+	double gflops; //single precision
+	double bandwidth; //GB/s
+	int threads;
+	double getRidgePoint() const {
+		return (bandwidth > 0.0) ? gflops / bandwidth : 0.0;
+	}
+};
+struct RooflinePoint {
+	int layerId;
+	std::string name;
+	ProfilePhase phase;
+	double intensity;
+	double time; //milliseconds per call
+	double achieved; //GFLOP/s
+	double attainable; //GFLOP/s
+	bool memoryBound;
+	double getEfficiency() const {
+		return (attainable > 0.0) ? achieved / attainable : 0.0;
+	}
+};
+/**
+ * Analytic FLOP/byte model over a built NeuralSystem, with an optional
+ * roofline placement of measured layer timings.
+ */
+class NeuralCostModel {
+public:
+	static SystemCost analyze(const NeuralSystem& sys, int batchSize);
+	/**
+	 * Measures sustained single precision FMA throughput and triad memory
+	 * bandwidth with all thread pool threads. Takes roughly 2*seconds.
+	 */
+	static MachinePeak measureMachine(double seconds = 0.25);
+	/**
+	 * Places each profiled layer on the roofline. The profile should come from
+	 * forward/backward calls made with the batch size the cost was built for.
+	 */
+	static std::vector<RooflinePoint> roofline(const SystemCost& cost,
+			const std::vector<ProfileSummary>& profile,
+			const MachinePeak& peak);
+	static void print(std::ostream& out, const SystemCost& cost);
+	static void print(std::ostream& out, const MachinePeak& peak,
+			const std::vector<RooflinePoint>& points);
+};
+}
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALCOUNTERS_H_
+#define NEURALCOUNTERS_H_
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+namespace tgr {
+enum class HardwareCounter {
+	Cycles = 0,
+	Instructions = 1,
+	L1DMisses = 2,
+	LLCMisses = 3,
+	BranchMisses = 4
+};
+static const int HARDWARE_COUNTER_COUNT = 5;
+const char* GetCounterName(HardwareCounter counter);
+struct CounterValues {
+	uint64_t values[HARDWARE_COUNTER_COUNT];
+	uint64_t& operator[](HardwareCounter c) {
+		return values[static_cast<int>(c)];
+	}
+	const uint64_t& operator[](HardwareCounter c) const {
+		return values[static_cast<int>(c)];
+	}
+};
+/**
+ * Hardware performance counters through Linux perf_event_open. One counter
+ * group is opened per thread of the process, so a reading is the sum over
+ * every thread, including the thread pool workers that run a layer's kernels.
+ * Layers execute one at a time, so the difference between two readings is
+ * attributed to the layer that ran in between. Counts are scaled when the
+ * kernel multiplexes the group. On other platforms, or when
+ * perf_event_paranoid forbids user counters, setEnabled() returns false.
+ */
+class NeuralCounters {
+protected:
+	struct ThreadCounters {
+		int tid;
+		int leader;
+		std::vector<int> fds;
+		std::vector<int> counters; //HardwareCounter for each fd
+	};
+	static std::atomic<bool> enabled;
+	static std::atomic<uint64_t> lastScan;
+	static std::mutex counterLock;
+	static std::vector<ThreadCounters> threads;
+	static void attachThreads();
+	static void detachThreads();
+public:
+	static bool isEnabled() {
+		return enabled.load(std::memory_order_relaxed);
+	}
+	static bool setEnabled(bool e);
+	//sum over all threads of the process since counting was enabled
+	static void read(CounterValues& values);
+};
+}
+#endif
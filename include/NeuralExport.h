@@ -0,0 +1,81 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALEXPORT_H_
+#define NEURALEXPORT_H_
+#include "NeuralKnowledge.h"
+#include <map>
+#include <string>
+#include <vector>
+namespace tgr {
+enum class WeightPrecision : int32_t {
+	Float32 = 0, Float16 = 1, BFloat16 = 2, Int8 = 3
+};
+std::string GetPrecisionName(WeightPrecision precision);
+//accepts fp32, fp16, bf16 and int8, throws otherwise
+WeightPrecision ParsePrecision(const std::string& name);
+struct ExportOptions {
+	WeightPrecision precision = WeightPrecision::Float16;
+	//precision of particular layers by id, overriding the default
+	std::map<int, WeightPrecision> layers;
+	//biases are small and shift every output, so they stay fp32
+	bool fullPrecisionBiases = true;
+	//entropy code the converted bytes
+	bool compress = true;
+};
+/**
+ * Writes knowledge for deployment at reduced precision: fp16, bf16 (the
+ * upper half of each float) or int8 with one scale per group of 128
+ * values. Each tensor is cut into chunks of 64K values whose bytes are
+ * split into planes and, with compress set, entropy coded with an order-0
+ * range coder, which mostly pays off on the sign and exponent planes.
+ * Chunks are coded independently, so both directions run in parallel and
+ * loading converts with the vector kernels of NeuralKernels.
+ *
+ * Exported knowledge is for inference and cannot be mapped; reading it
+ * gives knowledge that owns fp32 tensors.
+ */
+void ExportNeuralKnowledge(const std::string& file,
+		const NeuralKnowledge& knowledge, const ExportOptions& options =
+				ExportOptions());
+void ImportNeuralKnowledge(const std::string& file,
+		NeuralKnowledge& knowledge);
+//checks the magic number, whatever the extension
+bool IsExportedKnowledge(const std::string& file);
+/**
+ * Converts and codes a block of values like one chunk of an exported
+ * tensor, for other files that store floats at reduced precision. Blocks
+ * are coded independently; keep them to a few 64K values.
+ */
+void EncodeValues(const float* values, size_t n, WeightPrecision precision,
+		bool compress, std::vector<uint8_t>& out);
+//decodes a block written by EncodeValues, throws if it is corrupt
+void DecodeValues(const uint8_t* data, size_t bytes, WeightPrecision precision,
+		float* values, size_t n);
+/**
+ * Stores n values as fp32, fp16 or bf16 without compression, so each value
+ * stays at a fixed offset. Int8 throws.
+ */
+void NarrowValues(const float* values, size_t n, WeightPrecision precision,
+		void* out);
+void WidenValues(const void* data, size_t n, WeightPrecision precision,
+		float* values);
+}
+#endif
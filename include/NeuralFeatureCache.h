@@ -0,0 +1,96 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALFEATURECACHE_H_
+#define NEURALFEATURECACHE_H_
+#include "NeuralExport.h"
+#include "NeuralSignal.h"
+#include <memory>
+#include <string>
+#include <vector>
+namespace tgr {
+class NeuralSystem;
+struct FeatureCacheOptions {
+	//fp32, fp16 or bf16; fp16 halves the file and the pages read per epoch
+	WeightPrecision precision = WeightPrecision::Float16;
+	int batchSize = 64; //samples per trunk pass while the file is built
+};
+struct FeatureMapping;
+/**
+ * Trains the head of a network on cached trunk outputs. The leading frozen
+ * layers (see NeuralSystem::getFrozenTrunkSize) are run once over the whole
+ * dataset in the test phase, and the outputs they pass to the rest of the
+ * network are written to a file with a fixed stride per sample. The file
+ * is memory mapped, and forward() copies a batch of samples into the trunk
+ * outputs and runs only the layers after the trunk. An epoch then costs
+ * the head's share of the forward and backward passes.
+ *
+ * The file records a hash of the graph, the trunk weights and the inputs,
+ * and open() rebuilds it when any of them changed.
+ */
+class NeuralFeatureCache {
+protected:
+	std::string file;
+	size_t trunk;
+	WeightPrecision precision;
+	uint64_t sampleCount;
+	uint64_t sampleBytes;
+	std::vector<size_t> counts; //values per sample of each trunk output
+	std::shared_ptr<FeatureMapping> mapping;
+	void write(NeuralSystem& sys, const std::vector<Tensor>& inputs,
+			const FeatureCacheOptions& options, uint64_t key);
+	bool map(uint64_t key, const NeuralSystem& sys);
+public:
+	NeuralFeatureCache();
+	/**
+	 * Splits sys after its frozen trunk and maps file if it holds the trunk
+	 * outputs for these inputs, or runs the trunk over them and writes it
+	 * first. Returns true if an existing file was used. Throws if no layer
+	 * with weights is frozen.
+	 */
+	bool open(NeuralSystem& sys, const std::vector<Tensor>& inputs,
+			const std::string& file, const FeatureCacheOptions& options =
+					FeatureCacheOptions());
+	bool isOpen() const {
+		return (mapping.get() != nullptr);
+	}
+	const std::string& getFile() const {
+		return file;
+	}
+	//layers computed into the cache
+	size_t getTrunkSize() const {
+		return trunk;
+	}
+	uint64_t size() const {
+		return sampleCount;
+	}
+	uint64_t getSampleBytes() const {
+		return sampleBytes;
+	}
+	/**
+	 * Loads the cached trunk outputs of the given samples and runs the
+	 * layers after the trunk. Call bprop() and updateWeights() on sys
+	 * afterwards as after NeuralSystem::forward().
+	 */
+	std::vector<Tensor> forward(NeuralSystem& sys, const int* samples,
+			size_t count) const;
+};
+}
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALHISTORY_H_
+#define NEURALHISTORY_H_
+#include "NeuralKnowledge.h"
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+namespace tgr {
+class NeuralSystem;
+struct HistoryOptions {
+	std::string directory = ".";
+	//keyframes are <prefix>_<iteration>.tgw, deltas <prefix>_<iteration>.tgd
+	std::string prefix = "history";
+	//snapshots between full keyframes, bounds the deltas a lookup replays
+	int keyframeInterval = 32;
+	//low mantissa bits rounded off in deltas, 0 keeps every snapshot exact
+	int dropBits = 0;
+};
+struct HistoryStats {
+	int keyframes = 0;
+	int deltas = 0;
+	int reconstructed = 0;
+	uint64_t rawBytes = 0; //size of every recorded snapshot as plain floats
+	uint64_t storedBytes = 0; //bytes written to disk
+	double recordTime = 0.0;
+	double reconstructTime = 0.0;
+};
+/**
+ * Weight history with one snapshot per iteration at a fraction of the cost
+ * of full copies. Every keyframeInterval snapshots a full weight container
+ * is written; the snapshots in between are stored as the XOR of their float
+ * bits with the previous snapshot. Small updates leave the sign, exponent
+ * and high mantissa bits unchanged, so after splitting each block into byte
+ * planes the high planes are almost all zero and collapse under run length
+ * coding. Coding is lossless unless dropBits is set, which truncates the
+ * mantissa of snapshots between keyframes; the error does not accumulate
+ * along a chain, since each delta is taken against the truncated snapshot
+ * before it.
+ *
+ * Blocks are encoded and decoded in parallel. reconstruct() maps the nearest
+ * keyframe and replays the deltas since then, each block independently.
+ * Only the previous snapshot is kept in memory.
+ */
+class NeuralHistory {
+protected:
+	struct Entry {
+		int keyframe; //iteration of the keyframe the delta chain starts from
+		std::string file;
+	};
+	HistoryOptions options;
+	std::map<int, Entry> entries;
+	std::vector<KnowledgeTensor> layout; //tensor sizes of the current chain
+	std::vector<uint32_t> previous; //bits of the last recorded snapshot
+	int lastKeyframe;
+	int sinceKeyframe;
+	HistoryStats stats;
+	mutable std::mutex lock;
+	bool sameLayout(const std::vector<KnowledgeTensor>& tensors) const;
+	void writeKeyframe(int iteration, const std::string& name,
+			const std::vector<KnowledgeTensor>& tensors,
+			const std::map<int, std::string>& layerNames);
+	void writeDelta(int iteration, const std::vector<KnowledgeTensor>& tensors);
+public:
+	NeuralHistory(const HistoryOptions& options = HistoryOptions());
+	NeuralHistory(const NeuralHistory&) = delete;
+	NeuralHistory& operator=(const NeuralHistory&) = delete;
+	const HistoryOptions& getOptions() const {
+		return options;
+	}
+	std::string getFile(int iteration, bool keyframe) const;
+	/**
+	 * Appends a snapshot. Recording an iteration at or before the last one
+	 * starts over from there, as after a restart of training.
+	 */
+	void record(const NeuralSystem& sys, int iteration);
+	void record(const NeuralKnowledge& knowledge, int iteration);
+	void record(const std::string& name,
+			const std::vector<KnowledgeTensor>& tensors,
+			const std::map<int, std::string>& layerNames, int iteration);
+	bool has(int iteration) const;
+	//recorded iterations in ascending order
+	std::vector<int> getIterations() const;
+	//file the iteration was written to, a keyframe or a delta
+	std::string getRecordFile(int iteration) const;
+	//rebuilds the snapshot of an iteration as knowledge owning its tensors
+	void reconstruct(int iteration, NeuralKnowledge& knowledge);
+	HistoryStats getStats() const;
+	void printStats(std::ostream& out) const;
+};
+}
+#endif
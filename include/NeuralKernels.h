@@ -0,0 +1,112 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALKERNELS_H_
+#define NEURALKERNELS_H_
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+namespace tgr {
+enum class IsaLevel {
+	Generic = 0, SSE42 = 1, AVX2 = 2, AVX512 = 3
+};
+std::string GetIsaName(IsaLevel isa);
+//accepts generic, sse42, avx2 and avx512, throws otherwise
+IsaLevel ParseIsaLevel(const std::string& name);
+std::ostream& operator<<(std::ostream& os, IsaLevel isa);
+struct CpuFeatures {
+	std::string vendor;
+	std::string brand; //processor model string
+	bool sse42;
+	bool avx;
+	bool avx2;
+	bool fma;
+	bool f16c;
+	bool avx512f;
+	bool avx512bw;
+	bool avx512dq;
+	bool avx512vl;
+	bool avx512vnni;
+	bool osAvx; //OS saves ymm state
+	bool osAvx512; //OS saves zmm and mask state
+};
+/**
+ * Inner loops of the layers and optimizers, compiled once per instruction set
+ * level. All pointers are raw float arrays; nothing here allocates.
+ */
+struct KernelTable {
+	IsaLevel isa;
+	//sum a[i]*b[i]
+	float (*dot)(const float* a, const float* b, size_t n);
+	//dst[i] += c*src[i]
+	void (*muladd)(const float* src, float c, size_t n, float* dst);
+	//dst[i] += src[i]
+	void (*add)(const float* src, size_t n, float* dst);
+	//out[y*outStride+x] += sum w[wy*kw+wx]*in[y*yStride+x*xStride+wy*inStride+wx]
+	//for x<width, y<height, i.e. the interior of one convolution channel pair
+	void (*convolve)(const float* in, const float* w, float* out, int width,
+			int height, int kw, int kh, int inStride, int outStride,
+			int xStride, int yStride);
+	//result[s] = sum a[s][first(k)]*b[s][second(k)] over packed indices
+	//[begin,end), where first = p >> shift and second = p & mask
+	void (*sparseDot)(const uint32_t* packed, int begin, int end, int shift,
+			uint32_t mask, const float* const * a, const float* const * b,
+			bool sharedA, int count, float* result);
+	void (*tanhForward)(const float* x, float* y, size_t n);
+	//dx = dy*(1-y*y)
+	void (*tanhBackward)(const float* y, const float* dy, float* dx,
+			size_t n);
+	void (*sgd)(float* W, const float* dW, float alpha, float lambda,
+			size_t n);
+	void (*momentum)(float* W, const float* dW, float* V, float alpha,
+			float lambda, float mu, size_t n);
+	void (*adagrad)(float* W, const float* dW, float* g, float alpha,
+			float eps, size_t n);
+	void (*rmsprop)(float* W, const float* dW, float* g, float alpha,
+			float mu, float eps, size_t n);
+	void (*adam)(float* W, const float* dW, float* mt, float* vt, float alpha,
+			float b1, float b2, float b1_t, float b2_t, float eps, size_t n);
+	//dst[i] = src[i] read as an IEEE half
+	void (*halfToFloat)(const uint16_t* src, float* dst, size_t n);
+	//dst[i] = src[i] read as the upper half of a float
+	void (*bfloat16ToFloat)(const uint16_t* src, float* dst, size_t n);
+	//dst[i] = scale*src[i]
+	void (*int8ToFloat)(const int8_t* src, float scale, float* dst, size_t n);
+	//independent multiply-add chains for peak throughput measurements
+	float (*peakChains)(int64_t iterations);
+	int peakFlopsPerIteration;
+};
+/**
+ * Selects the widest kernel variant the CPU and OS support at startup
+ * (cpuid and xgetbv). The TIGER_ISA environment variable (generic, sse42,
+ * avx2, avx512) caps the level, which helps when comparing variants.
+ */
+class NeuralKernels {
+public:
+	static const KernelTable& get();
+	static IsaLevel getIsa();
+	//clamped to the supported level, returns the level that was selected
+	static IsaLevel setIsa(IsaLevel isa);
+	static IsaLevel getSupportedIsa();
+	static const CpuFeatures& getCpuFeatures();
+};
+}
+#endif
@@ -0,0 +1,334 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+/**
+ * Kernel bodies shared by the NeuralKernels*.cpp variants. There is no include
+ * guard on purpose: every variant includes this file inside its own namespace
+ * after selecting a target with #pragma GCC target, so the same source is
+ * vectorized once per instruction set. TGR_KERNEL_WIDTH is the number of float
+ * lanes of the target. Standard headers must be included before the target is
+ * selected, so none of their inline functions are compiled for it.
+ *
+ * Includers wrap this file in #pragma GCC push_options/pop_options. The
+ * option below lets selects vectorize; it does not reorder any arithmetic,
+ * so results match the scalar code for finite inputs. sqrt keeps its errno
+ * check regardless, so the loops that need it are written with SqrtLanes.
+ */
+#pragma GCC optimize("no-trapping-math")
+static const int LANES = TGR_KERNEL_WIDTH;
+typedef float Lanes __attribute__((vector_size(TGR_KERNEL_WIDTH * 4)));
+static inline Lanes LoadLanes(const float* ptr) {
+	Lanes v;
+	__builtin_memcpy(&v, ptr, sizeof(Lanes));
+	return v;
+}
+static inline void StoreLanes(float* ptr, const Lanes& v) {
+	__builtin_memcpy(ptr, &v, sizeof(Lanes));
+}
+static inline Lanes SqrtLanes(Lanes v) {
+#if TGR_KERNEL_WIDTH == 16
+	return (Lanes) _mm512_sqrt_ps((__m512 ) v);
+#elif TGR_KERNEL_WIDTH == 8
+	return (Lanes) _mm256_sqrt_ps((__m256 ) v);
+#elif defined(__SSE2__)
+	return (Lanes) _mm_sqrt_ps((__m128 ) v);
+#else
+	for (int l = 0; l < LANES; l++) {
+		v[l] = __builtin_sqrtf(v[l]);
+	}
+	return v;
+#endif
+}
+static inline float SumLanes(const Lanes& v) {
+	float sum = 0.0f;
+	for (int l = 0; l < LANES; l++) {
+		sum += v[l];
+	}
+	return sum;
+}
+static float Dot(const float* a, const float* b, size_t n) {
+	//four accumulators to hide the add latency
+	Lanes acc0 = { }, acc1 = { }, acc2 = { }, acc3 = { };
+	size_t i = 0;
+	for (; i + 4 * LANES <= n; i += 4 * LANES) {
+		acc0 += LoadLanes(a + i) * LoadLanes(b + i);
+		acc1 += LoadLanes(a + i + LANES) * LoadLanes(b + i + LANES);
+		acc2 += LoadLanes(a + i + 2 * LANES) * LoadLanes(b + i + 2 * LANES);
+		acc3 += LoadLanes(a + i + 3 * LANES) * LoadLanes(b + i + 3 * LANES);
+	}
+	for (; i + LANES <= n; i += LANES) {
+		acc0 += LoadLanes(a + i) * LoadLanes(b + i);
+	}
+	float sum = SumLanes((acc0 + acc1) + (acc2 + acc3));
+	for (; i < n; i++) {
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+static void MulAdd(const float* __restrict src, float c, size_t n,
+		float* __restrict dst) {
+	for (size_t i = 0; i < n; i++) {
+		dst[i] += c * src[i];
+	}
+}
+static void Add(const float* __restrict src, size_t n, float* __restrict dst) {
+	for (size_t i = 0; i < n; i++) {
+		dst[i] += src[i];
+	}
+}
+static void Convolve(const float* in, const float* w, float* out, int width,
+		int height, int kw, int kh, int inStride, int outStride, int xStride,
+		int yStride) {
+	if (xStride == 1) {
+		//one tap at a time across the whole output row
+		for (int y = 0; y < height; y++) {
+			float* __restrict pout = out + y * outStride;
+			const float* row = in + y * yStride;
+			for (int wy = 0; wy < kh; wy++) {
+				for (int wx = 0; wx < kw; wx++) {
+					const float c = w[wy * kw + wx];
+					const float* __restrict pin = row + wy * inStride + wx;
+					for (int x = 0; x < width; x++) {
+						pout[x] += c * pin[x];
+					}
+				}
+			}
+		}
+		return;
+	}
+	for (int y = 0; y < height; y++) {
+		float* pout = out + y * outStride;
+		const float* row = in + y * yStride;
+		for (int x = 0; x < width; x++) {
+			const float* pin = row + x * xStride;
+			float sum = 0.0f;
+			for (int wy = 0; wy < kh; wy++) {
+				for (int wx = 0; wx < kw; wx++) {
+					sum += w[wy * kw + wx] * pin[wy * inStride + wx];
+				}
+			}
+			pout[x] += sum;
+		}
+	}
+}
+static void SparseDotRange(const uint32_t* packed, int begin, int end,
+		int shift, uint32_t mask, const float* const * a,
+		const float* const * b, bool sharedA, int count, float* result) {
+	for (int k = begin; k < end; k++) {
+		uint32_t p = packed[k];
+		uint32_t f = p >> shift;
+		uint32_t g = p & mask;
+		for (int s = 0; s < count; s++) {
+			result[s] += a[sharedA ? 0 : s][f] * b[s][g];
+		}
+	}
+}
+//variants with hardware gathers replace this in their table
+static void SparseDot(const uint32_t* packed, int begin, int end, int shift,
+		uint32_t mask, const float* const * a, const float* const * b,
+		bool sharedA, int count, float* result) {
+	for (int s = 0; s < count; s++) {
+		result[s] = 0.0f;
+	}
+	SparseDotRange(packed, begin, end, shift, mask, a, b, sharedA, count,
+			result);
+}
+//Cephes style expf, accurate to a few ulp for x in [-87, 88]
+static inline float ExpLanes(float x) {
+	x = (x < -87.0f) ? -87.0f : x;
+	x = (x > 88.0f) ? 88.0f : x;
+	//round to nearest, truncating a positive value so it vectorizes
+	int n = (int) (x * 1.44269504088896341f + 128.5f) - 128;
+	float fn = (float) n;
+	float r = x - fn * 0.693359375f + fn * 2.12194440e-4f;
+	float p = 1.9875691500E-4f;
+	p = p * r + 1.3981999507E-3f;
+	p = p * r + 8.3334519073E-3f;
+	p = p * r + 4.1665795894E-2f;
+	p = p * r + 1.6666665459E-1f;
+	p = p * r + 5.0000001201E-1f;
+	p = p * r * r + r + 1.0f;
+	int32_t bits = (n + 127) << 23;
+	float scale;
+	__builtin_memcpy(&scale, &bits, sizeof(float));
+	return p * scale;
+}
+static void TanhForward(const float* __restrict x, float* __restrict y,
+		size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		float v = x[i];
+		float z = __builtin_fabsf(v);
+		//odd polynomial near zero, exp form elsewhere (Cephes tanhf)
+		float z2 = v * v;
+		float p = -5.70498872745E-3f;
+		p = p * z2 + 2.06390887954E-2f;
+		p = p * z2 - 5.37397155531E-2f;
+		p = p * z2 + 1.33314422036E-1f;
+		p = p * z2 - 3.33332819422E-1f;
+		float small = v + v * z2 * p;
+		float large = 1.0f - 2.0f / (ExpLanes(2.0f * z) + 1.0f);
+		large = __builtin_copysignf(large, v);
+		y[i] = (z < 0.625f) ? small : large;
+	}
+}
+static void TanhBackward(const float* __restrict y, const float* __restrict dy,
+		float* __restrict dx, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		dx[i] = dy[i] * (1.0f - y[i] * y[i]);
+	}
+}
+static void Sgd(float* __restrict W, const float* __restrict dW, float alpha,
+		float lambda, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		W[i] = W[i] - alpha * (dW[i] + lambda * W[i]);
+	}
+}
+static void Momentum(float* __restrict W, const float* __restrict dW,
+		float* __restrict V, float alpha, float lambda, float mu, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		float v = mu * V[i] - alpha * (dW[i] + W[i] * lambda);
+		W[i] += v;
+		V[i] = v;
+	}
+}
+static void Adagrad(float* W, const float* dW, float* g, float alpha,
+		float eps, size_t n) {
+	size_t i = 0;
+	for (; i + LANES <= n; i += LANES) {
+		Lanes d = LoadLanes(dW + i);
+		Lanes gi = LoadLanes(g + i) + d * d;
+		StoreLanes(g + i, gi);
+		StoreLanes(W + i, LoadLanes(W + i) - alpha * d / (SqrtLanes(gi) + eps));
+	}
+	for (; i < n; i++) {
+		g[i] += dW[i] * dW[i];
+		W[i] -= alpha * dW[i] / (__builtin_sqrtf(g[i]) + eps);
+	}
+}
+static void RMSprop(float* W, const float* dW, float* g, float alpha,
+		float mu, float eps, size_t n) {
+	size_t i = 0;
+	for (; i + LANES <= n; i += LANES) {
+		Lanes d = LoadLanes(dW + i);
+		Lanes gi = mu * LoadLanes(g + i) + (1 - mu) * d * d;
+		StoreLanes(g + i, gi);
+		StoreLanes(W + i, LoadLanes(W + i) - alpha * d / SqrtLanes(gi + eps));
+	}
+	for (; i < n; i++) {
+		g[i] = mu * g[i] + (1 - mu) * dW[i] * dW[i];
+		W[i] -= alpha * dW[i] / __builtin_sqrtf(g[i] + eps);
+	}
+}
+static void Adam(float* W, const float* dW, float* mt, float* vt, float alpha,
+		float b1, float b2, float b1_t, float b2_t, float eps, size_t n) {
+	const float c1 = 1.0f / (1.0f - b1_t);
+	const float c2 = 1.0f / (1.0f - b2_t);
+	size_t i = 0;
+	for (; i + LANES <= n; i += LANES) {
+		Lanes d = LoadLanes(dW + i);
+		Lanes m = b1 * LoadLanes(mt + i) + (1.0f - b1) * d;
+		Lanes v = b2 * LoadLanes(vt + i) + (1.0f - b2) * d * d;
+		StoreLanes(mt + i, m);
+		StoreLanes(vt + i, v);
+		StoreLanes(W + i,
+				LoadLanes(W + i) - alpha * (m * c1) / SqrtLanes(v * c2 + eps));
+	}
+	for (; i < n; i++) {
+		mt[i] = b1 * mt[i] + (1.0f - b1) * dW[i];
+		vt[i] = b2 * vt[i] + (1.0f - b2) * dW[i] * dW[i];
+		W[i] -= alpha * (mt[i] * c1) / __builtin_sqrtf(vt[i] * c2 + eps);
+	}
+}
+static void HalfToFloat(const uint16_t* __restrict src, float* __restrict dst,
+		size_t n) {
+	//moves exponent and mantissa into place and rebiases with one multiply,
+	//which also scales subnormals; infinity and NaN get their exponent back
+	for (size_t i = 0; i < n; i++) {
+		uint32_t h = src[i];
+		uint32_t bits = (h & 0x7FFFu) << 13;
+		float f;
+		__builtin_memcpy(&f, &bits, sizeof(f));
+		f *= 5.192296858534828e33f; //2^112
+		__builtin_memcpy(&bits, &f, sizeof(f));
+		if ((h & 0x7C00u) == 0x7C00u) {
+			bits |= 0x7F800000u;
+		}
+		bits |= (h & 0x8000u) << 16;
+		__builtin_memcpy(dst + i, &bits, sizeof(bits));
+	}
+}
+static void BFloat16ToFloat(const uint16_t* __restrict src,
+		float* __restrict dst, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		uint32_t bits = (uint32_t) src[i] << 16;
+		__builtin_memcpy(dst + i, &bits, sizeof(bits));
+	}
+}
+static void Int8ToFloat(const int8_t* __restrict src, float scale,
+		float* __restrict dst, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		dst[i] = scale * (float) src[i];
+	}
+}
+static const int PEAK_CHAINS = 10;
+//read at run time so the chains cannot be folded away
+static volatile float PeakConstants[3] = { 0.999f, 0.001f, 1.0f };
+static float PeakChains(int64_t iterations) {
+	//independent chains to cover multiply-add latency on two ports
+	const Lanes zero = { };
+	const Lanes a = zero + PeakConstants[0];
+	const Lanes b = zero + PeakConstants[1];
+	Lanes x0 = zero + PeakConstants[2], x1 = x0, x2 = x0, x3 = x0, x4 = x0;
+	Lanes x5 = x0, x6 = x0, x7 = x0, x8 = x0, x9 = x0;
+	for (int64_t i = 0; i < iterations; i++) {
+		x0 = x0 * a + b;
+		x1 = x1 * a + b;
+		x2 = x2 * a + b;
+		x3 = x3 * a + b;
+		x4 = x4 * a + b;
+		x5 = x5 * a + b;
+		x6 = x6 * a + b;
+		x7 = x7 * a + b;
+		x8 = x8 * a + b;
+		x9 = x9 * a + b;
+	}
+	return SumLanes(((x0 + x1) + (x2 + x3)) + ((x4 + x5) + (x6 + x7))
+			+ (x8 + x9));
+}
+static void FillTable(KernelTable& table, IsaLevel isa) {
+	table.isa = isa;
+	table.dot = Dot;
+	table.muladd = MulAdd;
+	table.add = Add;
+	table.convolve = Convolve;
+	table.sparseDot = SparseDot;
+	table.tanhForward = TanhForward;
+	table.tanhBackward = TanhBackward;
+	table.sgd = Sgd;
+	table.momentum = Momentum;
+	table.adagrad = Adagrad;
+	table.rmsprop = RMSprop;
+	table.adam = Adam;
+	table.halfToFloat = HalfToFloat;
+	table.bfloat16ToFloat = BFloat16ToFloat;
+	table.int8ToFloat = Int8ToFloat;
+	table.peakChains = PeakChains;
+	table.peakFlopsPerIteration = PEAK_CHAINS * LANES * 2;
+}
@@ -5,15 +5,38 @@
 #include <cereal/types/vector.hpp>
 #include <cereal/types/string.hpp>
 #include <cereal/types/map.hpp>
+#include "NeuralSignal.h"
+#include <memory>
 
 namespace tgr {
 class NeuralLayer;
 class NeuralSystem;
 typedef std::vector<aly::Vec1f> Knowledge;
+/**
+ * Read-only view of one weight tensor, pointing either into a knowledge's
+ * own storage or into a mapped weight container.
+ */
+struct KnowledgeTensor {
+	int layerId;
+	ChannelType type; //weight or bias
+	int index; //order among the layer's tensors of the same type
+	size_t count;
+	const float* data;
+	//0 for the weights, 1 and up for the optimizer's state of those weights
+	int slot = 0;
+};
+/**
+ * Layer id under which a checkpoint stores the optimizer's name and scalar
+ * state, see NeuralCheckpointer.
+ */
+static const int OptimizerLayerId = -1;
+struct KnowledgeMapping;
 class NeuralKnowledge {
 protected:
 	std::map<int, Knowledge> weights;
 	std::map<int, Knowledge> biasWeights;
+	std::map<int, std::string> layerNames;
+	std::shared_ptr<const KnowledgeMapping> mapping;
 	std::string name;
 	std::string file;
 public:
@@ -32,25 +55,78 @@ public:
 	void setFile(const std::string& f) {
 		file = f;
 	}
+	//not available for mapped knowledge, use getTensors() instead
 	Knowledge& getWeights(const NeuralLayer& layer);
 	const Knowledge& getWeights(const NeuralLayer& layer) const;
 
 	Knowledge& getBiasWeights(const NeuralLayer& layer);
 	const Knowledge& getBiasWeights(const NeuralLayer& layer) const;
+	std::string getLayerName(int layerId) const;
+	//every tensor ordered by layer id, weights before biases
+	std::vector<KnowledgeTensor> getTensors() const;
+	/**
+	 * Optimizer state saved with the weights of a mapped checkpoint: one
+	 * tensor per moment buffer, slot 1 and up, and the scalars under
+	 * OptimizerLayerId. Empty for knowledge that is not mapped.
+	 */
+	std::vector<KnowledgeTensor> getOptimizerTensors() const;
+	//name of the optimizer the state belongs to, empty if there is none
+	std::string getOptimizerName() const;
+	//true if the tensors live in a mapped weight container
+	bool isMapped() const {
+		return (mapping.get() != nullptr);
+	}
 	void clear() {
 		weights.clear();
+		biasWeights.clear();
+		layerNames.clear();
+		mapping.reset();
 	}
 	void add(const NeuralLayer& layer);
+	/**
+	 * Replaces the contents with zeroed tensors shaped like layout and
+	 * returns where to write each one, in layout order, for loaders that
+	 * decode straight into the knowledge.
+	 */
+	std::vector<float*> allocate(const std::vector<KnowledgeTensor>& layout,
+			const std::map<int, std::string>& names);
 	void set(const NeuralSystem& sys);
+	/**
+	 * Maps a weight container written by writeContainer(). The tensors are
+	 * not copied or byte swapped; they stay in the page cache, shared by
+	 * every process that maps the same file.
+	 */
+	void mapContainer(const std::string& file);
+	//writes the tensor payloads in parallel
+	void writeContainer(const std::string& file) const;
 	template<class Archive> void save(Archive & ar) const {
+		if (isMapped()) {
+			NeuralKnowledge copy = materialize();
+			copy.save(ar);
+			return;
+		}
 		ar(CEREAL_NVP(name), CEREAL_NVP(file), CEREAL_NVP(weights),
 				CEREAL_NVP(biasWeights));
 	}
 	template<class Archive> void load(Archive & ar) {
+		clear();
 		ar(CEREAL_NVP(name), CEREAL_NVP(file), CEREAL_NVP(weights),
 				CEREAL_NVP(biasWeights));
 	}
+	//copy of a mapped knowledge that owns its tensors
+	NeuralKnowledge materialize() const;
 };
+//checks the magic number, whatever the extension
+bool IsWeightContainer(const std::string& file);
+/**
+ * Writes tensors in the NeuralKnowledge container format. Payloads are
+ * written from the thread pool when parallel is set, otherwise from the
+ * calling thread only, for background writers that should not compete with
+ * training for workers.
+ */
+void WriteWeightContainer(const std::string& file, const std::string& name,
+		const std::vector<KnowledgeTensor>& tensors,
+		const std::map<int, std::string>& layerNames, bool parallel = true);
 void WriteNeuralKnowledgeToFile(const std::string& file,
 		const NeuralKnowledge& params);
 void ReadNeuralKnowledgeFromFile(const std::string& file,
@@ -30,6 +30,7 @@
 #include "NeuralLayerRegion.h"
 #include "NeuralKnowledge.h"
 #include "Neuron.h"
+#include "NeuralProfiler.h"
 #include <vector>
 #include <set>
 namespace tiny_dnn {
@@ -42,6 +43,7 @@ class NeuralFlowPane;
 namespace tgr {
 std::string MakeID(int len = 8);
 class NeuralSystem;
+struct PlanTable;
 struct NeuralState {
 	std::string name;
 	Knowledge weights;
@@ -83,6 +85,7 @@ protected:
 	bool visited;
 	bool initialized;
 	bool parallelize;
+	size_t grainSize;
 	BackendType backendType;
 	NeuralSystem* sys;
 	aly::NeuralLayerRegionPtr layerRegion;
@@ -96,6 +99,9 @@ protected:
 	std::vector<Tensor *> backwardInGradient;
 	std::vector<Tensor *> backwardOutData;
 	std::vector<Tensor *> backwardOutGradient;
+	//copies the tables for getTableKey() from the active NeuralPlan, if it
+	//has them; only valid in the constructor of the final class
+	bool restoreTables();
 public:
 	friend void Connect(const std::shared_ptr<NeuralLayer>& head,
 			const std::shared_ptr<NeuralLayer>& tail, int head_index,
@@ -155,12 +161,26 @@ public:
 	void setParallelize(bool parallelize) {
 		this->parallelize = parallelize;
 	}
+	bool isParallel() const {
+		return parallelize;
+	}
 	void setBackendType(BackendType backend_type) {
 		backendType = backend_type;
 	}
 	BackendType getBackendType() const {
 		return backendType;
 	}
+	//overrides the grain size of the parallel loops in forward() and
+	//backward(), 0 keeps the kernels' own values
+	void setGrainSize(size_t grain) {
+		grainSize = grain;
+	}
+	size_t getGrainSize() const {
+		return grainSize;
+	}
+	IsaLevel getKernelIsa() const {
+		return GetBackendIsa(backendType);
+	}
 	std::vector<const Storage*> getInputWeights() const;
 	std::vector<const Storage*> getOutputWeights() const;
 	std::vector<const Tensor*> getInputGradient() const;
@@ -212,6 +232,23 @@ public:
 	virtual int getFanOutSize() const {
 		return getOutputDimensions()[0].x;
 	}
+	/**
+	 * Multiply-accumulate operations in forward() for one sample. Layers
+	 * without weights count one operation per output element by default.
+	 */
+	virtual uint64_t getMultiplyAdds() const;
+	/**
+	 * Index tables the constructor derives from the layer's geometry, which
+	 * a NeuralPlan stores so they are not rebuilt at startup. The key names
+	 * everything the tables depend on and is empty for layers without any.
+	 */
+	virtual std::string getTableKey() const {
+		return std::string();
+	}
+	virtual void getTables(PlanTable& table) const {
+	}
+	virtual void setTables(const PlanTable& table) {
+	}
 
 	void setWeightInitialization(
 			const std::function<void(Storage& data, int fanIn, int fanOut)>& func) {
@@ -280,7 +317,7 @@ public:
 	void setName(const std::string& n) {
 		name = n;
 	}
-	std::string getName() const {
+	const std::string& getName() const {
 		return name;
 	}
 	void initialize(const aly::ExpandTreePtr& tree,
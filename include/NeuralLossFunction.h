@@ -16,6 +16,14 @@ public:
 	struct Interface {
 		virtual float f(const Storage &y, const Storage &t) const = 0;
 		virtual Storage df(const Storage &y, const Storage &t) const = 0;
+		//Writes df(y,t) into d, which is already sized like y.
+		virtual void dfInPlace(const Storage &y, const Storage &t,
+				Storage& d) const;
+		//Sparse targets: t is the one-hot vector for the given class label.
+		virtual float fSparse(const Storage &y, int label) const;
+		virtual void dfSparse(const Storage &y, int label, Storage& d) const;
+		virtual ~Interface() {
+		}
 	};
 private:
 	template<class T> struct Impl: public Interface {
@@ -29,6 +37,17 @@ private:
 		virtual Storage df(const Storage &y, const Storage &t) const override {
 			return value.df(y, t);
 		}
+		virtual void dfInPlace(const Storage &y, const Storage &t,
+				Storage& d) const override {
+			value.dfInPlace(y, t, d);
+		}
+		virtual float fSparse(const Storage &y, int label) const override {
+			return value.fSparse(y, label);
+		}
+		virtual void dfSparse(const Storage &y, int label, Storage& d) const
+				override {
+			value.dfSparse(y, label, d);
+		}
 	};
 	std::shared_ptr<Interface> impl;
 public:
@@ -57,6 +76,27 @@ public:
 	virtual Storage df(const Storage &y, const Storage &t) const {
 		return impl->df(y, t);
 	}
+	virtual void dfInPlace(const Storage &y, const Storage &t,
+			Storage& d) const {
+		impl->dfInPlace(y, t, d);
+	}
+	virtual float fSparse(const Storage &y, int label) const {
+		return impl->fSparse(y, label);
+	}
+	virtual void dfSparse(const Storage &y, int label, Storage& d) const {
+		impl->dfSparse(y, label, d);
+	}
+	/**
+	 * Batched kernels over all samples of one output channel. Gradients are
+	 * written into dy (typically the output signal's change buffer), which
+	 * must already hold one Storage per sample. t_cost is an optional
+	 * per-sample array of element weights.
+	 */
+	void gradient(const Tensor& y, const Tensor& t, const Storage* t_cost,
+			Tensor& dy, bool parallelize) const;
+	void gradient(const Tensor& y, const int* labels, const Storage* t_cost,
+			Tensor& dy, bool parallelize) const;
+	float loss(const Tensor& y, const int* labels, bool parallelize) const;
 	Storage gradient(const Storage& y, const Storage& t) const;
 	std::vector<Storage> gradient(const std::vector<Storage> &y,
 			const std::vector<Storage> &t) const;
@@ -74,6 +114,11 @@ public:
 	}
 	virtual float f(const Storage &y, const Storage &t) const override;
 	virtual Storage df(const Storage &y, const Storage &t) const override;
+	virtual void dfInPlace(const Storage &y, const Storage &t,
+			Storage& d) const override;
+	virtual float fSparse(const Storage &y, int label) const override;
+	virtual void dfSparse(const Storage &y, int label, Storage& d) const
+			override;
 };
 
 // absolute loss function for regression
@@ -83,6 +128,11 @@ public:
 	}
 	virtual float f(const Storage &y, const Storage &t) const override;
 	virtual Storage df(const Storage &y, const Storage &t) const override;
+	virtual void dfInPlace(const Storage &y, const Storage &t,
+			Storage& d) const override;
+	virtual float fSparse(const Storage &y, int label) const override;
+	virtual void dfSparse(const Storage &y, int label, Storage& d) const
+			override;
 };
 // absolute loss with epsilon range for regression
 // epsilon range [-eps, eps] with eps = 1./fraction
@@ -95,6 +145,11 @@ public:
 	}
 	virtual float f(const Storage &y, const Storage &t) const override;
 	virtual Storage df(const Storage &y, const Storage &t) const override;
+	virtual void dfInPlace(const Storage &y, const Storage &t,
+			Storage& d) const override;
+	virtual float fSparse(const Storage &y, int label) const override;
+	virtual void dfSparse(const Storage &y, int label, Storage& d) const
+			override;
 };
 
 // cross-entropy loss function for (multiple independent) binary classifications
@@ -104,6 +159,11 @@ public:
 	}
 	virtual float f(const Storage &y, const Storage &t) const override;
 	virtual Storage df(const Storage &y, const Storage &t) const override;
+	virtual void dfInPlace(const Storage &y, const Storage &t,
+			Storage& d) const override;
+	virtual float fSparse(const Storage &y, int label) const override;
+	virtual void dfSparse(const Storage &y, int label, Storage& d) const
+			override;
 };
 
 // cross-entropy loss function for multi-class classification
@@ -113,6 +173,25 @@ public:
 	}
 	virtual float f(const Storage &y, const Storage &t) const override;
 	virtual Storage df(const Storage &y, const Storage &t) const override;
+	virtual void dfInPlace(const Storage &y, const Storage &t,
+			Storage& d) const override;
+	virtual float fSparse(const Storage &y, int label) const override;
+	virtual void dfSparse(const Storage &y, int label, Storage& d) const
+			override;
+};
+// softmax followed by multi-class cross-entropy, evaluated on the raw scores
+// (logits) of the last layer. The network should not end in a softmax layer.
+class SoftmaxCrossEntropyLossFunction: public NeuralLossFunction::Interface {
+public:
+	SoftmaxCrossEntropyLossFunction() {
+	}
+	virtual float f(const Storage &y, const Storage &t) const override;
+	virtual Storage df(const Storage &y, const Storage &t) const override;
+	virtual void dfInPlace(const Storage &y, const Storage &t,
+			Storage& d) const override;
+	virtual float fSparse(const Storage &y, int label) const override;
+	virtual void dfSparse(const Storage &y, int label, Storage& d) const
+			override;
 };
 void ApplyCostIfDefined(std::vector<Storage> &sample_gradient,
 		const std::vector<Storage> &sample_cost);
@@ -0,0 +1,90 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALMEMORY_H_
+#define NEURALMEMORY_H_
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+namespace tgr {
+struct MemorySiteStats {
+	std::string name;
+	uint64_t liveBytes;
+	uint64_t peakBytes;
+	uint64_t allocations;
+};
+struct MemoryPoolStats {
+	uint64_t liveBytes; //requested bytes currently allocated
+	uint64_t peakBytes;
+	uint64_t reservedBytes; //bytes obtained from the OS, including caches
+	uint64_t cachedBytes; //free blocks held in the global pool
+	uint64_t hugePageBytes; //reserved bytes advised for transparent huge pages
+	uint64_t allocations;
+	uint64_t poolHits; //allocations served from a cache
+};
+/**
+ * Pooled 64 byte aligned memory for Storage. Requests are rounded up to a
+ * size class (four classes per power of two, so at most 25% is wasted) and
+ * freed blocks are kept in a small per-thread cache, then in a global pool,
+ * instead of going back to the OS. Blocks of hugePageThreshold bytes or more
+ * are mapped directly and advised for transparent huge pages on Linux.
+ *
+ * Every block carries a 64 byte header with its size class and the
+ * allocation site that was current when it was allocated, so live and peak
+ * bytes can be reported per site. Sites are registered once by name and
+ * selected for a scope with MemorySiteScope.
+ */
+class NeuralMemory {
+public:
+	static const size_t ALIGNMENT = 64;
+	static void* allocate(size_t bytes);
+	static void deallocate(void* ptr);
+	static int registerSite(const std::string& name);
+	static int getSite();
+	//returns the previous site
+	static int setSite(int site);
+	static std::vector<MemorySiteStats> getSiteStats();
+	static MemoryPoolStats getStats();
+	static void resetPeaks();
+	//when disabled, blocks are allocated and freed individually
+	static void setPooling(bool enabled);
+	static bool isPooling();
+	//bytes the global pool may hold before freed blocks are released
+	static void setCacheLimit(size_t bytes);
+	static void setHugePageThreshold(size_t bytes);
+	//releases every block cached in the global pool
+	static void trim();
+	static void printStats(std::ostream& out);
+};
+class MemorySiteScope {
+protected:
+	int previous;
+public:
+	MemorySiteScope(int site) :
+			previous(NeuralMemory::setSite(site)) {
+	}
+	~MemorySiteScope() {
+		NeuralMemory::setSite(previous);
+	}
+};
+}
+#endif
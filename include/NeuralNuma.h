@@ -0,0 +1,109 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALNUMA_H_
+#define NEURALNUMA_H_
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+namespace tgr {
+class NeuralSystem;
+enum class NumaPolicy {
+	Local = 0, //weights stay where the constructing thread touched them
+	Interleave = 1, //weight pages are spread round robin over all nodes
+	Replicate = 2 //each node runs its own replica, see NeuralNuma::replicate
+};
+std::string GetNumaPolicyName(NumaPolicy policy);
+std::ostream& operator<<(std::ostream& os, NumaPolicy policy);
+struct NumaNode {
+	int id;
+	std::vector<int> cpus;
+	uint64_t memoryBytes; //0 if unknown
+};
+/**
+ * NUMA topology and memory placement. The topology is read from
+ * /sys/devices/system/node; machines without it (or non-Linux hosts) report
+ * a single node holding every CPU, and every placement call becomes a no-op.
+ * Placement uses the mbind/set_mempolicy system calls directly, so libnuma
+ * is not needed.
+ *
+ * The policy defaults to the TIGER_NUMA environment variable (local,
+ * interleave or replicate), or local.
+ */
+class NeuralNuma {
+public:
+	static const std::vector<NumaNode>& getNodes();
+	static int getNodeCount();
+	//node owning a CPU, 0 if unknown
+	static int getCpuNode(int cpu);
+	//node of the CPU the calling thread is running on
+	static int getCurrentNode();
+	//node set by the innermost NumaNodeScope on this thread, -1 if none
+	static int getThreadNode();
+	//CPUs grouped node by node, so consecutive workers share a socket
+	static const std::vector<int>& getCpuOrder();
+	static void setPolicy(NumaPolicy policy);
+	static NumaPolicy getPolicy();
+	//page aligned interior of [ptr, ptr+bytes) is spread over all nodes or
+	//moved to one node. Returns false if the kernel refused.
+	static bool interleave(void* ptr, size_t bytes);
+	static bool bind(void* ptr, size_t bytes, int node);
+	/**
+	 * Applies the policy to every trainable weight of a system. Interleave
+	 * spreads the pages over all nodes. Replicate moves them to the node of
+	 * the calling thread's NumaNodeScope, if any, so a replica built on one
+	 * node keeps its weights there. Local leaves them alone.
+	 */
+	static void placeWeights(NeuralSystem& sys);
+	/**
+	 * Builds one system per node with make(), each inside a NumaNodeScope so
+	 * its weights and activations are first touched on that node, and copies
+	 * the master's weights into it. Run replica i inside NumaNodeScope(i).
+	 */
+	static std::vector<std::shared_ptr<NeuralSystem>> replicate(
+			const NeuralSystem& master,
+			const std::function<std::shared_ptr<NeuralSystem>()>& make);
+	static void copyWeights(const NeuralSystem& src, NeuralSystem& dst);
+	static void print(std::ostream& out);
+};
+/**
+ * Confines the calling thread to one node while in scope: it runs on that
+ * node's CPUs, prefers that node's memory for new pages, and parallel loops
+ * it starts are handed to pool workers pinned to the node (when pinning is
+ * on). Used for per-socket inference contexts and replicas.
+ */
+class NumaNodeScope {
+protected:
+	int previousNode;
+	std::vector<int> previousCpus;
+	int previousMode;
+	std::vector<unsigned long> previousMask;
+public:
+	NumaNodeScope(int node);
+	~NumaNodeScope();
+	NumaNodeScope(const NumaNodeScope&) = delete;
+	NumaNodeScope& operator=(const NumaNodeScope&) = delete;
+};
+}
+#endif
@@ -7,7 +7,9 @@
 #ifndef INCLUDE_NEURALOPTIMIZER_H_
 #define INCLUDE_NEURALOPTIMIZER_H_
 #include "NeuralSignal.h"
+#include <string>
 #include <unordered_map>
+#include <vector>
 namespace tgr {
 /**
  * base class of optimizer
@@ -20,6 +22,21 @@ public:
 	struct Interface {
 		virtual void update(const Storage &dW, Storage &W,bool parallelize) = 0;
 		virtual void reset() = 0;
+		virtual std::string getName() const = 0;
+		//moment buffers kept per weight tensor
+		virtual int getStateCount() const {
+			return 0;
+		}
+		//moment buffer of W, zero filled if W has not been updated yet
+		virtual Storage* getState(const Storage &W, int slot) {
+			return nullptr;
+		}
+		//state not tied to a weight tensor, such as Adam's decay powers
+		virtual std::vector<float_t> getScalars() const {
+			return std::vector<float_t>();
+		}
+		virtual void setScalars(const std::vector<float_t>& scalars) {
+		}
 	};
 private:
 	template<class T> struct Impl: public Interface {
@@ -33,6 +50,21 @@ private:
 		virtual void reset() override {
 			value.reset();
 		}
+		virtual std::string getName() const override {
+			return value.getName();
+		}
+		virtual int getStateCount() const override {
+			return value.getStateCount();
+		}
+		virtual Storage* getState(const Storage &W, int slot) override {
+			return value.getState(W, slot);
+		}
+		virtual std::vector<float_t> getScalars() const override {
+			return value.getScalars();
+		}
+		virtual void setScalars(const std::vector<float_t>& scalars) override {
+			value.setScalars(scalars);
+		}
 	};
 	std::shared_ptr<Interface> impl;
 public:
@@ -65,6 +97,27 @@ public:
 	virtual void reset() {
 		impl->reset();
 	}
+	/**
+	 * Optimizer state is keyed by the address of each weight tensor while
+	 * training. NeuralCheckpointer saves it under the tensor's layer id, type
+	 * and index instead, and NeuralSystem::setOptimizerState() restores it,
+	 * so a resumed run continues with the same moments.
+	 */
+	std::string getName() const {
+		return impl->getName();
+	}
+	int getStateCount() const {
+		return impl->getStateCount();
+	}
+	Storage* getState(const Storage &W, int slot) {
+		return impl->getState(W, slot);
+	}
+	std::vector<float_t> getScalars() const {
+		return impl->getScalars();
+	}
+	void setScalars(const std::vector<float_t>& scalars) {
+		impl->setScalars(scalars);
+	}
 };
 
 /**
@@ -82,6 +135,20 @@ struct AdagradOptimizer {
 		for (auto &e : E_)
 			e.clear();
 	}
+	std::string getName() const {
+		return "adagrad";
+	}
+	int getStateCount() const {
+		return N;
+	}
+	Storage* getState(const Storage &W, int slot) {
+		return &get<0>(W);
+	}
+	std::vector<float_t> getScalars() const {
+		return std::vector<float_t>();
+	}
+	void setScalars(const std::vector<float_t>& scalars) {
+	}
 private:
 	float_t eps;
 	static const int N = 1;
@@ -108,6 +175,20 @@ struct RMSpropOptimizer {
 		for (auto &e : E_)
 			e.clear();
 	}
+	std::string getName() const {
+		return "rmsprop";
+	}
+	int getStateCount() const {
+		return N;
+	}
+	Storage* getState(const Storage &W, int slot) {
+		return &get<0>(W);
+	}
+	std::vector<float_t> getScalars() const {
+		return std::vector<float_t>();
+	}
+	void setScalars(const std::vector<float_t>& scalars) {
+	}
 	float_t alpha;  // learning rate
 	float_t mu;     // decay term
 private:
@@ -136,7 +217,22 @@ struct AdamOptimizer: public NeuralOptimizer::Interface {
 	void reset() override {
 		for (auto &e : E_)
 			e.clear();
+		b1_t = b1;
+		b2_t = b2;
+	}
+	std::string getName() const override {
+		return "adam";
+	}
+	int getStateCount() const override {
+		return N;
 	}
+	Storage* getState(const Storage &W, int slot) override {
+		return (slot == 0) ? &get<0>(W) : &get<1>(W);
+	}
+	std::vector<float_t> getScalars() const override {
+		return std::vector<float_t> { b1_t, b2_t };
+	}
+	void setScalars(const std::vector<float_t>& scalars) override;
 	float_t alpha;  // learning rate
 	float_t b1;     // decay term
 	float_t b2;     // decay term
@@ -145,10 +241,11 @@ struct AdamOptimizer: public NeuralOptimizer::Interface {
 
 private:
 	float_t eps;  // constant value to avoid zero-division
-	static const int N = 1;
+	static const int N = 2; //first and second moments
 protected:
 	template<int Index>
 	Storage &get(const Storage &key) {
+		static_assert(Index < N, "index out of range");
 		if (E_[Index][&key].empty())
 			E_[Index][&key].resize(key.size(), float_t());
 		return E_[Index][&key];
@@ -165,6 +262,9 @@ struct GradientDescentOptimizer: public NeuralOptimizer::Interface {
 	GradientDescentOptimizer();
 	virtual void update(const Storage &dW, Storage &W, bool parallelize) override;
 	virtual void reset() override {}
+	virtual std::string getName() const override {
+		return "sgd";
+	}
 	float_t alpha;   // learning rate
 	float_t lambda;  // weight decay
 };
@@ -182,6 +282,15 @@ public:
 	virtual ~MomentumOptimizer(){}
 	virtual void update(const Storage &dW, Storage &W, bool parallelize) override;
 	virtual void reset() override;
+	virtual std::string getName() const override {
+		return "momentum";
+	}
+	virtual int getStateCount() const override {
+		return N;
+	}
+	virtual Storage* getState(const Storage &W, int slot) override {
+		return &get<0>(W);
+	}
 	float_t alpha;   // learning rate
 	float_t lambda;  // weight decay
 	float_t mu;      // momentum
@@ -0,0 +1,167 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALPLAN_H_
+#define NEURALPLAN_H_
+#include "NeuralLayer.h"
+#include "NeuralTuner.h"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+namespace tgr {
+class NeuralSystem;
+/**
+ * Index tables of one layer geometry, as flat int arrays in the order the
+ * layer added them. get() reads them back in the same order, checking sizes
+ * and that every value lies in [0, range), and throws if they do not match.
+ */
+struct PlanTable {
+	std::vector<std::vector<int>> arrays;
+	template<typename T> void add(const std::vector<T>& values) {
+		arrays.push_back(std::vector<int>(values.begin(), values.end()));
+	}
+	//stored as row offsets followed by the concatenated rows
+	template<typename T> void add(const std::vector<std::vector<T>>& rows) {
+		std::vector<int> offsets(rows.size() + 1, 0);
+		std::vector<int> values;
+		for (size_t r = 0; r < rows.size(); r++) {
+			values.insert(values.end(), rows[r].begin(), rows[r].end());
+			offsets[r + 1] = (int) values.size();
+		}
+		arrays.push_back(offsets);
+		arrays.push_back(values);
+	}
+	const std::vector<int>& next(size_t& index) const;
+	const std::vector<int>& next(size_t& index, size_t size, int range) const;
+	template<typename T> void get(size_t& index, std::vector<T>& values,
+			size_t size, int range) const {
+		const std::vector<int>& src = next(index, size, range);
+		values.assign(src.begin(), src.end());
+	}
+	template<typename T> void get(size_t& index,
+			std::vector<std::vector<T>>& rows, size_t count, int range) const {
+		const std::vector<int>& offsets = next(index);
+		const std::vector<int>& values = next(index, offsets.size() > 0 ?
+				(size_t) std::max(offsets.back(), 0) : 0, range);
+		checkOffsets(offsets, count, values.size());
+		rows.resize(count);
+		for (size_t r = 0; r < count; r++) {
+			rows[r].assign(values.begin() + offsets[r],
+					values.begin() + offsets[r + 1]);
+		}
+	}
+	//throws unless offsets are count + 1 ascending values from 0 to total
+	static void checkOffsets(const std::vector<int>& offsets, size_t count,
+			size_t total);
+};
+/**
+ * A signal of a planned system: output "channel" of the layer at position
+ * "layer" in execution order, or input -1 - channel if channel is negative.
+ */
+struct PlanSignal {
+	int32_t layer;
+	int32_t channel;
+};
+struct PlanAlias {
+	PlanSignal signal;
+	PlanSignal parent;
+	uint64_t offset;
+};
+/**
+ * Everything NeuralSystem::build() and the layer constructors compute at
+ * startup that depends only on the network and the machine: the execution
+ * order, the buffer aliases, the tuned backend and threading settings of
+ * each layer and the index tables of pooling and partially connected
+ * layers, keyed by their geometry.
+ *
+ * A plan is captured from a built system and written to disk. Made active
+ * with NeuralPlanScope, layers constructed meanwhile copy their tables from
+ * it instead of building them, and build() takes the order, aliases and
+ * settings from it if the graph has the signature it was captured for.
+ * Tuned settings are only applied on the machine they were tuned on. A plan
+ * that does not match is ignored and everything is built as usual.
+ */
+class NeuralPlan {
+protected:
+	uint64_t signature;
+	std::string machine; //NeuralTuner::getMachineKey() at capture
+	std::vector<int> order; //visit index of each layer, in execution order
+	std::vector<LayerTuning> tunings; //in execution order
+	std::vector<PlanAlias> aliases;
+	std::map<std::string, std::shared_ptr<const PlanTable>> tables;
+public:
+	NeuralPlan() :
+			signature(0) {
+	}
+	/**
+	 * Hashes the graph reachable from the input layers: layer types, names,
+	 * shapes, table keys and connections. visited receives the layers in the
+	 * order they were hashed, which is what the plan's order refers to.
+	 */
+	static uint64_t GetSignature(const std::vector<NeuralLayerPtr>& input,
+			std::vector<NeuralLayerPtr>* visited = nullptr);
+	//records the plan of a built system, after tuning if it is tuned
+	void capture(const NeuralSystem& sys);
+	uint64_t getSignature() const {
+		return signature;
+	}
+	const std::string& getMachine() const {
+		return machine;
+	}
+	const std::vector<int>& getOrder() const {
+		return order;
+	}
+	const std::vector<LayerTuning>& getTunings() const {
+		return tunings;
+	}
+	const std::vector<PlanAlias>& getAliases() const {
+		return aliases;
+	}
+	std::shared_ptr<const PlanTable> getTable(const std::string& key) const;
+	size_t getTableCount() const {
+		return tables.size();
+	}
+	void write(const std::string& file) const;
+	void read(const std::string& file);
+	//plan of the calling thread, nullptr if none
+	static std::shared_ptr<const NeuralPlan> getActive();
+	//returns the previous plan
+	static std::shared_ptr<const NeuralPlan> setActive(
+			const std::shared_ptr<const NeuralPlan>& plan);
+};
+class NeuralPlanScope {
+protected:
+	std::shared_ptr<const NeuralPlan> previous;
+public:
+	NeuralPlanScope(const std::shared_ptr<const NeuralPlan>& plan) :
+			previous(NeuralPlan::setActive(plan)) {
+	}
+	~NeuralPlanScope() {
+		NeuralPlan::setActive(previous);
+	}
+};
+void WriteNeuralPlanToFile(const std::string& file, const NeuralPlan& plan);
+//throws if the file cannot be read or is not a plan of this version
+std::shared_ptr<NeuralPlan> ReadNeuralPlanFromFile(const std::string& file);
+}
+#endif
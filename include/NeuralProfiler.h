@@ -0,0 +1,178 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALPROFILER_H_
+#define NEURALPROFILER_H_
+#include "NeuralCounters.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+namespace tgr {
+class NeuralLayer;
+enum class ProfilePhase {
+	Forward = 0, Backward = 1, Update = 2
+};
+std::ostream &operator<<(std::ostream &os, ProfilePhase phase);
+struct ProfileEvent {
+	static const int MAX_NAME = 48;
+	char name[MAX_NAME];
+	int layerId;
+	ProfilePhase phase;
+	int threadId;
+	uint64_t start; //nanoseconds since the profiler epoch
+	uint64_t end;
+	uint64_t bytes;
+	bool hasCounters;
+	CounterValues counters; //summed over all threads
+	double getDuration() const { //milliseconds
+		return 1E-6 * (end - start);
+	}
+};
+/**
+ * Fixed capacity event ring owned by one thread. Only the owning thread
+ * writes, so recording is a plain store followed by a release increment of
+ * the head. Clearing only moves the tail, so it never races with the
+ * writer. Readers copy the most recent events; entries being overwritten
+ * during a read may be torn, so read while training is paused when exact
+ * results matter.
+ */
+struct ProfileBuffer {
+	std::vector<ProfileEvent> events;
+	std::atomic<uint64_t> head;
+	std::atomic<uint64_t> tail;
+	int threadId;
+	ProfileBuffer(size_t capacity, int threadId) :
+			events(capacity), head(0), tail(0), threadId(threadId) {
+	}
+	void push(const ProfileEvent& e) {
+		uint64_t h = head.load(std::memory_order_relaxed);
+		events[h % events.size()] = e;
+		head.store(h + 1, std::memory_order_release);
+	}
+	void copyTo(std::vector<ProfileEvent>& out) const;
+};
+struct ProfileSummary {
+	int layerId;
+	std::string name;
+	ProfilePhase phase;
+	size_t count;
+	//milliseconds
+	double total;
+	double mean;
+	double p50;
+	double p99;
+	double min;
+	double max;
+	uint64_t bytes; //mean bytes touched per call
+	bool hasCounters;
+	CounterValues counters; //mean per call
+	double getIPC() const {
+		uint64_t cycles = counters[HardwareCounter::Cycles];
+		return (cycles > 0) ?
+				(double) counters[HardwareCounter::Instructions] / cycles : 0.0;
+	}
+};
+/**
+ * Process wide layer profiler. Disabled by default, in which case each hook
+ * costs one relaxed atomic load. When enabled, NeuralLayer records one event
+ * per forward(), backward() and updateWeights() call into the calling
+ * thread's ring buffer. If NeuralCounters is also enabled, each event carries
+ * the hardware counter deltas for the call.
+ */
+class NeuralProfiler {
+protected:
+	static std::atomic<bool> enabled;
+	static std::atomic<size_t> capacity;
+	static std::mutex bufferLock;
+	static std::vector<std::shared_ptr<ProfileBuffer>> buffers;
+	static ProfileBuffer* getThreadBuffer();
+public:
+	static std::mutex& getLock();
+	static bool isEnabled() {
+		return enabled.load(std::memory_order_relaxed);
+	}
+	static void setEnabled(bool e) {
+		enabled.store(e, std::memory_order_relaxed);
+	}
+	//events kept per thread, applies to threads that have not recorded yet.
+	static void setCapacity(size_t c);
+	static uint64_t now();
+	static uint64_t countBytes(const NeuralLayer* layer, ProfilePhase phase);
+	static void record(const NeuralLayer* layer, ProfilePhase phase,
+			uint64_t start, uint64_t end, uint64_t bytes,
+			const CounterValues* counters = nullptr);
+	static std::vector<ProfileEvent> getEvents();
+	static std::vector<ProfileSummary> getSummary();
+	//only events that started and ended within [startTime, endTime]
+	static std::vector<ProfileSummary> getSummary(uint64_t startTime,
+			uint64_t endTime);
+	static void clear();
+	static void writeChromeTrace(std::ostream& out);
+	static void writeChromeTrace(const std::string& file);
+	static void printSummary(std::ostream& out);
+};
+/**
+ * Times the enclosing scope and records it for a layer if the profiler was
+ * enabled when the scope was entered.
+ */
+class ProfileScope {
+protected:
+	const NeuralLayer* layer;
+	ProfilePhase phase;
+	uint64_t bytes;
+	uint64_t start;
+	bool counting;
+	CounterValues counters;
+public:
+	ProfileScope(const NeuralLayer* layer, ProfilePhase phase) :
+			layer(nullptr), phase(phase), bytes(0), start(0), counting(false) {
+		if (NeuralProfiler::isEnabled()) {
+			this->layer = layer;
+			bytes = NeuralProfiler::countBytes(layer, phase);
+			counting = NeuralCounters::isEnabled();
+			if (counting) {
+				NeuralCounters::read(counters);
+			}
+			start = NeuralProfiler::now();
+		}
+	}
+	~ProfileScope() {
+		if (layer != nullptr) {
+			uint64_t end = NeuralProfiler::now();
+			if (counting) {
+				CounterValues last;
+				NeuralCounters::read(last);
+				for (int c = 0; c < HARDWARE_COUNTER_COUNT; c++) {
+					counters.values[c] =
+							(last.values[c] > counters.values[c]) ?
+									last.values[c] - counters.values[c] : 0;
+				}
+			}
+			NeuralProfiler::record(layer, phase, start, end, bytes,
+					counting ? &counters : nullptr);
+		}
+	}
+};
+}
+#endif
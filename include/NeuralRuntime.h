@@ -27,6 +27,8 @@
 #include <AlloyWorker.h>
 #include "NeuralSystem.h"
 #include "NeuralCache.h"
+#include "NeuralCheckpoint.h"
+#include "NeuralHistory.h"
 #include "NeuralLossFunction.h"
 #include "NeuralOptimizer.h"
 namespace tgr {
@@ -56,25 +58,35 @@ protected:
 	aly::Number upperSample;
 	int optimizationMethod;
 	int lossFunction;
+	bool profile;
+	bool profileCounters;
+	std::string profileFile;
 	std::vector<int> sampleIndexes;
 	std::vector<float> outputData;
 	int iteration;
 	std::thread simulationThread;
 	std::shared_ptr<tgr::NeuralSystem> sys;
 	std::shared_ptr<tgr::NeuralCache> cache;
+	std::shared_ptr<NeuralCheckpointer> checkpointer;
+	std::shared_ptr<NeuralHistory> history;
 
 	bool stop_training_;
 	std::vector<Tensor> in_batch;
 	std::vector<Tensor> t_batch;
+	std::vector<Tensor> t_cost_batch;
 	std::vector<Tensor> inputs;
 	std::vector<Tensor> desiredOutputs;
 	std::vector<Tensor> t_costs;
+	//Class labels are kept as indexes, no one-hot target tensors are built.
+	std::vector<int> labels;
+	std::vector<Storage> labelCosts;
 	NeuralOptimizer optimizer;
 	NeuralLossFunction loss;
 	const Tensor* get_target_cost_sample_pointer(
 			const std::vector<Tensor> &t_cost, size_t i);
 	void trainOnce(NeuralOptimizer &optimizer, const NeuralLossFunction& loss,const Tensor *in, const Tensor *t, int size, const int nbThreads,const Tensor *t_cost);
 	void trainOneBatch(NeuralOptimizer &optimizer,const NeuralLossFunction& loss, const Tensor *in, const Tensor *t,int batch_size, const int num_tasks, const Tensor *t_cost);
+	void trainOneBatch(NeuralOptimizer &optimizer,const NeuralLossFunction& loss, const Tensor *in, const int *labels,int batch_size, const Storage *t_cost);
 public:
 	float getLoss(const NeuralLossFunction& loss);
 	std::function<void(int iteration, bool lastIteration)> onUpdate;
@@ -102,6 +114,35 @@ public:
 		this->optimizer = opt;
 	}
 	void cleanup();
+	/**
+	 * Records per-layer timings while training. A summary table is printed
+	 * after every epoch, and when traceFile is set the epoch's events are also
+	 * written there in Chrome trace format. With counters, each layer also
+	 * reports hardware counters (Linux only).
+	 */
+	void setProfiling(bool enabled, const std::string& traceFile = "",
+			bool counters = false) {
+		profile = enabled;
+		profileFile = traceFile;
+		profileCounters = counters;
+	}
+	/**
+	 * Writes the weights every options.interval epochs from a background
+	 * thread, see NeuralCheckpointer. An interval of 0 turns it off.
+	 */
+	void setCheckpointing(const CheckpointOptions& options);
+	std::shared_ptr<NeuralCheckpointer> getCheckpointer() const {
+		return checkpointer;
+	}
+	/**
+	 * Records the weights after every epoch as keyframes and compressed
+	 * deltas, see NeuralHistory. Recorded epochs become frames of the cache
+	 * and are rebuilt from the history when loaded.
+	 */
+	void setHistory(bool enabled, const HistoryOptions& options = HistoryOptions());
+	std::shared_ptr<NeuralHistory> getHistory() const {
+		return history;
+	}
 	std::shared_ptr<tgr::NeuralCache> getCache() const {
 		return cache;
 	}
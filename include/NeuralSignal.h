@@ -26,6 +26,9 @@
 #include <AlloyOptimizationMath.h>
 #include <memory>
 #include <map>
+#include "NeuralAllocator.h"
+#include "NeuralKernels.h"
+#include "NeuralThreadPool.h"
 #include "tiny_dnn/util/util.h"
 namespace tgr {
 enum class ChannelType
@@ -102,16 +105,18 @@ inline std::vector<tiny_dnn::shape3d> Convert(
 	return out;
 }
 
+/**
+ * The internal and avx backends both run NeuralKernels, which picks the
+ * instruction set at startup, so one binary runs on any x86-64 host.
+ */
 inline BackendType DefaultEngine() {
-#ifdef CNN_USE_AVX
-#if defined(__AVX__) || defined(__AVX2__)
-	return BackendType::avx;
-#else
-#error "your compiler does not support AVX"
-#endif
-#else
-	return BackendType::internal;
-#endif
+	return (NeuralKernels::getIsa() >= IsaLevel::AVX2) ?
+			BackendType::avx : BackendType::internal;
+}
+//instruction set a backend's kernels run with on this host
+inline IsaLevel GetBackendIsa(BackendType type) {
+	return (type == BackendType::internal || type == BackendType::avx) ?
+			NeuralKernels::getIsa() : IsaLevel::Generic;
 }
 inline std::ostream &operator<<(std::ostream &os, BackendType type) {
 	switch (type) {
@@ -137,7 +142,7 @@ inline std::ostream &operator<<(std::ostream &os, BackendType type) {
 	return os;
 }
 bool isTrainableWeight(ChannelType vtype);
-typedef std::vector<float, aly::aligned_allocator<float, 64>> Storage;
+typedef std::vector<float, StorageAllocator<float, 64>> Storage;
 typedef std::vector<Storage> Tensor;
 class NeuralLayer;
 struct Terminal {
@@ -165,6 +170,9 @@ public:
 	Tensor change;
 	NeuralLayer* input;
 	std::vector<std::shared_ptr<NeuralLayer>> outputs;
+	//Signal whose value/change buffers this signal views, starting at aliasOffset.
+	NeuralSignal* alias;
+	size_t aliasOffset;
 	float* getValuePtr(const aly::int3& pos);
 	float* getChangePtr(const aly::int3& pos);
 	inline float getValue(const aly::int3& pos);
@@ -176,6 +184,11 @@ public:
 	inline bool hasOutput() const {
 		return (outputs.size() != 0);
 	}
+	inline bool isAlias() const {
+		return (alias != nullptr);
+	}
+	void setAlias(NeuralSignal* parent, size_t offset);
+	void bindAlias(size_t sample_count);
 	void setValue(const aly::Image1f& data);
 	void setValue(const aly::Image3f& data);
 	void setValue(const aly::Image4f& data);
@@ -198,10 +211,7 @@ public:
 
 inline void foreach(std::function<void(size_t i)>& f, size_t size, bool parallelize=true) {
 	if(parallelize){
-#pragma omp parallel for
-		for (size_t i = 0; i < size; ++i) {
-			f(i);
-		}
+		NeuralThreadPool::parallelForEach(0, (size_t) size, f);
 	} else {
 		for (size_t i = 0; i < size; ++i) {
 			f(i);
@@ -211,10 +221,7 @@ inline void foreach(std::function<void(size_t i)>& f, size_t size, bool parallel
 
 inline void foreach(std::function<void(int i)>& f, int size, bool parallelize=true) {
 	if(parallelize){
-#pragma omp parallel for
-		for (size_t i = 0; i < size; ++i) {
-			f(i);
-		}
+		NeuralThreadPool::parallelForEach(0, (size_t) size, f);
 	} else {
 		for (size_t i = 0; i < size; ++i) {
 			f(i);
@@ -224,10 +231,7 @@ inline void foreach(std::function<void(int i)>& f, int size, bool parallelize=tr
 
 inline void foreach(std::function<void(int i)>& f, size_t size, bool parallelize=true) {
 	if(parallelize){
-#pragma omp parallel for
-		for (size_t i = 0; i < size; ++i) {
-			f(i);
-		}
+		NeuralThreadPool::parallelForEach(0, (size_t) size, f);
 	} else {
 		for (size_t i = 0; i < size; ++i) {
 			f(i);
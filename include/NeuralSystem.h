@@ -36,9 +36,13 @@
 #include "LinearLayer.h"
 #include "MaxPoolingLayer.h"
 #include "PartialConnectedLayer.h"
+#include "SliceLayer.h"
 #include "TanhLayer.h"
+#include "ReLULayer.h"
 #include "ConvolutionLayer.h"
 #include "NeuralLossFunction.h"
+#include "NeuralTuner.h"
+#include "NeuralPlan.h"
 #include <map>
 namespace aly {
 class NeuralFlowPane;
@@ -59,6 +63,16 @@ protected:
 	NeuralKnowledge knowledge;
 	std::string name;
 	aly::GraphDataPtr graph;
+	std::vector<SignalPtr> aliases;
+	bool planned;
+	size_t trunk;
+	std::vector<SignalPtr> trunkOutputs;
+	void planAliases();
+	bool buildFromPlan(const NeuralPlan& plan,
+			const std::vector<NeuralLayerPtr>& input,
+			const std::vector<NeuralLayerPtr>& output);
+	void bindAliases(size_t sample_count);
+	size_t setInputData(const std::vector<Tensor> &in_data);
 	void reorderForLayerwiseProcessing(const std::vector<Tensor> &input,
 			std::vector<std::vector<const Storage *>> &output);
 
@@ -69,6 +83,13 @@ public:
 			const std::vector<Storage> &t, const std::vector<Storage> &t_cost);
 	void bprop(const NeuralLossFunction& loss, const std::vector<Tensor> &out,
 			const std::vector<Tensor> &t, const std::vector<Tensor> &t_cost);
+	/**
+	 * Back propagates class labels through the network. Uses the outputs of
+	 * the last forward() call, and requires a single output layer. labels and
+	 * t_cost (optional) hold one entry per sample in the batch.
+	 */
+	void bprop(const NeuralLossFunction& loss, const int* labels,
+			const Storage* t_cost = nullptr);
 	Storage fprop(const Storage &in);
 	std::vector<Storage> fprop(const std::vector<Storage> &in);
 	std::vector<Tensor> fprop(const std::vector<Tensor> &in);
@@ -102,6 +123,12 @@ public:
 	size_t getOutputDataSize() const;
 	std::vector<Tensor> mergeOutputs();
 	void setKnowledge(const NeuralKnowledge& k);
+	/**
+	 * Restores optimizer state saved with a checkpoint of this network.
+	 * Returns false if the checkpoint has none, and throws if it was saved
+	 * for another optimizer or network.
+	 */
+	bool setOptimizerState(const NeuralKnowledge& k, NeuralOptimizer& optimizer);
 	void reset();
 	NeuralKnowledge& getKnowledge() {
 		return knowledge;
@@ -127,6 +154,8 @@ public:
 			const std::vector<Storage> &in, const std::vector<Tensor> &t);
 	float getLoss(const NeuralLossFunction& loss, const std::vector<int> &in,
 			const std::vector<Tensor> &t);
+	float getLoss(const NeuralLossFunction& loss,
+			const std::vector<Tensor> &in, const std::vector<int> &labels);
 	bool gradientCheck(const NeuralLossFunction& func,
 			const std::vector<Tensor> &in,
 			const std::vector<std::vector<int>> &t, float eps,
@@ -151,6 +180,9 @@ public:
 	std::vector<NeuralLayerPtr>& getRoots() {
 		return roots;
 	}
+	const std::string& getName() const {
+		return name;
+	}
 	const std::vector<NeuralLayerPtr>& getLayers() const {
 		return layers;
 	}
@@ -169,16 +201,62 @@ public:
 	std::vector<NeuralLayerPtr>& getOutputLayers() {
 		return outputLayers;
 	}
+	const std::vector<SignalPtr>& getAliases() const {
+		return aliases;
+	}
 	std::vector<Storage> test(const std::vector<Storage> &in);
 	NeuralSystem(const std::string& name,
 			const std::shared_ptr<aly::NeuralFlowPane>& pane);
 	std::vector<Tensor> forward(const std::vector<Tensor> &in_data);
 	void evaluate();
+	/**
+	 * Times the candidate backends and threading settings of every layer on
+	 * this batch and keeps the fastest, see NeuralTuner.
+	 */
+	std::vector<TuneResult> tune(const std::vector<Tensor> &in,
+			const TuneOptions& options = TuneOptions());
 	void setup(bool reset_weight);
 	void clearGradients();
 	void backward(const std::vector<Tensor> &out_grad);
+	void backward();
+	/**
+	 * Number of leading layers, in execution order, whose outputs cannot
+	 * change during training: layers set not trainable and the layers
+	 * without weights around them. 0 if no layer with weights is frozen.
+	 */
+	size_t getFrozenTrunkSize() const;
+	//outputs of the first count layers that are read by the layers after them
+	std::vector<SignalPtr> getTrunkOutputs(size_t count) const;
+	/**
+	 * Splits the network after its first count layers, which must all be
+	 * frozen. backward() then stops at the first layer after the trunk, and
+	 * forwardTrunk() and forwardHead() run either side of the split, see
+	 * NeuralFeatureCache. 0 removes the split.
+	 */
+	void setTrunk(size_t count);
+	size_t getTrunk() const {
+		return trunk;
+	}
+	const std::vector<SignalPtr>& getTrunkOutputs() const {
+		return trunkOutputs;
+	}
+	//runs the trunk only, leaving its results in getTrunkOutputs()
+	void forwardTrunk(const std::vector<Tensor> &in_data);
+	//sizes the trunk outputs for a batch before they are filled in
+	void bindTrunkOutputs(size_t sample_count);
+	//runs the layers after the trunk on the trunk outputs, like forward()
+	std::vector<Tensor> forwardHead();
+	/**
+	 * Orders the layers reachable from the inputs and plans their buffers.
+	 * If a NeuralPlan is active and matches the graph, its order, aliases
+	 * and tuned settings are used instead, see isPlanned().
+	 */
 	void build(const std::vector<NeuralLayerPtr>& input,
 			const std::vector<NeuralLayerPtr> &output);
+	//true if the last build() was restored from a NeuralPlan
+	bool isPlanned() const {
+		return planned;
+	}
 	void build(NeuralLayerPtr input, NeuralLayerPtr output) {
 		build(std::vector<NeuralLayerPtr> { input },
 				std::vector<NeuralLayerPtr> { output });
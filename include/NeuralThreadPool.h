@@ -0,0 +1,121 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALTHREADPOOL_H_
+#define NEURALTHREADPOOL_H_
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+namespace tgr {
+enum class NestedPolicy {
+	Serial, Parallel
+};
+typedef std::function<void(size_t begin, size_t end)> RangeFunction;
+class TaskGroup;
+/**
+ * Process wide work-stealing pool behind every parallel loop in tgr and
+ * tiny_dnn. Each worker owns a deque: it pushes and pops its own tasks at
+ * the back and idle workers steal from the front. Threads outside the pool
+ * submit through a shared injection queue.
+ *
+ * parallelFor() splits a range into chunks of at most grainSize elements
+ * (and at least one chunk per thread), and the calling thread works on
+ * chunks alongside the workers it wakes. By default a parallelFor() issued
+ * from inside another parallel loop runs serially on the calling thread, so
+ * nested kernels never oversubscribe the cores. NestedPolicy::Parallel lets
+ * nested loops share the pool instead.
+ *
+ * The thread count includes the calling thread. It defaults to the
+ * TIGER_THREADS environment variable, or the hardware concurrency.
+ */
+class NeuralThreadPool {
+protected:
+	friend class TaskGroup;
+	static void submit(const std::function<void()>& task);
+	//runs one queued task on the calling thread, false if none was found
+	static bool runPendingTask();
+public:
+	static void setThreadCount(int threads);
+	static int getThreadCount();
+	//pins worker i to CPU i+1 of NeuralNuma::getCpuOrder(), leaving the first
+	//CPU to the submitting thread
+	static void setPinning(bool pin);
+	static bool isPinning();
+	static void setNestedPolicy(NestedPolicy policy);
+	static NestedPolicy getNestedPolicy();
+	static void setDefaultGrainSize(size_t grain);
+	static size_t getDefaultGrainSize();
+	static bool isWorkerThread();
+	static bool isInParallelRegion();
+	//grainSize of 0 uses the default grain size
+	static void parallelFor(size_t begin, size_t end, const RangeFunction& f,
+			size_t grainSize = 0);
+	template<typename Func> static void parallelForEach(size_t begin,
+			size_t end, const Func& f, size_t grainSize = 0) {
+		parallelFor(begin, end, [&f](size_t b, size_t e) {
+			for (size_t i = b; i < e; i++) {
+				f(i);
+			}
+		}, grainSize);
+	}
+};
+/**
+ * Replaces the grain size of every parallelFor() the calling thread issues
+ * while the scope is alive. A grain of 0 leaves the callers' values alone.
+ * NeuralLayer uses it to apply tuned blocking to the kernels it runs.
+ */
+class GrainScope {
+protected:
+	size_t previous;
+public:
+	GrainScope(size_t grainSize);
+	~GrainScope();
+	GrainScope(const GrainScope&) = delete;
+	GrainScope& operator=(const GrainScope&) = delete;
+};
+/**
+ * Set of tasks run on the pool. wait() executes queued tasks while the
+ * group is incomplete, so waiting from inside a task cannot deadlock. The
+ * first exception thrown by a task is rethrown from wait().
+ */
+class TaskGroup {
+protected:
+	struct State {
+		std::atomic<int> pending;
+		std::mutex lock;
+		std::condition_variable done;
+		std::exception_ptr error;
+		State() :
+				pending(0) {
+		}
+	};
+	std::shared_ptr<State> state;
+public:
+	TaskGroup();
+	~TaskGroup();
+	void run(const std::function<void()>& task);
+	void wait();
+};
+}
+#endif
@@ -0,0 +1,162 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALTRACE_H_
+#define NEURALTRACE_H_
+#include "NeuralExport.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+namespace tgr {
+class NeuralSystem;
+//the NeuralState field a traced tensor belongs to
+enum class TraceSlot : int32_t {
+	Responses = 0, ResponseChanges = 1, Weights = 2, WeightChanges = 3
+};
+std::ostream &operator<<(std::ostream &os, TraceSlot slot);
+struct TraceOptions {
+	std::vector<int> layers; //layer ids to trace, empty traces every layer
+	int interval = 100; //iterations between samples, 0 disables tracing
+	bool responses = true;
+	bool responseChanges = true;
+	bool weights = false;
+	bool weightChanges = false;
+	//samples of the batch kept per response, 0 keeps the whole batch
+	int maxSamples = 8;
+	//raw values waiting for the compressor; samples that do not fit are dropped
+	uint64_t captureBytes = 32ULL << 20;
+	//compressed frames kept in memory before the oldest are spilled
+	uint64_t memoryBytes = 32ULL << 20;
+	WeightPrecision precision = WeightPrecision::Int8;
+	//frames pushed out of memory are appended here, empty discards them
+	std::string file;
+};
+struct TraceFrame {
+	int iteration;
+	int layerId;
+	TraceSlot slot;
+	int channel; //output channel for responses, input channel for weights
+	aly::dim3 dimensions;
+	//weights and weight changes have one, changes are summed over the batch
+	int samples;
+	std::vector<float> values; //samples x dimensions
+};
+struct TraceStats {
+	uint64_t samples = 0; //iterations recorded
+	uint64_t dropped = 0; //iterations lost because the capture ring was full
+	uint64_t frames = 0; //tensors compressed
+	uint64_t spilled = 0; //frames appended to the file
+	uint64_t discarded = 0; //frames pushed out of memory without a file
+	uint64_t rawBytes = 0;
+	uint64_t compressedBytes = 0;
+	uint64_t residentBytes = 0;
+	double captureTime = 0.0; //seconds the training thread spent copying
+	double compressTime = 0.0; //seconds the compressor thread spent coding
+};
+struct TraceUnitStats {
+	int layerId;
+	TraceSlot slot;
+	int channel;
+	int frames;
+	int units;
+	int deadUnits; //zero in every recorded sample
+	int saturatedUnits; //at or beyond the threshold in every recorded sample
+	double meanAbs;
+};
+struct TraceRecord;
+/**
+ * Opt-in recorder of activations, gradients and weights over a training
+ * run, sampled every few iterations for a subset of layers, with a fixed
+ * memory budget.
+ *
+ * record() copies the selected tensors into a lock-free single producer,
+ * single consumer ring and returns; it never waits, and drops the sample
+ * if the ring is full. A background thread quantizes and range codes each
+ * tensor with the export codecs (see EncodeValues) and keeps the compressed
+ * frames in memory, appending the oldest to the trace file once they
+ * exceed the budget. Remaining frames are written when the tracer is
+ * destroyed, so the file holds the whole run.
+ */
+class NeuralTracer {
+protected:
+	TraceOptions options;
+	//capture ring in 64-bit words, see record()
+	std::vector<uint64_t> ring;
+	std::atomic<uint64_t> head; //words written by the training thread
+	std::atomic<uint64_t> tail; //words consumed by the compressor
+	std::atomic<uint64_t> samples;
+	std::atomic<uint64_t> dropped;
+	std::atomic<uint64_t> rawBytes;
+	std::atomic<uint64_t> captureNanos;
+	std::thread worker;
+	mutable std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable drained;
+	std::deque<std::shared_ptr<TraceRecord>> resident;
+	std::ofstream spillFile;
+	TraceStats stats;
+	bool busy;
+	bool stopping;
+	bool isTraced(int layerId) const;
+	void run();
+	void spill(const std::vector<std::shared_ptr<TraceRecord>>& records);
+public:
+	NeuralTracer(const TraceOptions& options = TraceOptions());
+	~NeuralTracer();
+	NeuralTracer(const NeuralTracer&) = delete;
+	NeuralTracer& operator=(const NeuralTracer&) = delete;
+	const TraceOptions& getOptions() const {
+		return options;
+	}
+	bool isDue(int iteration) const;
+	/**
+	 * Samples the system if tracing is due at this iteration. Call after
+	 * backward() and before the weights are updated, so gradients are still
+	 * in place. Returns false if nothing was recorded.
+	 */
+	bool record(const NeuralSystem& sys, int iteration);
+	//waits until every recorded sample is compressed
+	void flush();
+	//decodes the frames still in memory, of one layer or of all if -1
+	std::vector<TraceFrame> getFrames(int layerId = -1) const;
+	TraceStats getStats() const;
+	void printStats(std::ostream& out) const;
+};
+//frames of a trace file, of one layer or of all if -1
+std::vector<TraceFrame> ReadNeuralTraceFromFile(const std::string& file,
+		int layerId = -1);
+/**
+ * Finds dead and saturated units per traced tensor. A unit is dead if it is
+ * zero in every recorded sample, and saturated if its magnitude is at least
+ * "saturation" in every recorded sample.
+ */
+std::vector<TraceUnitStats> GetTraceUnitStats(
+		const std::vector<TraceFrame>& frames, float saturation = 0.99f);
+void PrintTraceUnitStats(std::ostream& out,
+		const std::vector<TraceUnitStats>& stats);
+}
+#endif
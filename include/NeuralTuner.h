@@ -0,0 +1,91 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALTUNER_H_
+#define NEURALTUNER_H_
+#include "NeuralSignal.h"
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+namespace tgr {
+class NeuralSystem;
+class NeuralLayer;
+/**
+ * Execution settings chosen for one layer.
+ */
+struct LayerTuning {
+	BackendType backend = BackendType::internal;
+	bool parallelize = false;
+	size_t grainSize = 0; //0 keeps the kernels' own grain sizes
+	double time = 0.0; //milliseconds per call when tuned
+};
+struct TuneOptions {
+	std::string cacheFile; //empty disables the on-disk cache
+	bool backward = true; //time backward() along with forward()
+	bool parallelize = true; //allow parallel candidates
+	bool retune = false; //ignore cached entries
+	int minIterations = 3;
+	double minTime = 0.005; //seconds spent timing each candidate
+	//a candidate has to beat the current settings by this fraction
+	double threshold = 0.05;
+};
+struct TuneResult {
+	int layerId;
+	std::string name;
+	std::string signature;
+	LayerTuning tuning;
+	double baseline; //milliseconds per call with the settings before tuning
+	bool cached;
+};
+/**
+ * Empirical per-layer autotuner. For every layer of a system it times each
+ * backend, serial and parallel execution and a few grain sizes on the
+ * layer's actual shape and batch size, and keeps the fastest. Results are
+ * stored in a text cache keyed by the CPU model, kernel instruction set,
+ * thread count and layer signature, so later runs on the same machine apply
+ * them without timing anything.
+ */
+class NeuralTuner {
+public:
+	/**
+	 * Tunes every layer for the batch in "input" and applies the results.
+	 * Layer outputs and gradients are left in an unspecified state, so run
+	 * forward() again before reading them.
+	 */
+	static std::vector<TuneResult> tune(NeuralSystem& sys,
+			const std::vector<Tensor>& input, const TuneOptions& options =
+					TuneOptions());
+	//layer type, shapes, work and batch size
+	static std::string getSignature(const NeuralLayer& layer, int batchSize,
+			bool backward);
+	//CPU model, kernel instruction set and thread count
+	static std::string getMachineKey();
+	static void apply(NeuralLayer& layer, const LayerTuning& tuning);
+	static std::map<std::string, LayerTuning> readCache(
+			const std::string& file);
+	static void writeCache(const std::string& file,
+			const std::map<std::string, LayerTuning>& entries);
+	static void print(std::ostream& out,
+			const std::vector<TuneResult>& results);
+};
+}
+#endif
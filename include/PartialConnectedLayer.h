@@ -10,12 +10,70 @@
 
 #include "NeuralLayer.h"
 #include "NeuralSignal.h"
+#include <array>
 namespace tgr {
+/**
+ * Connection table in compressed sparse row form. Each row stores a range of
+ * packed 32-bit entries, where one entry holds both ids of a connection
+ * (first id in the high bits, second id in the low bits).
+ */
+class PackedConnectionTable {
+public:
+	PackedConnectionTable() :
+			shift(0), mask(0) {
+	}
+	/**
+	 * @param rows        [in] number of rows in the table
+	 * @param first_range [in] upper bound of the first id of each entry
+	 * @param second_range [in] upper bound of the second id of each entry
+	 * @param coo         [in] connections as (row, first, second)
+	 **/
+	void build(int rows, int first_range, int second_range,
+			const std::vector<std::array<int, 3>>& coo);
+	// appends offsets, packed entries and (shift, mask) to a plan table
+	void write(PlanTable& table) const;
+	// reads what write() stored, checked against the ranges build() takes
+	void read(const PlanTable& table, size_t& index, int rows,
+			int first_range, int second_range);
+	int rows() const {
+		return (offsets.size() > 0) ? static_cast<int>(offsets.size()) - 1 : 0;
+	}
+	int begin(int row) const {
+		return offsets[row];
+	}
+	int end(int row) const {
+		return offsets[row + 1];
+	}
+	int size(int row) const {
+		return offsets[row + 1] - offsets[row];
+	}
+	int first(int k) const {
+		return static_cast<int>(packed[k] >> shift);
+	}
+	int second(int k) const {
+		return static_cast<int>(packed[k] & mask);
+	}
+	const uint32_t* data() const {
+		return packed.data();
+	}
+	int getShift() const {
+		return shift;
+	}
+	uint32_t getMask() const {
+		return mask;
+	}
+	int maxRowSize() const;
+	int nonZeros() const {
+		return (offsets.size() > 0) ? offsets.back() : 0;
+	}
+private:
+	std::vector<int> offsets;
+	std::vector<uint32_t> packed;
+	int shift;
+	uint32_t mask;
+};
 class PartialConnectedLayer: public NeuralLayer {
 public:
-	typedef std::vector<std::pair<int, int>> io_connections;
-	typedef std::vector<std::pair<int, int>> wi_connections;
-	typedef std::vector<std::pair<int, int>> wo_connections;
 	PartialConnectedLayer(const std::string& name,int in_dim, int out_dim, size_t weight_dim,
 			size_t bias_dim, float scale_factor = 1.0f);
 	virtual void forwardPropagation(const std::vector<Tensor*>&in_data,
@@ -26,20 +84,36 @@ public:
 					override;
 	virtual int getFanInSize() const override;
 	virtual int getFanOutSize() const override;
+	virtual uint64_t getMultiplyAdds() const override;
+	virtual void getTables(PlanTable& table) const override;
+	virtual void setTables(const PlanTable& table) override;
 	virtual void getStencilInput(const aly::int3& pos,std::vector<aly::int3>& stencil) const =0;
 	virtual void getStencilWeight(const aly::int3& pos,std::vector<aly::int3>& stencil) const =0;
 	virtual bool getStencilBias(const aly::int3& pos,aly::int3& stencil) const =0;
 
 private:
 	size_t param_size() const;
+	int in_count;
+	int out_count;
+	int weight_count;
+	int bias_count;
+	std::vector<std::array<int, 3>> pending_weights; // (weight_id, in_id, out_id)
+	std::vector<std::array<int, 3>> pending_biases;  // (bias_id, 0, out_id)
 protected:
 	void connect_weight(int input_index, int output_index, int weight_index);
 	void connect_bias(int bias_index, int output_index);
-	std::vector<io_connections> weight2io;  // weight_id -> [(in_id, out_id)]
-	std::vector<wi_connections> out2wi;     // out_id -> [(weight_id, in_id)]
-	std::vector<wo_connections> in2wo;      // in_id -> [(weight_id, out_id)]
-	std::vector<std::vector<int>> bias2out;
-	std::vector<size_t> out2bias;
+	// compiles connections added with connect_weight/connect_bias into CSR tables
+	void compile_connections();
+	void sparse_forward(const std::vector<Tensor*>&in_data,
+			std::vector<Tensor*> &out_data, float scale, bool parallel);
+	void sparse_backward(const std::vector<Tensor*> &in_data,
+			std::vector<Tensor*> &out_grad, std::vector<Tensor*> &in_grad,
+			float scale, bool parallel);
+	PackedConnectionTable weight2io;  // weight_id -> [(in_id, out_id)]
+	PackedConnectionTable out2wi;     // out_id -> [(weight_id, in_id)]
+	PackedConnectionTable in2wo;      // in_id -> [(weight_id, out_id)]
+	PackedConnectionTable bias2out;   // bias_id -> [(0, out_id)]
+	std::vector<int> out2bias;
 	float scale_factor;
 };
 typedef std::shared_ptr<PartialConnectedLayer> PartialConnectedLayerPtr;
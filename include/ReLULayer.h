@@ -0,0 +1,62 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef INCLUDE_RELULAYER_H_
+#define INCLUDE_RELULAYER_H_
+
+#include "ActivationLayer.h"
+namespace tgr {
+/**
+ * Rectified linear unit, y = max(x, 0). A non-zero negative slope gives the
+ * leaky variant, y = slope * x for x < 0.
+ */
+class ReLULayer: public ActivationLayer {
+protected:
+	float negativeSlope;
+public:
+	ReLULayer(int in_width, int in_height, int in_channels,
+			float negative_slope = 0.0f) :
+			ActivationLayer("relu", in_width, in_height, in_channels), negativeSlope(
+					negative_slope) {
+	}
+	ReLULayer(int size, float negative_slope = 0.0f) :
+			ActivationLayer("relu", size), negativeSlope(negative_slope) {
+	}
+	float getNegativeSlope() const {
+		return negativeSlope;
+	}
+	virtual void forward_activation(const Storage &x, Storage &y) override;
+
+	virtual void backward_activation(const Storage &x, const Storage &y,
+			Storage &dx, const Storage &dy) override;
+	virtual bool isElementwise() const override {
+		return true;
+	}
+	virtual void forward_elements(const float* x, float* y, size_t n)
+			override;
+	virtual void backward_elements(const float* x, const float* y, float* dx,
+			const float* dy, size_t n) override;
+
+	virtual std::pair<float_t, float_t> scale() const override;
+};
+typedef std::shared_ptr<ReLULayer> ReLULayerPtr;
+}
+
+#endif /* INCLUDE_RELULAYER_H_ */
@@ -50,6 +50,22 @@ public:
 	virtual std::vector<aly::dim3> getOutputDimensions() const override {
 		return out_shapes;
 	}
+	SliceType getSliceType() const {
+		return slice_type;
+	}
+	int getChannelOffset(int index) const;
+	virtual void getStencilInput(const aly::int3& pos,
+			std::vector<aly::int3>& stencil) const override {
+		stencil = std::vector<aly::int3> { pos };
+	}
+	virtual void getStencilWeight(const aly::int3& pos,
+			std::vector<aly::int3>& stencil) const override {
+		stencil.clear();
+	}
+	virtual bool getStencilBias(const aly::int3& pos, aly::int3& stencil) const
+			override {
+		return false;
+	}
 	virtual void forwardPropagation(const std::vector<Tensor *> &in_data,
 			std::vector<Tensor *> &out_data) override;
 	virtual void backwardPropagation(const std::vector<Tensor *> &in_data,
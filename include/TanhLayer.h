@@ -23,6 +23,13 @@ public:
 
 	virtual void backward_activation(const Storage &x, const Storage &y,
 			Storage &dx, const Storage &dy) override;
+	virtual bool isElementwise() const override {
+		return true;
+	}
+	virtual void forward_elements(const float* x, float* y, size_t n)
+			override;
+	virtual void backward_elements(const float* x, const float* y, float* dx,
+			const float* dy, size_t n) override;
 
 	virtual std::pair<float_t, float_t> scale() const override;
 };
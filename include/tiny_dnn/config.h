@@ -10,11 +10,6 @@
 #include <cstddef>
 #include <cstdint>
 
-/**
- * define if you want to use intel TBB library
- */
-// #define CNN_USE_TBB
-
 /**
  * define to enable avx vectorization
  */
@@ -25,16 +20,6 @@
  */
 // #define CNN_USE_SSE
 
-/**
- * define to enable OMP parallelization
- */
-// #define CNN_USE_OMP
-
-/**
- * define to enable Grand Central Dispatch parallelization
- */
-//#define CNN_USE_GCD
-
 /**
  * define to use exceptions
  */
@@ -73,11 +58,7 @@
  * number of task in batch-gradient-descent.
  * @todo automatic optimization
  */
-#ifdef CNN_USE_OMP
-#define CNN_TASK_SIZE 100
-#else
 #define CNN_TASK_SIZE 8
-#endif
 
 namespace tiny_dnn {
 
@@ -900,7 +900,10 @@ inline void conv2d_grad_op_avx(const tensor_t &prev_out,
                                const core::conv_params &params,
                                const bool layer_parallelize) {
 #ifdef CNN_USE_AVX
-  if (params.weight.height == 5 && params.weight.width == 5) {
+  // the 5x5 backward kernel expects a materialized padded input, implicit
+  // padding is handled by the internal kernel
+  if (params.weight.height == 5 && params.weight.width == 5 &&
+      !params.implicit_padding()) {
     avx_conv2d_5x5_back_kernel(params, prev_out, W, dW, db, curr_delta,
                                prev_delta, layer_parallelize);
     return;
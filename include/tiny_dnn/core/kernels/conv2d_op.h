@@ -37,7 +37,8 @@ class Conv2dOp : public core::OpKernel {
 
     const core::backend_t engine = context.engine();
 
-    if (engine == core::backend_t::internal) {
+    if (engine == core::backend_t::internal ||
+        (engine == core::backend_t::nnpack && params.implicit_padding())) {
       kernels::conv2d_op_internal(in_data, W[0], bias[0], out_data, params,
                                   context.parallelize());
     } else if (engine == core::backend_t::nnpack) {
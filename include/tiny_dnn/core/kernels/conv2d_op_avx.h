@@ -46,8 +46,18 @@ void avx_conv2d_5x5_kernel(const core::conv_params &params,
   // static const __m256 mask = _mm256_castsi256_ps(_mm256_setr_epi32(-1, -1,
   // -1, -1, -1, 0, 0, 0));
 
+  // output rectangle whose 5x5 windows lie inside the input, everything else
+  // is a border pixel when the padding is not materialized
+  const int pl = params.pad_left();
+  const int pt = params.pad_top();
+  int x0, x1, y0, y1;
+  core::conv_interior_range(5, w_stride, pl, out.width, in_padded.width, x0,
+                            x1);
+  core::conv_interior_range(5, params.h_stride, pt, out.height,
+                            in_padded.height, y0, y1);
+
   const __m128 y_bias_scale = _mm_set_ss(bias_scale);
-  if (out.height == 1 && out.width == 1) {
+  if (out.height == 1 && out.width == 1 && !params.implicit_padding()) {
     const float *pw = (const float *)&W[0];
     for (serial_size_t o = 0; o < out.depth; ++o) {
       __m256 sum0     = _mm256_setzero_ps();
@@ -84,7 +94,8 @@ void avx_conv2d_5x5_kernel(const core::conv_params &params,
       _mm_store_ss(&a[o], _mm_add_ss(hsum, b));
     }
   } else {
-    const serial_size_t nblocks = out.width / 4;
+    const serial_size_t iwidth  = std::max(x1 - x0, 0);
+    const serial_size_t nblocks = iwidth / 4;
     for (serial_size_t o = 0; o < out.depth; ++o, oidx += out_area) {
       float *pa = &a[oidx];
       // init to bias value
@@ -135,11 +146,16 @@ void avx_conv2d_5x5_kernel(const core::conv_params &params,
         __m256 w2d = leftShift<12>(w2a);
         __m256 w3d = leftShift<12>(w3a);
         __m256 w4d = leftShift<12>(w4a);
-        float *ppa = pa;
+        const int hs     = static_cast<int>(params.h_stride);
+        const int ws     = static_cast<int>(w_stride);
+        const float *pib = pi + (y0 * hs - pt) *
+                                  static_cast<int>(in_padded.width) +
+                           x0 * ws - pl;
+        float *ppa = pa + y0 * out.width + x0;
         if (w_stride == 1) {
           if (nblocks) {
-            for (serial_size_t y = 0; y < out.height; ++y, ppa += out.width) {
-              const float *pi0 = (pi + y * stride);
+            for (int y = y0; y < y1; ++y, ppa += out.width) {
+              const float *pi0 = (pib + (y - y0) * stride);
               const float *pi1 = pi0 + 1 * in_padded.width;
               const float *pi2 = pi0 + 2 * in_padded.width;
               const float *pi3 = pi0 + 3 * in_padded.width;
@@ -205,7 +221,7 @@ void avx_conv2d_5x5_kernel(const core::conv_params &params,
                 sum      = _mm_add_ps(sum, hsum0123);
                 _mm_storeu_ps(ppa + i * 4, sum);
               }
-              for (serial_size_t x = nblocks * 4; x < out.width; ++x) {
+              for (serial_size_t x = nblocks * 4; x < iwidth; ++x) {
                 sum         = _mm_load_ss(&ppa[x]);
                 i0          = _mm256_loadu_ps(pi0 + x);
                 i1          = _mm256_loadu_ps(pi1 + x);
@@ -222,13 +238,13 @@ void avx_conv2d_5x5_kernel(const core::conv_params &params,
               }     // x loop
             }       // y loop
           } else {  // if (nblocks) {
-            for (serial_size_t y = 0; y < out.height; ++y, ppa += out.width) {
-              const float *pi0 = (pi + y * stride);
+            for (int y = y0; y < y1; ++y, ppa += out.width) {
+              const float *pi0 = (pib + (y - y0) * stride);
               const float *pi1 = pi0 + 1 * in_padded.width;
               const float *pi2 = pi0 + 2 * in_padded.width;
               const float *pi3 = pi0 + 3 * in_padded.width;
               const float *pi4 = pi0 + 4 * in_padded.width;
-              for (serial_size_t x = 0; x < out.width; ++x) {
+              for (serial_size_t x = 0; x < iwidth; ++x) {
                 __m128 sum  = _mm_load_ss(&ppa[x]);
                 __m256 i0   = _mm256_loadu_ps(pi0 + x);
                 __m256 i1   = _mm256_loadu_ps(pi1 + x);
@@ -246,13 +262,13 @@ void avx_conv2d_5x5_kernel(const core::conv_params &params,
             }    // y loop
           }
         } else {  // if (w_stride == 1) {
-          for (serial_size_t y = 0; y < out.height; ++y, ppa += out.width) {
-            const float *pi0 = (pi + y * stride);
+          for (int y = y0; y < y1; ++y, ppa += out.width) {
+            const float *pi0 = (pib + (y - y0) * stride);
             const float *pi1 = pi0 + 1 * in_padded.width;
             const float *pi2 = pi0 + 2 * in_padded.width;
             const float *pi3 = pi0 + 3 * in_padded.width;
             const float *pi4 = pi0 + 4 * in_padded.width;
-            for (serial_size_t x = 0; x < out.width; ++x) {
+            for (serial_size_t x = 0; x < iwidth; ++x) {
               __m128 sum  = _mm_load_ss(&ppa[x]);
               __m256 i0   = _mm256_loadu_ps(pi0);
               __m256 i1   = _mm256_loadu_ps(pi1);
@@ -274,6 +290,9 @@ void avx_conv2d_5x5_kernel(const core::conv_params &params,
             }  // x loop
           }    // y loop
         }
+        if (params.implicit_padding()) {
+          conv2d_border_accumulate(params, pi, pw, pa, x0, x1, y0, y1);
+        }
       }  // in depth loop
     }    // out depth loop
   }      // else
@@ -455,7 +474,9 @@ inline void conv2d_op_avx(const tensor_t &in_data,
                           const core::conv_params &params,
                           const bool layer_parallelize) {
 #ifdef CNN_USE_AVX
-  if (params.weight.height == 5 && params.weight.width == 5) {
+  // the double kernel still expects a materialized padded input
+  if (params.weight.height == 5 && params.weight.width == 5 &&
+      (std::is_same<float_t, float>::value || !params.implicit_padding())) {
     // @todo consider better parallelization
     for_i(layer_parallelize, in_data.size(), [&](size_t i) {
       avx_conv2d_5x5_kernel(params, in_data[i], W, bias, out_data[i],
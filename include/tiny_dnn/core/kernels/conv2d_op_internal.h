@@ -10,65 +10,162 @@
 namespace tiny_dnn {
 namespace kernels {
 
+/* Adds the contribution of one input channel to the output pixels outside of
+ * the interior rectangle [x0, x1) x [y0, y1). Taps that fall outside the input
+ * are skipped, which is equivalent to reading zero padding.
+ *
+ * @param pin  first element of the input channel (in_padded layout)
+ * @param pw   kernel weights for (out channel, in channel)
+ * @param pa   first element of the output channel
+ */
+inline void conv2d_border_accumulate(const core::conv_params &params,
+                                     const float_t *pin,
+                                     const float_t *pw,
+                                     float_t *pa,
+                                     int x0,
+                                     int x1,
+                                     int y0,
+                                     int y1) {
+  const int iw = params.in_padded.width;
+  const int ih = params.in_padded.height;
+  const int ow = params.out.width;
+  const int oh = params.out.height;
+  const int kw = params.weight.width;
+  const int kh = params.weight.height;
+  const int pl = params.pad_left();
+  const int pt = params.pad_top();
+  for (int y = 0; y < oh; y++) {
+    const int iy  = y * static_cast<int>(params.h_stride) - pt;
+    const int wy0 = std::max(0, -iy);
+    const int wy1 = std::min(kh, ih - iy);
+    const bool interior_row = (y >= y0 && y < y1);
+    for (int x = 0; x < ow; x++) {
+      if (interior_row && x >= x0 && x < x1) {
+        x = x1 - 1;
+        continue;
+      }
+      const int ix  = x * static_cast<int>(params.w_stride) - pl;
+      const int wx0 = std::max(0, -ix);
+      const int wx1 = std::min(kw, iw - ix);
+      float_t sum{0};
+      for (int wy = wy0; wy < wy1; wy++) {
+        const float_t *prow = pin + (iy + wy) * iw + ix;
+        const float_t *pwrow = pw + wy * kw;
+        for (int wx = wx0; wx < wx1; wx++) {
+          sum += pwrow[wx] * prow[wx];
+        }
+      }
+      pa[y * ow + x] += sum;
+    }
+  }
+}
+
+/* Backward counterpart of conv2d_border_accumulate. Scatters the deltas of
+ * the output pixels outside of [x0, x1) x [y0, y1) back into one input
+ * channel, skipping taps that fall into the padding.
+ *
+ * @param pdelta_src first element of the output channel delta
+ * @param pw         kernel weights for (out channel, in channel)
+ * @param pdelta_dst first element of the input channel delta (in_padded layout)
+ */
+inline void conv2d_border_scatter(const core::conv_params &params,
+                                  const float_t *pdelta_src,
+                                  const float_t *pw,
+                                  float_t *pdelta_dst,
+                                  int x0,
+                                  int x1,
+                                  int y0,
+                                  int y1) {
+  const int iw = params.in_padded.width;
+  const int ih = params.in_padded.height;
+  const int ow = params.out.width;
+  const int oh = params.out.height;
+  const int kw = params.weight.width;
+  const int kh = params.weight.height;
+  const int pl = params.pad_left();
+  const int pt = params.pad_top();
+  for (int y = 0; y < oh; y++) {
+    const int iy  = y * static_cast<int>(params.h_stride) - pt;
+    const int wy0 = std::max(0, -iy);
+    const int wy1 = std::min(kh, ih - iy);
+    const bool interior_row = (y >= y0 && y < y1);
+    for (int x = 0; x < ow; x++) {
+      if (interior_row && x >= x0 && x < x1) {
+        x = x1 - 1;
+        continue;
+      }
+      const int ix  = x * static_cast<int>(params.w_stride) - pl;
+      const int wx0 = std::max(0, -ix);
+      const int wx1 = std::min(kw, iw - ix);
+      const float_t v = pdelta_src[y * ow + x];
+      for (int wy = wy0; wy < wy1; wy++) {
+        float_t *prow        = pdelta_dst + (iy + wy) * iw + ix;
+        const float_t *pwrow = pw + wy * kw;
+        for (int wx = wx0; wx < wx1; wx++) {
+          prow[wx] += pwrow[wx] * v;
+        }
+      }
+    }
+  }
+}
+
 inline void conv2d_op_internal(const tensor_t &in_data,
                                const vec_t &W,
                                const vec_t &bias,
                                tensor_t &out_data,
                                const core::conv_params &params,
                                const bool parallelize) {
-  for_(parallelize, 0, in_data.size(),
-       [&](const blocked_range &r) {
-         size_t out_area           = params.out.area();
-         serial_size_t iw          = params.in_padded.width;
-         serial_size_t id          = params.in.depth;
-         serial_size_t ow          = params.out.width;
-         serial_size_t oh          = params.out.height;
-         serial_size_t od          = params.out.depth;
-         serial_size_t kw          = params.weight.width;
-         serial_size_t kh          = params.weight.height;
-         serial_size_t elem_stride = params.w_stride;
-         serial_size_t line_stride = iw * params.h_stride;
-         for (size_t sample = r.begin(); sample < r.end(); sample++) {
-           const vec_t &in = in_data[sample];
-           vec_t &a        = out_data[sample];
-           for (serial_size_t o = 0; o < od; o++) {
-             float_t *pa = &a[params.out.get_index(0, 0, o)];
-             for (serial_size_t inc = 0; inc < id; inc++) {
-               if (!params.tbl.isConnected(o, inc)) continue;
-               serial_size_t idx;
-               idx                = params.weight.get_index(0, 0, id * o + inc);
-               const float_t *pw  = &W[idx];
-               idx                = params.in_padded.get_index(0, 0, inc);
-               const float_t *pin = &in[idx];
-               float_t *pout      = pa;
-               for (serial_size_t y = 0; y < oh; y++) {
-                 const float_t *pin_line = pin;
-                 for (serial_size_t x = 0; x < ow; x++) {
-                   const float_t *pin_element = pin_line;
-                   const float_t *pw_element  = pw;
-                   float_t sum{0};
-                   // should be optimized for small kernel(3x3,5x5)
-                   for (serial_size_t wy = 0; wy < kh; wy++) {    // NOLINT
-                     for (serial_size_t wx = 0; wx < kw; wx++) {  // NOLINT
-                       sum += pw_element[wx] * pin_element[wx];
-                     }
-                     pw_element += kw;
-                     pin_element += iw;
-                   }
-                   pout[x] += sum;
-                   pin_line += elem_stride;
-                 }
-                 pout += ow;
-                 pin += line_stride;
-               }
-             }
-             if (params.has_bias) {
-               vectorize::add(bias[o], out_area, pa);
-             }
-           }
-         }
-       },
-       0);
+  size_t out_area           = params.out.area();
+  serial_size_t iw          = params.in_padded.width;
+  serial_size_t id          = params.in.depth;
+  serial_size_t ow          = params.out.width;
+  serial_size_t od          = params.out.depth;
+  serial_size_t kw          = params.weight.width;
+  serial_size_t kh          = params.weight.height;
+  serial_size_t elem_stride = params.w_stride;
+  serial_size_t line_stride = iw * params.h_stride;
+  const int pl              = params.pad_left();
+  const int pt              = params.pad_top();
+  const tgr::KernelTable &kernels = tgr::NeuralKernels::get();
+  // outputs whose window lies fully inside the input, the rest is
+  // handled by conv2d_border_accumulate
+  int x0, x1, y0, y1;
+  core::conv_interior_range(kw, params.w_stride, pl, ow,
+                            params.in_padded.width, x0, x1);
+  core::conv_interior_range(kh, params.h_stride, pt, params.out.height,
+                            params.in_padded.height, y0, y1);
+  // small batches are split by output channel
+  for_sample_blocks(
+    parallelize, in_data.size(), od, 1,
+    [&](size_t sample, size_t o_begin, size_t o_end) {
+      const vec_t &in = in_data[sample];
+      vec_t &a        = out_data[sample];
+      for (serial_size_t o = o_begin; o < o_end; o++) {
+        float_t *pa = &a[params.out.get_index(0, 0, o)];
+        for (serial_size_t inc = 0; inc < id; inc++) {
+          if (!params.tbl.isConnected(o, inc)) continue;
+          serial_size_t idx;
+          idx                = params.weight.get_index(0, 0, id * o + inc);
+          const float_t *pw  = &W[idx];
+          idx                = params.in_padded.get_index(0, 0, inc);
+          const float_t *pin = &in[idx];
+          if (x0 < x1 && y0 < y1) {
+            const float_t *pin_row =
+              pin +
+              (y0 * static_cast<int>(params.h_stride) - pt) *
+                static_cast<int>(iw) +
+              x0 * static_cast<int>(elem_stride) - pl;
+            kernels.convolve(pin_row, pw, pa + y0 * ow + x0, x1 - x0, y1 - y0,
+                             kw, kh, iw, ow, elem_stride, line_stride);
+          }
+          conv2d_border_accumulate(params, pin, pw, pa, x0, x1, y0, y1);
+        }
+        if (params.has_bias) {
+          vectorize::add(bias[o], out_area, pa);
+        }
+      }
+    },
+    0);
 }
 
 /******************************************************************/
@@ -84,6 +181,21 @@ void conv2d_op_internal(const tensor_t &prev_out,
                         const bool parallelize) {
   typedef typename vec_t::value_type float_t;
 
+  const int iw = params.in_padded.width;
+  const int ih = params.in_padded.height;
+  const int ow = params.out.width;
+  const int oh = params.out.height;
+  const int kw = params.weight.width;
+  const int kh = params.weight.height;
+  const int ws = params.w_stride;
+  const int hs = params.h_stride;
+  const int pl = params.pad_left();
+  const int pt = params.pad_top();
+  // output positions whose window lies fully inside the input
+  int ix0, ix1, iy0, iy1;
+  core::conv_interior_range(kw, ws, pl, ow, iw, ix0, ix1);
+  core::conv_interior_range(kh, hs, pt, oh, ih, iy0, iy1);
+
   for_i(parallelize, prev_out.size(), [&](int sample) {
     // propagate delta to previous layer
     for (serial_size_t inc = 0; inc < params.in.depth; inc++) {
@@ -99,30 +211,26 @@ void conv2d_op_internal(const tensor_t &prev_out,
         const float_t *pdelta_src = &curr_delta[sample][idx];
 
         idx = params.in_padded.get_index(0, 0, inc);
-        // float_t* pdelta_dst = &(*prev_delta)[sample][idx];
         float_t *pdelta_dst = &prev_delta[sample][idx];
 
-        for (serial_size_t y = 0; y < params.out.height; y++) {
-          for (serial_size_t x = 0; x < params.out.width; x++) {
-            const float_t *ppw = pw;
-
-            idx                       = y * params.out.width + x;
-            const float_t ppdelta_src = pdelta_src[idx];
-
-            float_t *ppdelta_dst =
-              pdelta_dst + y * params.h_stride * params.in_padded.width +
-              x * params.w_stride;
-
-            for (serial_size_t wy = 0; wy < params.weight.height;
-                 wy++) {  // NOLINT
-              for (serial_size_t wx = 0; wx < params.weight.width;
-                   wx++) {  // NOLINT
-                idx = wy * params.in_padded.width + wx;
-                ppdelta_dst[idx] += *ppw++ * ppdelta_src;
+        // full windows first, then the clipped border
+        for (int y = iy0; y < iy1; y++) {
+          const float_t *psrc = pdelta_src + y * ow;
+          const int base      = (y * hs - pt) * iw - pl;
+          for (int x = ix0; x < ix1; x++) {
+            const float_t ppdelta_src = psrc[x];
+            float_t *ppdelta_dst      = pdelta_dst + base + x * ws;
+            for (int wy = 0; wy < kh; wy++) {  // NOLINT
+              float_t *prow      = ppdelta_dst + wy * iw;
+              const float_t *ppw = pw + wy * kw;
+              for (int wx = 0; wx < kw; wx++) {  // NOLINT
+                prow[wx] += ppw[wx] * ppdelta_src;
               }
             }
           }
         }
+        conv2d_border_scatter(params, pdelta_src, pw, pdelta_dst, ix0, ix1,
+                              iy0, iy1);
       }
     }
 
@@ -131,33 +239,31 @@ void conv2d_op_internal(const tensor_t &prev_out,
       for (serial_size_t outc = 0; outc < params.out.depth; outc++) {
         if (!params.tbl.isConnected(outc, inc)) continue;
 
-        for (serial_size_t wy = 0; wy < params.weight.height; wy++) {
-          for (serial_size_t wx = 0; wx < params.weight.width; wx++) {
+        for (int wy = 0; wy < kh; wy++) {
+          // output rows/columns for which this tap reads inside the input
+          int y0, y1;
+          core::conv_tap_range(wy, hs, pt, oh, ih, y0, y1);
+          for (int wx = 0; wx < kw; wx++) {
+            int x0, x1;
+            core::conv_tap_range(wx, ws, pl, ow, iw, x0, x1);
             float_t dst{0};
 
-            serial_size_t idx    = 0;
-            idx                  = params.in_padded.get_index(wx, wy, inc);
+            serial_size_t idx    = params.in_padded.get_index(0, 0, inc);
             const float_t *prevo = &prev_out[sample][idx];
 
             idx                  = params.out.get_index(0, 0, outc);
             const float_t *delta = &curr_delta[sample][idx];
 
-            if (params.w_stride > 1) {
-              for (serial_size_t y = 0; y < params.out.height; y++) {
-                serial_size_t prevo_idx =
-                  y * params.in_padded.width * params.h_stride;
-                serial_size_t delta_idx = y * params.out.width;
-
-                for (serial_size_t x = 0; x < params.out.width; x++) {
-                  dst += prevo[prevo_idx + x * params.w_stride] *
-                         delta[delta_idx + x];
+            for (int y = y0; y < y1; y++) {
+              const int base           = (y * hs + wy - pt) * iw + wx - pl;
+              const float_t *delta_row = delta + y * ow;
+              if (ws > 1) {
+                for (int x = x0; x < x1; x++) {
+                  dst += prevo[base + x * ws] * delta_row[x];
                 }
-              }
-            } else {
-              for (serial_size_t y = 0; y < params.out.height; y++) {
-                dst += vectorize::dot(
-                  prevo + y * params.in_padded.width * params.h_stride,
-                  delta + y * params.out.width, params.out.width);
+              } else if (x1 > x0) {
+                dst += vectorize::dot(prevo + base + x0, delta_row + x0,
+                                      x1 - x0);
               }
             }
 
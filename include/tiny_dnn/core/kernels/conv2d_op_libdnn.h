@@ -198,7 +198,10 @@ class Conv2dLibDNNForwardOp : public core::OpKernel {
 
     std::vector<int32_t> kernel = {params.weight.height, params.weight.width};
 
-    std::vector<int32_t> pad = {dy / 2, dx / 2};
+    // libdnn pads on the fly, so implicit padding maps onto the same config
+    std::vector<int32_t> pad = {
+      static_cast<int32_t>(dy / 2 + params.pad_top()),
+      static_cast<int32_t>(dx / 2 + params.pad_left())};
 
     std::vector<int32_t> stride = {params.h_stride, params.w_stride};
 
@@ -18,21 +18,26 @@ inline void fully_connected_op_internal(const tensor_t &in_data,
                                         tensor_t &out_data,
                                         const fully_params &params,
                                         const bool layer_parallelize) {
-  for_i(layer_parallelize, in_data.size(), [&](int sample) {
-    const vec_t &in = in_data[sample];
-    vec_t &out      = out_data[sample];
-
-    for (serial_size_t i = 0; i < params.out_size; i++) {
-      out[i] = float_t{0};
-      for (serial_size_t c = 0; c < params.in_size; c++) {
-        out[i] += W[c * params.out_size + i] * in[c];
-      }
-
+  // out = bias + sum_c in[c] * W[c][:], one contiguous row of W per input.
+  // Small batches are split into column blocks of W, each block keeping
+  // about element_block_size multiply-adds.
+  const size_t min_block =
+    std::max(size_t(16), element_block_size / std::max(params.in_size, 1u));
+  for_sample_blocks(
+    layer_parallelize, in_data.size(), params.out_size, min_block,
+    [&](size_t sample, size_t begin, size_t end) {
+      const vec_t &in = in_data[sample];
+      float_t *out    = &out_data[sample][begin];
+      const size_t n  = end - begin;
       if (params.has_bias) {
-        out[i] += bias[i];
+        std::copy(&bias[begin], &bias[begin] + n, out);
+      } else {
+        std::fill(out, out + n, float_t{0});
       }
-    }
-  });
+      for (serial_size_t c = 0; c < params.in_size; c++) {
+        vectorize::muladd(&W[c * params.out_size + begin], in[c], n, out);
+      }
+    });
 }
 
 inline void fully_connected_op_internal(const tensor_t &prev_out,
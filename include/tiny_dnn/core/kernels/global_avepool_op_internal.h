@@ -15,12 +15,15 @@ inline void global_avepool_op_internal(
   tensor_t &out_data,
   const core::global_avepool_params &params,
   const bool layer_parallelize) {
-  for_i(layer_parallelize, in_data.size(), [&](int sample) {
+  const size_t pool_area = params.in.width * params.in.height;
+  for_sample_blocks(
+    layer_parallelize, in_data.size(), params.in.depth,
+    element_block_size / std::max(pool_area, size_t(1)),
+    [&](size_t sample, size_t begin, size_t end) {
     const vec_t &in = in_data[sample];
     vec_t &out      = out_data[sample];
 
-    const size_t pool_area = params.in.width * params.in.height;
-    for (size_t i = 0; i < params.in.depth; i++) {
+    for (size_t i = begin; i < end; i++) {
       for (size_t j = 0; j < pool_area; j++) {
         out[i] += in[i * pool_area + j];
       }
@@ -16,12 +16,14 @@ inline void maxpool_op_internal(
   std::vector<std::vector<serial_size_t>> &max_idx,
   const std::vector<std::vector<serial_size_t>> &out2in,
   const bool layer_parallelize) {
-  for_i(layer_parallelize, in_data.size(), [&](int sample) {
+  for_sample_blocks(
+    layer_parallelize, in_data.size(), out2in.size(),
+    element_block_size / 4, [&](size_t sample, size_t begin, size_t end) {
     const vec_t &in                 = in_data[sample];
     vec_t &out                      = out_data[sample];
     std::vector<serial_size_t> &max = max_idx[sample];
 
-    for (serial_size_t i = 0; i < out2in.size(); i++) {
+    for (size_t i = begin; i < end; i++) {
       const auto &in_index = out2in[i];
       float_t max_value    = std::numeric_limits<float_t>::lowest();
       serial_size_t idx    = 0;
@@ -7,6 +7,7 @@
 */
 #pragma once
 
+#include "tiny_dnn/core/params/conv_params.h"
 #include "tiny_dnn/core/params/deconv_params.h"
 
 namespace tiny_dnn {
@@ -98,6 +99,163 @@ inline void tiny_deconv2d_back_kernel(const deconv_params &params,
   });
 }
 
+/* Backward pass of tiny_deconv2d_unpadded_kernel. curr_delta is in the
+ * out_unpadded layout; taps that fall into the cropped border contribute
+ * nothing.
+ */
+/* Backward counterpart of deconv2d_border_scatter. Gathers the delta of the
+ * input pixels outside of [x0, x1) x [y0, y1) of one input channel from the
+ * out_unpadded layout, skipping taps that fall into the cropped border.
+ *
+ * @param pdelta_src first element of the output channel delta (out_unpadded)
+ * @param pw         kernel weights for (out channel, in channel)
+ * @param pdelta_dst first element of the input channel delta
+ */
+inline void deconv2d_border_gather(const deconv_params &params,
+                                   const float_t *pdelta_src,
+                                   const float_t *pw,
+                                   float_t *pdelta_dst,
+                                   int x0,
+                                   int x1,
+                                   int y0,
+                                   int y1) {
+  const int iw = params.in.width;
+  const int ih = params.in.height;
+  const int ow = params.out_unpadded.width;
+  const int oh = params.out_unpadded.height;
+  const int kw = params.weight.width;
+  const int kh = params.weight.height;
+  const int pl = params.crop_left();
+  const int pt = params.crop_top();
+  for (int y = 0; y < ih; y++) {
+    const int oy  = y * static_cast<int>(params.h_stride) - pt;
+    const int wy0 = std::max(0, -oy);
+    const int wy1 = std::min(kh, oh - oy);
+    const bool interior_row = (y >= y0 && y < y1);
+    for (int x = 0; x < iw; x++) {
+      if (interior_row && x >= x0 && x < x1) {
+        x = x1 - 1;
+        continue;
+      }
+      const int ox  = x * static_cast<int>(params.w_stride) - pl;
+      const int wx0 = std::max(0, -ox);
+      const int wx1 = std::min(kw, ow - ox);
+      float_t sum{0};
+      for (int wy = wy0; wy < wy1; wy++) {
+        const float_t *prow  = pdelta_src + (oy + wy) * ow + ox;
+        const float_t *pwrow = pw + wy * kw;
+        for (int wx = wx0; wx < wx1; wx++) {
+          sum += pwrow[wx] * prow[wx];
+        }
+      }
+      pdelta_dst[y * iw + x] += sum;
+    }
+  }
+}
+
+inline void tiny_deconv2d_unpadded_back_kernel(const deconv_params &params,
+                                               const tensor_t &prev_out,
+                                               const vec_t &W,
+                                               tensor_t &dW,
+                                               tensor_t &db,
+                                               const tensor_t &curr_delta,
+                                               tensor_t *prev_delta,
+                                               const bool layer_parallelize) {
+  const int iw = params.in.width;
+  const int ih = params.in.height;
+  const int ow = params.out_unpadded.width;
+  const int oh = params.out_unpadded.height;
+  const int kw = params.weight.width;
+  const int kh = params.weight.height;
+  const int ws = params.w_stride;
+  const int hs = params.h_stride;
+  const int pl = params.crop_left();
+  const int pt = params.crop_top();
+  // input pixels whose taps all land inside out_unpadded
+  int ix0, ix1, iy0, iy1;
+  conv_interior_range(kw, ws, pl, iw, ow, ix0, ix1);
+  conv_interior_range(kh, hs, pt, ih, oh, iy0, iy1);
+  for_i(layer_parallelize, prev_out.size(), [&](int sample) {
+    for (serial_size_t inc = 0; inc < params.in.depth; inc++) {
+      for (serial_size_t outc = 0; outc < params.out.depth; outc++) {
+        if (!params.tbl.isConnected(outc, inc)) continue;
+
+        serial_size_t idx = 0;
+        idx               = params.in.depth * outc + inc;
+        idx               = params.weight.get_index(0, 0, idx);
+        const float_t *pw = &W[idx];
+
+        idx = params.out_unpadded.get_index(0, 0, outc);
+        const float_t *pdelta_src = &curr_delta[sample][idx];
+
+        idx                 = params.in.get_index(0, 0, inc);
+        float_t *pdelta_dst = &(*prev_delta)[sample][idx];
+
+        for (int y = iy0; y < iy1; y++) {
+          const int base = (y * hs - pt) * ow - pl;
+          float_t *pdst  = pdelta_dst + y * iw;
+          for (int x = ix0; x < ix1; x++) {
+            const float_t *psrc = pdelta_src + base + x * ws;
+            float_t sum{0};
+            for (int wy = 0; wy < kh; wy++) {
+              const float_t *prow  = psrc + wy * ow;
+              const float_t *pwrow = pw + wy * kw;
+              for (int wx = 0; wx < kw; wx++) {
+                sum += pwrow[wx] * prow[wx];
+              }
+            }
+            pdst[x] += sum;
+          }
+        }
+        deconv2d_border_gather(params, pdelta_src, pw, pdelta_dst, ix0, ix1,
+                               iy0, iy1);
+      }
+    }
+
+    for (serial_size_t inc = 0; inc < params.in.depth; inc++) {
+      for (serial_size_t outc = 0; outc < params.out.depth; outc++) {
+        if (!params.tbl.isConnected(outc, inc)) continue;
+        const float_t *prevo = &prev_out[sample][params.in.get_index(0, 0, inc)];
+        const float_t *delta =
+          &curr_delta[sample][params.out_unpadded.get_index(0, 0, outc)];
+        for (int wy = 0; wy < kh; wy++) {
+          // input rows/columns whose tap lands inside out_unpadded
+          int y0, y1;
+          conv_tap_range(wy, hs, pt, ih, oh, y0, y1);
+          for (int wx = 0; wx < kw; wx++) {
+            int x0, x1;
+            conv_tap_range(wx, ws, pl, iw, ow, x0, x1);
+            float_t dst{0};
+            for (int y = y0; y < y1; y++) {
+              const float_t *prevo_row = prevo + y * iw;
+              const int base           = (y * hs + wy - pt) * ow + wx - pl;
+              if (ws > 1) {
+                for (int x = x0; x < x1; x++) {
+                  dst += prevo_row[x] * delta[base + x * ws];
+                }
+              } else if (x1 > x0) {
+                dst += vectorize::dot(prevo_row + x0, delta + base + x0,
+                                      x1 - x0);
+              }
+            }
+            serial_size_t idx = params.in.depth * outc + inc;
+            dW[sample][params.weight.get_index(wx, wy, idx)] += dst;
+          }
+        }
+      }
+    }
+
+    if (params.has_bias) {
+      for (serial_size_t outc = 0; outc < params.out.depth; outc++) {
+        serial_size_t idx    = params.out_unpadded.get_index(0, 0, outc);
+        const float_t *delta = &curr_delta[sample][idx];
+        const float_t *deltaa = delta + params.out_unpadded.area();
+        db[sample][outc] += std::accumulate(delta, deltaa, float_t{0});
+      }
+    }
+  });
+}
+
 }  // namespace kernels
 }  // namespace core
 }  // namespace tiny_dnn
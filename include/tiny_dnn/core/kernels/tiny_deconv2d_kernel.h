@@ -7,6 +7,7 @@
 */
 #pragma once
 
+#include "tiny_dnn/core/params/conv_params.h"
 #include "tiny_dnn/core/params/deconv_params.h"
 
 namespace tiny_dnn {
@@ -65,6 +66,119 @@ inline void tiny_deconv2d_kernel(const deconv_params &params,
   });
 }
 
+/* Scatters the input pixels outside of [x0, x1) x [y0, y1) of one input
+ * channel into the out_unpadded layout. Taps that fall into the cropped
+ * border are skipped.
+ *
+ * @param pi   first element of the input channel
+ * @param pw   kernel weights for (out channel, in channel)
+ * @param pout first element of the output channel (out_unpadded layout)
+ */
+inline void deconv2d_border_scatter(const deconv_params &params,
+                                    const float_t *pi,
+                                    const float_t *pw,
+                                    float_t *pout,
+                                    int x0,
+                                    int x1,
+                                    int y0,
+                                    int y1) {
+  const int iw = params.in.width;
+  const int ih = params.in.height;
+  const int ow = params.out_unpadded.width;
+  const int oh = params.out_unpadded.height;
+  const int kw = params.weight.width;
+  const int kh = params.weight.height;
+  const int pl = params.crop_left();
+  const int pt = params.crop_top();
+  for (int y = 0; y < ih; y++) {
+    const int oy  = y * static_cast<int>(params.h_stride) - pt;
+    const int wy0 = std::max(0, -oy);
+    const int wy1 = std::min(kh, oh - oy);
+    const bool interior_row = (y >= y0 && y < y1);
+    for (int x = 0; x < iw; x++) {
+      if (interior_row && x >= x0 && x < x1) {
+        x = x1 - 1;
+        continue;
+      }
+      const int ox  = x * static_cast<int>(params.w_stride) - pl;
+      const int wx0 = std::max(0, -ox);
+      const int wx1 = std::min(kw, ow - ox);
+      const float_t v = pi[y * iw + x];
+      for (int wy = wy0; wy < wy1; wy++) {
+        float_t *prow        = pout + (oy + wy) * ow + ox;
+        const float_t *pwrow = pw + wy * kw;
+        for (int wx = wx0; wx < wx1; wx++) {
+          prow[wx] += pwrow[wx] * v;
+        }
+      }
+    }
+  }
+}
+
+/* Same as tiny_deconv2d_kernel, but writes straight into the out_unpadded
+ * layout. Taps that fall into the cropped border are skipped, so no padded
+ * output buffer is needed.
+ */
+inline void tiny_deconv2d_unpadded_kernel(const deconv_params &params,
+                                          const tensor_t &in,
+                                          const vec_t &W,
+                                          const vec_t &bias,
+                                          tensor_t &out,
+                                          const bool layer_parallelize) {
+  const int iw = params.in.width;
+  const int ih = params.in.height;
+  const int ow = params.out_unpadded.width;
+  const int oh = params.out_unpadded.height;
+  const int kw = params.weight.width;
+  const int kh = params.weight.height;
+  const int ws = params.w_stride;
+  const int hs = params.h_stride;
+  const int pl = params.crop_left();
+  const int pt = params.crop_top();
+  // input pixels whose taps all land inside out_unpadded
+  int x0, x1, y0, y1;
+  conv_interior_range(kw, ws, pl, iw, ow, x0, x1);
+  conv_interior_range(kh, hs, pt, ih, oh, y0, y1);
+  // small batches are split by output channel
+  for_sample_blocks(
+    layer_parallelize, in.size(), params.out.depth, 1,
+    [&](size_t sample, size_t o_begin, size_t o_end) {
+    for (serial_size_t o = o_begin; o < o_end; o++) {
+      float_t *pout = &out[sample][params.out_unpadded.get_index(0, 0, o)];
+      for (serial_size_t inc = 0; inc < params.in.depth; inc++) {
+        if (!params.tbl.isConnected(o, inc)) continue;
+
+        serial_size_t idx = 0;
+        idx               = params.in.depth * o + inc;
+        idx               = params.weight.get_index(0, 0, idx);
+        const float_t *pw = &W[idx];
+        const float_t *pi = &in[sample][params.in.get_index(0, 0, inc)];
+
+        for (int y = y0; y < y1; y++) {
+          const float_t *prow_in = pi + y * iw;
+          const int base         = (y * hs - pt) * ow - pl;
+          for (int x = x0; x < x1; x++) {
+            const float_t v = prow_in[x];
+            float_t *ppout  = pout + base + x * ws;
+            for (int wy = 0; wy < kh; wy++) {
+              float_t *prow        = ppout + wy * ow;
+              const float_t *pwrow = pw + wy * kw;
+              for (int wx = 0; wx < kw; wx++) {
+                prow[wx] += pwrow[wx] * v;
+              }
+            }
+          }
+        }
+        deconv2d_border_scatter(params, pi, pw, pout, x0, x1, y0, y1);
+      }
+
+      if (params.has_bias) {
+        vectorize::add(bias[o], params.out_unpadded.area(), pout);
+      }
+    }
+  });
+}
+
 }  // namespace kernels
 }  // namespace core
 }  // namespace tiny_dnn
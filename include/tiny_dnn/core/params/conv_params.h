@@ -64,6 +64,22 @@ class conv_params : public Params {
   serial_size_t w_stride;
   serial_size_t h_stride;
 
+  /* Padding that is not materialized in the input buffer. When the caller
+   * passes an unpadded input (in_padded == in) with padding::same, kernels
+   * skip the taps that fall outside the image instead of reading zeros.
+   */
+  serial_size_t pad_left() const {
+    return (pad_type == padding::same && in_padded.width == in.width)
+             ? weight.width / 2
+             : 0;
+  }
+  serial_size_t pad_top() const {
+    return (pad_type == padding::same && in_padded.height == in.height)
+             ? weight.height / 2
+             : 0;
+  }
+  bool implicit_padding() const { return pad_left() > 0 || pad_top() > 0; }
+
   friend std::ostream &operator<<(std::ostream &o,
                                   const core::conv_params &param) {
     o << "in:        " << param.in << "\n";
@@ -77,6 +93,34 @@ class conv_params : public Params {
   }
 };
 
+/* Range [lo, hi) of output positions p for which the given kernel tap reads
+ * inside the input, i.e. 0 <= p * stride + tap - pad < len.
+ */
+inline void conv_tap_range(int tap,
+                           int stride,
+                           int pad,
+                           int count,
+                           int len,
+                           int &lo,
+                           int &hi) {
+  lo     = (pad - tap > 0) ? (pad - tap + stride - 1) / stride : 0;
+  int in = len - 1 - tap + pad;
+  hi     = (in < 0) ? 0 : std::min(count, in / stride + 1);
+  lo     = std::min(lo, hi);
+}
+
+/* Range [lo, hi) of output positions whose whole window lies inside the
+ * input. Everything outside of it is a border position.
+ */
+inline void conv_interior_range(
+  int ksize, int stride, int pad, int count, int len, int &lo, int &hi) {
+  int lo0, hi0, lo1, hi1;
+  conv_tap_range(0, stride, pad, count, len, lo0, hi0);
+  conv_tap_range(ksize - 1, stride, pad, count, len, lo1, hi1);
+  lo = std::max(lo0, lo1);
+  hi = std::max(lo, std::min(hi0, hi1));
+}
+
 inline conv_params &Params::conv() {
   return *(static_cast<conv_params *>(this));
 }
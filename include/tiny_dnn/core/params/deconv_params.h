@@ -27,6 +27,16 @@ struct deconv_params {
   padding pad_type;
   serial_size_t w_stride;
   serial_size_t h_stride;
+
+  /* Offset of out_unpadded inside the full (padded) output. Kernels that
+   * write out_unpadded directly drop the contributions that land outside it.
+   */
+  serial_size_t crop_left() const {
+    return (pad_type == padding::same) ? weight.width / 2 : 0;
+  }
+  serial_size_t crop_top() const {
+    return (pad_type == padding::same) ? weight.height / 2 : 0;
+  }
 };
 
 }  // namespace core
@@ -9,6 +9,7 @@
 
 #include <tiny_dnn/util/aligned_allocator.h>
 #include <tiny_dnn/util/nn_error.h>
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <limits>
@@ -16,48 +17,11 @@
 #include <type_traits>
 #include <vector>
 
+#include "NeuralThreadPool.h"
 #include "tiny_dnn/config.h"
 
-#ifdef CNN_USE_TBB
-#ifndef NOMINMAX
-#define NOMINMAX  // tbb includes windows.h in tbb/machine/windows_api.h
-#endif
-#include <tbb/task_group.h>
-#include <tbb/tbb.h>
-#endif
-
-#if !defined(CNN_USE_OMP) && !defined(CNN_SINGLE_THREAD)
-#include <future>
-#include <thread>
-#endif
-
-#if defined(CNN_USE_GCD) && !defined(CNN_SINGLE_THREAD)
-#include <dispatch/dispatch.h>
-#endif
-
 namespace tiny_dnn {
 
-#ifdef CNN_USE_TBB
-
-static tbb::task_scheduler_init tbbScheduler(
-  tbb::task_scheduler_init::automatic);  // tbb::task_scheduler_init::deferred);
-
-typedef tbb::blocked_range<size_t> blocked_range;
-
-template <typename Func>
-void parallel_for(size_t begin, size_t end, const Func &f, size_t grainsize) {
-  assert(end >= begin);
-  tbb::parallel_for(
-    blocked_range(begin, end, end - begin > grainsize ? grainsize : 1), f);
-}
-
-template <typename Func>
-void xparallel_for(size_t begin, size_t end, const Func &f) {
-  f(blocked_range(begin, end, 100));
-}
-
-#else
-
 struct blocked_range {
   typedef size_t const_iterator;
 
@@ -79,45 +43,7 @@ void xparallel_for(size_t begin, size_t end, const Func &f) {
   f(r);
 }
 
-#if defined(CNN_USE_OMP)
-
-template <typename Func>
-void parallel_for(size_t begin,
-                  size_t end,
-                  const Func &f,
-                  size_t /*grainsize*/) {
-  assert(end >= begin);
-#pragma omp parallel for
-  for (size_t i = begin; i < end; ++i) f(blocked_range(i, i + 1));
-}
-
-#elif defined(CNN_USE_GCD)
-
-template <typename Func>
-void parallel_for(size_t begin, size_t end, const Func &f, size_t grainsize) {
-  assert(end >= begin);
-  size_t count     = end - begin;
-  size_t blockSize = grainsize;
-  if (count < blockSize || blockSize == 0) {
-    blockSize = 1;
-  }
-  size_t blockCount = (count + blockSize - 1) / blockSize;
-  assert(blockCount > 0);
-
-  dispatch_apply(blockCount, dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0),
-                 ^(size_t block) {
-                   size_t blockStart = block * blockSize;
-                   size_t blockEnd   = blockStart + blockSize;
-                   if (blockEnd > end) {
-                     blockEnd = end;
-                   }
-                   assert(blockStart < blockEnd);
-
-                   f(blocked_range(blockStart, blockEnd));
-                 });
-}
-
-#elif defined(CNN_SINGLE_THREAD)
+#if defined(CNN_SINGLE_THREAD)
 
 template <typename Func>
 void parallel_for(size_t begin,
@@ -129,41 +55,18 @@ void parallel_for(size_t begin,
 
 #else
 
+// all parallel loops share tgr::NeuralThreadPool, which handles thread
+// count, pinning and nested loops
 template <typename Func>
-void parallel_for(size_t begin,
-                  size_t end,
-                  const Func &f,
-                  size_t /*grainsize*/) {
+void parallel_for(size_t begin, size_t end, const Func &f, size_t grainsize) {
   assert(end >= begin);
-  size_t nthreads  = std::thread::hardware_concurrency();
-  size_t blockSize = (end - begin) / nthreads;
-  if (blockSize * nthreads < end - begin) blockSize++;
-
-  std::vector<std::future<void> > futures;
-
-  size_t blockBegin            = begin;
-  size_t blockEnd              = blockBegin + blockSize;
-  if (blockEnd > end) blockEnd = end;
-
-  for (size_t i = 0; i < nthreads; i++) {
-    futures.push_back(
-      std::move(std::async(std::launch::async, [blockBegin, blockEnd, &f] {
-        f(blocked_range(blockBegin, blockEnd));
-      })));
-
-    blockBegin += blockSize;
-    blockEnd = blockBegin + blockSize;
-    if (blockBegin >= end) break;
-    if (blockEnd > end) blockEnd = end;
-  }
-
-  for (auto &future : futures) future.wait();
+  tgr::NeuralThreadPool::parallelFor(
+    begin, end, [&f](size_t b, size_t e) { f(blocked_range(b, e)); },
+    grainsize);
 }
 
 #endif
 
-#endif  // CNN_USE_TBB
-
 template <typename T, typename U>
 bool value_representation(U const &value) {
   return static_cast<U>(static_cast<T>(value)) == value;
@@ -209,9 +112,6 @@ inline void for_i(bool parallelize, T size, Func f, size_t grainsize = 100) {
 #else  // #ifdef CNN_SINGLE_THREAD
   for_(parallelize, 0, size,
        [&](const blocked_range &r) {
-#ifdef CNN_USE_OMP
-#pragma omp parallel for
-#endif
          for (size_t i = r.begin(); i < r.end(); i++) {
            f(i);
          }
@@ -225,4 +125,60 @@ inline void for_i(T size, Func f, size_t grainsize = 100) {
   for_i(true, size, f, grainsize);
 }
 
+// smallest run of cheap element-wise work worth giving to another thread
+constexpr size_t element_block_size = 4096;
+
+// Number of blocks to cut each sample's [0, inner) range into. Batches with
+// at least one sample per thread stay whole, smaller batches (batch 1
+// inference) are split so every thread gets about two blocks, as long as
+// each block keeps min_block items.
+inline size_t sample_split(bool parallelize,
+                           size_t samples,
+                           size_t inner,
+                           size_t min_block) {
+#ifdef CNN_SINGLE_THREAD
+  return 1;
+#else
+  if (!parallelize || samples == 0) return 1;
+  // nested loops run serially by default, blocks would only add overhead
+  if (tgr::NeuralThreadPool::isInParallelRegion() &&
+      tgr::NeuralThreadPool::getNestedPolicy() == tgr::NestedPolicy::Serial)
+    return 1;
+  size_t threads =
+    static_cast<size_t>(tgr::NeuralThreadPool::getThreadCount());
+  if (samples >= threads) return 1;
+  size_t wanted = (2 * threads + samples - 1) / samples;
+  size_t most   = std::max(size_t(1), inner / std::max(size_t(1), min_block));
+  return std::min(wanted, most);
+#endif
+}
+
+// Calls f(sample, begin, end) over [0, inner) of every sample, splitting
+// inside samples when the batch is too small to occupy the pool (see
+// sample_split). f has to write disjoint outputs for disjoint ranges.
+template <typename Func>
+inline void for_sample_blocks(bool parallelize,
+                              size_t samples,
+                              size_t inner,
+                              size_t min_block,
+                              Func f,
+                              size_t grainsize = 100) {
+  if (samples == 0 || inner == 0) return;
+  size_t blocks     = sample_split(parallelize, samples, inner, min_block);
+  size_t block_size = (inner + blocks - 1) / blocks;
+  blocks            = (inner + block_size - 1) / block_size;
+  if (blocks == 1) {
+    for_i(parallelize, samples, [&](size_t sample) { f(sample, 0, inner); },
+          grainsize);
+    return;
+  }
+  for_i(parallelize, samples * blocks,
+        [&](size_t task) {
+          size_t sample = task / blocks;
+          size_t begin  = (task % blocks) * block_size;
+          f(sample, begin, std::min(inner, begin + block_size));
+        },
+        1);
+}
+
 }  // namespace tiny_dnn
@@ -14,6 +14,8 @@
 #include <cstdint>
 #include <numeric>
 
+#include "NeuralKernels.h"
+
 #ifdef CNN_USE_AVX
 #include "tiny_dnn/core/kernels/avx_kernel_common.h"
 #endif
@@ -643,6 +645,26 @@ void reduce(const T *src, std::size_t size, T *dst) {
   }
 }
 
+// float kernels are picked at run time for the widest instruction set the
+// CPU supports, see tgr::NeuralKernels
+template <>
+inline void muladd<float>(const float *src,
+                          float c,
+                          std::size_t size,
+                          float *dst) {
+  tgr::NeuralKernels::get().muladd(src, c, size, dst);
+}
+
+template <>
+inline float dot<float>(const float *s1, const float *s2, std::size_t size) {
+  return tgr::NeuralKernels::get().dot(s1, s2, size);
+}
+
+template <>
+inline void reduce<float>(const float *src, std::size_t size, float *dst) {
+  tgr::NeuralKernels::get().add(src, size, dst);
+}
+
 template <typename T>
 inline void fill(T *dst, std::size_t size, T value) {
 #if defined(_MSC_VER)
@@ -12,7 +12,15 @@ void ActivationLayer::forwardPropagation(const std::vector<Tensor *> &in_data,
 		std::vector<Tensor *> &out_data) {
 	const Tensor &x = *in_data[0];
 	Tensor &y = *out_data[0];
-	tiny_dnn::for_i(x.size(), [&](int i) {forward_activation(x[i], y[i]);});
+	if (isElementwise() && x.size() > 0) {
+		tiny_dnn::for_sample_blocks(true, x.size(), x[0].size(),
+				tiny_dnn::element_block_size,
+				[&](size_t i, size_t begin, size_t end) {
+					forward_elements(&x[i][begin], &y[i][begin], end - begin);
+				});
+	} else {
+		tiny_dnn::for_i(x.size(), [&](int i) {forward_activation(x[i], y[i]);});
+	}
 }
 void ActivationLayer::backwardPropagation(const std::vector<Tensor*> &in_data,
 		const std::vector<Tensor*> &out_data, std::vector<Tensor*> &out_grad,
@@ -21,7 +29,16 @@ void ActivationLayer::backwardPropagation(const std::vector<Tensor*> &in_data,
 	const Tensor&dy = *out_grad[0];
 	const Tensor&x = *in_data[0];
 	const Tensor&y = *out_data[0];
-	tiny_dnn::for_i(x.size(),
-			[&](size_t i) {backward_activation(x[i], y[i], dx[i], dy[i]);});
+	if (isElementwise() && x.size() > 0) {
+		tiny_dnn::for_sample_blocks(true, x.size(), x[0].size(),
+				tiny_dnn::element_block_size,
+				[&](size_t i, size_t begin, size_t end) {
+					backward_elements(&x[i][begin], &y[i][begin], &dx[i][begin],
+							&dy[i][begin], end - begin);
+				});
+	} else {
+		tiny_dnn::for_i(x.size(),
+				[&](size_t i) {backward_activation(x[i], y[i], dx[i], dy[i]);});
+	}
 }
 }
@@ -8,52 +8,25 @@
 #include "AveragePoolingLayer.h"
 #include "tiny_dnn/util/util.h"
 #include "tiny_dnn/layers/layer.h"
+#include <sstream>
 using namespace tiny_dnn;
 using namespace aly;
 namespace tgr {
 
-// forward_propagation
-inline void tiny_average_pooling_kernel(bool parallelize,
-		const std::vector<Tensor *> &in_data, std::vector<Tensor *> &out_data,
-		const dim3& out_dim, float_t scale_factor,
-		std::vector<typename PartialConnectedLayer::wi_connections> &out2wi) {
-	tiny_dnn::for_i(parallelize, in_data[0]->size(),
-			[&](size_t sample) {
-				const Storage &in = (*in_data[0])[sample];
-				const Storage &W = (*in_data[1])[0];
-				const Storage &b = (*in_data[2])[0];
-				Storage &out = (*out_data[0])[sample];
-				auto oarea = out_dim.area();
-				size_t idx = 0;
-				for (int d = 0; d < out_dim.z; ++d) {
-					float_t weight = W[d] * scale_factor;
-					float_t bias = b[d];
-					for (int i = 0; i < oarea; ++i, ++idx) {
-						const auto &connections = out2wi[idx];
-						float_t value {0};
-						for (auto connection : connections) value += in[connection.second];
-						value *= weight;
-						value += bias;
-						out[idx] = value;
-					}
-				}
-				assert(out.size() == out2wi.size());
-			});
-}
 void AveragePoolingLayer::getStencilInput(const aly::int3& pos,
 		std::vector<aly::int3>& stencil) const {
-	wo_connections outarray = out2wi[out_dim(pos)];
-	stencil.resize(outarray.size());
-	for (int i = 0; i < outarray.size(); i++) {
-		stencil[i] = in_dim(outarray[i].second);
+	int row = out_dim(pos);
+	stencil.resize(out2wi.size(row));
+	for (int k = out2wi.begin(row), i = 0; k < out2wi.end(row); k++, i++) {
+		stencil[i] = in_dim(out2wi.second(k));
 	}
 }
 void AveragePoolingLayer::getStencilWeight(const aly::int3& pos,
 		std::vector<aly::int3>& stencil) const {
-	wo_connections outarray = out2wi[out_dim(pos)];
-	stencil.resize(outarray.size());
-	for (int i = 0; i < outarray.size(); i++) {
-		stencil[i] = in_dim(outarray[i].first);
+	int row = out_dim(pos);
+	stencil.resize(out2wi.size(row));
+	for (int k = out2wi.begin(row), i = 0; k < out2wi.end(row); k++, i++) {
+		stencil[i] = in_dim(out2wi.first(k));
 	}
 }
 bool AveragePoolingLayer::getStencilBias(const aly::int3& pos,
@@ -66,53 +39,6 @@ bool AveragePoolingLayer::getStencilBias(const aly::int3& pos,
 	}
 }
 
-// back_propagation
-inline void tiny_average_pooling_back_kernel(bool parallelize,
-		const std::vector<Tensor *> &in_data,
-		const std::vector<Tensor *> &out_data, std::vector<Tensor *> &out_grad,
-		std::vector<Tensor *> &in_grad, const dim3 &in_dim,
-		float_t scale_factor,
-		std::vector<typename PartialConnectedLayer::io_connections> &weight2io,
-		std::vector<typename PartialConnectedLayer::wo_connections> &in2wo,
-		std::vector<std::vector<int>> &bias2out) {
-	CNN_UNREFERENCED_PARAMETER(out_data);
-	tiny_dnn::for_i(parallelize, in_data[0]->size(), [&](size_t sample) {
-		const Storage &prev_out = (*in_data[0])[sample];
-		const Storage &W = (*in_data[1])[0];
-		Storage &dW = (*in_grad[1])[sample];
-		Storage &db = (*in_grad[2])[sample];
-		Storage &prev_delta = (*in_grad[0])[sample];
-		Storage &curr_delta = (*out_grad[0])[sample];
-
-		auto inarea = in_dim.area();
-		size_t idx = 0;
-		for (size_t i = 0; i < in_dim.z; ++i) {
-			float_t weight = W[i] * scale_factor;
-			for (size_t j = 0; j < inarea; ++j, ++idx) {
-				prev_delta[idx] = weight * curr_delta[in2wo[idx][0].second];
-			}
-		}
-
-		for (size_t i = 0; i < weight2io.size(); ++i) {
-			const auto &connections = weight2io[i];
-			float_t diff {0};
-
-			for (auto connection : connections)
-			diff += prev_out[connection.first] * curr_delta[connection.second];
-
-			dW[i] += diff * scale_factor;
-		}
-
-		for (size_t i = 0; i < bias2out.size(); i++) {
-			const std::vector<int> &outs = bias2out[i];
-			float_t diff {0};
-
-			for (auto o : outs) diff += curr_delta[o];
-
-			db[i] += diff;
-		}
-	});
-}
 std::vector<aly::dim3> AveragePoolingLayer::getInputDimensions() const {
 	return {in_dim, w_dim, dim3(1, 1, out_dim.z)};
 }
@@ -120,20 +46,25 @@ std::vector<aly::dim3> AveragePoolingLayer::getInputDimensions() const {
 std::vector<aly::dim3> AveragePoolingLayer::getOutputDimensions() const {
 	return {out_dim};
 }
+std::string AveragePoolingLayer::getTableKey() const {
+	std::stringstream ss;
+	ss << "average_pool " << in_dim.x << " " << in_dim.y << " " << in_dim.z
+			<< " " << pool_size_x << " " << pool_size_y << " " << stride_x << " "
+			<< stride_y << " " << (int) pad_type;
+	return ss.str();
+}
 
 void AveragePoolingLayer::forwardPropagation(
 		const std::vector<Tensor *> &in_data, std::vector<Tensor *> &out_data) {
-	tiny_average_pooling_kernel(parallelize, in_data, out_data, out_dim,
-			Base::scale_factor, Base::out2wi);
+	sparse_forward(in_data, out_data, Base::scale_factor, parallelize);
 }
 
 void AveragePoolingLayer::backwardPropagation(
 		const std::vector<Tensor *> &in_data,
 		const std::vector<Tensor *> &out_data, std::vector<Tensor *> &out_grad,
 		std::vector<Tensor *> &in_grad) {
-	tiny_average_pooling_back_kernel(parallelize, in_data, out_data, out_grad,
-			in_grad, in_dim, Base::scale_factor, Base::weight2io, Base::in2wo,
-			Base::bias2out);
+	CNN_UNREFERENCED_PARAMETER(out_data);
+	sparse_backward(in_data, out_grad, in_grad, Base::scale_factor, parallelize);
 }
 
 std::pair<int, int> AveragePoolingLayer::pool_size() const {
@@ -162,6 +93,7 @@ void AveragePoolingLayer::init_connection(int pooling_size_x,
 			}
 		}
 	}
+	this->compile_connections();
 }
 
 void AveragePoolingLayer::connect_kernel(int pooling_size_x, int pooling_size_y,
@@ -199,7 +131,9 @@ AveragePoolingLayer::AveragePoolingLayer(int in_width, int in_height,
 		pooling_size_mismatch(in_width, in_height, pool_size_x, pool_size_y);
 	}
 
-	init_connection(pool_size_x, pool_size_y);
+	if (!restoreTables()) {
+		init_connection(pool_size_x, pool_size_y);
+	}
 }
 
 }
@@ -109,18 +109,20 @@ void BatchNormalizationLayer::forwardPropagation(
 // y = (x - mean) ./ sqrt(variance + eps)
 	calc_stddev(variance);
 
-	for_i(in_data[0]->size(), [&](int i) {
-		const float_t *inptr = &in[i][0];
-		float_t *outptr = &out[i][0];
-
-		for (size_t j = 0; j < in_channels; j++) {
-			float_t m = mean[j];
-
-			for (size_t k = 0; k < in_spatial_size; k++) {
-				*outptr++ = (*inptr++ - m) / stddevStorage[j];
-			}
-		}
-	});
+	//small batches are split by channel
+	tiny_dnn::for_sample_blocks(true, in.size(), in_channels,
+			tiny_dnn::element_block_size / std::max((size_t) in_spatial_size, (size_t) 1),
+			[&](size_t i, size_t begin, size_t end) {
+				const float_t *inptr = &in[i][begin * in_spatial_size];
+				float_t *outptr = &out[i][begin * in_spatial_size];
+				for (size_t j = begin; j < end; j++) {
+					float_t m = mean[j];
+
+					for (size_t k = 0; k < in_spatial_size; k++) {
+						*outptr++ = (*inptr++ - m) / stddevStorage[j];
+					}
+				}
+			});
 
 	if (phase == tiny_dnn::net_phase::train && update_immidiately) {
 		meanStorage = mean_current;
@@ -60,7 +60,11 @@ void ConcatLayer::forwardPropagation(const std::vector<Tensor *> &in_data,
 		for (int i = 0; i < in_shapes.size(); i++) {
 			const float_t *ins = &(*in_data[i])[s][0];
 			int dim = in_shapes[i].size();
-			outs = std::copy(ins, ins + dim, outs);
+			//inputs planned as views of the output are already in place
+			if (ins != outs) {
+				std::copy(ins, ins + dim, outs);
+			}
+			outs += dim;
 		}
 	});
 }
@@ -76,7 +80,9 @@ void ConcatLayer::backwardPropagation(const std::vector<Tensor *> &in_data,
 		for (int i = 0; i < in_shapes.size(); i++) {
 			int dim = in_shapes[i].size();
 			float_t *ins = &(*in_grad[i])[s][0];
-			std::copy(outs, outs + dim, ins);
+			if (ins != outs) {
+				std::copy(outs, outs + dim, ins);
+			}
 			outs += dim;
 		}
 	});
@@ -57,10 +57,11 @@ int ConvolutionLayer::conv_out_dim(int in_width, int in_height, int window_size,
 }
 void ConvolutionLayer::conv_set_params(const shape3d &in, int w_width,
 		int w_height, int outc, padding ptype, bool has_bias, int w_stride,
-		int h_stride, const ConnectionTable &tbl) {
+		int h_stride, const tiny_dnn::core::ConnectionTable &tbl) {
 	params.in = in;
-	params.in_padded = shape3d(in_length(in.width, w_width, ptype),
-			in_length(in.height, w_height, ptype), in.depth);
+	// same padding is handled inside the kernels, the input is never copied
+	// into a padded buffer
+	params.in_padded = in;
 	params.out = shape3d(conv_out_length(in.width, w_width, w_stride, ptype),
 			conv_out_length(in.height, w_height, h_stride, ptype), outc);
 	params.weight = shape3d(w_width, w_height, in.depth * outc);
@@ -69,21 +70,6 @@ void ConvolutionLayer::conv_set_params(const shape3d &in, int w_width,
 	params.w_stride = w_stride;
 	params.h_stride = h_stride;
 	params.tbl = tbl;
-
-	// init padding buffer
-	if (params.pad_type == padding::same) {
-		cws_.prev_delta_padded.resize(1,
-				vec_t(params.in_padded.size(), float_t(0)));
-	}
-
-	// set parameters to padding operation
-	padding_op = Conv2dPadding(params);
-}
-
-int ConvolutionLayer::in_length(int in_length, int window_size,
-		tiny_dnn::padding pad_type) const {
-	return pad_type == tiny_dnn::padding::same ?
-			(in_length + window_size - 1) : in_length;
 }
 int ConvolutionLayer::conv_out_dim(int in_width, int in_height,
 		int window_width, int window_height, int w_stride, int h_stride,
@@ -138,20 +124,10 @@ std::vector<aly::dim3> ConvolutionLayer::getInputDimensions() const {
 std::vector<aly::dim3> ConvolutionLayer::getOutputDimensions() const {
 	return {aly::dim3(params.out.width,params.out.height,params.out.depth)};
 }
-Tensor* ConvolutionLayer::in_data_padded(const std::vector<Tensor*> &in) {
-	return (params.pad_type == padding::valid) ? in[0] : &cws_.prev_out_padded;
-}
 void ConvolutionLayer::forwardPropagation(const std::vector<Tensor*>&in_data,
 		std::vector<Tensor*> &out_data) {
-	// apply padding to the input tensor
-	padding_op.copy_and_pad_input(*in_data[0], cws_.prev_out_padded);
-
-	fwd_in_data.resize(in_data.size());
-	std::copy(in_data.begin(), in_data.end(), fwd_in_data.begin());
-	fwd_in_data[0] = in_data_padded(in_data);
-
 	// forward convolutional op context
-	fwd_ctx.set_in_out(fwd_in_data, out_data);
+	fwd_ctx.set_in_out(in_data, out_data);
 	fwd_ctx.setParallelize(parallelize);
 	fwd_ctx.setEngine(static_cast<backend_t>(NeuralLayer::getBackendType()));
 
@@ -161,35 +137,29 @@ void ConvolutionLayer::forwardPropagation(const std::vector<Tensor*>&in_data,
 void ConvolutionLayer::backwardPropagation(const std::vector<Tensor*> &in_data,
 		const std::vector<Tensor*> &out_data, std::vector<Tensor*> &out_grad,
 		std::vector<Tensor*> &in_grad) {
-	bwd_in_data.resize(in_data.size());
-	std::copy(in_data.begin(), in_data.end(), bwd_in_data.begin());
-	bwd_in_data[0] = in_data_padded(in_data);
-
-	bwd_in_grad.resize(in_grad.size());
-	std::copy(in_grad.begin(), in_grad.end(), bwd_in_grad.begin());
-	if (params.pad_type == padding::same) {
-		bwd_in_grad[0] = &cws_.prev_delta_padded;
-	}
-
-	bwd_ctx.set_in_out(bwd_in_data, out_data, out_grad, bwd_in_grad);
+	bwd_ctx.set_in_out(in_data, out_data, out_grad, in_grad);
 	bwd_ctx.setParams(&params);
 	bwd_ctx.setParallelize(parallelize);
 	bwd_ctx.setEngine(static_cast<backend_t>(NeuralLayer::getBackendType()));
 
 	// launch convolutional kernel
 	kernel_back->compute(bwd_ctx);
-
-	// unpad deltas
-	padding_op.copy_and_unpad_delta(cws_.prev_delta_padded, *in_grad[0]);
-}
-void ConvolutionLayer::setSampleCount(size_t sample_count) {
-	NeuralLayer::setSampleCount(sample_count);
-	cws_.prev_delta_padded.resize(sample_count,
-			vec_t(params.in_padded.size(), float_t(0)));
 }
 int ConvolutionLayer::getFanInSize() const {
 	return params.weight.width * params.weight.height * params.in.depth;
 }
+uint64_t ConvolutionLayer::getMultiplyAdds() const {
+	uint64_t connections = 0;
+	for (serial_size_t o = 0; o < params.out.depth; o++) {
+		for (serial_size_t i = 0; i < params.in.depth; i++) {
+			if (params.tbl.isConnected(o, i)) {
+				connections++;
+			}
+		}
+	}
+	return (uint64_t) params.out.width * params.out.height
+			* params.weight.width * params.weight.height * connections;
+}
 int ConvolutionLayer::getFanOutSize() const {
 	return (params.weight.width / params.w_stride)
 			* (params.weight.height / params.h_stride) * params.out.depth;
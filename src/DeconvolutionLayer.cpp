@@ -30,6 +30,18 @@ int DeconvolutionLayer::getFanInSize() const {
 }
 
 ///< number of outgoing connections for each input unit
+uint64_t DeconvolutionLayer::getMultiplyAdds() const {
+	uint64_t connections = 0;
+	for (serial_size_t o = 0; o < params.out.depth; o++) {
+		for (serial_size_t i = 0; i < params.in.depth; i++) {
+			if (params.tbl.isConnected(o, i)) {
+				connections++;
+			}
+		}
+	}
+	return (uint64_t) params.in.width * params.in.height
+			* params.weight.width * params.weight.height * connections;
+}
 int DeconvolutionLayer::getFanOutSize() const {
 	return (params.weight.width * params.w_stride)
 			* (params.weight.height * params.h_stride) * params.out.depth;
@@ -37,16 +49,14 @@ int DeconvolutionLayer::getFanOutSize() const {
 
 void DeconvolutionLayer::forwardPropagation(
 		const std::vector<Tensor *> &in_data, std::vector<Tensor *> &out_data) {
-	// launch deconvolutional kernel
-	deconv_layer_worker_storage.prev_out = in_data[0];
+	// launch deconvolutional kernel, the output is written unpadded
 	const Storage &W = (*in_data[1])[0];
 	const Storage &bias = (*in_data[2])[0];
 	Tensor &out = *out_data[0];
 	const Tensor &in = *in_data[0];  // input
 	fill_tensor(out, float_t { 0 });
-	tiny_dnn::core::kernels::tiny_deconv2d_kernel(params, in, W, bias, out,parallelize);
-	copy_and_unpad_output(out);
-	out = *(deconv_layer_worker_storage.curr_out_unpadded);
+	tiny_dnn::core::kernels::tiny_deconv2d_unpadded_kernel(params, in, W, bias,
+			out, parallelize);
 }
 
 /**
@@ -66,23 +76,18 @@ void DeconvolutionLayer::backwardPropagation(
 		const std::vector<Tensor *> &in_data,
 		const std::vector<Tensor *> &out_data, std::vector<Tensor *> &out_grad,
 		std::vector<Tensor *> &in_grad) {
-	deconv_layer_worker_specific_storage &cws = deconv_layer_worker_storage;
-	if (params.pad_type == padding::same)
-		copy_and_pad_delta(cws.curr_delta_padded, *in_grad[0]);
-
-	const Tensor &prev_out = *(cws.prev_out);
+	const Tensor &prev_out = *in_data[0];
 	const Storage &W = (*in_data[1])[0];
 	Tensor &dW = *in_grad[1];
 	Tensor &db = *in_grad[2];
-	Tensor &curr_delta =
-			(params.pad_type == padding::same) ?
-					cws.curr_delta_padded : *out_grad[0];
+	const Tensor &curr_delta = *out_grad[0];
 	Tensor *prev_delta = in_grad[0];
 	assert(W.size() == params.weight.size());
 	assert(dW[0].size() == params.weight.size());
 	assert(curr_delta[0].size() == getOutputDimensions()[0].size());
 	fill_tensor(*prev_delta, float_t { 0 });
-	tiny_dnn::core::kernels::avx_deconv2d_back_kernel(params, prev_out, W, dW, db,curr_delta, prev_delta);
+	tiny_dnn::core::kernels::tiny_deconv2d_unpadded_back_kernel(params,
+			prev_out, W, dW, db, curr_delta, prev_delta, parallelize);
 }
 std::vector<aly::dim3> DeconvolutionLayer::getInputDimensions() const {
 	if (params.has_bias) {
@@ -96,40 +101,21 @@ std::vector<aly::dim3> DeconvolutionLayer::getOutputDimensions() const {
 	return {Convert(params.out_unpadded)};
 }
 void DeconvolutionLayer::init_backend(const backend_t backend_type) {
-	/*
-	std::shared_ptr<core::backend> backend = nullptr;
-	// allocate new backend
-	if (backend_type == backend_t::internal) {
-		backend = std::make_shared<core::tiny_backend>(&params,
-				[this](const Tensor &in) {return copy_and_unpad_output(in);},
-				[this](const Tensor &delta, Tensor &dst) {
-					return copy_and_pad_delta(delta, dst);
-				}, &deconv_layer_worker_storage);
-#ifdef CNN_USE_AVX
-	} else if (backend_type == backend_t::avx) {
-		backend = std::make_shared<core::avx_backend>(
-				&params,
-				[this](const Tensor &in) {return copy_and_unpad_output(in);},
-				[this](const Tensor &delta, Tensor &dst) {
-					return copy_and_pad_delta(delta, dst);
-				},
-				&deconv_layer_worker_storage);
-#endif
-	} else {
-		throw nn_error("Not supported backend type.");
-	}
-
-	if (backend) {
-		this->backend = backend;
-		//backend_->set_layer(this); //Blake: What to do here! Create own Backend class?
-	} else {
-		throw nn_error("Could not allocate the backend.");
+	//forward/backward always call the unpadded internal kernels, there is no
+	//separate avx, nnpack or libdnn deconvolution to select
+	if (backend_type == backend_t::opencl) {
+		throw nn_error("Not implemented engine: " + to_string(backend_type));
+	} else if (backend_type != backend_t::internal
+			&& backend_type != backend_t::avx
+			&& backend_type != backend_t::nnpack
+			&& backend_type != backend_t::libdnn) {
+		throw nn_error("Not supported engine: " + to_string(backend_type));
 	}
-	*/
 }
 void DeconvolutionLayer::deconv_set_params(const shape3d &in, int w_width,
 		int w_height, int outc, padding ptype, bool has_bias, int w_stride,
-		int h_stride, const ConnectionTable &tbl = ConnectionTable()) {
+		int h_stride, const tiny_dnn::core::ConnectionTable &tbl =
+				tiny_dnn::core::ConnectionTable()) {
 	params.in = in;
 	params.out = shape3d(deconv_out_length(in.width, w_width, w_stride),
 			deconv_out_length(in.height, w_height, h_stride), outc);
@@ -160,18 +146,6 @@ void DeconvolutionLayer::deconv_set_params(const shape3d &in, int w_width,
 
 }
 
-void DeconvolutionLayer::init_workers(int sample_count) {
-	deconv_layer_worker_specific_storage &dws = deconv_layer_worker_storage;
-
-	if (params.pad_type == padding::same) {
-		dws.curr_out_buf.resize(sample_count,
-				Storage(params.out_unpadded.size(), float { 0 }));
-		dws.curr_delta_padded.resize(sample_count,
-				Storage(params.out.size(), float { 0 }));
-	} else {
-		dws.curr_out_buf.clear();
-	}
-}
 int DeconvolutionLayer::in_length(int in_length, int window_size,
 		padding pad_type) const {
 	return in_length;
@@ -231,62 +205,4 @@ int DeconvolutionLayer::deconv_out_dim(int in_width, int in_height,
 					pad_type);
 }
 
-void DeconvolutionLayer::copy_and_pad_delta(const Tensor &delta,
-		Tensor &delta_padded) {
-	if (params.pad_type == padding::valid) {
-		delta_padded = delta;
-	} else {
-		for (int sample = 0; sample < delta.size(); sample++) {
-			Storage &dst = delta_padded[sample];
-			const Storage &src = delta[sample];
-
-			for (int c = 0; c < params.in.depth; c++) {
-				float *pdst = &dst[params.in.get_index(0, 0, c)];
-				const float *pin = &src[params.in.get_index(0, 0, c)];
-
-				for (int y = 0; y < params.in.height;
-						y++, pdst += params.in.width, pin += params.in.width) {
-					std::copy(pin, pin + params.in.width, pdst);
-				}
-			}
-		}
-	}
 }
-
-void DeconvolutionLayer::copy_and_unpad_output(const Tensor &out) {
-	deconv_layer_worker_specific_storage &dws = deconv_layer_worker_storage;
-
-	dws.curr_out_buf = Tensor(out.size(),
-			Storage(params.out_unpadded.size(), 0));
-	Tensor *dst_tensor = &dws.curr_out_buf;
-
-	if (params.pad_type == padding::valid) {
-		dws.curr_out_unpadded = &out;
-	} else {
-		// make unpadded version in order to restore scale in fprop/bprop
-		for (int sample = 0; sample < out.size(); sample++) {
-			int idx = 0;
-			Storage &dst = (*dst_tensor)[sample];
-			int wieght_w_half = params.weight.width / 2;
-			int wieght_h_half = params.weight.height / 2;
-
-			for (int c = 0; c < params.out_unpadded.depth; c++) {
-				float *pimg = &dst[params.out_unpadded.get_index(0, 0, c)];
-				idx = params.out.get_index(wieght_w_half, wieght_h_half, c);
-				const float *pout = &out[sample][idx];
-
-				for (int y = wieght_h_half;
-						y < params.out_unpadded.height + wieght_h_half;
-						y++, pout += params.out.width, pimg +=
-								params.out_unpadded.width) {
-					std::copy(pout, pout + params.out_unpadded.width, pimg);
-				}
-			}
-		}
-
-		dws.curr_out_unpadded = &dws.curr_out_buf;
-	}
-}
-
-}
-
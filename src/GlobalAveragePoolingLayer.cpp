@@ -6,6 +6,8 @@
  */
 
 #include "GlobalAveragePoolingLayer.h"
+#include "tiny_dnn/core/kernels/global_avepool_op.h"
+#include "tiny_dnn/core/kernels/global_avepool_grad_op.h"
 using namespace tiny_dnn;
 namespace tgr {
 GlobalAveragePoolingLayer::GlobalAveragePoolingLayer(int in_width,
@@ -49,6 +51,24 @@ std::vector<aly::dim3> GlobalAveragePoolingLayer::getOutputDimensions() const {
 std::pair<int, int> GlobalAveragePoolingLayer::pool_size() const {
 	return std::make_pair(params.in.width, params.in.height);
 }
+void GlobalAveragePoolingLayer::getStencilInput(const aly::int3& pos,
+		std::vector<aly::int3>& stencil) const {
+	//output is one value per channel, stored along x
+	stencil.clear();
+	for (int y = 0; y < (int) params.in.height; y++) {
+		for (int x = 0; x < (int) params.in.width; x++) {
+			stencil.push_back(aly::int3(x, y, pos.x));
+		}
+	}
+}
+void GlobalAveragePoolingLayer::getStencilWeight(const aly::int3& pos,
+		std::vector<aly::int3>& stencil) const {
+	stencil.clear();
+}
+bool GlobalAveragePoolingLayer::getStencilBias(const aly::int3& pos,
+		aly::int3& stencil) const {
+	return false;
+}
 void GlobalAveragePoolingLayer::init_backend(
 		tiny_dnn::core::backend_t backend_type) {
 	core::OpKernelConstruction ctx = core::OpKernelConstruction(
@@ -9,6 +9,25 @@
 #include "tiny_dnn/tiny_dnn.h"
 using namespace tiny_dnn;
 namespace tgr {
+void LocalResponseNormLayer::getStencilInput(const aly::int3& pos,
+		std::vector<aly::int3>& stencil) const {
+	int half = size / 2;
+	stencil.clear();
+	if (region == norm_region::across_channels) {
+		for (int z = std::max(pos.z - half, 0);
+				z <= std::min(pos.z + half, (int) in_shape.z - 1); z++) {
+			stencil.push_back(aly::int3(pos.x, pos.y, z));
+		}
+	} else {
+		for (int y = std::max(pos.y - half, 0);
+				y <= std::min(pos.y + half, (int) in_shape.y - 1); y++) {
+			for (int x = std::max(pos.x - half, 0);
+					x <= std::min(pos.x + half, (int) in_shape.x - 1); x++) {
+				stencil.push_back(aly::int3(x, y, pos.z));
+			}
+		}
+	}
+}
 void LocalResponseNormLayer::forwardPropagation(
 		const std::vector<Tensor *> &in_data, std::vector<Tensor *> &out_data) {
 	// @todo revise the parallelism strategy
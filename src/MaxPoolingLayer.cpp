@@ -5,6 +5,8 @@
  *      Author: blake
  */
 #include "MaxPoolingLayer.h"
+#include "NeuralPlan.h"
+#include <sstream>
 using namespace aly;
 using namespace tiny_dnn;
 using namespace tiny_dnn::core;
@@ -22,7 +24,9 @@ MaxPoolingLayer::MaxPoolingLayer(int in_width, int in_height, int in_channels,
 			pooling_size_x, pooling_size_y, stride_x, stride_y,
 			static_cast<padding>(pad_type));
 
-	init_connection();
+	if (!restoreTables()) {
+		init_connection();
+	}
 	init_backend(backend_type);
 	NeuralLayer::setBackendType(backend_type);
 }
@@ -34,6 +38,31 @@ int MaxPoolingLayer::getFanInSize() const {
 int MaxPoolingLayer::getFanOutSize() const {
 	return 1;
 }
+uint64_t MaxPoolingLayer::getMultiplyAdds() const {
+	return (uint64_t) params.out.size() * params.pool_size_x
+			* params.pool_size_y;
+}
+void MaxPoolingLayer::getStencilInput(const aly::int3& pos,
+		std::vector<aly::int3>& stencil) const {
+	const auto& in_index = params.out2in[params.out.get_index(pos.x, pos.y,
+			pos.z)];
+	int width = (int) params.in.width;
+	int height = (int) params.in.height;
+	stencil.resize(in_index.size());
+	for (size_t i = 0; i < in_index.size(); i++) {
+		int index = (int) in_index[i];
+		stencil[i] = aly::int3(index % width, (index / width) % height,
+				index / (width * height));
+	}
+}
+void MaxPoolingLayer::getStencilWeight(const aly::int3& pos,
+		std::vector<aly::int3>& stencil) const {
+	stencil.clear();
+}
+bool MaxPoolingLayer::getStencilBias(const aly::int3& pos,
+		aly::int3& stencil) const {
+	return false;
+}
 
 void MaxPoolingLayer::forwardPropagation(const std::vector<Tensor *> &in_data,
 		std::vector<Tensor *> &out_data) {
@@ -76,6 +105,24 @@ void MaxPoolingLayer::setSampleCount(size_t sample_count) {
 	NeuralLayer::setSampleCount(sample_count);
 	params.out2inmax.resize(sample_count,std::vector<uint32_t>(params.out.size()));
 }
+std::string MaxPoolingLayer::getTableKey() const {
+	std::stringstream ss;
+	ss << "max_pool " << params.in.width << " " << params.in.height << " "
+			<< params.in.depth << " " << params.out.width << " "
+			<< params.out.height << " " << params.pool_size_x << " "
+			<< params.pool_size_y << " " << params.stride_x << " "
+			<< params.stride_y;
+	return ss.str();
+}
+void MaxPoolingLayer::getTables(PlanTable& table) const {
+	table.add(params.out2in);
+	table.add(params.in2out);
+}
+void MaxPoolingLayer::setTables(const PlanTable& table) {
+	size_t index = 0;
+	table.get(index, params.out2in, params.out.size(), (int) params.in.size());
+	table.get(index, params.in2out, params.in.size(), (int) params.out.size());
+}
 void MaxPoolingLayer::connect_kernel(int pooling_size_x, int pooling_size_y,
 		int outx, int outy, int c) {
 	int dxmax = static_cast<int>(std::min(static_cast<int>(pooling_size_x),
@@ -7,6 +7,8 @@
 
 #include "MaxUnpoolingLayer.h"
 #include "tiny_dnn/tiny_dnn.h"
+#include "NeuralPlan.h"
+#include <sstream>
 using namespace tiny_dnn;
 namespace tgr {
 int MaxUnpoolingLayer::getFanInSize() const {
@@ -15,6 +17,20 @@ int MaxUnpoolingLayer::getFanInSize() const {
 int MaxUnpoolingLayer::getFanOutSize() const {
 	return in2out[0].size();
 }
+void MaxUnpoolingLayer::getStencilInput(const aly::int3& pos,
+		std::vector<aly::int3>& stencil) const {
+	stencil = std::vector<aly::int3> { aly::int3(
+			std::min(pos.x / stride, (int) in.x - 1),
+			std::min(pos.y / stride, (int) in.y - 1), pos.z) };
+}
+void MaxUnpoolingLayer::getStencilWeight(const aly::int3& pos,
+		std::vector<aly::int3>& stencil) const {
+	stencil.clear();
+}
+bool MaxUnpoolingLayer::getStencilBias(const aly::int3& pos,
+		aly::int3& stencil) const {
+	return false;
+}
 MaxUnpoolingLayer::MaxUnpoolingLayer(int in_width, int in_height,
 		int in_channels, int unpooling_size, int stride) :
 		NeuralLayer("Max Unpooling", { ChannelType::data },
@@ -23,7 +39,25 @@ MaxUnpoolingLayer::MaxUnpoolingLayer(int in_width, int in_height,
 				unpool_out_dim(in_width, unpooling_size, stride),
 				unpool_out_dim(in_height, unpooling_size, stride), in_channels) {
 	worker_storage.in2outmax.resize(out.size());
-	init_connection();
+	if (!restoreTables()) {
+		init_connection();
+	}
+}
+std::string MaxUnpoolingLayer::getTableKey() const {
+	std::stringstream ss;
+	ss << "max_unpool " << in.x << " " << in.y << " " << in.z << " "
+			<< unpool_size << " " << stride;
+	return ss.str();
+}
+void MaxUnpoolingLayer::getTables(PlanTable& table) const {
+	table.add(out2in);
+	table.add(in2out);
+}
+void MaxUnpoolingLayer::setTables(const PlanTable& table) {
+	size_t index = 0;
+	table.get(index, out2in, out.size(), (int) in.size());
+	table.get(index, in2out, in.size(), (int) out.size());
+	worker_storage.in2outmax.resize(in.size());
 }
 
 void MaxUnpoolingLayer::connect_kernel(int unpooling_size, int inx, int iny,
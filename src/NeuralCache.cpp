@@ -1,88 +1,334 @@
 #include "NeuralCache.h"
 #include <AlloyFileUtil.h>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
 using namespace aly;
 namespace tgr {
-	void CacheElement::load() {
-		std::lock_guard<std::mutex> lockMe(accessLock);
-		if (!loaded) {
-			neuralKnowledge.reset(new NeuralKnowledge());
-			ReadNeuralKnowledgeFromFile(knowledgeFile, *neuralKnowledge);
-			loaded = true;
+	static uint64_t GetKnowledgeBytes(const NeuralKnowledge& k) {
+		uint64_t bytes = 0;
+		for (const KnowledgeTensor& t : k.getTensors()) {
+			bytes += t.count * sizeof(float);
 		}
+		return bytes;
 	}
-	void CacheElement::unload() {
-		std::lock_guard<std::mutex> lockMe(accessLock);
-		if (loaded) {
-			if (writeOnce) {
-				WriteNeuralKnowledgeToFile(neuralKnowledge->getFile(), *neuralKnowledge);
-				writeOnce = false;
+	void NeuralCache::setState(CacheElement& elem, CacheState state, const std::shared_ptr<NeuralKnowledge>& knowledge) {
+		std::lock_guard<std::mutex> lockMe(elem.accessLock);
+		elem.state = state;
+		elem.neuralKnowledge = knowledge;
+	}
+	CacheElement::~CacheElement() {
+		if (ownsFile && FileExists(knowledgeFile)) {
+			RemoveFile(knowledgeFile);
+			std::string imageFile = GetFileWithoutExtension(knowledgeFile) + ".png";
+			if (FileExists(imageFile))RemoveFile(imageFile);
+		}
+	}
+	NeuralCache::NeuralCache(uint64_t budgetBytes) :budget(budgetBytes) {
+		worker = std::thread([this] {
+			run();
+		});
+	}
+	NeuralCache::~NeuralCache() {
+		{
+			std::lock_guard<std::mutex> lockMe(accessLock);
+			stopping = true;
+		}
+		workChanged.notify_all();
+		worker.join();
+	}
+	std::shared_ptr<CacheElement> NeuralCache::getElement(int frame) {
+		auto iter = cache.find(frame);
+		return (iter != cache.end()) ? iter->second : std::shared_ptr<CacheElement>();
+	}
+	void NeuralCache::touch(CacheElement& elem) {
+		lruList.splice(lruList.begin(), lruList, elem.lruPosition);
+	}
+	void NeuralCache::makeResident(CacheElement& elem, const std::shared_ptr<NeuralKnowledge>& knowledge, bool dirty) {
+		elem.bytes = GetKnowledgeBytes(*knowledge);
+		elem.dirty = dirty;
+		elem.queued = 0;
+		setState(elem, CacheState::Loaded, knowledge);
+		lruList.push_front(elem.frame);
+		elem.lruPosition = lruList.begin();
+		residentBytes += elem.bytes;
+		evict();
+	}
+	void NeuralCache::evict() {
+		//the most recently used snapshot stays even if it alone is over budget
+		while (residentBytes > budget && lruList.size() > 1) {
+			std::shared_ptr<CacheElement> elem = cache[lruList.back()];
+			lruList.pop_back();
+			residentBytes -= elem->bytes;
+			stats.evictions++;
+			if (elem->dirty) {
+				writeBacks[elem->frame] = elem->getKnowledge();
+				elem->dirty = false;
+				workChanged.notify_all();
 			}
-			neuralKnowledge.reset();
-			loaded = false;
+			setState(*elem, CacheState::Unloaded, nullptr);
 		}
 	}
-	void CacheElement::set(const NeuralKnowledge& nknow) {
-		neuralKnowledge.reset(new NeuralKnowledge());
-		*neuralKnowledge = nknow;
-		knowledgeFile = nknow.getFile();
-		loaded = true;
+	void NeuralCache::request(CacheElement& elem, bool demand) {
+		if (elem.state == CacheState::Loaded || (elem.state == CacheState::Failed && !demand)) {
+			return;
+		}
+		//an evicted snapshot that is still waiting to be written comes back
+		//without touching the disk
+		auto pendingWrite = writeBacks.find(elem.frame);
+		if (pendingWrite != writeBacks.end()) {
+			std::shared_ptr<NeuralKnowledge> knowledge = pendingWrite->second;
+			writeBacks.erase(pendingWrite);
+			makeResident(elem, knowledge, true);
+			loaded.notify_all();
+			return;
+		}
+		int priority = demand ? 2 : 1;
+		if (elem.queued >= priority) {
+			return;
+		}
+		elem.queued = priority;
+		(demand ? demandQueue : prefetchQueue).push_back(elem.frame);
+		if (elem.state != CacheState::Loading) {
+			setState(elem, CacheState::Loading, nullptr);
+		}
+		workChanged.notify_all();
 	}
-	std::shared_ptr<NeuralKnowledge> CacheElement::getKnowledge() {
-		load();
-		return neuralKnowledge;
+	void NeuralCache::run() {
+		std::unique_lock<std::mutex> lockMe(accessLock);
+		while (true) {
+			workChanged.wait(lockMe, [this] {
+				return stopping || demandQueue.size() > 0 || writeBacks.size() > 0 || prefetchQueue.size() > 0;
+			});
+			if (stopping) {
+				break;
+			}
+			//requested frames first, then writes that free memory, then guesses
+			if (demandQueue.size() > 0 || (writeBacks.size() == 0 && prefetchQueue.size() > 0)) {
+				std::deque<int>& queue = (demandQueue.size() > 0) ? demandQueue : prefetchQueue;
+				int frame = queue.front();
+				queue.pop_front();
+				std::shared_ptr<CacheElement> elem = getElement(frame);
+				if (elem.get() == nullptr || elem->queued == 0 || elem->state != CacheState::Loading) {
+					continue;
+				}
+				elem->queued = 0;
+				std::string file = elem->knowledgeFile;
+				std::function<void(int, const std::string&, NeuralKnowledge&)> read = loader;
+				lockMe.unlock();
+				std::shared_ptr<NeuralKnowledge> knowledge(new NeuralKnowledge());
+				bool ok = true;
+				try {
+					if (read) {
+						read(frame, file, *knowledge);
+					} else {
+						ReadNeuralKnowledgeFromFile(file, *knowledge);
+					}
+				} catch (std::exception& e) {
+					std::cerr << "Could not load " << file << ": " << e.what() << std::endl;
+					ok = false;
+				}
+				lockMe.lock();
+				//set() or clear() may have replaced the element meanwhile
+				if (getElement(frame) != elem || elem->state != CacheState::Loading) {
+					continue;
+				}
+				if (ok) {
+					stats.loads++;
+					makeResident(*elem, knowledge, false);
+				} else {
+					setState(*elem, CacheState::Failed, nullptr);
+				}
+				loaded.notify_all();
+				if (ok && onLoaded) {
+					lockMe.unlock();
+					onLoaded(frame);
+					lockMe.lock();
+				}
+			} else {
+				auto pendingWrite = writeBacks.begin();
+				int frame = pendingWrite->first;
+				std::shared_ptr<NeuralKnowledge> knowledge = pendingWrite->second;
+				//held so the element cannot delete its file during the write
+				std::shared_ptr<CacheElement> elem = getElement(frame);
+				if (elem.get() == nullptr) {
+					writeBacks.erase(pendingWrite);
+					continue;
+				}
+				std::string file = elem->knowledgeFile;
+				lockMe.unlock();
+				bool ok = true;
+				try {
+					WriteNeuralKnowledgeToFile(file, *knowledge);
+				} catch (std::exception& e) {
+					std::cerr << "Could not write " << file << ": " << e.what() << std::endl;
+					ok = false;
+				}
+				lockMe.lock();
+				pendingWrite = writeBacks.find(frame);
+				if (pendingWrite != writeBacks.end() && pendingWrite->second == knowledge) {
+					writeBacks.erase(pendingWrite);
+					if (!ok) {
+						setState(*elem, CacheState::Failed, nullptr);
+					}
+				}
+				if (ok) {
+					stats.writes++;
+				}
+				elem.reset();
+			}
+		}
 	}
-	std::shared_ptr<CacheElement> NeuralCache::set(int frame, const NeuralKnowledge& nknow) {
+	void NeuralCache::setBudget(uint64_t bytes) {
 		std::lock_guard<std::mutex> lockMe(accessLock);
-		auto iter = cache.find(frame);
-		std::shared_ptr<CacheElement> elem;
-		if (iter != cache.end()) {
-			elem = iter->second;
+		budget = bytes;
+		evict();
+	}
+	std::shared_ptr<CacheElement> NeuralCache::set(int frame, const NeuralKnowledge& nknow) {
+		if (nknow.getFile().size() == 0) {
+			throw std::runtime_error("Cached knowledge needs a file to be written to.");
 		}
-		else {
-			elem = std::shared_ptr<CacheElement>(new CacheElement());
+		std::shared_ptr<NeuralKnowledge> knowledge(new NeuralKnowledge(nknow));
+		std::lock_guard<std::mutex> lockMe(accessLock);
+		std::shared_ptr<CacheElement> elem = getElement(frame);
+		if (elem.get() == nullptr) {
+			elem.reset(new CacheElement(frame));
 			cache[frame] = elem;
+		} else if (elem->state == CacheState::Loaded) {
+			lruList.erase(elem->lruPosition);
+			residentBytes -= elem->bytes;
+		}
+		writeBacks.erase(frame);
+		{
+			std::lock_guard<std::mutex> lockElem(elem->accessLock);
+			elem->knowledgeFile = nknow.getFile();
 		}
-		elem->set(nknow);
-		if (elem->isLoaded()) {
-			while ((int)loadedList.size() >= maxElements) {
-				cache[loadedList.begin()->second]->unload();
-				loadedList.erase(loadedList.begin());
+		elem->ownsFile = true;
+		makeResident(*elem, knowledge, true);
+		loaded.notify_all();
+		return elem;
+	}
+	std::shared_ptr<CacheElement> NeuralCache::setFile(int frame, const std::string& file) {
+		std::lock_guard<std::mutex> lockMe(accessLock);
+		std::shared_ptr<CacheElement> elem = getElement(frame);
+		if (elem.get() == nullptr) {
+			elem.reset(new CacheElement(frame));
+			cache[frame] = elem;
+		} else {
+			if (elem->state == CacheState::Loaded) {
+				lruList.erase(elem->lruPosition);
+				residentBytes -= elem->bytes;
 			}
-			loadedList.insert(std::pair<uint64_t, int>(counter++, frame));
+			writeBacks.erase(frame);
+			loaded.notify_all();
 		}
+		{
+			std::lock_guard<std::mutex> lockElem(elem->accessLock);
+			elem->knowledgeFile = file;
+		}
+		elem->ownsFile = false;
+		elem->dirty = false;
+		elem->queued = 0;
+		setState(*elem, CacheState::Unloaded, nullptr);
 		return elem;
 	}
 	std::shared_ptr<CacheElement> NeuralCache::get(int frame) {
 		std::lock_guard<std::mutex> lockMe(accessLock);
-		auto iter = cache.find(frame);
-		if (iter != cache.end()) {
-			std::shared_ptr<CacheElement> elem = iter->second;
-			if (!elem->isLoaded()) {
-				while ((int)loadedList.size() >= maxElements) {
-					cache[loadedList.begin()->second]->unload();
-					loadedList.erase(loadedList.begin());
-				}
-				elem->load();
-				loadedList.insert(std::pair<uint64_t, int>(counter++, frame));
-			}
+		std::shared_ptr<CacheElement> elem = getElement(frame);
+		if (elem.get() == nullptr) {
 			return elem;
 		}
-		else {
-			return std::shared_ptr<CacheElement>();
+		if (elem->state == CacheState::Loaded) {
+			stats.hits++;
+			touch(*elem);
+		} else {
+			stats.misses++;
+			request(*elem, true);
 		}
+		return elem;
 	}
-	CacheElement::~CacheElement() {
-		if (FileExists(knowledgeFile)) {
-			RemoveFile(knowledgeFile);
-			std::string imageFile = GetFileWithoutExtension(knowledgeFile) + ".png";
-			if (FileExists(imageFile))RemoveFile(imageFile);
+	std::shared_ptr<NeuralKnowledge> NeuralCache::load(int frame) {
+		std::unique_lock<std::mutex> lockMe(accessLock);
+		std::shared_ptr<CacheElement> elem = getElement(frame);
+		if (elem.get() == nullptr) {
+			return std::shared_ptr<NeuralKnowledge>();
+		}
+		if (elem->state == CacheState::Loaded) {
+			stats.hits++;
+		} else {
+			stats.misses++;
+			request(*elem, true);
+			loaded.wait(lockMe, [&] {
+				return elem->state != CacheState::Loading || stopping;
+			});
 		}
+		if (elem->state != CacheState::Loaded) {
+			return std::shared_ptr<NeuralKnowledge>();
+		}
+		touch(*elem);
+		return elem->getKnowledge();
+	}
+	void NeuralCache::prefetch(const std::vector<int>& frames) {
+		std::lock_guard<std::mutex> lockMe(accessLock);
+		//a new guess replaces the previous one, so scrubbing does not leave a
+		//backlog of frames the user has moved away from
+		for (int frame : prefetchQueue) {
+			std::shared_ptr<CacheElement> elem = getElement(frame);
+			if (elem.get() != nullptr && elem->queued == 1) {
+				elem->queued = 0;
+				setState(*elem, CacheState::Unloaded, nullptr);
+			}
+		}
+		prefetchQueue.clear();
+		for (int frame : frames) {
+			std::shared_ptr<CacheElement> elem = getElement(frame);
+			if (elem.get() != nullptr) {
+				request(*elem, false);
+			}
+		}
+	}
+	void NeuralCache::prefetch(int frame, int radius) {
+		std::vector<int> frames;
+		for (int r = 1; r <= radius; r++) {
+			frames.push_back(frame + r);
+			frames.push_back(frame - r);
+		}
+		prefetch(frames);
+	}
+	void NeuralCache::setLoader(const std::function<void(int frame, const std::string& file, NeuralKnowledge& knowledge)>& f) {
+		std::lock_guard<std::mutex> lockMe(accessLock);
+		loader = f;
+	}
+	std::vector<int> NeuralCache::getFrames() {
+		std::lock_guard<std::mutex> lockMe(accessLock);
+		std::vector<int> frames;
+		for (const auto& pr : cache) {
+			frames.push_back(pr.first);
+		}
+		std::sort(frames.begin(), frames.end());
+		return frames;
+	}
+	CacheStats NeuralCache::getStats() {
+		std::lock_guard<std::mutex> lockMe(accessLock);
+		CacheStats s = stats;
+		s.residentBytes = residentBytes;
+		s.budgetBytes = budget;
+		s.residentElements = (int) lruList.size();
+		s.elements = (int) cache.size();
+		return s;
 	}
 	void NeuralCache::clear() {
 		std::lock_guard<std::mutex> lockMe(accessLock);
-		counter = 0;
-		loadedList.clear();
+		lruList.clear();
+		demandQueue.clear();
+		prefetchQueue.clear();
+		writeBacks.clear();
+		residentBytes = 0;
+		for (auto& pr : cache) {
+			pr.second->queued = 0;
+			setState(*pr.second, CacheState::Unloaded, nullptr);
+		}
 		cache.clear();
-
+		loaded.notify_all();
 	}
 }
@@ -0,0 +1,1130 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralCaffe.h"
+#include "DropOutLayer.h"
+#include "GlobalAveragePoolingLayer.h"
+#include "LocalResponseNormLayer.h"
+#include "PowerLayer.h"
+#include "NeuralThreadPool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+namespace tgr {
+/*
+ * Caffe files are protobuf messages. Only the fields the importer uses are
+ * decoded, from either the text format or the binary wire format, into the
+ * same tree of fields keyed by name; everything else is skipped. Blob data
+ * in a binary file is not decoded at all, the tree keeps a pointer to the
+ * packed little-endian floats in the mapped file.
+ */
+struct CaffeMessage {
+	std::vector<std::pair<std::string, std::string>> values;
+	std::vector<std::pair<std::string, std::shared_ptr<CaffeMessage>>> messages;
+	const char* packed = nullptr;
+	size_t packedCount = 0;
+	std::vector<float> floats; //blob data that was not packed
+	bool has(const std::string& name) const {
+		for (const auto& pr : values) {
+			if (pr.first == name)
+				return true;
+		}
+		return (getMessage(name) != nullptr);
+	}
+	std::string get(const std::string& name, const std::string& def) const {
+		for (const auto& pr : values) {
+			if (pr.first == name)
+				return pr.second;
+		}
+		return def;
+	}
+	std::vector<std::string> getAll(const std::string& name) const {
+		std::vector<std::string> all;
+		for (const auto& pr : values) {
+			if (pr.first == name)
+				all.push_back(pr.second);
+		}
+		return all;
+	}
+	int getInt(const std::string& name, int def) const {
+		return has(name) ? (int) std::strtoll(get(name, "").c_str(), nullptr, 10) : def;
+	}
+	float getFloat(const std::string& name, float def) const {
+		return has(name) ? std::strtof(get(name, "").c_str(), nullptr) : def;
+	}
+	bool getBool(const std::string& name, bool def) const {
+		std::string value = get(name, def ? "true" : "false");
+		return (value == "true" || value == "1");
+	}
+	const CaffeMessage* getMessage(const std::string& name) const {
+		for (const auto& pr : messages) {
+			if (pr.first == name)
+				return pr.second.get();
+		}
+		return nullptr;
+	}
+	std::vector<const CaffeMessage*> getMessages(const std::string& name) const {
+		std::vector<const CaffeMessage*> all;
+		for (const auto& pr : messages) {
+			if (pr.first == name)
+				all.push_back(pr.second.get());
+		}
+		return all;
+	}
+	size_t getDataCount() const {
+		return (packed != nullptr) ? packedCount : floats.size();
+	}
+	void readData(size_t offset, size_t count, float* dst) const {
+		const char* src = (packed != nullptr) ? packed + offset * sizeof(float) : (const char*) (floats.data() + offset);
+		std::memcpy(dst, src, count * sizeof(float));
+	}
+};
+enum class CaffeKind {
+	Int, Float, Bool, String, Enum, Message, Floats, Doubles
+};
+struct CaffeField {
+	const char* message;
+	int number;
+	const char* name;
+	CaffeKind kind;
+	const char* type; //message or enum type
+};
+//field numbers from caffe.proto, V1 layers are read into the same names
+static const CaffeField CaffeFields[] = {
+	{ "NetParameter", 1, "name", CaffeKind::String, "" },
+	{ "NetParameter", 3, "input", CaffeKind::String, "" },
+	{ "NetParameter", 4, "input_dim", CaffeKind::Int, "" },
+	{ "NetParameter", 8, "input_shape", CaffeKind::Message, "BlobShape" },
+	{ "NetParameter", 100, "layer", CaffeKind::Message, "LayerParameter" },
+	{ "NetParameter", 2, "layers", CaffeKind::Message, "V1LayerParameter" },
+	{ "BlobShape", 1, "dim", CaffeKind::Int, "" },
+	{ "BlobProto", 7, "shape", CaffeKind::Message, "BlobShape" },
+	{ "BlobProto", 5, "data", CaffeKind::Floats, "" },
+	{ "BlobProto", 8, "double_data", CaffeKind::Doubles, "" },
+	{ "NetStateRule", 1, "phase", CaffeKind::Enum, "Phase" },
+	{ "LayerParameter", 1, "name", CaffeKind::String, "" },
+	{ "LayerParameter", 2, "type", CaffeKind::String, "" },
+	{ "LayerParameter", 3, "bottom", CaffeKind::String, "" },
+	{ "LayerParameter", 4, "top", CaffeKind::String, "" },
+	{ "LayerParameter", 7, "blobs", CaffeKind::Message, "BlobProto" },
+	{ "LayerParameter", 8, "include", CaffeKind::Message, "NetStateRule" },
+	{ "LayerParameter", 104, "concat_param", CaffeKind::Message, "ConcatParameter" },
+	{ "LayerParameter", 106, "convolution_param", CaffeKind::Message, "ConvolutionParameter" },
+	{ "LayerParameter", 108, "dropout_param", CaffeKind::Message, "DropoutParameter" },
+	{ "LayerParameter", 110, "eltwise_param", CaffeKind::Message, "EltwiseParameter" },
+	{ "LayerParameter", 117, "inner_product_param", CaffeKind::Message, "InnerProductParameter" },
+	{ "LayerParameter", 118, "lrn_param", CaffeKind::Message, "LRNParameter" },
+	{ "LayerParameter", 121, "pooling_param", CaffeKind::Message, "PoolingParameter" },
+	{ "LayerParameter", 122, "power_param", CaffeKind::Message, "PowerParameter" },
+	{ "LayerParameter", 123, "relu_param", CaffeKind::Message, "ReLUParameter" },
+	{ "LayerParameter", 139, "batch_norm_param", CaffeKind::Message, "BatchNormParameter" },
+	{ "LayerParameter", 143, "input_param", CaffeKind::Message, "InputParameter" },
+	{ "V1LayerParameter", 2, "bottom", CaffeKind::String, "" },
+	{ "V1LayerParameter", 3, "top", CaffeKind::String, "" },
+	{ "V1LayerParameter", 4, "name", CaffeKind::String, "" },
+	{ "V1LayerParameter", 5, "type", CaffeKind::Enum, "V1LayerType" },
+	{ "V1LayerParameter", 6, "blobs", CaffeKind::Message, "BlobProto" },
+	{ "V1LayerParameter", 32, "include", CaffeKind::Message, "NetStateRule" },
+	{ "V1LayerParameter", 9, "concat_param", CaffeKind::Message, "ConcatParameter" },
+	{ "V1LayerParameter", 10, "convolution_param", CaffeKind::Message, "ConvolutionParameter" },
+	{ "V1LayerParameter", 12, "dropout_param", CaffeKind::Message, "DropoutParameter" },
+	{ "V1LayerParameter", 24, "eltwise_param", CaffeKind::Message, "EltwiseParameter" },
+	{ "V1LayerParameter", 17, "inner_product_param", CaffeKind::Message, "InnerProductParameter" },
+	{ "V1LayerParameter", 18, "lrn_param", CaffeKind::Message, "LRNParameter" },
+	{ "V1LayerParameter", 19, "pooling_param", CaffeKind::Message, "PoolingParameter" },
+	{ "V1LayerParameter", 21, "power_param", CaffeKind::Message, "PowerParameter" },
+	{ "V1LayerParameter", 30, "relu_param", CaffeKind::Message, "ReLUParameter" },
+	{ "BatchNormParameter", 2, "moving_average_fraction", CaffeKind::Float, "" },
+	{ "BatchNormParameter", 3, "eps", CaffeKind::Float, "" },
+	{ "ConcatParameter", 1, "concat_dim", CaffeKind::Int, "" },
+	{ "ConcatParameter", 2, "axis", CaffeKind::Int, "" },
+	{ "ConvolutionParameter", 1, "num_output", CaffeKind::Int, "" },
+	{ "ConvolutionParameter", 2, "bias_term", CaffeKind::Bool, "" },
+	{ "ConvolutionParameter", 3, "pad", CaffeKind::Int, "" },
+	{ "ConvolutionParameter", 4, "kernel_size", CaffeKind::Int, "" },
+	{ "ConvolutionParameter", 5, "group", CaffeKind::Int, "" },
+	{ "ConvolutionParameter", 6, "stride", CaffeKind::Int, "" },
+	{ "ConvolutionParameter", 9, "pad_h", CaffeKind::Int, "" },
+	{ "ConvolutionParameter", 10, "pad_w", CaffeKind::Int, "" },
+	{ "ConvolutionParameter", 11, "kernel_h", CaffeKind::Int, "" },
+	{ "ConvolutionParameter", 12, "kernel_w", CaffeKind::Int, "" },
+	{ "ConvolutionParameter", 13, "stride_h", CaffeKind::Int, "" },
+	{ "ConvolutionParameter", 14, "stride_w", CaffeKind::Int, "" },
+	{ "ConvolutionParameter", 18, "dilation", CaffeKind::Int, "" },
+	{ "DropoutParameter", 1, "dropout_ratio", CaffeKind::Float, "" },
+	{ "EltwiseParameter", 1, "operation", CaffeKind::Enum, "EltwiseOp" },
+	{ "EltwiseParameter", 2, "coeff", CaffeKind::Float, "" },
+	{ "InnerProductParameter", 1, "num_output", CaffeKind::Int, "" },
+	{ "InnerProductParameter", 2, "bias_term", CaffeKind::Bool, "" },
+	{ "InnerProductParameter", 5, "axis", CaffeKind::Int, "" },
+	{ "InnerProductParameter", 6, "transpose", CaffeKind::Bool, "" },
+	{ "InputParameter", 1, "shape", CaffeKind::Message, "BlobShape" },
+	{ "LRNParameter", 1, "local_size", CaffeKind::Int, "" },
+	{ "LRNParameter", 2, "alpha", CaffeKind::Float, "" },
+	{ "LRNParameter", 3, "beta", CaffeKind::Float, "" },
+	{ "LRNParameter", 4, "norm_region", CaffeKind::Enum, "NormRegion" },
+	{ "LRNParameter", 5, "k", CaffeKind::Float, "" },
+	{ "PoolingParameter", 1, "pool", CaffeKind::Enum, "PoolMethod" },
+	{ "PoolingParameter", 2, "kernel_size", CaffeKind::Int, "" },
+	{ "PoolingParameter", 3, "stride", CaffeKind::Int, "" },
+	{ "PoolingParameter", 4, "pad", CaffeKind::Int, "" },
+	{ "PoolingParameter", 5, "kernel_h", CaffeKind::Int, "" },
+	{ "PoolingParameter", 6, "kernel_w", CaffeKind::Int, "" },
+	{ "PoolingParameter", 7, "stride_h", CaffeKind::Int, "" },
+	{ "PoolingParameter", 8, "stride_w", CaffeKind::Int, "" },
+	{ "PoolingParameter", 9, "pad_h", CaffeKind::Int, "" },
+	{ "PoolingParameter", 10, "pad_w", CaffeKind::Int, "" },
+	{ "PoolingParameter", 12, "global_pooling", CaffeKind::Bool, "" },
+	{ "PowerParameter", 1, "power", CaffeKind::Float, "" },
+	{ "PowerParameter", 2, "scale", CaffeKind::Float, "" },
+	{ "PowerParameter", 3, "shift", CaffeKind::Float, "" },
+	{ "ReLUParameter", 1, "negative_slope", CaffeKind::Float, "" }
+};
+struct CaffeEnum {
+	const char* type;
+	int value;
+	const char* name;
+};
+static const CaffeEnum CaffeEnums[] = {
+	{ "Phase", 0, "TRAIN" }, { "Phase", 1, "TEST" },
+	{ "PoolMethod", 0, "MAX" }, { "PoolMethod", 1, "AVE" }, { "PoolMethod", 2, "STOCHASTIC" },
+	{ "NormRegion", 0, "ACROSS_CHANNELS" }, { "NormRegion", 1, "WITHIN_CHANNEL" },
+	{ "EltwiseOp", 0, "PROD" }, { "EltwiseOp", 1, "SUM" }, { "EltwiseOp", 2, "MAX" }
+};
+//V1 layer types, with the type string that replaced each of them
+struct CaffeV1Type {
+	int value;
+	const char* name;
+	const char* type;
+};
+static const CaffeV1Type CaffeV1Types[] = {
+	{ 35, "ABSVAL", "AbsVal" }, { 1, "ACCURACY", "Accuracy" }, { 30, "ARGMAX", "ArgMax" },
+	{ 2, "BNLL", "BNLL" }, { 3, "CONCAT", "Concat" }, { 37, "CONTRASTIVE_LOSS", "ContrastiveLoss" },
+	{ 4, "CONVOLUTION", "Convolution" }, { 5, "DATA", "Data" }, { 39, "DECONVOLUTION", "Deconvolution" },
+	{ 6, "DROPOUT", "Dropout" }, { 32, "DUMMY_DATA", "DummyData" }, { 7, "EUCLIDEAN_LOSS", "EuclideanLoss" },
+	{ 25, "ELTWISE", "Eltwise" }, { 38, "EXP", "Exp" }, { 8, "FLATTEN", "Flatten" },
+	{ 9, "HDF5_DATA", "HDF5Data" }, { 10, "HDF5_OUTPUT", "HDF5Output" }, { 28, "HINGE_LOSS", "HingeLoss" },
+	{ 11, "IM2COL", "Im2col" }, { 12, "IMAGE_DATA", "ImageData" }, { 13, "INFOGAIN_LOSS", "InfogainLoss" },
+	{ 14, "INNER_PRODUCT", "InnerProduct" }, { 15, "LRN", "LRN" }, { 29, "MEMORY_DATA", "MemoryData" },
+	{ 16, "MULTINOMIAL_LOGISTIC_LOSS", "MultinomialLogisticLoss" }, { 34, "MVN", "MVN" },
+	{ 17, "POOLING", "Pooling" }, { 26, "POWER", "Power" }, { 18, "RELU", "ReLU" },
+	{ 19, "SIGMOID", "Sigmoid" }, { 27, "SIGMOID_CROSS_ENTROPY_LOSS", "SigmoidCrossEntropyLoss" },
+	{ 36, "SILENCE", "Silence" }, { 20, "SOFTMAX", "Softmax" }, { 21, "SOFTMAX_LOSS", "SoftmaxWithLoss" },
+	{ 22, "SPLIT", "Split" }, { 33, "SLICE", "Slice" }, { 23, "TANH", "TanH" },
+	{ 24, "WINDOW_DATA", "WindowData" }, { 31, "THRESHOLD", "Threshold" }
+};
+static const CaffeField* FindField(const char* message, int number) {
+	for (const CaffeField& f : CaffeFields) {
+		if (f.number == number && std::strcmp(f.message, message) == 0) {
+			return &f;
+		}
+	}
+	return nullptr;
+}
+static std::string GetEnumName(const char* type, uint64_t value) {
+	if (std::strcmp(type, "V1LayerType") == 0) {
+		for (const CaffeV1Type& t : CaffeV1Types) {
+			if ((uint64_t) t.value == value)
+				return t.name;
+		}
+	}
+	for (const CaffeEnum& e : CaffeEnums) {
+		if ((uint64_t) e.value == value && std::strcmp(e.type, type) == 0) {
+			return e.name;
+		}
+	}
+	return std::to_string(value);
+}
+static std::string GetLayerType(const std::string& type) {
+	for (const CaffeV1Type& t : CaffeV1Types) {
+		if (type == t.name)
+			return t.type;
+	}
+	return type;
+}
+static std::string FormatFloat(float value) {
+	std::stringstream ss;
+	ss << std::setprecision(9) << value;
+	return ss.str();
+}
+static uint64_t ReadVarint(const char*& p, const char* end) {
+	uint64_t value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (p >= end) {
+			throw std::runtime_error("Caffe model is truncated.");
+		}
+		uint8_t byte = (uint8_t) *p++;
+		value |= (uint64_t) (byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			return value;
+		}
+	}
+	throw std::runtime_error("Caffe model has a corrupt varint.");
+}
+static void AddVarint(const CaffeField& field, uint64_t value, CaffeMessage& msg) {
+	std::string text;
+	switch (field.kind) {
+	case CaffeKind::Int:
+		text = std::to_string((int64_t) value);
+		break;
+	case CaffeKind::Bool:
+		text = (value != 0) ? "true" : "false";
+		break;
+	case CaffeKind::Enum:
+		text = GetEnumName(field.type, value);
+		break;
+	default:
+		return;
+	}
+	msg.values.push_back(std::make_pair(field.name, text));
+}
+static void ParseBinary(const char* p, const char* end, const char* type, CaffeMessage& msg) {
+	while (p < end) {
+		uint64_t key = ReadVarint(p, end);
+		const CaffeField* field = FindField(type, (int) (key >> 3));
+		switch (key & 7) {
+		case 0: {
+			uint64_t value = ReadVarint(p, end);
+			if (field != nullptr) {
+				AddVarint(*field, value, msg);
+			}
+			break;
+		}
+		case 1: {
+			if (end - p < 8) {
+				throw std::runtime_error("Caffe model is truncated.");
+			}
+			if (field != nullptr && field->kind == CaffeKind::Doubles) {
+				double value;
+				std::memcpy(&value, p, sizeof(value));
+				msg.floats.push_back((float) value);
+			}
+			p += 8;
+			break;
+		}
+		case 5: {
+			if (end - p < 4) {
+				throw std::runtime_error("Caffe model is truncated.");
+			}
+			float value;
+			std::memcpy(&value, p, sizeof(value));
+			if (field != nullptr && field->kind == CaffeKind::Float) {
+				msg.values.push_back(std::make_pair(field->name, FormatFloat(value)));
+			} else if (field != nullptr && field->kind == CaffeKind::Floats) {
+				msg.floats.push_back(value);
+			}
+			p += 4;
+			break;
+		}
+		case 2: {
+			uint64_t length = ReadVarint(p, end);
+			if (length > (uint64_t) (end - p)) {
+				throw std::runtime_error("Caffe model is truncated.");
+			}
+			const char* next = p + length;
+			if (field == nullptr) {
+				//skipped
+			} else if (field->kind == CaffeKind::String) {
+				msg.values.push_back(std::make_pair(field->name, std::string(p, (size_t) length)));
+			} else if (field->kind == CaffeKind::Message) {
+				std::shared_ptr<CaffeMessage> child(new CaffeMessage());
+				ParseBinary(p, next, field->type, *child);
+				msg.messages.push_back(std::make_pair(field->name, child));
+			} else if (field->kind == CaffeKind::Floats && msg.packed == nullptr && msg.floats.size() == 0) {
+				//left in the file, copied once straight into the weights
+				msg.packed = p;
+				msg.packedCount = (size_t) (length / sizeof(float));
+			} else if (field->kind == CaffeKind::Floats || field->kind == CaffeKind::Doubles) {
+				if (msg.packed != nullptr) {
+					msg.floats.resize(msg.packedCount);
+					std::memcpy(msg.floats.data(), msg.packed, msg.packedCount * sizeof(float));
+					msg.packed = nullptr;
+				}
+				size_t width = (field->kind == CaffeKind::Floats) ? sizeof(float) : sizeof(double);
+				for (const char* q = p; q + width <= next; q += width) {
+					if (field->kind == CaffeKind::Floats) {
+						float value;
+						std::memcpy(&value, q, sizeof(value));
+						msg.floats.push_back(value);
+					} else {
+						double value;
+						std::memcpy(&value, q, sizeof(value));
+						msg.floats.push_back((float) value);
+					}
+				}
+			} else if (field->kind == CaffeKind::Float) {
+				for (const char* q = p; q + sizeof(float) <= next; q += sizeof(float)) {
+					float value;
+					std::memcpy(&value, q, sizeof(value));
+					msg.values.push_back(std::make_pair(field->name, FormatFloat(value)));
+				}
+			} else {
+				//packed repeated varints
+				const char* q = p;
+				while (q < next) {
+					AddVarint(*field, ReadVarint(q, next), msg);
+				}
+			}
+			p = next;
+			break;
+		}
+		default:
+			throw std::runtime_error("Caffe model uses an unsupported protobuf wire type.");
+		}
+	}
+}
+class CaffeTextParser {
+protected:
+	const std::string& text;
+	const std::string& file;
+	size_t pos = 0;
+	int line = 1;
+	void fail(const std::string& message) const {
+		throw std::runtime_error(aly::MakeString() << file << ":" << line << ": " << message);
+	}
+	void skipSpace() {
+		while (pos < text.size()) {
+			char c = text[pos];
+			if (c == '#') {
+				while (pos < text.size() && text[pos] != '\n')
+					pos++;
+			} else if (c == '\n') {
+				line++;
+				pos++;
+			} else if (std::isspace((unsigned char) c)) {
+				pos++;
+			} else {
+				break;
+			}
+		}
+	}
+	std::string readToken() {
+		skipSpace();
+		if (pos >= text.size()) {
+			fail("unexpected end of file");
+		}
+		char quote = text[pos];
+		if (quote == '"' || quote == '\'') {
+			std::string value;
+			for (pos++; pos < text.size() && text[pos] != quote; pos++) {
+				if (text[pos] == '\\' && pos + 1 < text.size())
+					pos++;
+				value += text[pos];
+			}
+			if (pos >= text.size()) {
+				fail("unterminated string");
+			}
+			pos++;
+			return value;
+		}
+		size_t start = pos;
+		while (pos < text.size() && !std::isspace((unsigned char) text[pos]) && std::strchr(":{}[],;#", text[pos]) == nullptr) {
+			pos++;
+		}
+		if (pos == start) {
+			fail(std::string("unexpected '") + text[pos] + "'");
+		}
+		return text.substr(start, pos - start);
+	}
+	void addValue(CaffeMessage& msg, const std::string& messageName, const std::string& name, const std::string& value) {
+		if (messageName == "blobs" && (name == "data" || name == "double_data")) {
+			msg.floats.push_back(std::strtof(value.c_str(), nullptr));
+		} else {
+			msg.values.push_back(std::make_pair(name, value));
+		}
+	}
+public:
+	CaffeTextParser(const std::string& text, const std::string& file) :
+			text(text), file(file) {
+	}
+	void parse(CaffeMessage& msg, const std::string& messageName, bool nested) {
+		while (true) {
+			skipSpace();
+			if (pos >= text.size()) {
+				if (nested) {
+					fail("missing }");
+				}
+				return;
+			}
+			char c = text[pos];
+			if (c == '}') {
+				if (!nested) {
+					fail("unexpected }");
+				}
+				pos++;
+				return;
+			}
+			if (c == ',' || c == ';') {
+				pos++;
+				continue;
+			}
+			std::string name = readToken();
+			skipSpace();
+			bool colon = (pos < text.size() && text[pos] == ':');
+			if (colon) {
+				pos++;
+				skipSpace();
+			}
+			if (pos < text.size() && text[pos] == '{') {
+				pos++;
+				std::shared_ptr<CaffeMessage> child(new CaffeMessage());
+				parse(*child, name, true);
+				msg.messages.push_back(std::make_pair(name, child));
+			} else if (!colon) {
+				fail("expected ':' after " + name);
+			} else if (pos < text.size() && text[pos] == '[') {
+				for (pos++;;) {
+					skipSpace();
+					if (pos < text.size() && text[pos] == ']') {
+						pos++;
+						break;
+					}
+					addValue(msg, messageName, name, readToken());
+					skipSpace();
+					if (pos < text.size() && text[pos] == ',')
+						pos++;
+				}
+			} else {
+				addValue(msg, messageName, name, readToken());
+			}
+		}
+	}
+};
+//a caffemodel mapped read-only, so blobs are never copied on the way in
+struct CaffeModelFile {
+	const char* base = nullptr;
+	size_t size = 0;
+	bool mapped = false;
+	std::vector<char> buffer;
+	CaffeModelFile(const std::string& file) {
+#ifndef _WIN32
+		int fd = ::open(file.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw std::runtime_error("Could not open " + file);
+		}
+		struct stat st;
+		if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+			size = (size_t) st.st_size;
+			void* ptr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (ptr != MAP_FAILED) {
+				base = (const char*) ptr;
+				mapped = true;
+			}
+		}
+		::close(fd);
+		if (mapped) {
+			return;
+		}
+#endif
+		std::ifstream is(file, std::ios::binary | std::ios::ate);
+		if (!is.is_open()) {
+			throw std::runtime_error("Could not open " + file);
+		}
+		buffer.resize((size_t) is.tellg());
+		is.seekg(0);
+		if (!is.read(buffer.data(), buffer.size())) {
+			throw std::runtime_error("Could not read " + file);
+		}
+		base = buffer.data();
+		size = buffer.size();
+	}
+	~CaffeModelFile() {
+#ifndef _WIN32
+		if (mapped) {
+			munmap((void*) base, size);
+		}
+#endif
+	}
+};
+enum class BlobLayout {
+	Direct, //same layout as the signal
+	Transposed, //InnerProduct weights, Caffe stores [out][in] and tgr [in][out]
+	Grouped //grouped convolution, Caffe leaves out the unconnected kernels
+};
+struct CaffeBlobLoad {
+	NeuralLayerPtr layer;
+	int channel; //input signal that receives the blob
+	const CaffeMessage* blob;
+	BlobLayout layout;
+	int rows, cols; //Caffe blob dimensions for Transposed and Grouped
+	int area; //kernel area for Grouped
+	tiny_dnn::core::ConnectionTable table;
+};
+//where a Caffe blob comes from, with the shape Caffe gives it
+struct CaffeTop {
+	NeuralLayerPtr layer;
+	int index;
+	aly::dim3 shape;
+};
+static const size_t BlobBlock = 1 << 16;
+class CaffeBuilder {
+protected:
+	BackendType backend;
+	std::map<std::string, const CaffeMessage*> trained;
+	std::map<std::string, CaffeTop> tops;
+	std::vector<NeuralLayerPtr> inputs;
+	std::vector<NeuralLayerPtr> layers;
+	std::vector<NeuralLayerPtr> untrained; //random initialization skipped
+	std::vector<CaffeBlobLoad> loads;
+	std::vector<std::function<void()>> fixups; //run once the system is built
+	static aly::dim3 GetShape(const CaffeMessage& shape, const std::string& name) {
+		std::vector<std::string> dims = shape.getAll("dim");
+		return GetShape(std::vector<std::string>(dims.begin(), dims.end()), name);
+	}
+	static aly::dim3 GetShape(const std::vector<std::string>& dims, const std::string& name) {
+		//N x C x H x W, the batch size is ignored
+		if (dims.size() < 2 || dims.size() > 4) {
+			throw std::runtime_error("Caffe input " + name + " must have 2 to 4 dimensions.");
+		}
+		int c = std::atoi(dims[1].c_str());
+		int h = (dims.size() > 2) ? std::atoi(dims[2].c_str()) : 1;
+		int w = (dims.size() > 3) ? std::atoi(dims[3].c_str()) : 1;
+		return aly::dim3(w, h, c);
+	}
+	static std::string GetName(const CaffeMessage& def) {
+		return def.get("name", "");
+	}
+	static int GetDimension(const CaffeMessage& p, const std::string& single, const std::string& all, int index, int def) {
+		if (p.has(single)) {
+			return p.getInt(single, def);
+		}
+		std::vector<std::string> values = p.getAll(all);
+		if (values.size() == 0) {
+			return def;
+		}
+		return std::atoi(values[std::min((size_t) index, values.size() - 1)].c_str());
+	}
+	static Padding GetPadding(const std::string& name, int pad, int kernel) {
+		if (pad == 0) {
+			return Padding::Valid;
+		} else if (pad == (kernel - 1) / 2) {
+			return Padding::Same;
+		}
+		throw std::runtime_error(aly::MakeString() << "Caffe layer " << name << " pads by " << pad << ", tgr only supports valid or same padding.");
+	}
+	static void CheckShape(const std::string& name, const aly::dim3& caffe, const aly::dim3& tgr) {
+		if (caffe.x != tgr.x || caffe.y != tgr.y) {
+			throw std::runtime_error(aly::MakeString() << "Caffe layer " << name << " produces " << caffe.x << "x" << caffe.y << " but the tgr layer produces " << tgr.x << "x" << tgr.y << ".");
+		}
+	}
+	static int FindChannel(const NeuralLayer& layer, ChannelType type) {
+		std::vector<ChannelType> types = layer.getInputTypes();
+		for (size_t i = 0; i < types.size(); i++) {
+			if (types[i] == type)
+				return (int) i;
+		}
+		return -1;
+	}
+	const CaffeTop& getBottom(const CaffeMessage& def, int index) {
+		std::vector<std::string> bottoms = def.getAll("bottom");
+		if (index >= (int) bottoms.size()) {
+			throw std::runtime_error("Caffe layer " + GetName(def) + " is missing an input.");
+		}
+		auto it = tops.find(bottoms[index]);
+		if (it == tops.end()) {
+			throw std::runtime_error("Caffe layer " + GetName(def) + " reads blob " + bottoms[index] + ", which no layer produces.");
+		}
+		return it->second;
+	}
+	std::vector<const CaffeMessage*> getBlobs(const CaffeMessage& def) {
+		std::vector<const CaffeMessage*> blobs = def.getMessages("blobs");
+		if (blobs.size() == 0) {
+			auto it = trained.find(GetName(def));
+			if (it != trained.end()) {
+				blobs = it->second->getMessages("blobs");
+			}
+		}
+		return blobs;
+	}
+	//the blob of an input signal is loaded after the system is built
+	void load(const CaffeMessage& def, const NeuralLayerPtr& layer, ChannelType type, const CaffeMessage* blob, BlobLayout layout = BlobLayout::Direct, int rows = 0, int cols = 0, int area = 0,
+			const tiny_dnn::core::ConnectionTable& table = tiny_dnn::core::ConnectionTable()) {
+		CaffeBlobLoad b;
+		b.layer = layer;
+		b.channel = FindChannel(*layer, type);
+		b.blob = blob;
+		b.layout = layout;
+		b.rows = rows;
+		b.cols = cols;
+		b.area = area;
+		b.table = table;
+		if (b.channel < 0) {
+			throw std::runtime_error("Caffe layer " + GetName(def) + " has more blobs than its tgr layer has weights.");
+		}
+		loads.push_back(b);
+	}
+	//weights and bias, when the layer was trained
+	void loadWeights(const CaffeMessage& def, const NeuralLayerPtr& layer, bool bias, BlobLayout layout = BlobLayout::Direct, int rows = 0, int cols = 0, int area = 0,
+			const tiny_dnn::core::ConnectionTable& table = tiny_dnn::core::ConnectionTable()) {
+		std::vector<const CaffeMessage*> blobs = getBlobs(def);
+		if (blobs.size() == 0) {
+			return;
+		}
+		if (blobs.size() < (bias ? 2U : 1U)) {
+			throw std::runtime_error("Caffe layer " + GetName(def) + " is missing its bias.");
+		}
+		load(def, layer, ChannelType::weight, blobs[0], layout, rows, cols, area, table);
+		if (bias) {
+			load(def, layer, ChannelType::bias, blobs[1]);
+		}
+		//nothing to gain from filling weights with random numbers first
+		layer->setTrainable(false);
+		untrained.push_back(layer);
+	}
+	void add(const CaffeMessage& def, const NeuralLayerPtr& layer, int inputCount, const aly::dim3& shape) {
+		layer->setName(GetName(def));
+		for (int i = 0; i < inputCount; i++) {
+			const CaffeTop& bottom = getBottom(def, i);
+			Connect(bottom.layer, layer, bottom.index, i);
+		}
+		std::vector<std::string> outputs = def.getAll("top");
+		if (outputs.size() > 0) {
+			tops[outputs[0]] = CaffeTop { layer, 0, shape };
+		}
+		layers.push_back(layer);
+	}
+	void addInput(const std::string& name, const aly::dim3& shape) {
+		NeuralLayerPtr input = std::make_shared<InputLayer>(shape);
+		input->setName(name);
+		tops[name] = CaffeTop { input, 0, shape };
+		inputs.push_back(input);
+		layers.push_back(input);
+	}
+	void addConvolution(const CaffeMessage& def) {
+		const CaffeMessage* p = def.getMessage("convolution_param");
+		if (p == nullptr) {
+			throw std::runtime_error("Caffe layer " + GetName(def) + " has no convolution_param.");
+		}
+		const CaffeTop& bottom = getBottom(def, 0);
+		aly::dim3 in = bottom.shape;
+		for (const std::string& d : p->getAll("dilation")) {
+			if (std::atoi(d.c_str()) != 1) {
+				throw std::runtime_error("Caffe layer " + GetName(def) + " uses dilation, which tgr does not support.");
+			}
+		}
+		int kh = GetDimension(*p, "kernel_h", "kernel_size", 0, 0);
+		int kw = GetDimension(*p, "kernel_w", "kernel_size", 1, 0);
+		int sh = GetDimension(*p, "stride_h", "stride", 0, 1);
+		int sw = GetDimension(*p, "stride_w", "stride", 1, 1);
+		int ph = GetDimension(*p, "pad_h", "pad", 0, 0);
+		int pw = GetDimension(*p, "pad_w", "pad", 1, 0);
+		int out = p->getInt("num_output", 0);
+		int group = p->getInt("group", 1);
+		bool bias = p->getBool("bias_term", true);
+		if (kw <= 0 || kh <= 0 || out <= 0) {
+			throw std::runtime_error("Caffe layer " + GetName(def) + " needs kernel_size and num_output.");
+		}
+		Padding pad = GetPadding(GetName(def), pw, kw);
+		if (GetPadding(GetName(def), ph, kh) != pad) {
+			throw std::runtime_error("Caffe layer " + GetName(def) + " pads its width and height differently.");
+		}
+		tiny_dnn::core::ConnectionTable table;
+		if (group > 1) {
+			table = tiny_dnn::core::ConnectionTable(group, in.z, out);
+		}
+		std::shared_ptr<ConvolutionLayer> conv = std::make_shared<ConvolutionLayer>(in.x, in.y, kw, kh, in.z, out, table, pad, bias, sw, sh, backend);
+		aly::dim3 shape((in.x + 2 * pw - kw) / sw + 1, (in.y + 2 * ph - kh) / sh + 1, out);
+		CheckShape(GetName(def), shape, conv->getOutputDimensions()[0]);
+		if (group > 1) {
+			loadWeights(def, conv, bias, BlobLayout::Grouped, out, in.z / group, kw * kh, table);
+		} else {
+			loadWeights(def, conv, bias);
+		}
+		add(def, conv, 1, shape);
+	}
+	void addInnerProduct(const CaffeMessage& def) {
+		const CaffeMessage* p = def.getMessage("inner_product_param");
+		if (p == nullptr) {
+			throw std::runtime_error("Caffe layer " + GetName(def) + " has no inner_product_param.");
+		}
+		if (p->getInt("axis", 1) != 1) {
+			throw std::runtime_error("Caffe layer " + GetName(def) + " must flatten from axis 1.");
+		}
+		int in = (int) getBottom(def, 0).shape.volume();
+		int out = p->getInt("num_output", 0);
+		bool bias = p->getBool("bias_term", true);
+		NeuralLayerPtr fc = std::make_shared<FullyConnectedLayer>(in, out, bias, backend);
+		//a transposed Caffe layer already stores [in][out]
+		loadWeights(def, fc, bias, p->getBool("transpose", false) ? BlobLayout::Direct : BlobLayout::Transposed, out, in);
+		add(def, fc, 1, aly::dim3(out, 1, 1));
+	}
+	void addPooling(const CaffeMessage& def) {
+		const CaffeMessage* p = def.getMessage("pooling_param");
+		if (p == nullptr) {
+			throw std::runtime_error("Caffe layer " + GetName(def) + " has no pooling_param.");
+		}
+		aly::dim3 in = getBottom(def, 0).shape;
+		std::string method = p->get("pool", "MAX");
+		if (method != "MAX" && method != "AVE") {
+			throw std::runtime_error("Caffe layer " + GetName(def) + " uses " + method + " pooling, which tgr does not support.");
+		}
+		if (p->getBool("global_pooling", false)) {
+			if (method == "AVE") {
+				add(def, std::make_shared<GlobalAveragePoolingLayer>(in, backend), 1, aly::dim3(1, 1, in.z));
+			} else {
+				add(def, std::make_shared<MaxPoolingLayer>(in.x, in.y, in.z, in.x, in.y, 1, 1, Padding::Valid, backend), 1, aly::dim3(1, 1, in.z));
+			}
+			return;
+		}
+		int kh = p->has("kernel_h") ? p->getInt("kernel_h", 0) : p->getInt("kernel_size", 0);
+		int kw = p->has("kernel_w") ? p->getInt("kernel_w", 0) : p->getInt("kernel_size", 0);
+		int sh = p->has("stride_h") ? p->getInt("stride_h", 1) : p->getInt("stride", 1);
+		int sw = p->has("stride_w") ? p->getInt("stride_w", 1) : p->getInt("stride", 1);
+		int ph = p->has("pad_h") ? p->getInt("pad_h", 0) : p->getInt("pad", 0);
+		int pw = p->has("pad_w") ? p->getInt("pad_w", 0) : p->getInt("pad", 0);
+		if (kw <= 0 || kh <= 0) {
+			throw std::runtime_error("Caffe layer " + GetName(def) + " needs kernel_size.");
+		}
+		Padding pad = GetPadding(GetName(def), pw, kw);
+		if (GetPadding(GetName(def), ph, kh) != pad) {
+			throw std::runtime_error("Caffe layer " + GetName(def) + " pads its width and height differently.");
+		}
+		//Caffe rounds pooled sizes up and drops a last window that starts in the padding
+		auto pooled = [](int size, int kernel, int stride, int pad) {
+			int n = (size + 2 * pad - kernel + stride - 1) / stride + 1;
+			if (pad > 0 && (n - 1) * stride >= size + pad) {
+				n--;
+			}
+			return n;
+		};
+		aly::dim3 shape(pooled(in.x, kw, sw, pw), pooled(in.y, kh, sh, ph), in.z);
+		NeuralLayerPtr pool;
+		if (method == "MAX") {
+			pool = std::make_shared<MaxPoolingLayer>(in.x, in.y, in.z, kw, kh, sw, sh, pad, backend);
+		} else {
+			pool = std::make_shared<AveragePoolingLayer>(in.x, in.y, in.z, kw, kh, sw, sh, pad);
+			//tgr average pooling has weights, Caffe's is a plain average
+			pool->setTrainable(false);
+			fixups.push_back([pool] {
+				std::vector<ChannelType> types = pool->getInputTypes();
+				for (size_t i = 0; i < types.size(); i++) {
+					if (isTrainableWeight(types[i])) {
+						Storage& w = pool->getInputWeights(i);
+						std::fill(w.begin(), w.end(), (types[i] == ChannelType::weight) ? 1.0f : 0.0f);
+					}
+				}
+			});
+		}
+		CheckShape(GetName(def), shape, pool->getOutputDimensions()[0]);
+		add(def, pool, 1, shape);
+	}
+	void addBatchNorm(const CaffeMessage& def) {
+		const CaffeMessage* p = def.getMessage("batch_norm_param");
+		const CaffeTop& bottom = getBottom(def, 0);
+		float eps = (p != nullptr) ? p->getFloat("eps", 1E-5f) : 1E-5f;
+		float momentum = (p != nullptr) ? p->getFloat("moving_average_fraction", 0.999f) : 0.999f;
+		aly::dim3 produced = bottom.layer->getOutputDimensions(bottom.index);
+		if (produced.x != bottom.shape.x || produced.y != bottom.shape.y || produced.z != bottom.shape.z) {
+			throw std::runtime_error("Caffe layer " + GetName(def) + " normalizes the output of " + bottom.layer->getName() + ", which tgr BatchNorm cannot take its channels from.");
+		}
+		std::shared_ptr<BatchNormalizationLayer> bn = std::make_shared<BatchNormalizationLayer>(*bottom.layer, eps, momentum);
+		std::vector<const CaffeMessage*> blobs = getBlobs(def);
+		if (blobs.size() > 0) {
+			if (blobs.size() != 3 || blobs[2]->getDataCount() < 1) {
+				throw std::runtime_error("Caffe layer " + GetName(def) + " should store mean, variance and a scale factor.");
+			}
+			std::string name = GetName(def);
+			int channels = bottom.shape.z;
+			//Caffe keeps running sums, divided by the factor in the third blob
+			fixups.push_back([bn, blobs, channels, name] {
+				float factor;
+				blobs[2]->readData(0, 1, &factor);
+				factor = (factor == 0.0f) ? 0.0f : 1.0f / factor;
+				Storage mean(channels), variance(channels);
+				if (blobs[0]->getDataCount() != (size_t) channels || blobs[1]->getDataCount() != (size_t) channels) {
+					throw std::runtime_error("Caffe layer " + name + " has statistics for the wrong number of channels.");
+				}
+				blobs[0]->readData(0, channels, mean.data());
+				blobs[1]->readData(0, channels, variance.data());
+				for (int c = 0; c < channels; c++) {
+					mean[c] *= factor;
+					variance[c] *= factor;
+				}
+				bn->setMean(mean);
+				bn->setVariance(variance);
+			});
+		}
+		add(def, bn, 1, bottom.shape);
+	}
+	void addConcat(const CaffeMessage& def) {
+		const CaffeMessage* p = def.getMessage("concat_param");
+		int axis = (p == nullptr) ? 1 : (p->has("axis") ? p->getInt("axis", 1) : p->getInt("concat_dim", 1));
+		if (axis != 1) {
+			throw std::runtime_error("Caffe layer " + GetName(def) + " concatenates along an axis other than channels.");
+		}
+		int count = (int) def.getAll("bottom").size();
+		std::vector<aly::dim3> shapes;
+		aly::dim3 shape(0, 0, 0);
+		for (int i = 0; i < count; i++) {
+			shapes.push_back(getBottom(def, i).shape);
+			shape = aly::dim3(shapes[i].x, shapes[i].y, shape.z + shapes[i].z);
+		}
+		add(def, std::make_shared<ConcatLayer>(shapes), count, shape);
+	}
+	void addEltwise(const CaffeMessage& def) {
+		const CaffeMessage* p = def.getMessage("eltwise_param");
+		if (p != nullptr) {
+			if (p->get("operation", "SUM") != "SUM") {
+				throw std::runtime_error("Caffe layer " + GetName(def) + " uses an element wise operation other than a sum.");
+			}
+			for (const std::string& c : p->getAll("coeff")) {
+				if (std::strtof(c.c_str(), nullptr) != 1.0f) {
+					throw std::runtime_error("Caffe layer " + GetName(def) + " weights its sum, which tgr does not support.");
+				}
+			}
+		}
+		int count = (int) def.getAll("bottom").size();
+		aly::dim3 shape = getBottom(def, 0).shape;
+		add(def, std::make_shared<AddElementsLayer>(count, (int) shape.volume()), count, shape);
+	}
+	void addLayer(const CaffeMessage& def) {
+		std::string type = GetLayerType(def.get("type", ""));
+		std::string name = GetName(def);
+		for (const CaffeMessage* rule : def.getMessages("include")) {
+			if (rule->get("phase", "") == "TRAIN") {
+				return;
+			}
+		}
+		if (type == "Input") {
+			const CaffeMessage* p = def.getMessage("input_param");
+			std::vector<const CaffeMessage*> shapes;
+			if (p != nullptr) {
+				shapes = p->getMessages("shape");
+			}
+			std::vector<std::string> outputs = def.getAll("top");
+			if (shapes.size() == 0) {
+				throw std::runtime_error("Caffe input " + name + " has no shape.");
+			}
+			for (size_t i = 0; i < outputs.size(); i++) {
+				addInput(outputs[i], GetShape(*shapes[std::min(i, shapes.size() - 1)], outputs[i]));
+			}
+		} else if (type == "Data" || type == "ImageData" || type == "HDF5Data" || type == "MemoryData" || type == "WindowData" || type == "DummyData") {
+			throw std::runtime_error("Caffe layer " + name + " reads a data source; import the deploy prototxt, which declares the input shape instead.");
+		} else if (type == "Convolution") {
+			addConvolution(def);
+		} else if (type == "InnerProduct") {
+			addInnerProduct(def);
+		} else if (type == "Pooling") {
+			addPooling(def);
+		} else if (type == "LRN") {
+			const CaffeMessage empty = CaffeMessage();
+			const CaffeMessage* p = def.getMessage("lrn_param");
+			if (p == nullptr)
+				p = &empty;
+			if (p->getFloat("k", 1.0f) != 1.0f) {
+				throw std::runtime_error("Caffe layer " + name + " sets k, tgr LRN always uses 1.");
+			}
+			aly::dim3 in = getBottom(def, 0).shape;
+			norm_region region = (p->get("norm_region", "ACROSS_CHANNELS") == "WITHIN_CHANNEL") ? norm_region::within_channels : norm_region::across_channels;
+			add(def, std::make_shared<LocalResponseNormLayer>(in, p->getInt("local_size", 5), p->getFloat("alpha", 1.0f), p->getFloat("beta", 0.75f), region), 1, in);
+		} else if (type == "ReLU") {
+			const CaffeMessage* p = def.getMessage("relu_param");
+			aly::dim3 in = getBottom(def, 0).shape;
+			add(def, std::make_shared<ReLULayer>(in.x, in.y, in.z, (p != nullptr) ? p->getFloat("negative_slope", 0.0f) : 0.0f), 1, in);
+		} else if (type == "TanH") {
+			aly::dim3 in = getBottom(def, 0).shape;
+			add(def, std::make_shared<TanhLayer>(in.x, in.y, in.z), 1, in);
+		} else if (type == "Dropout") {
+			const CaffeMessage* p = def.getMessage("dropout_param");
+			aly::dim3 in = getBottom(def, 0).shape;
+			add(def, std::make_shared<DropOutLayer>((int) in.volume(), (p != nullptr) ? p->getFloat("dropout_ratio", 0.5f) : 0.5f), 1, in);
+		} else if (type == "BatchNorm") {
+			addBatchNorm(def);
+		} else if (type == "Power") {
+			const CaffeMessage empty = CaffeMessage();
+			const CaffeMessage* p = def.getMessage("power_param");
+			if (p == nullptr)
+				p = &empty;
+			if (p->getFloat("shift", 0.0f) != 0.0f) {
+				throw std::runtime_error("Caffe layer " + name + " shifts its input, which tgr PowerLayer does not support.");
+			}
+			aly::dim3 in = getBottom(def, 0).shape;
+			add(def, std::make_shared<PowerLayer>(in, p->getFloat("power", 1.0f), p->getFloat("scale", 1.0f)), 1, in);
+		} else if (type == "Concat") {
+			addConcat(def);
+		} else if (type == "Eltwise") {
+			addEltwise(def);
+		} else if (type == "Split" || type == "Flatten") {
+			//no data is moved, the tops are other names for the bottom
+			CaffeTop bottom = getBottom(def, 0);
+			if (type == "Flatten") {
+				bottom.shape = aly::dim3((int) bottom.shape.volume(), 1, 1);
+			}
+			for (const std::string& top : def.getAll("top")) {
+				tops[top] = bottom;
+			}
+		} else if (type == "Softmax" || type == "Accuracy" || type == "Silence" || type.find("Loss") != std::string::npos) {
+			//the loss function applies softmax during training
+		} else {
+			throw std::runtime_error("Caffe layer " + name + " has type " + type + ", which has no tgr layer.");
+		}
+	}
+	void copyBlob(const CaffeBlobLoad& b, Storage& w, size_t begin, size_t end) {
+		switch (b.layout) {
+		case BlobLayout::Direct:
+			b.blob->readData(begin, end - begin, w.data() + begin);
+			break;
+		case BlobLayout::Transposed: {
+			//rows of the Caffe blob, scattered into columns of the signal
+			std::vector<float> row(b.cols);
+			for (size_t r = begin; r < end; r++) {
+				b.blob->readData(r * b.cols, b.cols, row.data());
+				for (int c = 0; c < b.cols; c++) {
+					w[(size_t) c * b.rows + r] = row[c];
+				}
+			}
+			break;
+		}
+		case BlobLayout::Grouped: {
+			//one output channel per task, unconnected kernels stay zero
+			int inputs = (int) (w.size() / ((size_t) b.rows * b.area));
+			for (size_t o = begin; o < end; o++) {
+				size_t src = o * b.cols * b.area;
+				for (int i = 0; i < inputs; i++) {
+					float* dst = w.data() + (o * inputs + i) * b.area;
+					if (b.table.isConnected((int) o, i)) {
+						b.blob->readData(src, b.area, dst);
+						src += b.area;
+					} else {
+						std::fill(dst, dst + b.area, 0.0f);
+					}
+				}
+			}
+			break;
+		}
+		}
+	}
+	void loadBlobs() {
+		struct Block {
+			size_t load;
+			size_t begin;
+			size_t end;
+		};
+		std::vector<Block> blocks;
+		for (size_t i = 0; i < loads.size(); i++) {
+			const CaffeBlobLoad& b = loads[i];
+			Storage& w = b.layer->getInputWeights(b.channel);
+			size_t expected = (b.layout == BlobLayout::Grouped) ? (size_t) b.rows * b.cols * b.area : w.size();
+			if (b.blob->getDataCount() != expected) {
+				throw std::runtime_error(aly::MakeString() << "Caffe layer " << b.layer->getName() << " has a blob of " << b.blob->getDataCount() << " values where tgr expects " << expected << ".");
+			}
+			//direct copies split by values, the others by Caffe rows
+			size_t count = (b.layout == BlobLayout::Direct) ? w.size() : (size_t) b.rows;
+			size_t step = (b.layout == BlobLayout::Direct) ? BlobBlock : std::max((size_t) 1, BlobBlock / std::max((size_t) 1, expected / std::max(count, (size_t) 1)));
+			for (size_t start = 0; start < count; start += step) {
+				blocks.push_back(Block { i, start, std::min(count, start + step) });
+			}
+		}
+		NeuralThreadPool::parallelForEach(0, blocks.size(), [&](size_t k) {
+			const CaffeBlobLoad& b = loads[blocks[k].load];
+			copyBlob(b, b.layer->getInputWeights(b.channel), blocks[k].begin, blocks[k].end);
+		}, 1);
+	}
+public:
+	CaffeBuilder(BackendType backend) :
+			backend(backend) {
+	}
+	std::shared_ptr<NeuralSystem> build(const CaffeMessage& net, const CaffeMessage* weights) {
+		if (weights != nullptr) {
+			for (const char* field : { "layer", "layers" }) {
+				for (const CaffeMessage* layer : weights->getMessages(field)) {
+					if (layer->getMessages("blobs").size() > 0) {
+						trained[GetName(*layer)] = layer;
+					}
+				}
+			}
+		}
+		//inputs declared on the net rather than as Input layers
+		std::vector<std::string> names = net.getAll("input");
+		std::vector<const CaffeMessage*> shapes = net.getMessages("input_shape");
+		std::vector<std::string> dims = net.getAll("input_dim");
+		for (size_t i = 0; i < names.size(); i++) {
+			if (i < shapes.size()) {
+				addInput(names[i], GetShape(*shapes[i], names[i]));
+			} else if (dims.size() >= 4 * (i + 1)) {
+				addInput(names[i], GetShape(std::vector<std::string>(dims.begin() + 4 * i, dims.begin() + 4 * (i + 1)), names[i]));
+			} else {
+				throw std::runtime_error("Caffe input " + names[i] + " has no shape.");
+			}
+		}
+		std::vector<const CaffeMessage*> defs = net.getMessages("layer");
+		if (defs.size() == 0) {
+			defs = net.getMessages("layers");
+		}
+		for (const CaffeMessage* def : defs) {
+			addLayer(*def);
+		}
+		if (inputs.size() == 0) {
+			throw std::runtime_error("Caffe network has no inputs.");
+		}
+		std::vector<NeuralLayerPtr> outputs;
+		for (const NeuralLayerPtr& layer : layers) {
+			if (layer->getOutputLayers().size() == 0) {
+				outputs.push_back(layer);
+			}
+		}
+		std::shared_ptr<NeuralSystem> sys(new NeuralSystem(net.get("name", "caffe"), nullptr));
+		sys->build(inputs, outputs);
+		loadBlobs();
+		for (const std::function<void()>& f : fixups) {
+			f();
+		}
+		for (const NeuralLayerPtr& layer : untrained) {
+			layer->setTrainable(true);
+		}
+		return sys;
+	}
+};
+std::shared_ptr<NeuralSystem> ReadCaffeModel(const std::string& prototxt, const std::string& caffemodel, BackendType backend) {
+	if (prototxt.size() == 0 && caffemodel.size() == 0) {
+		throw std::runtime_error("Caffe import needs a prototxt or a caffemodel.");
+	}
+	CaffeMessage net;
+	if (prototxt.size() > 0) {
+		std::ifstream is(prototxt);
+		if (!is.is_open()) {
+			throw std::runtime_error("Could not open " + prototxt);
+		}
+		std::stringstream ss;
+		ss << is.rdbuf();
+		std::string text = ss.str();
+		CaffeTextParser(text, prototxt).parse(net, "", false);
+	}
+	std::unique_ptr<CaffeModelFile> file;
+	CaffeMessage trained;
+	if (caffemodel.size() > 0) {
+		file.reset(new CaffeModelFile(caffemodel));
+		ParseBinary(file->base, file->base + file->size, "NetParameter", trained);
+	}
+	CaffeBuilder builder(backend);
+	return builder.build((prototxt.size() > 0) ? net : trained, (caffemodel.size() > 0) ? &trained : nullptr);
+}
+}
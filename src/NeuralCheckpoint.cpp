@@ -0,0 +1,269 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralCheckpoint.h"
+#include "NeuralSystem.h"
+#include "NeuralMemory.h"
+#include "NeuralThreadPool.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+namespace tgr {
+typedef std::chrono::high_resolution_clock Clock;
+static const int CheckpointSite = NeuralMemory::registerSite("checkpoint");
+//floats copied per task, so one large layer is still split across workers
+static const size_t CopyBlock = 1 << 16;
+struct CheckpointSnapshot {
+	int iteration;
+	std::string file;
+	std::string name;
+	std::vector<Storage> buffers;
+	std::vector<KnowledgeTensor> tensors; //data points into buffers
+	std::map<int, std::string> layerNames;
+};
+static double Seconds(Clock::time_point start) {
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+NeuralCheckpointer::NeuralCheckpointer(const CheckpointOptions& options) :
+		options(options), writing(false), stopping(false) {
+	writer = std::thread([this] {
+		run();
+	});
+}
+NeuralCheckpointer::~NeuralCheckpointer() {
+	{
+		std::lock_guard<std::mutex> lockMe(lock);
+		stopping = true;
+	}
+	changed.notify_all();
+	//the writer drains the queue before it exits
+	writer.join();
+}
+bool NeuralCheckpointer::isDue(int iteration) const {
+	return (options.interval > 0 && iteration % options.interval == 0);
+}
+std::string NeuralCheckpointer::getFile(int iteration) const {
+	std::stringstream ss;
+	ss << options.directory << "/" << options.prefix << "_" << std::setw(4)
+			<< std::setfill('0') << iteration << ".tgw";
+	return ss.str();
+}
+void NeuralCheckpointer::throwError() {
+	if (error) {
+		std::exception_ptr e = error;
+		error = nullptr;
+		std::rethrow_exception(e);
+	}
+}
+bool NeuralCheckpointer::checkpoint(const NeuralSystem& sys, int iteration,
+		bool force, NeuralOptimizer* optimizer) {
+	if (!force && !isDue(iteration)) {
+		return false;
+	}
+	std::shared_ptr<CheckpointSnapshot> snapshot;
+	{
+		std::unique_lock<std::mutex> lockMe(lock);
+		throwError();
+		auto isBusy = [this] {
+			return ((int) pending.size() + (writing ? 1 : 0)
+					>= std::max(options.maxPending, 1));
+		};
+		if (isBusy()) {
+			if (options.dropWhenBusy) {
+				stats.dropped++;
+				return false;
+			}
+			auto start = Clock::now();
+			changed.wait(lockMe, [&] {
+				return !isBusy() || error;
+			});
+			stats.stallTime += Seconds(start);
+			throwError();
+		}
+		if (spare.size() > 0) {
+			snapshot = spare.back();
+			spare.pop_back();
+		}
+	}
+	auto start = Clock::now();
+	if (snapshot.get() == nullptr) {
+		snapshot.reset(new CheckpointSnapshot());
+	}
+	snapshot->iteration = iteration;
+	snapshot->file = getFile(iteration);
+	snapshot->name = sys.getName();
+	snapshot->tensors.clear();
+	snapshot->layerNames.clear();
+	std::vector<const Storage*> sources;
+	int stateCount = (optimizer != nullptr) ? optimizer->getStateCount() : 0;
+	Storage scalars;
+	if (optimizer != nullptr) {
+		std::vector<float_t> values = optimizer->getScalars();
+		scalars.assign(values.begin(), values.end());
+		KnowledgeTensor t;
+		t.layerId = OptimizerLayerId;
+		t.type = ChannelType::weight;
+		t.index = 0;
+		t.count = scalars.size();
+		t.data = nullptr;
+		t.slot = 1;
+		snapshot->tensors.push_back(t);
+		sources.push_back(&scalars);
+		snapshot->layerNames[OptimizerLayerId] = optimizer->getName();
+	}
+	for (const NeuralLayerPtr& layer : sys) {
+		int weightIndex = 0, biasIndex = 0;
+		for (const SignalPtr& sig : layer->getInputSignals()) {
+			if (sig.get() == nullptr || !isTrainableWeight(sig->type)
+					|| sig->value.size() == 0)
+				continue;
+			KnowledgeTensor t;
+			t.layerId = layer->getId();
+			t.type = sig->type;
+			t.index = (sig->type == ChannelType::bias) ?
+					biasIndex++ : weightIndex++;
+			t.count = sig->value.front().size();
+			t.data = nullptr;
+			snapshot->tensors.push_back(t);
+			sources.push_back(&sig->value.front());
+			//moments missing until the first update are saved as zeros
+			for (int s = 0; s < stateCount; s++) {
+				const Storage* state = optimizer->getState(sig->value.front(), s);
+				t.count = state->size();
+				t.slot = s + 1;
+				snapshot->tensors.push_back(t);
+				sources.push_back(state);
+			}
+		}
+		snapshot->layerNames[layer->getId()] = layer->getName();
+	}
+	//buffers of a recycled snapshot already have the right sizes, so steady
+	//state checkpoints allocate nothing
+	{
+		MemorySiteScope site(CheckpointSite);
+		snapshot->buffers.resize(sources.size());
+		for (size_t i = 0; i < sources.size(); i++) {
+			snapshot->buffers[i].resize(sources[i]->size());
+			snapshot->tensors[i].data = snapshot->buffers[i].data();
+		}
+	}
+	std::vector<std::pair<size_t, size_t>> blocks;
+	for (size_t i = 0; i < sources.size(); i++) {
+		for (size_t b = 0; b < sources[i]->size(); b += CopyBlock) {
+			blocks.push_back(std::make_pair(i, b));
+		}
+	}
+	NeuralThreadPool::parallelForEach(0, blocks.size(), [&](size_t j) {
+		size_t i = blocks[j].first;
+		size_t begin = blocks[j].second;
+		size_t count = std::min(CopyBlock, sources[i]->size() - begin);
+		std::memcpy(snapshot->buffers[i].data() + begin,
+				sources[i]->data() + begin, count * sizeof(float));
+	}, 1);
+	{
+		std::lock_guard<std::mutex> lockMe(lock);
+		stats.captured++;
+		stats.captureTime += Seconds(start);
+		pending.push_back(snapshot);
+	}
+	changed.notify_all();
+	return true;
+}
+void NeuralCheckpointer::run() {
+	std::unique_lock<std::mutex> lockMe(lock);
+	while (true) {
+		changed.wait(lockMe, [this] {
+			return stopping || pending.size() > 0;
+		});
+		if (pending.size() == 0) {
+			break;
+		}
+		std::shared_ptr<CheckpointSnapshot> snapshot = pending.front();
+		pending.pop_front();
+		writing = true;
+		lockMe.unlock();
+		auto start = Clock::now();
+		std::exception_ptr failed;
+		uint64_t bytes = 0;
+		try {
+			//written from this thread only, the pool belongs to training
+			WriteWeightContainer(snapshot->file, snapshot->name,
+					snapshot->tensors, snapshot->layerNames, false);
+			for (const KnowledgeTensor& t : snapshot->tensors) {
+				bytes += t.count * sizeof(float);
+			}
+			if (onWritten) {
+				onWritten(snapshot->iteration, snapshot->file);
+			}
+		} catch (...) {
+			failed = std::current_exception();
+		}
+		std::vector<std::string> expired;
+		lockMe.lock();
+		writing = false;
+		stats.writeTime += Seconds(start);
+		if (failed) {
+			error = failed;
+		} else {
+			stats.written++;
+			stats.bytes += bytes;
+			files.push_back(snapshot->file);
+			while (options.keep > 0 && (int) files.size() > options.keep) {
+				expired.push_back(files.front());
+				files.pop_front();
+			}
+		}
+		spare.push_back(snapshot);
+		changed.notify_all();
+		if (expired.size() > 0) {
+			lockMe.unlock();
+			for (const std::string& file : expired) {
+				std::remove(file.c_str());
+			}
+			lockMe.lock();
+		}
+	}
+}
+void NeuralCheckpointer::flush() {
+	std::unique_lock<std::mutex> lockMe(lock);
+	changed.wait(lockMe, [this] {
+		return (pending.size() == 0 && !writing) || error;
+	});
+	throwError();
+}
+std::vector<std::string> NeuralCheckpointer::getFiles() const {
+	std::lock_guard<std::mutex> lockMe(lock);
+	return std::vector<std::string>(files.begin(), files.end());
+}
+CheckpointStats NeuralCheckpointer::getStats() const {
+	std::lock_guard<std::mutex> lockMe(lock);
+	return stats;
+}
+void NeuralCheckpointer::printStats(std::ostream& out) const {
+	CheckpointStats s = getStats();
+	out << "Checkpoints: " << s.written << " written, " << s.dropped
+			<< " dropped, " << (s.bytes >> 20) << " MB, capture "
+			<< 1000.0 * s.captureTime / std::max(s.captured, 1)
+			<< " ms each, stalled " << s.stallTime << " s, writing "
+			<< s.writeTime << " s" << std::endl;
+}
+}
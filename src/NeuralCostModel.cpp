@@ -0,0 +1,287 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralCostModel.h"
+#include "NeuralKernels.h"
+#include "NeuralSystem.h"
+#include "NeuralThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+namespace tgr {
+typedef std::chrono::high_resolution_clock Clock;
+static uint64_t Volume(const aly::dim3& dims) {
+	return (uint64_t) dims.x * dims.y * dims.z;
+}
+SystemCost NeuralCostModel::analyze(const NeuralSystem& sys, int batchSize) {
+	SystemCost cost;
+	cost.batchSize = batchSize;
+	cost.forwardMACs = 0;
+	cost.backwardMACs = 0;
+	cost.parameterBytes = 0;
+	cost.activationBytes = 0;
+	cost.residentBytes = 0;
+	uint64_t gradientBytes = 0;
+	const int N = (int) sys.size();
+	std::map<const NeuralLayer*, int> order;
+	for (int i = 0; i < N; i++) {
+		order[sys[i].get()] = i;
+	}
+	std::set<NeuralSignal*> signals;
+	for (int i = 0; i < N; i++) {
+		const NeuralLayerPtr layer = sys[i];
+		LayerCost lc;
+		lc.layerId = layer->getId();
+		lc.name = layer->getName();
+		lc.parameterBytes = 0;
+		lc.inputBytes = 0;
+		lc.outputBytes = 0;
+		for (const SignalPtr& sig : layer->getInputSignals()) {
+			if (sig.get() == nullptr) {
+				continue;
+			}
+			signals.insert(sig.get());
+			uint64_t bytes = Volume(sig->dimensions) * sizeof(float);
+			if (isTrainableWeight(sig->type)) {
+				lc.parameterBytes += bytes;
+			} else {
+				lc.inputBytes += bytes * batchSize;
+			}
+		}
+		for (const SignalPtr& sig : layer->getOutputSignals()) {
+			if (sig.get() == nullptr) {
+				continue;
+			}
+			signals.insert(sig.get());
+			if (sig->type == ChannelType::data) {
+				lc.outputBytes += Volume(sig->dimensions) * sizeof(float)
+						* batchSize;
+			}
+		}
+		bool hasWeights = (lc.parameterBytes > 0);
+		uint64_t weightGradients =
+				(hasWeights && layer->isTrainable()) ?
+						lc.parameterBytes * batchSize : 0;
+		lc.forwardMACs = layer->getMultiplyAdds() * batchSize;
+		//weighted layers compute both input and weight gradients
+		lc.backwardMACs = hasWeights ? 2 * lc.forwardMACs : lc.forwardMACs;
+		lc.forwardBytes = lc.inputBytes + lc.parameterBytes + lc.outputBytes;
+		lc.backwardBytes = 2 * (lc.inputBytes + lc.outputBytes)
+				+ lc.parameterBytes + weightGradients;
+		cost.forwardMACs += lc.forwardMACs;
+		cost.backwardMACs += lc.backwardMACs;
+		cost.parameterBytes += lc.parameterBytes;
+		gradientBytes += weightGradients;
+		cost.layers.push_back(lc);
+	}
+	//Activation lifetimes in layer order. Aliased signals extend the lifetime
+	//of the buffer they view instead of holding memory of their own.
+	std::map<NeuralSignal*, std::pair<int, int>> lifetimes;
+	for (NeuralSignal* sig : signals) {
+		uint64_t bytes = Volume(sig->dimensions) * sizeof(float);
+		if (sig->type != ChannelType::data) {
+			cost.residentBytes += bytes * (1 + batchSize);
+			continue;
+		}
+		if (!sig->isAlias()) {
+			cost.activationBytes += bytes * batchSize;
+			cost.residentBytes += 2 * bytes * batchSize;
+		}
+		auto producer = order.find(sig->input);
+		int first = (producer != order.end()) ? producer->second : 0;
+		int last = sig->hasOutput() ? first : N - 1;
+		for (const NeuralLayerPtr& out : sig->outputs) {
+			auto consumer = order.find(out.get());
+			if (consumer != order.end()) {
+				last = std::max(last, consumer->second);
+			}
+		}
+		NeuralSignal* root = sig;
+		while (root->isAlias()) {
+			root = root->alias;
+		}
+		auto it = lifetimes.find(root);
+		if (it == lifetimes.end()) {
+			lifetimes[root] = std::pair<int, int>(first, last);
+		} else {
+			it->second.first = std::min(it->second.first, first);
+			it->second.second = std::max(it->second.second, last);
+		}
+	}
+	std::vector<uint64_t> live(std::max(N, 1), 0);
+	for (auto& pr : lifetimes) {
+		uint64_t bytes = Volume(pr.first->dimensions) * sizeof(float)
+				* batchSize;
+		for (int i = pr.second.first; i <= pr.second.second; i++) {
+			live[i] += bytes;
+		}
+	}
+	uint64_t peakLive = *std::max_element(live.begin(), live.end());
+	cost.peakInferenceBytes = cost.parameterBytes + peakLive;
+	//training keeps every activation for backward, and activation gradients
+	//have the same lifetimes in reverse order.
+	cost.peakTrainingBytes = cost.parameterBytes + gradientBytes
+			+ cost.activationBytes + peakLive;
+	return cost;
+}
+MachinePeak NeuralCostModel::measureMachine(double seconds) {
+	MachinePeak peak;
+	peak.gflops = 0.0;
+	peak.bandwidth = 0.0;
+	peak.threads = NeuralThreadPool::getThreadCount();
+	//multiply-add chains of the kernel variant the layers run
+	const KernelTable& kernels = NeuralKernels::get();
+	volatile float sink = 0.0f;
+	const int64_t iterations = 1 << 20;
+	double elapsed = 0.0;
+	do {
+		std::mutex sinkLock;
+		auto start = Clock::now();
+		//one chain per pool thread
+		NeuralThreadPool::parallelForEach(0, peak.threads, [&](size_t) {
+			float r = kernels.peakChains(iterations);
+			std::lock_guard<std::mutex> lockMe(sinkLock);
+			sink = sink + r;
+		}, 1);
+		double t = std::chrono::duration<double>(Clock::now() - start).count();
+		elapsed += t;
+		peak.gflops = std::max(peak.gflops,
+				1E-9 * peak.threads * iterations * kernels.peakFlopsPerIteration
+						/ t);
+	} while (elapsed < seconds);
+	//triad over arrays well beyond the last level cache
+	const int64_t N = 1 << 24;
+	Storage a(N), b(N), c(N);
+	NeuralThreadPool::parallelForEach(0, N, [&](size_t i) {
+		a[i] = 0.0f;
+		b[i] = 1.0f;
+		c[i] = 2.0f;
+	}, 1 << 16);
+	elapsed = 0.0;
+	do {
+		auto start = Clock::now();
+		NeuralThreadPool::parallelForEach(0, N, [&](size_t i) {
+			a[i] = b[i] + 3.0f * c[i];
+		}, 1 << 16);
+		double t = std::chrono::duration<double>(Clock::now() - start).count();
+		elapsed += t;
+		peak.bandwidth = std::max(peak.bandwidth,
+				1E-9 * 3.0 * N * sizeof(float) / t);
+	} while (elapsed < seconds);
+	sink = sink + a[N / 2];
+	return peak;
+}
+std::vector<RooflinePoint> NeuralCostModel::roofline(const SystemCost& cost,
+		const std::vector<ProfileSummary>& profile, const MachinePeak& peak) {
+	std::vector<RooflinePoint> points;
+	for (const ProfileSummary& s : profile) {
+		if (s.phase == ProfilePhase::Update) {
+			continue;
+		}
+		for (const LayerCost& lc : cost.layers) {
+			if (lc.layerId != s.layerId || lc.name != s.name) {
+				continue;
+			}
+			bool forward = (s.phase == ProfilePhase::Forward);
+			RooflinePoint p;
+			p.layerId = lc.layerId;
+			p.name = lc.name;
+			p.phase = s.phase;
+			p.intensity =
+					forward ?
+							lc.getForwardIntensity() :
+							lc.getBackwardIntensity();
+			p.time = s.mean;
+			double flops = 2.0 * (forward ? lc.forwardMACs : lc.backwardMACs);
+			p.achieved = (s.mean > 0.0) ? 1E-6 * flops / s.mean : 0.0;
+			p.attainable = std::min(peak.gflops, p.intensity * peak.bandwidth);
+			p.memoryBound = (p.intensity < peak.getRidgePoint());
+			points.push_back(p);
+			break;
+		}
+	}
+	std::sort(points.begin(), points.end(),
+			[](const RooflinePoint& a, const RooflinePoint& b) {
+				return a.time > b.time;
+			});
+	return points;
+}
+static std::string LayerLabel(const std::string& name, int id) {
+	std::stringstream ss;
+	ss << name.substr(0, 24) << " [" << id << "]";
+	return ss.str();
+}
+void NeuralCostModel::print(std::ostream& out, const SystemCost& cost) {
+	const double MB = 1.0 / (1024.0 * 1024.0);
+	out << "Cost model, batch size " << cost.batchSize << std::endl;
+	out << std::left << std::setw(32) << "Layer" << std::right
+			<< std::setw(14) << "Fwd MMACs" << std::setw(14) << "Bwd MMACs"
+			<< std::setw(12) << "Params(MB)" << std::setw(12) << "In(MB)"
+			<< std::setw(12) << "Out(MB)" << std::setw(10) << "Fwd AI"
+			<< std::setw(10) << "Bwd AI" << std::endl;
+	out << std::fixed << std::setprecision(3);
+	for (const LayerCost& lc : cost.layers) {
+		out << std::left << std::setw(32) << LayerLabel(lc.name, lc.layerId)
+				<< std::right << std::setw(14) << 1E-6 * lc.forwardMACs
+				<< std::setw(14) << 1E-6 * lc.backwardMACs << std::setw(12)
+				<< MB * lc.parameterBytes << std::setw(12)
+				<< MB * lc.inputBytes << std::setw(12) << MB * lc.outputBytes
+				<< std::setw(10) << lc.getForwardIntensity() << std::setw(10)
+				<< lc.getBackwardIntensity() << std::endl;
+	}
+	out << "Total forward GMACs:  " << 1E-9 * cost.forwardMACs << std::endl;
+	out << "Total backward GMACs: " << 1E-9 * cost.backwardMACs << std::endl;
+	out << "Parameters (MB):      " << MB * cost.parameterBytes << std::endl;
+	out << "Activations (MB):     " << MB * cost.activationBytes << std::endl;
+	out << "Resident (MB):        " << MB * cost.residentBytes << std::endl;
+	out << "Peak inference (MB):  " << MB * cost.peakInferenceBytes
+			<< std::endl;
+	out << "Peak training (MB):   " << MB * cost.peakTrainingBytes
+			<< std::endl;
+	out.unsetf(std::ios_base::floatfield);
+}
+void NeuralCostModel::print(std::ostream& out, const MachinePeak& peak,
+		const std::vector<RooflinePoint>& points) {
+	out << std::fixed << std::setprecision(2);
+	out << "Roofline: " << peak.gflops << " GFLOP/s, " << peak.bandwidth
+			<< " GB/s, ridge " << peak.getRidgePoint() << " flop/byte, "
+			<< peak.threads << " threads" << std::endl;
+	out << std::left << std::setw(32) << "Layer" << std::setw(10) << "Phase"
+			<< std::right << std::setw(10) << "Time(ms)" << std::setw(10)
+			<< "AI" << std::setw(12) << "GFLOP/s" << std::setw(12)
+			<< "Roof" << std::setw(8) << "Eff%" << std::setw(10) << "Bound"
+			<< std::endl;
+	for (const RooflinePoint& p : points) {
+		std::stringstream phase;
+		phase << p.phase;
+		out << std::left << std::setw(32) << LayerLabel(p.name, p.layerId)
+				<< std::setw(10) << phase.str() << std::right << std::setw(10)
+				<< p.time << std::setw(10) << p.intensity << std::setw(12)
+				<< p.achieved << std::setw(12) << p.attainable << std::setw(8)
+				<< 100.0 * p.getEfficiency() << std::setw(10)
+				<< (p.memoryBound ? "memory" : "compute") << std::endl;
+	}
+	out.unsetf(std::ios_base::floatfield);
+}
+}
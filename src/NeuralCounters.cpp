@@ -0,0 +1,186 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralCounters.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#ifdef __linux__
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+namespace tgr {
+std::atomic<bool> NeuralCounters::enabled(false);
+std::atomic<uint64_t> NeuralCounters::lastScan(0);
+std::mutex NeuralCounters::counterLock;
+std::vector<NeuralCounters::ThreadCounters> NeuralCounters::threads;
+//new worker threads are picked up at most this often
+static const uint64_t SCAN_INTERVAL = 100000000ULL;
+const char* GetCounterName(HardwareCounter counter) {
+	switch (counter) {
+	case HardwareCounter::Cycles:
+		return "cycles";
+	case HardwareCounter::Instructions:
+		return "instructions";
+	case HardwareCounter::L1DMisses:
+		return "l1d_misses";
+	case HardwareCounter::LLCMisses:
+		return "llc_misses";
+	case HardwareCounter::BranchMisses:
+		return "branch_misses";
+	}
+	return "unknown";
+}
+static uint64_t Now() {
+	return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#ifdef __linux__
+static int OpenCounter(HardwareCounter counter, int tid, int group) {
+	perf_event_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	switch (counter) {
+	case HardwareCounter::Cycles:
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_CPU_CYCLES;
+		break;
+	case HardwareCounter::Instructions:
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+		break;
+	case HardwareCounter::L1DMisses:
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_L1D
+				| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+				| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		break;
+	case HardwareCounter::LLCMisses:
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		break;
+	case HardwareCounter::BranchMisses:
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+		break;
+	}
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+			| PERF_FORMAT_TOTAL_TIME_RUNNING;
+	//user space only, which perf_event_paranoid=2 still allows
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int) syscall(__NR_perf_event_open, &attr, tid, -1, group, 0);
+}
+void NeuralCounters::attachThreads() {
+	DIR* dir = opendir("/proc/self/task");
+	if (dir == nullptr) {
+		return;
+	}
+	while (dirent* entry = readdir(dir)) {
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+		int tid = std::atoi(entry->d_name);
+		if (std::find_if(threads.begin(), threads.end(),
+				[=](const ThreadCounters& t) {return t.tid == tid;})
+				!= threads.end()) {
+			continue;
+		}
+		ThreadCounters tc;
+		tc.tid = tid;
+		tc.leader = OpenCounter(HardwareCounter::Cycles, tid, -1);
+		if (tc.leader < 0) {
+			continue;
+		}
+		tc.fds.push_back(tc.leader);
+		tc.counters.push_back(static_cast<int>(HardwareCounter::Cycles));
+		for (int c = 1; c < HARDWARE_COUNTER_COUNT; c++) {
+			//not every PMU exposes every event, keep whatever opens
+			int fd = OpenCounter(static_cast<HardwareCounter>(c), tid,
+					tc.leader);
+			if (fd >= 0) {
+				tc.fds.push_back(fd);
+				tc.counters.push_back(c);
+			}
+		}
+		threads.push_back(tc);
+	}
+	closedir(dir);
+	lastScan.store(Now(), std::memory_order_relaxed);
+}
+void NeuralCounters::detachThreads() {
+	for (ThreadCounters& tc : threads) {
+		for (int fd : tc.fds) {
+			close(fd);
+		}
+	}
+	threads.clear();
+}
+bool NeuralCounters::setEnabled(bool e) {
+	std::lock_guard<std::mutex> lockMe(counterLock);
+	detachThreads();
+	if (e) {
+		attachThreads();
+	}
+	enabled.store(threads.size() > 0, std::memory_order_relaxed);
+	return isEnabled() == e;
+}
+void NeuralCounters::read(CounterValues& values) {
+	std::memset(values.values, 0, sizeof(values.values));
+	std::lock_guard<std::mutex> lockMe(counterLock);
+	if (Now() - lastScan.load(std::memory_order_relaxed) > SCAN_INTERVAL) {
+		attachThreads();
+	}
+	uint64_t buffer[3 + HARDWARE_COUNTER_COUNT];
+	for (const ThreadCounters& tc : threads) {
+		ssize_t len = ::read(tc.leader, buffer, sizeof(buffer));
+		if (len < (ssize_t) (3 * sizeof(uint64_t))) {
+			continue;
+		}
+		uint64_t nr = std::min((uint64_t) tc.counters.size(), buffer[0]);
+		uint64_t timeEnabled = buffer[1];
+		uint64_t timeRunning = buffer[2];
+		if (timeRunning == 0) {
+			continue;
+		}
+		//the kernel multiplexes groups when there are not enough counters
+		double scale = (double) timeEnabled / (double) timeRunning;
+		for (uint64_t i = 0; i < nr; i++) {
+			values.values[tc.counters[i]] += (uint64_t) (scale * buffer[3 + i]);
+		}
+	}
+}
+#else
+void NeuralCounters::attachThreads() {
+}
+void NeuralCounters::detachThreads() {
+}
+bool NeuralCounters::setEnabled(bool e) {
+	return !e;
+}
+void NeuralCounters::read(CounterValues& values) {
+	std::memset(values.values, 0, sizeof(values.values));
+}
+#endif
+}
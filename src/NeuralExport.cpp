@@ -0,0 +1,636 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralExport.h"
+#include "NeuralKernels.h"
+#include "NeuralThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+namespace tgr {
+/*
+ * Exported knowledge layout, every field little-endian:
+ *   header (64 bytes)
+ *   tensor table, one ExportTensor per tensor
+ *   layer table, one ExportLayer per layer
+ *   strings: knowledge name, then layer names
+ *   tensor payloads: chunkCount + 1 offsets from the payload start, then
+ *   the chunks
+ * A chunk holds up to ChunkValues values as byte planes: for int8 first the
+ * four planes of the group scales, then the values; for the other formats
+ * plane p holds byte p of every value. Each plane is stored raw, as a
+ * single repeated byte, or range coded with its 256 symbol frequencies.
+ */
+static const char ExportMagic[8] = { 'T', 'I', 'G', 'E', 'R', 'Q', 'N', 'T' };
+static const uint32_t ExportVersion = 1;
+static const uint32_t ExportByteOrder = 0x01020304;
+static const size_t ChunkValues = 1 << 16;
+static const size_t GroupValues = 128; //int8 values sharing a scale
+enum PlaneMode {
+	PlaneRaw = 0, PlaneConstant = 1, PlaneCoded = 2
+};
+struct ExportHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t tensorCount;
+	uint32_t layerCount;
+	uint32_t nameLength;
+	uint32_t reserved;
+	uint64_t tensorOffset;
+	uint64_t layerOffset;
+	uint64_t stringOffset;
+	uint64_t fileBytes;
+};
+struct ExportTensor {
+	int32_t layerId;
+	int32_t type;
+	int32_t index;
+	int32_t precision;
+	uint64_t count;
+	uint64_t offset;
+	uint64_t bytes;
+	uint32_t chunkCount;
+	uint32_t reserved;
+};
+struct ExportLayer {
+	int32_t id;
+	uint32_t nameLength;
+	uint64_t nameOffset;
+};
+static_assert(sizeof(ExportHeader) == 64, "Export header must be 64 bytes.");
+static_assert(sizeof(ExportTensor) == 48, "Unexpected export tensor size.");
+static_assert(sizeof(ExportLayer) == 16, "Unexpected export layer size.");
+std::string GetPrecisionName(WeightPrecision precision) {
+	switch (precision) {
+	case WeightPrecision::Float32:
+		return "fp32";
+	case WeightPrecision::Float16:
+		return "fp16";
+	case WeightPrecision::BFloat16:
+		return "bf16";
+	case WeightPrecision::Int8:
+		return "int8";
+	default:
+		return "unknown";
+	}
+}
+WeightPrecision ParsePrecision(const std::string& name) {
+	for (WeightPrecision p : { WeightPrecision::Float32, WeightPrecision::Float16,
+			WeightPrecision::BFloat16, WeightPrecision::Int8 }) {
+		if (name == GetPrecisionName(p)) {
+			return p;
+		}
+	}
+	throw std::runtime_error("Unknown precision " + name);
+}
+static int GetPlaneCount(WeightPrecision precision) {
+	switch (precision) {
+	case WeightPrecision::Float16:
+	case WeightPrecision::BFloat16:
+		return 2;
+	case WeightPrecision::Int8:
+		return 1;
+	default:
+		return 4;
+	}
+}
+//round to nearest even, overflow goes to infinity
+static uint16_t FloatToHalf(float value) {
+	const uint32_t infinity = 255u << 23;
+	const uint32_t halfMax = (127u + 16u) << 23;
+	const uint32_t subnormalMagic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+	uint32_t f;
+	std::memcpy(&f, &value, sizeof(f));
+	uint32_t sign = f & 0x80000000u;
+	f ^= sign;
+	uint16_t h;
+	if (f >= halfMax) {
+		h = (f > infinity) ? 0x7E00 : 0x7C00;
+	} else if (f < (113u << 23)) {
+		//adding the magic number lets the FPU round the subnormal
+		float x, magic;
+		std::memcpy(&x, &f, sizeof(x));
+		std::memcpy(&magic, &subnormalMagic, sizeof(magic));
+		x += magic;
+		std::memcpy(&f, &x, sizeof(f));
+		h = (uint16_t) (f - subnormalMagic);
+	} else {
+		uint32_t odd = (f >> 13) & 1u;
+		f += ((uint32_t) (15 - 127) << 23) + 0xFFFu + odd;
+		h = (uint16_t) (f >> 13);
+	}
+	return h | (uint16_t) (sign >> 16);
+}
+static uint16_t FloatToBFloat16(float value) {
+	uint32_t f;
+	std::memcpy(&f, &value, sizeof(f));
+	if ((f & 0x7FFFFFFFu) > 0x7F800000u) {
+		return (uint16_t) ((f >> 16) | 0x40u); //keep NaN a NaN
+	}
+	f += 0x7FFFu + ((f >> 16) & 1u);
+	return (uint16_t) (f >> 16);
+}
+/*
+ * Order-0 range coding (rANS) of one byte plane, with 12 bit probabilities
+ * and byte-wise renormalization.
+ */
+static const int ProbBits = 12;
+static const uint32_t ProbScale = 1u << ProbBits;
+static const uint32_t RansLow = 1u << 23;
+static void NormalizeFrequencies(const uint32_t* counts, size_t total,
+		uint32_t* freq) {
+	uint32_t sum = 0;
+	for (int s = 0; s < 256; s++) {
+		freq[s] = (counts[s] == 0) ?
+				0 : std::max((uint32_t) ((uint64_t) counts[s] * ProbScale / total), 1u);
+		sum += freq[s];
+	}
+	//symbols raised to one may push the sum over, take it from the largest
+	while (sum > ProbScale) {
+		int largest = (int) (std::max_element(freq, freq + 256) - freq);
+		freq[largest]--;
+		sum--;
+	}
+	int largest = (int) (std::max_element(freq, freq + 256) - freq);
+	freq[largest] += ProbScale - sum;
+}
+static void PutU32(std::vector<uint8_t>& out, uint32_t v) {
+	for (int b = 0; b < 4; b++) {
+		out.push_back((uint8_t) (v >> (8 * b)));
+	}
+}
+static bool EncodeRans(const uint8_t* src, size_t n, std::vector<uint8_t>& out) {
+	uint32_t counts[256] = { 0 };
+	for (size_t i = 0; i < n; i++) {
+		counts[src[i]]++;
+	}
+	uint32_t freq[256], cum[257];
+	NormalizeFrequencies(counts, n, freq);
+	cum[0] = 0;
+	for (int s = 0; s < 256; s++) {
+		cum[s + 1] = cum[s] + freq[s];
+	}
+	//the coder runs backwards, so the bytes come out in reverse
+	std::vector<uint8_t> reversed;
+	reversed.reserve(n);
+	uint32_t x = RansLow;
+	for (size_t i = n; i-- > 0;) {
+		uint32_t f = freq[src[i]];
+		uint32_t limit = ((RansLow >> ProbBits) << 8) * f;
+		while (x >= limit) {
+			reversed.push_back((uint8_t) x);
+			x >>= 8;
+		}
+		x = ((x / f) << ProbBits) + (x % f) + cum[src[i]];
+	}
+	for (int b = 3; b >= 0; b--) {
+		reversed.push_back((uint8_t) (x >> (8 * b)));
+	}
+	size_t bytes = 1 + 256 * 2 + 4 + reversed.size();
+	if (bytes >= 1 + n) {
+		return false;
+	}
+	out.push_back(PlaneCoded);
+	for (int s = 0; s < 256; s++) {
+		out.push_back((uint8_t) freq[s]);
+		out.push_back((uint8_t) (freq[s] >> 8));
+	}
+	PutU32(out, (uint32_t) reversed.size());
+	out.insert(out.end(), reversed.rbegin(), reversed.rend());
+	return true;
+}
+static void EncodePlane(const uint8_t* src, size_t n, bool compress,
+		std::vector<uint8_t>& out) {
+	if (n > 0 && std::all_of(src, src + n, [src](uint8_t b) {return b == src[0];})) {
+		out.push_back(PlaneConstant);
+		out.push_back(src[0]);
+		return;
+	}
+	if (compress && EncodeRans(src, n, out)) {
+		return;
+	}
+	out.push_back(PlaneRaw);
+	out.insert(out.end(), src, src + n);
+}
+struct ByteReader {
+	const uint8_t* ptr;
+	const uint8_t* end;
+	const uint8_t* take(size_t n) {
+		if ((size_t) (end - ptr) < n) {
+			throw std::runtime_error("Exported weights are corrupt.");
+		}
+		const uint8_t* p = ptr;
+		ptr += n;
+		return p;
+	}
+	uint32_t u32() {
+		const uint8_t* p = take(4);
+		return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16)
+				| ((uint32_t) p[3] << 24);
+	}
+};
+static void DecodePlane(ByteReader& in, uint8_t* dst, size_t n) {
+	uint8_t mode = *in.take(1);
+	if (mode == PlaneRaw) {
+		std::memcpy(dst, in.take(n), n);
+	} else if (mode == PlaneConstant) {
+		std::memset(dst, *in.take(1), n);
+	} else if (mode == PlaneCoded) {
+		const uint8_t* table = in.take(256 * 2);
+		uint32_t freq[256], cum[256];
+		uint8_t symbols[ProbScale];
+		uint32_t total = 0;
+		for (int s = 0; s < 256; s++) {
+			freq[s] = (uint32_t) table[2 * s] | ((uint32_t) table[2 * s + 1] << 8);
+			cum[s] = total;
+			total += freq[s];
+			if (total > ProbScale) {
+				throw std::runtime_error("Exported weights are corrupt.");
+			}
+			std::memset(symbols + cum[s], s, freq[s]);
+		}
+		if (total != ProbScale) {
+			throw std::runtime_error("Exported weights are corrupt.");
+		}
+		uint32_t bytes = in.u32();
+		ByteReader stream = { in.take(bytes), in.ptr };
+		uint32_t x = stream.u32();
+		for (size_t i = 0; i < n; i++) {
+			uint32_t slot = x & (ProbScale - 1);
+			uint8_t s = symbols[slot];
+			dst[i] = s;
+			x = freq[s] * (x >> ProbBits) + slot - cum[s];
+			while (x < RansLow) {
+				x = (x << 8) | *stream.take(1);
+			}
+		}
+	} else {
+		throw std::runtime_error("Exported weights are corrupt.");
+	}
+}
+static WeightPrecision GetPrecision(const KnowledgeTensor& t,
+		const ExportOptions& options) {
+	if (t.type == ChannelType::bias && options.fullPrecisionBiases) {
+		return WeightPrecision::Float32;
+	}
+	auto it = options.layers.find(t.layerId);
+	return (it != options.layers.end()) ? it->second : options.precision;
+}
+static void EncodeChunk(const float* values, size_t n,
+		WeightPrecision precision, bool compress, std::vector<uint8_t>& out) {
+	int planeCount = GetPlaneCount(precision);
+	std::vector<uint8_t> planes(planeCount * n);
+	out.clear();
+	if (precision == WeightPrecision::Int8) {
+		size_t groups = (n + GroupValues - 1) / GroupValues;
+		std::vector<uint8_t> scalePlanes(4 * groups);
+		for (size_t g = 0; g < groups; g++) {
+			size_t begin = g * GroupValues;
+			size_t end = std::min(n, begin + GroupValues);
+			//non-finite values saturate instead of ruining the whole group
+			float maxAbs = 0.0f;
+			for (size_t i = begin; i < end; i++) {
+				if (std::isfinite(values[i])) {
+					maxAbs = std::max(maxAbs, std::abs(values[i]));
+				}
+			}
+			float scale = maxAbs / 127.0f;
+			float inverse = (scale > 0.0f) ? 1.0f / scale : 0.0f;
+			for (size_t i = begin; i < end; i++) {
+				float v = values[i] * inverse;
+				v = std::isnan(v) ? 0.0f : std::min(std::max(v, -127.0f), 127.0f);
+				planes[i] = (uint8_t) (int8_t) std::lrint(v);
+			}
+			uint32_t bits;
+			std::memcpy(&bits, &scale, sizeof(bits));
+			for (int b = 0; b < 4; b++) {
+				scalePlanes[b * groups + g] = (uint8_t) (bits >> (8 * b));
+			}
+		}
+		for (int b = 0; b < 4; b++) {
+			EncodePlane(scalePlanes.data() + b * groups, groups, compress, out);
+		}
+	} else {
+		for (size_t i = 0; i < n; i++) {
+			uint32_t bits;
+			if (precision == WeightPrecision::Float16) {
+				bits = FloatToHalf(values[i]);
+			} else if (precision == WeightPrecision::BFloat16) {
+				bits = FloatToBFloat16(values[i]);
+			} else {
+				std::memcpy(&bits, values + i, sizeof(bits));
+			}
+			for (int b = 0; b < planeCount; b++) {
+				planes[b * n + i] = (uint8_t) (bits >> (8 * b));
+			}
+		}
+	}
+	for (int b = 0; b < planeCount; b++) {
+		EncodePlane(planes.data() + b * n, n, compress, out);
+	}
+}
+static void DecodeChunk(ByteReader in, WeightPrecision precision, float* dst,
+		size_t n) {
+	const KernelTable& kernels = NeuralKernels::get();
+	int planeCount = GetPlaneCount(precision);
+	std::vector<uint8_t> planes(planeCount * n);
+	if (precision == WeightPrecision::Int8) {
+		size_t groups = (n + GroupValues - 1) / GroupValues;
+		std::vector<uint8_t> scalePlanes(4 * groups);
+		for (int b = 0; b < 4; b++) {
+			DecodePlane(in, scalePlanes.data() + b * groups, groups);
+		}
+		DecodePlane(in, planes.data(), n);
+		for (size_t g = 0; g < groups; g++) {
+			uint32_t bits = 0;
+			for (int b = 0; b < 4; b++) {
+				bits |= (uint32_t) scalePlanes[b * groups + g] << (8 * b);
+			}
+			float scale;
+			std::memcpy(&scale, &bits, sizeof(scale));
+			size_t begin = g * GroupValues;
+			kernels.int8ToFloat(reinterpret_cast<const int8_t*>(planes.data()) + begin,
+					scale, dst + begin, std::min(GroupValues, n - begin));
+		}
+		return;
+	}
+	for (int b = 0; b < planeCount; b++) {
+		DecodePlane(in, planes.data() + b * n, n);
+	}
+	if (precision == WeightPrecision::Float32) {
+		for (size_t i = 0; i < n; i++) {
+			uint32_t bits = (uint32_t) planes[i] | ((uint32_t) planes[n + i] << 8)
+					| ((uint32_t) planes[2 * n + i] << 16)
+					| ((uint32_t) planes[3 * n + i] << 24);
+			std::memcpy(dst + i, &bits, sizeof(bits));
+		}
+		return;
+	}
+	std::vector<uint16_t> halves(n);
+	for (size_t i = 0; i < n; i++) {
+		halves[i] = (uint16_t) (planes[i] | (planes[n + i] << 8));
+	}
+	if (precision == WeightPrecision::Float16) {
+		kernels.halfToFloat(halves.data(), dst, n);
+	} else {
+		kernels.bfloat16ToFloat(halves.data(), dst, n);
+	}
+}
+void EncodeValues(const float* values, size_t n, WeightPrecision precision,
+		bool compress, std::vector<uint8_t>& out) {
+	EncodeChunk(values, n, precision, compress, out);
+}
+void DecodeValues(const uint8_t* data, size_t bytes, WeightPrecision precision,
+		float* values, size_t n) {
+	ByteReader in = { data, data + bytes };
+	DecodeChunk(in, precision, values, n);
+}
+void NarrowValues(const float* values, size_t n, WeightPrecision precision,
+		void* out) {
+	if (precision == WeightPrecision::Float32) {
+		std::memcpy(out, values, n * sizeof(float));
+	} else if (precision == WeightPrecision::Float16) {
+		uint16_t* dst = static_cast<uint16_t*>(out);
+		for (size_t i = 0; i < n; i++) {
+			dst[i] = FloatToHalf(values[i]);
+		}
+	} else if (precision == WeightPrecision::BFloat16) {
+		uint16_t* dst = static_cast<uint16_t*>(out);
+		for (size_t i = 0; i < n; i++) {
+			dst[i] = FloatToBFloat16(values[i]);
+		}
+	} else {
+		throw std::runtime_error("Values of a fixed width must be fp32, fp16 or bf16.");
+	}
+}
+void WidenValues(const void* data, size_t n, WeightPrecision precision,
+		float* values) {
+	const KernelTable& kernels = NeuralKernels::get();
+	if (precision == WeightPrecision::Float32) {
+		std::memcpy(values, data, n * sizeof(float));
+	} else if (precision == WeightPrecision::Float16) {
+		kernels.halfToFloat(static_cast<const uint16_t*>(data), values, n);
+	} else if (precision == WeightPrecision::BFloat16) {
+		kernels.bfloat16ToFloat(static_cast<const uint16_t*>(data), values, n);
+	} else {
+		throw std::runtime_error("Values of a fixed width must be fp32, fp16 or bf16.");
+	}
+}
+void ExportNeuralKnowledge(const std::string& file,
+		const NeuralKnowledge& knowledge, const ExportOptions& options) {
+	std::vector<KnowledgeTensor> tensors = knowledge.getTensors();
+	std::vector<ExportTensor> entries(tensors.size());
+	std::vector<std::pair<size_t, size_t>> chunks;
+	for (size_t i = 0; i < tensors.size(); i++) {
+		const KnowledgeTensor& t = tensors[i];
+		ExportTensor& e = entries[i];
+		std::memset(&e, 0, sizeof(e));
+		e.layerId = t.layerId;
+		e.type = static_cast<int32_t>(t.type);
+		e.index = t.index;
+		e.precision = static_cast<int32_t>(GetPrecision(t, options));
+		e.count = t.count;
+		e.chunkCount = (uint32_t) ((t.count + ChunkValues - 1) / ChunkValues);
+		for (size_t c = 0; c < e.chunkCount; c++) {
+			chunks.push_back(std::make_pair(i, c));
+		}
+	}
+	std::vector<std::vector<uint8_t>> encoded(chunks.size());
+	NeuralThreadPool::parallelForEach(0, chunks.size(), [&](size_t j) {
+		const KnowledgeTensor& t = tensors[chunks[j].first];
+		size_t begin = chunks[j].second * ChunkValues;
+		EncodeChunk(t.data + begin, std::min(ChunkValues, t.count - begin),
+				static_cast<WeightPrecision>(entries[chunks[j].first].precision),
+				options.compress, encoded[j]);
+	}, 1);
+	std::vector<ExportLayer> layers;
+	std::string strings = knowledge.getName();
+	for (const KnowledgeTensor& t : tensors) {
+		if (layers.size() == 0 || layers.back().id != t.layerId) {
+			std::string layerName = knowledge.getLayerName(t.layerId);
+			ExportLayer l;
+			l.id = t.layerId;
+			l.nameLength = (uint32_t) layerName.size();
+			l.nameOffset = strings.size();
+			strings += layerName;
+			layers.push_back(l);
+		}
+	}
+	ExportHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, ExportMagic, sizeof(ExportMagic));
+	header.version = ExportVersion;
+	header.byteOrder = ExportByteOrder;
+	header.tensorCount = (uint32_t) entries.size();
+	header.layerCount = (uint32_t) layers.size();
+	header.nameLength = (uint32_t) knowledge.getName().size();
+	header.tensorOffset = sizeof(ExportHeader);
+	header.layerOffset = header.tensorOffset + entries.size() * sizeof(ExportTensor);
+	header.stringOffset = header.layerOffset + layers.size() * sizeof(ExportLayer);
+	for (ExportLayer& l : layers) {
+		l.nameOffset += header.stringOffset;
+	}
+	//payloads follow the strings, each with its chunk offsets first
+	uint64_t offset = header.stringOffset + strings.size();
+	std::vector<std::vector<uint64_t>> chunkOffsets(entries.size());
+	size_t j = 0;
+	for (size_t i = 0; i < entries.size(); i++) {
+		ExportTensor& e = entries[i];
+		std::vector<uint64_t>& offsets = chunkOffsets[i];
+		offsets.push_back((e.chunkCount + 1) * sizeof(uint64_t));
+		for (uint32_t c = 0; c < e.chunkCount; c++, j++) {
+			offsets.push_back(offsets.back() + encoded[j].size());
+		}
+		e.offset = offset;
+		e.bytes = offsets.back();
+		offset += e.bytes;
+	}
+	header.fileBytes = offset;
+	std::string tmpFile = file + ".tmp";
+	bool ok;
+	{
+		std::ofstream os(tmpFile, std::ios::binary);
+		os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		os.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(ExportTensor));
+		os.write(reinterpret_cast<const char*>(layers.data()), layers.size() * sizeof(ExportLayer));
+		os.write(strings.data(), strings.size());
+		j = 0;
+		for (size_t i = 0; i < entries.size(); i++) {
+			os.write(reinterpret_cast<const char*>(chunkOffsets[i].data()), chunkOffsets[i].size() * sizeof(uint64_t));
+			for (uint32_t c = 0; c < entries[i].chunkCount; c++, j++) {
+				os.write(reinterpret_cast<const char*>(encoded[j].data()), encoded[j].size());
+			}
+		}
+		ok = os.good();
+	}
+	if (!ok || std::rename(tmpFile.c_str(), file.c_str()) != 0) {
+		std::remove(tmpFile.c_str());
+		throw std::runtime_error("Could not write exported weights " + file);
+	}
+}
+void ImportNeuralKnowledge(const std::string& file, NeuralKnowledge& knowledge) {
+	std::vector<uint8_t> data;
+	{
+		std::ifstream is(file, std::ios::binary | std::ios::ate);
+		if (!is.good()) {
+			throw std::runtime_error("Could not open exported weights " + file);
+		}
+		data.resize((size_t) is.tellg());
+		is.seekg(0);
+		is.read(reinterpret_cast<char*>(data.data()), data.size());
+		if (!is.good()) {
+			throw std::runtime_error("Could not read exported weights " + file);
+		}
+	}
+	auto fail = [&file](const std::string& msg) {
+		throw std::runtime_error("Invalid exported weights " + file + ": " + msg);
+	};
+	if (data.size() < sizeof(ExportHeader)) {
+		fail("file is truncated.");
+	}
+	ExportHeader header;
+	std::memcpy(&header, data.data(), sizeof(header));
+	if (std::memcmp(header.magic, ExportMagic, sizeof(ExportMagic)) != 0) {
+		fail("bad magic number.");
+	}
+	if (header.byteOrder != ExportByteOrder) {
+		fail("written with a different byte order.");
+	}
+	if (header.version != ExportVersion) {
+		fail("unsupported version " + std::to_string(header.version) + ".");
+	}
+	if (header.fileBytes != data.size()) {
+		fail("file is truncated.");
+	}
+	auto inRange = [&data](uint64_t offset, uint64_t bytes) {
+		return (offset <= data.size() && bytes <= data.size() - offset);
+	};
+	if (!inRange(header.tensorOffset, (uint64_t) header.tensorCount * sizeof(ExportTensor))
+			|| !inRange(header.layerOffset, (uint64_t) header.layerCount * sizeof(ExportLayer))
+			|| !inRange(header.stringOffset, header.nameLength)) {
+		fail("tables out of range.");
+	}
+	std::vector<ExportTensor> entries(header.tensorCount);
+	std::memcpy(entries.data(), data.data() + header.tensorOffset, entries.size() * sizeof(ExportTensor));
+	std::vector<ExportLayer> layers(header.layerCount);
+	std::memcpy(layers.data(), data.data() + header.layerOffset, layers.size() * sizeof(ExportLayer));
+	std::map<int, std::string> names;
+	for (const ExportLayer& l : layers) {
+		if (!inRange(l.nameOffset, l.nameLength)) {
+			fail("layer name out of range.");
+		}
+		names[l.id].assign(reinterpret_cast<const char*>(data.data() + l.nameOffset), l.nameLength);
+	}
+	std::vector<KnowledgeTensor> layout(entries.size());
+	std::vector<std::pair<size_t, size_t>> chunks;
+	for (size_t i = 0; i < entries.size(); i++) {
+		const ExportTensor& e = entries[i];
+		if (e.precision < 0 || e.precision > static_cast<int32_t>(WeightPrecision::Int8)
+				|| e.chunkCount != (e.count + ChunkValues - 1) / ChunkValues
+				|| !inRange(e.offset, e.bytes) || e.bytes < (e.chunkCount + 1) * sizeof(uint64_t)) {
+			fail("tensor " + std::to_string(i) + " out of range.");
+		}
+		const uint8_t* payload = data.data() + e.offset;
+		for (uint32_t c = 0; c <= e.chunkCount; c++) {
+			uint64_t at;
+			std::memcpy(&at, payload + c * sizeof(uint64_t), sizeof(at));
+			if (at > e.bytes) {
+				fail("chunk of tensor " + std::to_string(i) + " out of range.");
+			}
+		}
+		for (size_t c = 0; c < e.chunkCount; c++) {
+			chunks.push_back(std::make_pair(i, c));
+		}
+		KnowledgeTensor& t = layout[i];
+		t.layerId = e.layerId;
+		t.type = static_cast<ChannelType>(e.type);
+		t.index = e.index;
+		t.count = (size_t) e.count;
+		t.data = nullptr;
+	}
+	knowledge.setName(std::string(reinterpret_cast<const char*>(data.data() + header.stringOffset), header.nameLength));
+	knowledge.setFile(file);
+	std::vector<float*> targets = knowledge.allocate(layout, names);
+	NeuralThreadPool::parallelForEach(0, chunks.size(), [&](size_t j) {
+		const ExportTensor& e = entries[chunks[j].first];
+		size_t c = chunks[j].second;
+		const uint8_t* payload = data.data() + e.offset;
+		uint64_t begin, end;
+		std::memcpy(&begin, payload + c * sizeof(uint64_t), sizeof(begin));
+		std::memcpy(&end, payload + (c + 1) * sizeof(uint64_t), sizeof(end));
+		if (begin > end) {
+			throw std::runtime_error("Exported weights " + file + " are corrupt.");
+		}
+		size_t first = c * ChunkValues;
+		ByteReader in = { payload + begin, payload + end };
+		DecodeChunk(in, static_cast<WeightPrecision>(e.precision), targets[chunks[j].first] + first,
+				std::min(ChunkValues, (size_t) e.count - first));
+	}, 1);
+}
+bool IsExportedKnowledge(const std::string& file) {
+	std::ifstream is(file, std::ios::binary);
+	char magic[sizeof(ExportMagic)];
+	return (is.read(magic, sizeof(magic)) && std::memcmp(magic, ExportMagic, sizeof(magic)) == 0);
+}
+}
@@ -0,0 +1,303 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralFeatureCache.h"
+#include "NeuralSystem.h"
+#include "NeuralThreadPool.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+namespace tgr {
+static const char FeatureMagic[8] = { 'T', 'I', 'G', 'E', 'R', 'F', 'T', 'R' };
+static const uint32_t FeatureVersion = 1;
+static const uint32_t FeatureByteOrder = 0x01020304;
+static const uint64_t FeatureAlignment = 64;
+struct FeatureHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint64_t key;
+	uint64_t sampleCount;
+	uint64_t sampleBytes;
+	uint64_t dataOffset;
+	uint64_t fileBytes;
+	uint32_t outputCount;
+	int32_t precision;
+};
+struct FeatureOutput {
+	int32_t layerId;
+	int32_t channel;
+	uint64_t count;
+};
+struct FeatureMapping {
+	const char* base = nullptr;
+	size_t size = 0;
+	bool mapped = false;
+	std::vector<char> buffer;
+	~FeatureMapping() {
+#ifndef _WIN32
+		if (mapped) {
+			munmap((void*) base, size);
+		}
+#endif
+	}
+};
+//FNV-1a over 32 bit words, the inputs can be large
+struct FeatureHash {
+	uint64_t value = 0xcbf29ce484222325ULL;
+	void add(const void* data, size_t bytes) {
+		const uint8_t* ptr = static_cast<const uint8_t*>(data);
+		size_t i = 0;
+		for (; i + 4 <= bytes; i += 4) {
+			uint32_t word;
+			std::memcpy(&word, ptr + i, sizeof(word));
+			value = (value ^ word) * 0x100000001b3ULL;
+		}
+		for (; i < bytes; i++) {
+			value = (value ^ ptr[i]) * 0x100000001b3ULL;
+		}
+	}
+	void add(int64_t v) {
+		add(&v, sizeof(v));
+	}
+};
+static size_t GetValueBytes(WeightPrecision precision) {
+	switch (precision) {
+	case WeightPrecision::Float32:
+		return 4;
+	case WeightPrecision::Float16:
+	case WeightPrecision::BFloat16:
+		return 2;
+	default:
+		throw std::runtime_error("Feature caches are fp32, fp16 or bf16.");
+	}
+}
+static FeatureOutput GetFeatureOutput(const SignalPtr& sig) {
+	const NeuralLayer* layer = sig->input;
+	FeatureOutput out;
+	out.layerId = layer->getId();
+	out.channel = -1;
+	for (int c = 0; c < layer->outputChannels; c++) {
+		if (layer->getOutput((size_t) c) == sig) {
+			out.channel = c;
+		}
+	}
+	out.count = sig->dimensions.volume();
+	return out;
+}
+NeuralFeatureCache::NeuralFeatureCache() :
+		trunk(0), precision(WeightPrecision::Float16), sampleCount(0), sampleBytes(
+				0) {
+}
+bool NeuralFeatureCache::open(NeuralSystem& sys,
+		const std::vector<Tensor>& inputs, const std::string& file,
+		const FeatureCacheOptions& options) {
+	size_t frozen = sys.getFrozenTrunkSize();
+	if (frozen == 0) {
+		throw std::runtime_error(
+				"No layers of " + sys.getName() + " are frozen, nothing to cache.");
+	}
+	sys.setTrunk(frozen);
+	mapping.reset();
+	this->file = file;
+	trunk = frozen;
+	precision = options.precision;
+	sampleCount = inputs.size();
+	counts.clear();
+	sampleBytes = 0;
+	size_t valueBytes = GetValueBytes(precision);
+	FeatureHash hash;
+	hash.add((int64_t) NeuralPlan::GetSignature(sys.getInputLayers()));
+	hash.add((int64_t) trunk);
+	hash.add((int64_t) precision);
+	for (const SignalPtr& sig : sys.getTrunkOutputs()) {
+		FeatureOutput out = GetFeatureOutput(sig);
+		hash.add(&out, sizeof(out));
+		counts.push_back((size_t) out.count);
+		sampleBytes += out.count * valueBytes;
+	}
+	for (size_t l = 0; l < trunk; l++) {
+		for (const Storage* w : sys[l]->getInputWeights()) {
+			hash.add(w->data(), w->size() * sizeof(float));
+		}
+	}
+	hash.add((int64_t) inputs.size());
+	for (const Tensor& input : inputs) {
+		for (const Storage& s : input) {
+			hash.add((int64_t) s.size());
+			hash.add(s.data(), s.size() * sizeof(float));
+		}
+	}
+	if (map(hash.value, sys)) {
+		return true;
+	}
+	write(sys, inputs, options, hash.value);
+	if (!map(hash.value, sys)) {
+		throw std::runtime_error("Could not map feature cache " + file);
+	}
+	return false;
+}
+void NeuralFeatureCache::write(NeuralSystem& sys,
+		const std::vector<Tensor>& inputs, const FeatureCacheOptions& options,
+		uint64_t key) {
+	const std::vector<SignalPtr>& outputs = sys.getTrunkOutputs();
+	FeatureHeader header;
+	std::memcpy(header.magic, FeatureMagic, sizeof(FeatureMagic));
+	header.version = FeatureVersion;
+	header.byteOrder = FeatureByteOrder;
+	header.key = key;
+	header.sampleCount = sampleCount;
+	header.sampleBytes = sampleBytes;
+	header.outputCount = (uint32_t) outputs.size();
+	header.precision = static_cast<int32_t>(precision);
+	header.dataOffset = sizeof(header) + outputs.size() * sizeof(FeatureOutput);
+	header.dataOffset = (header.dataOffset + FeatureAlignment - 1)
+			/ FeatureAlignment * FeatureAlignment;
+	header.fileBytes = header.dataOffset + sampleCount * sampleBytes;
+	std::vector<char> table(header.dataOffset - sizeof(header), 0);
+	for (size_t o = 0; o < outputs.size(); o++) {
+		FeatureOutput out = GetFeatureOutput(outputs[o]);
+		std::memcpy(table.data() + o * sizeof(out), &out, sizeof(out));
+	}
+	size_t valueBytes = GetValueBytes(precision);
+	size_t batchSize = (size_t) std::max(options.batchSize, 1);
+	std::vector<uint8_t> block(batchSize * sampleBytes);
+	std::vector<Tensor> batch;
+	std::string tmpFile = file + ".tmp";
+	bool ok;
+	sys.setPhase(NetPhase::Test);
+	{
+		std::ofstream os(tmpFile, std::ios::binary);
+		os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		os.write(table.data(), table.size());
+		for (size_t start = 0; start < inputs.size() && os.good(); start +=
+				batchSize) {
+			size_t end = std::min(inputs.size(), start + batchSize);
+			batch.assign(inputs.begin() + start, inputs.begin() + end);
+			sys.forwardTrunk(batch);
+			NeuralThreadPool::parallelForEach(0, end - start, [&](size_t i) {
+				uint8_t* dst = block.data() + i * sampleBytes;
+				for (size_t o = 0; o < outputs.size(); o++) {
+					NarrowValues(outputs[o]->value[i].data(), counts[o], precision, dst);
+					dst += counts[o] * valueBytes;
+				}
+			}, 1);
+			os.write(reinterpret_cast<const char*>(block.data()),
+					(end - start) * sampleBytes);
+		}
+		ok = os.good();
+	}
+	sys.setPhase(NetPhase::Train);
+	if (!ok || std::rename(tmpFile.c_str(), file.c_str()) != 0) {
+		std::remove(tmpFile.c_str());
+		throw std::runtime_error("Could not write feature cache " + file);
+	}
+}
+bool NeuralFeatureCache::map(uint64_t key, const NeuralSystem& sys) {
+	std::shared_ptr<FeatureMapping> m(new FeatureMapping());
+#ifndef _WIN32
+	int fd = ::open(file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+		m->size = (size_t) st.st_size;
+		//pages are read on first use, so only the batches trained touch the disk
+		void* ptr = ::mmap(nullptr, m->size, PROT_READ, MAP_SHARED, fd, 0);
+		if (ptr != MAP_FAILED) {
+			m->base = (const char*) ptr;
+			m->mapped = true;
+		}
+	}
+	::close(fd);
+#else
+	std::ifstream is(file, std::ios::binary | std::ios::ate);
+	if (is.is_open()) {
+		m->buffer.resize((size_t) is.tellg());
+		is.seekg(0);
+		if (is.read(m->buffer.data(), m->buffer.size())) {
+			m->base = m->buffer.data();
+			m->size = m->buffer.size();
+		}
+	}
+#endif
+	if (m->base == nullptr || m->size < sizeof(FeatureHeader)) {
+		return false;
+	}
+	FeatureHeader header;
+	std::memcpy(&header, m->base, sizeof(header));
+	const std::vector<SignalPtr>& outputs = sys.getTrunkOutputs();
+	if (std::memcmp(header.magic, FeatureMagic, sizeof(FeatureMagic)) != 0
+			|| header.version != FeatureVersion
+			|| header.byteOrder != FeatureByteOrder || header.key != key
+			|| header.sampleCount != sampleCount
+			|| header.sampleBytes != sampleBytes
+			|| header.precision != static_cast<int32_t>(precision)
+			|| header.outputCount != outputs.size()
+			|| header.dataOffset % FeatureAlignment != 0
+			|| header.fileBytes != m->size
+			|| header.dataOffset > m->size
+			|| (m->size - header.dataOffset) / std::max(sampleBytes, (uint64_t) 1)
+					< sampleCount) {
+		return false;
+	}
+	mapping = m;
+	return true;
+}
+std::vector<Tensor> NeuralFeatureCache::forward(NeuralSystem& sys,
+		const int* samples, size_t count) const {
+	if (mapping.get() == nullptr) {
+		throw std::runtime_error("Feature cache is not open.");
+	}
+	const std::vector<SignalPtr>& outputs = sys.getTrunkOutputs();
+	if (sys.getTrunk() != trunk || outputs.size() != counts.size()) {
+		throw std::runtime_error(
+				"Feature cache " + file + " does not match the network's trunk.");
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (samples[i] < 0 || (uint64_t) samples[i] >= sampleCount) {
+			throw std::runtime_error(
+					"Sample " + std::to_string(samples[i])
+							+ " is not in the feature cache.");
+		}
+	}
+	FeatureHeader header;
+	std::memcpy(&header, mapping->base, sizeof(header));
+	const char* data = mapping->base + header.dataOffset;
+	size_t valueBytes = GetValueBytes(precision);
+	sys.bindTrunkOutputs(count);
+	NeuralThreadPool::parallelForEach(0, count, [&](size_t i) {
+		const char* src = data + (uint64_t) samples[i] * sampleBytes;
+		for (size_t o = 0; o < outputs.size(); o++) {
+			WidenValues(src, counts[o], precision, outputs[o]->value[i].data());
+			src += counts[o] * valueBytes;
+		}
+	}, 1);
+	return sys.forwardHead();
+}
+}
@@ -19,6 +19,7 @@
 * THE SOFTWARE.
 */
 #include "NeuralFlowPane.h"
+#include "NeuralSystem.h"
 #include "AlloyApplication.h"
 #include "AlloyDrawUtil.h"
 #include <iomanip>
@@ -339,3 +340,15 @@ namespace aly{
 		}
 	}
 }
+// the layer tree is part of the UI, so it is built here rather than in the
+// neural core
+namespace tgr {
+void NeuralSystem::initialize(const aly::ExpandTreePtr& tree) {
+	aly::TreeItemPtr root = aly::TreeItemPtr(new aly::TreeItem("Neural Layers"));
+	tree->addItem(root);
+	root->setExpanded(true);
+	for (NeuralLayerPtr n : roots) {
+		n->initialize(tree, root);
+	}
+}
+}
@@ -0,0 +1,495 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralHistory.h"
+#include "NeuralSystem.h"
+#include "NeuralThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+namespace tgr {
+typedef std::chrono::high_resolution_clock Clock;
+/*
+ * Delta file layout, every field little-endian:
+ *   header (64 bytes)
+ *   blockCount + 1 offsets of the block payloads, the last one is the end
+ *   block payloads
+ * A block holds BlockFloats floats of the snapshot, all tensors laid end to
+ * end. Its payload is the XOR with the previous snapshot, split into four
+ * byte planes and run length coded: a varint (length << 1 | zero), followed
+ * by length literal bytes unless zero is set.
+ */
+static const char DeltaMagic[8] = { 'T', 'I', 'G', 'E', 'R', 'D', 'L', 'T' };
+static const uint32_t DeltaVersion = 1;
+static const uint32_t DeltaByteOrder = 0x01020304;
+static const size_t BlockFloats = 1 << 16;
+//shorter zero runs are cheaper to leave inside a literal
+static const size_t MinZeroRun = 4;
+struct DeltaHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	int32_t iteration;
+	int32_t base; //iteration the delta applies to
+	int32_t keyframe;
+	uint32_t blockFloats;
+	uint64_t floatCount;
+	uint64_t blockCount;
+	uint64_t fileBytes;
+	char reserved[8];
+};
+static_assert(sizeof(DeltaHeader) == 64, "Delta header must be 64 bytes.");
+static double Seconds(Clock::time_point start) {
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+static uint64_t CountFloats(const std::vector<KnowledgeTensor>& tensors) {
+	uint64_t count = 0;
+	for (const KnowledgeTensor& t : tensors) {
+		count += t.count;
+	}
+	return count;
+}
+/*
+ * Calls f(tensor, offset in tensor, offset in block, count) for the pieces
+ * of the tensors that fall into one block of the concatenated snapshot.
+ */
+template<class F> static void ForEachPiece(
+		const std::vector<KnowledgeTensor>& tensors,
+		const std::vector<uint64_t>& starts, uint64_t begin, uint64_t end,
+		F f) {
+	size_t i = std::upper_bound(starts.begin(), starts.end(), begin)
+			- starts.begin() - 1;
+	for (; i < tensors.size() && starts[i] < end; i++) {
+		uint64_t from = std::max(begin, starts[i]);
+		uint64_t to = std::min(end, starts[i] + tensors[i].count);
+		if (to > from) {
+			f(i, (size_t) (from - starts[i]), (size_t) (from - begin),
+					(size_t) (to - from));
+		}
+	}
+}
+static std::vector<uint64_t> GetStarts(
+		const std::vector<KnowledgeTensor>& tensors) {
+	std::vector<uint64_t> starts(tensors.size());
+	uint64_t offset = 0;
+	for (size_t i = 0; i < tensors.size(); i++) {
+		starts[i] = offset;
+		offset += tensors[i].count;
+	}
+	return starts;
+}
+static void PutVarint(std::vector<uint8_t>& out, uint64_t v) {
+	while (v >= 0x80) {
+		out.push_back((uint8_t) (v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((uint8_t) v);
+}
+static void EncodeBlock(const uint32_t* bits, size_t n,
+		std::vector<uint8_t>& planes, std::vector<uint8_t>& out) {
+	size_t total = 4 * n;
+	planes.resize(total);
+	for (size_t i = 0; i < n; i++) {
+		uint32_t x = bits[i];
+		planes[i] = (uint8_t) x;
+		planes[n + i] = (uint8_t) (x >> 8);
+		planes[2 * n + i] = (uint8_t) (x >> 16);
+		planes[3 * n + i] = (uint8_t) (x >> 24);
+	}
+	out.clear();
+	size_t literal = 0;
+	auto putLiteral = [&](size_t end) {
+		if (end > literal) {
+			PutVarint(out, (uint64_t) (end - literal) << 1);
+			out.insert(out.end(), planes.begin() + literal,
+					planes.begin() + end);
+		}
+	};
+	size_t i = 0;
+	while (i < total) {
+		if (planes[i] != 0) {
+			i++;
+			continue;
+		}
+		size_t j = i;
+		while (j < total && planes[j] == 0)
+			j++;
+		if (j - i >= MinZeroRun || j == total) {
+			putLiteral(i);
+			PutVarint(out, ((uint64_t) (j - i) << 1) | 1);
+			literal = j;
+		}
+		i = j;
+	}
+	putLiteral(total);
+}
+//XORs a block payload into bits
+static void DecodeBlock(const uint8_t* data, size_t bytes, uint32_t* bits,
+		size_t n, std::vector<uint8_t>& planes) {
+	size_t total = 4 * n;
+	planes.resize(total);
+	const uint8_t* end = data + bytes;
+	size_t o = 0;
+	while (o < total) {
+		uint64_t v = 0;
+		int shift = 0;
+		while (true) {
+			if (data == end || shift > 63) {
+				throw std::runtime_error("Corrupt weight history block.");
+			}
+			uint8_t c = *data++;
+			v |= (uint64_t) (c & 0x7F) << shift;
+			shift += 7;
+			if ((c & 0x80) == 0)
+				break;
+		}
+		uint64_t length = v >> 1;
+		if (length > total - o || ((v & 1) == 0 && length > (uint64_t) (end - data))) {
+			throw std::runtime_error("Corrupt weight history block.");
+		}
+		if (v & 1) {
+			std::memset(planes.data() + o, 0, (size_t) length);
+		} else {
+			std::memcpy(planes.data() + o, data, (size_t) length);
+			data += length;
+		}
+		o += (size_t) length;
+	}
+	for (size_t i = 0; i < n; i++) {
+		bits[i] ^= (uint32_t) planes[i] | ((uint32_t) planes[n + i] << 8)
+				| ((uint32_t) planes[2 * n + i] << 16)
+				| ((uint32_t) planes[3 * n + i] << 24);
+	}
+}
+static void ReadFile(const std::string& file, std::vector<uint8_t>& data) {
+	std::ifstream is(file, std::ios::binary | std::ios::ate);
+	if (!is.good()) {
+		throw std::runtime_error("Could not read weight history " + file);
+	}
+	std::streamoff size = is.tellg();
+	is.seekg(0);
+	data.resize((size_t) size);
+	is.read(reinterpret_cast<char*>(data.data()), size);
+	if (!is.good()) {
+		throw std::runtime_error("Could not read weight history " + file);
+	}
+}
+NeuralHistory::NeuralHistory(const HistoryOptions& options) :
+		options(options), lastKeyframe(-1), sinceKeyframe(0) {
+}
+std::string NeuralHistory::getFile(int iteration, bool keyframe) const {
+	std::stringstream ss;
+	ss << options.directory << "/" << options.prefix << "_" << std::setw(6)
+			<< std::setfill('0') << iteration << (keyframe ? ".tgw" : ".tgd");
+	return ss.str();
+}
+bool NeuralHistory::sameLayout(
+		const std::vector<KnowledgeTensor>& tensors) const {
+	if (tensors.size() != layout.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < tensors.size(); i++) {
+		if (tensors[i].layerId != layout[i].layerId
+				|| tensors[i].type != layout[i].type
+				|| tensors[i].index != layout[i].index
+				|| tensors[i].count != layout[i].count) {
+			return false;
+		}
+	}
+	return true;
+}
+void NeuralHistory::record(const NeuralSystem& sys, int iteration) {
+	std::vector<KnowledgeTensor> tensors;
+	std::map<int, std::string> layerNames;
+	//the tensors point straight at the live weights, recording is synchronous
+	for (const NeuralLayerPtr& layer : sys) {
+		int weightIndex = 0, biasIndex = 0;
+		for (const SignalPtr& sig : layer->getInputSignals()) {
+			if (sig.get() == nullptr || !isTrainableWeight(sig->type)
+					|| sig->value.size() == 0)
+				continue;
+			KnowledgeTensor t;
+			t.layerId = layer->getId();
+			t.type = sig->type;
+			t.index = (sig->type == ChannelType::bias) ?
+					biasIndex++ : weightIndex++;
+			t.count = sig->value.front().size();
+			t.data = sig->value.front().data();
+			tensors.push_back(t);
+		}
+		layerNames[layer->getId()] = layer->getName();
+	}
+	record(sys.getName(), tensors, layerNames, iteration);
+}
+void NeuralHistory::record(const NeuralKnowledge& knowledge, int iteration) {
+	std::vector<KnowledgeTensor> tensors = knowledge.getTensors();
+	std::map<int, std::string> layerNames;
+	for (const KnowledgeTensor& t : tensors) {
+		layerNames[t.layerId] = knowledge.getLayerName(t.layerId);
+	}
+	record(knowledge.getName(), tensors, layerNames, iteration);
+}
+void NeuralHistory::record(const std::string& name,
+		const std::vector<KnowledgeTensor>& tensors,
+		const std::map<int, std::string>& layerNames, int iteration) {
+	auto start = Clock::now();
+	bool restart = false;
+	{
+		std::lock_guard<std::mutex> lockMe(lock);
+		if (entries.size() > 0 && entries.rbegin()->first >= iteration) {
+			entries.erase(entries.lower_bound(iteration), entries.end());
+			restart = true;
+		}
+	}
+	if (restart || lastKeyframe < 0 || sinceKeyframe + 1 >= options.keyframeInterval
+			|| !sameLayout(tensors)) {
+		writeKeyframe(iteration, name, tensors, layerNames);
+	} else {
+		writeDelta(iteration, tensors);
+	}
+	std::lock_guard<std::mutex> lockMe(lock);
+	stats.rawBytes += CountFloats(tensors) * sizeof(float);
+	stats.recordTime += Seconds(start);
+}
+void NeuralHistory::writeKeyframe(int iteration, const std::string& name,
+		const std::vector<KnowledgeTensor>& tensors,
+		const std::map<int, std::string>& layerNames) {
+	std::string file = getFile(iteration, true);
+	WriteWeightContainer(file, name, tensors, layerNames, true);
+	layout = tensors;
+	std::vector<uint64_t> starts = GetStarts(tensors);
+	previous.resize(CountFloats(tensors));
+	NeuralThreadPool::parallelForEach(0, tensors.size(), [&](size_t i) {
+		std::memcpy(previous.data() + starts[i], tensors[i].data,
+				tensors[i].count * sizeof(float));
+	}, 1);
+	uint64_t bytes = 0;
+	std::ifstream is(file, std::ios::binary | std::ios::ate);
+	if (is.good()) {
+		bytes = (uint64_t) is.tellg();
+	}
+	lastKeyframe = iteration;
+	sinceKeyframe = 0;
+	std::lock_guard<std::mutex> lockMe(lock);
+	Entry& e = entries[iteration];
+	e.keyframe = iteration;
+	e.file = file;
+	stats.keyframes++;
+	stats.storedBytes += bytes;
+}
+void NeuralHistory::writeDelta(int iteration,
+		const std::vector<KnowledgeTensor>& tensors) {
+	std::vector<uint64_t> starts = GetStarts(tensors);
+	uint64_t floatCount = previous.size();
+	size_t blockCount = (size_t) ((floatCount + BlockFloats - 1) / BlockFloats);
+	std::vector<std::vector<uint8_t>> payloads(blockCount);
+	int dropBits = std::min(std::max(options.dropBits, 0), 23);
+	uint32_t mask = ~((1u << dropBits) - 1u);
+	NeuralThreadPool::parallelForEach(0, blockCount, [&](size_t b) {
+		uint64_t begin = b * BlockFloats;
+		uint64_t end = std::min(floatCount, begin + BlockFloats);
+		size_t n = (size_t) (end - begin);
+		std::vector<uint32_t> bits(n);
+		ForEachPiece(tensors, starts, begin, end,
+				[&](size_t i, size_t from, size_t to, size_t count) {
+					std::memcpy(bits.data() + to, tensors[i].data + from, count * sizeof(float));
+				});
+		//the new bits become the reference for the next delta
+		uint32_t* prev = previous.data() + begin;
+		for (size_t k = 0; k < n; k++) {
+			uint32_t x = bits[k] & mask;
+			bits[k] = x ^ prev[k];
+			prev[k] = x;
+		}
+		std::vector<uint8_t> planes;
+		EncodeBlock(bits.data(), n, planes, payloads[b]);
+	}, 1);
+	int base;
+	{
+		std::lock_guard<std::mutex> lockMe(lock);
+		base = entries.rbegin()->first;
+	}
+	DeltaHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, DeltaMagic, sizeof(DeltaMagic));
+	header.version = DeltaVersion;
+	header.byteOrder = DeltaByteOrder;
+	header.iteration = iteration;
+	header.base = base;
+	header.keyframe = lastKeyframe;
+	header.blockFloats = (uint32_t) BlockFloats;
+	header.floatCount = floatCount;
+	header.blockCount = blockCount;
+	std::vector<uint64_t> offsets(blockCount + 1);
+	offsets[0] = sizeof(DeltaHeader) + offsets.size() * sizeof(uint64_t);
+	for (size_t b = 0; b < blockCount; b++) {
+		offsets[b + 1] = offsets[b] + payloads[b].size();
+	}
+	header.fileBytes = offsets.back();
+	std::string file = getFile(iteration, false);
+	std::string tmpFile = file + ".tmp";
+	bool ok;
+	{
+		std::ofstream os(tmpFile, std::ios::binary);
+		os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		os.write(reinterpret_cast<const char*>(offsets.data()),
+				offsets.size() * sizeof(uint64_t));
+		for (const std::vector<uint8_t>& payload : payloads) {
+			os.write(reinterpret_cast<const char*>(payload.data()),
+					payload.size());
+		}
+		ok = os.good();
+	}
+	if (!ok || std::rename(tmpFile.c_str(), file.c_str()) != 0) {
+		std::remove(tmpFile.c_str());
+		//the chain is broken, the next snapshot starts a new one
+		lastKeyframe = -1;
+		throw std::runtime_error("Could not write weight history " + file);
+	}
+	sinceKeyframe++;
+	std::lock_guard<std::mutex> lockMe(lock);
+	Entry& e = entries[iteration];
+	e.keyframe = lastKeyframe;
+	e.file = file;
+	stats.deltas++;
+	stats.storedBytes += header.fileBytes;
+}
+bool NeuralHistory::has(int iteration) const {
+	std::lock_guard<std::mutex> lockMe(lock);
+	return (entries.find(iteration) != entries.end());
+}
+std::vector<int> NeuralHistory::getIterations() const {
+	std::lock_guard<std::mutex> lockMe(lock);
+	std::vector<int> iterations;
+	for (const auto& pr : entries) {
+		iterations.push_back(pr.first);
+	}
+	return iterations;
+}
+std::string NeuralHistory::getRecordFile(int iteration) const {
+	std::lock_guard<std::mutex> lockMe(lock);
+	auto it = entries.find(iteration);
+	return (it != entries.end()) ? it->second.file : std::string();
+}
+void NeuralHistory::reconstruct(int iteration, NeuralKnowledge& knowledge) {
+	auto start = Clock::now();
+	std::string keyFile;
+	int keyIteration;
+	std::vector<std::pair<int, std::string>> chain;
+	{
+		std::lock_guard<std::mutex> lockMe(lock);
+		auto it = entries.find(iteration);
+		if (it == entries.end()) {
+			throw std::runtime_error(
+					"No weight history for iteration "
+							+ std::to_string(iteration));
+		}
+		auto key = entries.find(it->second.keyframe);
+		keyFile = key->second.file;
+		keyIteration = key->first;
+		for (auto d = std::next(key); d != std::next(it); d++) {
+			chain.push_back(std::make_pair(d->first, d->second.file));
+		}
+	}
+	NeuralKnowledge keyframe;
+	keyframe.mapContainer(keyFile);
+	knowledge = keyframe.materialize();
+	knowledge.setFile(keyFile);
+	std::vector<KnowledgeTensor> tensors = knowledge.getTensors();
+	std::vector<uint64_t> starts = GetStarts(tensors);
+	uint64_t floatCount = CountFloats(tensors);
+	std::vector<std::vector<uint8_t>> deltas(chain.size());
+	for (size_t d = 0; d < chain.size(); d++) {
+		const std::string& file = chain[d].second;
+		ReadFile(file, deltas[d]);
+		const std::vector<uint8_t>& data = deltas[d];
+		if (data.size() < sizeof(DeltaHeader)) {
+			throw std::runtime_error("Invalid weight history " + file);
+		}
+		const DeltaHeader* header = reinterpret_cast<const DeltaHeader*>(data.data());
+		if (std::memcmp(header->magic, DeltaMagic, sizeof(DeltaMagic)) != 0
+				|| header->version != DeltaVersion
+				|| header->byteOrder != DeltaByteOrder
+				|| header->fileBytes != data.size()
+				|| header->blockFloats != BlockFloats
+				|| header->floatCount != floatCount
+				|| header->blockCount != (floatCount + BlockFloats - 1) / BlockFloats
+				|| sizeof(DeltaHeader) + (header->blockCount + 1) * sizeof(uint64_t) > data.size()) {
+			throw std::runtime_error("Invalid weight history " + file);
+		}
+		const uint64_t* offsets = reinterpret_cast<const uint64_t*>(data.data() + sizeof(DeltaHeader));
+		for (uint64_t b = 0; b < header->blockCount; b++) {
+			if (offsets[b] > offsets[b + 1] || offsets[b + 1] > data.size()) {
+				throw std::runtime_error("Invalid weight history " + file);
+			}
+		}
+		//files of a run that was restarted do not belong to this chain
+		int base = (d == 0) ? keyIteration : chain[d - 1].first;
+		if (header->iteration != chain[d].first || header->base != base
+				|| header->keyframe != keyIteration) {
+			throw std::runtime_error("Weight history " + file + " is out of sequence");
+		}
+	}
+	size_t blockCount = (size_t) ((floatCount + BlockFloats - 1) / BlockFloats);
+	//materialize() gave the knowledge its own buffers, written in place here
+	NeuralThreadPool::parallelForEach(0, blockCount, [&](size_t b) {
+		uint64_t begin = b * BlockFloats;
+		uint64_t end = std::min(floatCount, begin + BlockFloats);
+		size_t n = (size_t) (end - begin);
+		std::vector<uint32_t> bits(n);
+		std::vector<uint8_t> planes;
+		ForEachPiece(tensors, starts, begin, end,
+				[&](size_t i, size_t from, size_t to, size_t count) {
+					std::memcpy(bits.data() + to, tensors[i].data + from, count * sizeof(float));
+				});
+		for (const std::vector<uint8_t>& data : deltas) {
+			const uint64_t* offsets = reinterpret_cast<const uint64_t*>(data.data() + sizeof(DeltaHeader));
+			DecodeBlock(data.data() + offsets[b], (size_t) (offsets[b + 1] - offsets[b]), bits.data(), n, planes);
+		}
+		ForEachPiece(tensors, starts, begin, end,
+				[&](size_t i, size_t from, size_t to, size_t count) {
+					std::memcpy(const_cast<float*>(tensors[i].data) + from, bits.data() + to, count * sizeof(float));
+				});
+	}, 1);
+	std::lock_guard<std::mutex> lockMe(lock);
+	stats.reconstructed++;
+	stats.reconstructTime += Seconds(start);
+}
+HistoryStats NeuralHistory::getStats() const {
+	std::lock_guard<std::mutex> lockMe(lock);
+	return stats;
+}
+void NeuralHistory::printStats(std::ostream& out) const {
+	HistoryStats s = getStats();
+	int records = s.keyframes + s.deltas;
+	out << "History: " << records << " snapshots (" << s.keyframes
+			<< " keyframes), " << (s.storedBytes >> 20) << " MB of "
+			<< (s.rawBytes >> 20) << " MB, record "
+			<< 1000.0 * s.recordTime / std::max(records, 1)
+			<< " ms each, reconstruct "
+			<< 1000.0 * s.reconstructTime / std::max(s.reconstructed, 1)
+			<< " ms each" << std::endl;
+}
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralKernels.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+namespace tgr {
+//defined in NeuralKernelsSSE42.cpp, NeuralKernelsAVX2.cpp and
+//NeuralKernelsAVX512.cpp, nullptr when the compiler cannot target them
+const KernelTable* GetKernelTableSSE42();
+const KernelTable* GetKernelTableAVX2();
+const KernelTable* GetKernelTableAVX512();
+namespace generic {
+#pragma GCC push_options
+#define TGR_KERNEL_WIDTH 4
+#include "NeuralKernelsImpl.h"
+#undef TGR_KERNEL_WIDTH
+#pragma GCC pop_options
+static KernelTable MakeTable() {
+	KernelTable table;
+	FillTable(table, IsaLevel::Generic);
+	return table;
+}
+}
+std::string GetIsaName(IsaLevel isa) {
+	switch (isa) {
+	case IsaLevel::Generic:
+		return "Generic";
+	case IsaLevel::SSE42:
+		return "SSE4.2";
+	case IsaLevel::AVX2:
+		return "AVX2";
+	case IsaLevel::AVX512:
+		return "AVX-512";
+	default:
+		return "Unknown";
+	}
+}
+std::ostream& operator<<(std::ostream& os, IsaLevel isa) {
+	return os << GetIsaName(isa);
+}
+static CpuFeatures DetectCpuFeatures() {
+	CpuFeatures f;
+	f.sse42 = f.avx = f.avx2 = f.fma = f.f16c = false;
+	f.avx512f = f.avx512bw = f.avx512dq = f.avx512vl = f.avx512vnni = false;
+	f.osAvx = f.osAvx512 = false;
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+	if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+		return f;
+	unsigned int maxLeaf = eax;
+	char vendor[13];
+	std::memcpy(vendor, &ebx, 4);
+	std::memcpy(vendor + 4, &edx, 4);
+	std::memcpy(vendor + 8, &ecx, 4);
+	vendor[12] = '\0';
+	f.vendor = vendor;
+	__get_cpuid(1, &eax, &ebx, &ecx, &edx);
+	f.sse42 = (ecx & (1u << 20)) != 0;
+	f.fma = (ecx & (1u << 12)) != 0;
+	f.avx = (ecx & (1u << 28)) != 0;
+	f.f16c = (ecx & (1u << 29)) != 0;
+	bool osxsave = (ecx & (1u << 27)) != 0;
+	if (osxsave) {
+		//which register state the OS saves on context switches
+		uint32_t xcr0lo, xcr0hi;
+		__asm__ __volatile__("xgetbv" : "=a"(xcr0lo), "=d"(xcr0hi) : "c"(0));
+		f.osAvx = (xcr0lo & 0x6) == 0x6;
+		f.osAvx512 = (xcr0lo & 0xE6) == 0xE6;
+	}
+	if (maxLeaf >= 7) {
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		f.avx2 = (ebx & (1u << 5)) != 0;
+		f.avx512f = (ebx & (1u << 16)) != 0;
+		f.avx512dq = (ebx & (1u << 17)) != 0;
+		f.avx512bw = (ebx & (1u << 30)) != 0;
+		f.avx512vl = (ebx & (1u << 31)) != 0;
+		f.avx512vnni = (ecx & (1u << 11)) != 0;
+	}
+	if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) && eax >= 0x80000004) {
+		char brand[49];
+		for (unsigned int leaf = 0; leaf < 3; leaf++) {
+			unsigned int regs[4];
+			__get_cpuid(0x80000002 + leaf, &regs[0], &regs[1], &regs[2], &regs[3]);
+			std::memcpy(brand + 16 * leaf, regs, 16);
+		}
+		brand[48] = '\0';
+		std::string str = brand;
+		size_t first = str.find_first_not_of(' ');
+		size_t last = str.find_last_not_of(' ');
+		if (first != std::string::npos) {
+			f.brand = str.substr(first, last - first + 1);
+		}
+	}
+#endif
+	return f;
+}
+static const KernelTable* GetTable(IsaLevel isa) {
+	static const KernelTable genericTable = generic::MakeTable();
+	const KernelTable* table = nullptr;
+	switch (isa) {
+	case IsaLevel::AVX512:
+		table = GetKernelTableAVX512();
+		break;
+	case IsaLevel::AVX2:
+		table = GetKernelTableAVX2();
+		break;
+	case IsaLevel::SSE42:
+		table = GetKernelTableSSE42();
+		break;
+	default:
+		break;
+	}
+	if (table != nullptr)
+		return table;
+	if (isa == IsaLevel::Generic)
+		return &genericTable;
+	return GetTable((IsaLevel) ((int) isa - 1));
+}
+IsaLevel ParseIsaLevel(const std::string& name) {
+	std::string str = name;
+	std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+	if (str == "generic")
+		return IsaLevel::Generic;
+	if (str == "sse42" || str == "sse4.2")
+		return IsaLevel::SSE42;
+	if (str == "avx2")
+		return IsaLevel::AVX2;
+	if (str == "avx512" || str == "avx-512")
+		return IsaLevel::AVX512;
+	throw std::runtime_error("Unknown instruction set " + name);
+}
+static std::atomic<const KernelTable*> CurrentTable(nullptr);
+const CpuFeatures& NeuralKernels::getCpuFeatures() {
+	static const CpuFeatures features = DetectCpuFeatures();
+	return features;
+}
+IsaLevel NeuralKernels::getSupportedIsa() {
+	const CpuFeatures& f = getCpuFeatures();
+	if (f.avx512f && f.avx512bw && f.avx512dq && f.avx512vl && f.avx2 && f.fma
+			&& f.osAvx512)
+		return IsaLevel::AVX512;
+	if (f.avx2 && f.fma && f.avx && f.osAvx)
+		return IsaLevel::AVX2;
+	if (f.sse42)
+		return IsaLevel::SSE42;
+	return IsaLevel::Generic;
+}
+IsaLevel NeuralKernels::setIsa(IsaLevel isa) {
+	isa = std::min(isa, getSupportedIsa());
+	const KernelTable* table = GetTable(isa);
+	CurrentTable.store(table);
+	return table->isa;
+}
+const KernelTable& NeuralKernels::get() {
+	const KernelTable* table = CurrentTable.load(std::memory_order_acquire);
+	if (table == nullptr) {
+		IsaLevel isa = getSupportedIsa();
+		const char* env = std::getenv("TIGER_ISA");
+		if (env != nullptr) {
+			try {
+				isa = ParseIsaLevel(env);
+			} catch (std::exception&) {
+				//keep the detected level
+			}
+		}
+		setIsa(isa);
+		table = CurrentTable.load();
+	}
+	return *table;
+}
+IsaLevel NeuralKernels::getIsa() {
+	return get().isa;
+}
+}
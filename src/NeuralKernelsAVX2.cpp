@@ -0,0 +1,111 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+namespace tgr {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+namespace avx2 {
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#define TGR_KERNEL_WIDTH 8
+#include "NeuralKernelsImpl.h"
+#undef TGR_KERNEL_WIDTH
+static inline float HorizontalSum(__m256 v) {
+	__m128 lo = _mm256_castps256_ps128(v);
+	__m128 hi = _mm256_extractf128_ps(v, 1);
+	lo = _mm_add_ps(lo, hi);
+	lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+	lo = _mm_add_ss(lo, _mm_movehdup_ps(lo));
+	return _mm_cvtss_f32(lo);
+}
+//eight table entries per step with hardware gathers
+static void SparseDotGather(const uint32_t* packed, int begin, int end,
+		int shift, uint32_t mask, const float* const * a,
+		const float* const * b, bool sharedA, int count, float* result) {
+	const int MAX_TILE = 8;
+	int k = begin;
+	for (int s = 0; s < count; s++) {
+		result[s] = 0.0f;
+	}
+	if (end - k >= 8 && count <= MAX_TILE) {
+		const __m256i vmask = _mm256_set1_epi32(static_cast<int>(mask));
+		const __m128i vshift = _mm_cvtsi32_si128(shift);
+		__m256 acc[MAX_TILE];
+		for (int s = 0; s < count; s++) {
+			acc[s] = _mm256_setzero_ps();
+		}
+		for (; k + 8 <= end; k += 8) {
+			__m256i p = _mm256_loadu_si256(
+					reinterpret_cast<const __m256i*>(packed + k));
+			__m256i first = _mm256_srl_epi32(p, vshift);
+			__m256i second = _mm256_and_si256(p, vmask);
+			__m256 wa = _mm256_setzero_ps();
+			if (sharedA) {
+				wa = _mm256_i32gather_ps(a[0], first, 4);
+			}
+			for (int s = 0; s < count; s++) {
+				__m256 va = sharedA ? wa : _mm256_i32gather_ps(a[s], first, 4);
+				__m256 vb = _mm256_i32gather_ps(b[s], second, 4);
+				acc[s] = _mm256_fmadd_ps(va, vb, acc[s]);
+			}
+		}
+		for (int s = 0; s < count; s++) {
+			result[s] = HorizontalSum(acc[s]);
+		}
+	}
+	SparseDotRange(packed, k, end, shift, mask, a, b, sharedA, count, result);
+}
+//F16C shipped with every AVX2 part, but it has its own feature bit
+__attribute__((target("avx2,fma,f16c")))
+static void HalfToFloatF16C(const uint16_t* src, float* dst, size_t n) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+	}
+	HalfToFloat(src + i, dst + i, n - i);
+}
+#pragma GCC pop_options
+static KernelTable MakeTable() {
+	KernelTable table;
+	FillTable(table, IsaLevel::AVX2);
+	table.sparseDot = SparseDotGather;
+	if (NeuralKernels::getCpuFeatures().f16c) {
+		table.halfToFloat = HalfToFloatF16C;
+	}
+	return table;
+}
+}
+const KernelTable* GetKernelTableAVX2() {
+	static const KernelTable table = avx2::MakeTable();
+	return &table;
+}
+#else
+const KernelTable* GetKernelTableAVX2() {
+	return nullptr;
+}
+#endif
+}
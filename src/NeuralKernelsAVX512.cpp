@@ -0,0 +1,98 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+namespace tgr {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+namespace avx512 {
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512dq,avx512vl,avx2,fma,prefer-vector-width=512")
+#define TGR_KERNEL_WIDTH 16
+#include "NeuralKernelsImpl.h"
+#undef TGR_KERNEL_WIDTH
+//sixteen table entries per step with hardware gathers
+static void SparseDotGather(const uint32_t* packed, int begin, int end,
+		int shift, uint32_t mask, const float* const * a,
+		const float* const * b, bool sharedA, int count, float* result) {
+	const int MAX_TILE = 8;
+	int k = begin;
+	for (int s = 0; s < count; s++) {
+		result[s] = 0.0f;
+	}
+	if (end - k >= 16 && count <= MAX_TILE) {
+		const __m512i vmask = _mm512_set1_epi32(static_cast<int>(mask));
+		const __m128i vshift = _mm_cvtsi32_si128(shift);
+		__m512 acc[MAX_TILE];
+		for (int s = 0; s < count; s++) {
+			acc[s] = _mm512_setzero_ps();
+		}
+		for (; k + 16 <= end; k += 16) {
+			__m512i p = _mm512_loadu_si512(packed + k);
+			__m512i first = _mm512_srl_epi32(p, vshift);
+			__m512i second = _mm512_and_si512(p, vmask);
+			__m512 wa = _mm512_setzero_ps();
+			if (sharedA) {
+				wa = _mm512_i32gather_ps(first, a[0], 4);
+			}
+			for (int s = 0; s < count; s++) {
+				__m512 va = sharedA ? wa : _mm512_i32gather_ps(first, a[s], 4);
+				__m512 vb = _mm512_i32gather_ps(second, b[s], 4);
+				acc[s] = _mm512_fmadd_ps(va, vb, acc[s]);
+			}
+		}
+		for (int s = 0; s < count; s++) {
+			result[s] = _mm512_reduce_add_ps(acc[s]);
+		}
+	}
+	SparseDotRange(packed, k, end, shift, mask, a, b, sharedA, count, result);
+}
+static void HalfToFloatConvert(const uint16_t* src, float* dst, size_t n) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		_mm512_storeu_ps(dst + i, _mm512_cvtph_ps(h));
+	}
+	HalfToFloat(src + i, dst + i, n - i);
+}
+#pragma GCC pop_options
+static KernelTable MakeTable() {
+	KernelTable table;
+	FillTable(table, IsaLevel::AVX512);
+	table.sparseDot = SparseDotGather;
+	table.halfToFloat = HalfToFloatConvert;
+	return table;
+}
+}
+const KernelTable* GetKernelTableAVX512() {
+	static const KernelTable table = avx512::MakeTable();
+	return &table;
+}
+#else
+const KernelTable* GetKernelTableAVX512() {
+	return nullptr;
+}
+#endif
+}
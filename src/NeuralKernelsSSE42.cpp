@@ -0,0 +1,52 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+namespace tgr {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+namespace sse42 {
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+#define TGR_KERNEL_WIDTH 4
+#include "NeuralKernelsImpl.h"
+#undef TGR_KERNEL_WIDTH
+#pragma GCC pop_options
+static KernelTable MakeTable() {
+	KernelTable table;
+	FillTable(table, IsaLevel::SSE42);
+	return table;
+}
+}
+const KernelTable* GetKernelTableSSE42() {
+	static const KernelTable table = sse42::MakeTable();
+	return &table;
+}
+#else
+const KernelTable* GetKernelTableSSE42() {
+	return nullptr;
+}
+#endif
+}
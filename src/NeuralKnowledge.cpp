@@ -1,12 +1,92 @@
 #include "NeuralLayer.h"
 #include "NeuralKnowledge.h"
+#include "NeuralExport.h"
 #include "AlloyFileUtil.h"
 #include "NeuralSystem.h"
+#include "NeuralMemory.h"
+#include "NeuralThreadPool.h"
 #include <cereal/archives/xml.hpp>
 #include <cereal/archives/json.hpp>
 #include <cereal/archives/portable_binary.hpp>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 using namespace aly;
 namespace tgr {
+	/*
+	 * Weight container layout, every field little-endian:
+	 *   header (64 bytes)
+	 *   layer table, one ContainerLayer per layer
+	 *   tensor directory, one ContainerTensor per tensor
+	 *   strings: knowledge name, then layer names
+	 *   tensor payloads as raw floats, each starting on a 64 byte boundary
+	 * Version 2 added the slot of a tensor, which was always 0 before.
+	 */
+	static const char ContainerMagic[8] = { 'T', 'I', 'G', 'E', 'R', 'W', 'G', 'T' };
+	static const uint32_t ContainerVersion = 2;
+	static const uint32_t ContainerByteOrder = 0x01020304;
+	static const uint64_t ContainerAlignment = 64;
+	struct ContainerHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder; //reads back as 0x04030201 on hosts of the other order
+		uint32_t layerCount;
+		uint32_t tensorCount;
+		uint32_t nameLength;
+		uint32_t reserved;
+		uint64_t layerOffset;
+		uint64_t tensorOffset;
+		uint64_t stringOffset;
+		uint64_t fileBytes;
+	};
+	struct ContainerLayer {
+		int32_t id;
+		uint32_t firstTensor;
+		uint32_t tensorCount;
+		uint32_t nameLength;
+		uint64_t nameOffset;
+	};
+	struct ContainerTensor {
+		int32_t layerId;
+		int32_t type;
+		int32_t index;
+		int32_t slot;
+		uint64_t count;
+		uint64_t offset;
+	};
+	static_assert(sizeof(ContainerHeader) == 64, "Container header must be 64 bytes.");
+	static_assert(sizeof(ContainerLayer) == 24, "Unexpected container layer size.");
+	static_assert(sizeof(ContainerTensor) == 32, "Unexpected container tensor size.");
+	static uint64_t AlignUp(uint64_t offset) {
+		return (offset + ContainerAlignment - 1) & ~(ContainerAlignment - 1);
+	}
+	struct KnowledgeMapping {
+		const char* base = nullptr;
+		size_t size = 0;
+		bool mapped = false; //false if read into pooled memory
+		std::vector<KnowledgeTensor> tensors;
+		std::vector<KnowledgeTensor> stateTensors;
+		std::map<int, std::string> layerNames;
+		~KnowledgeMapping() {
+			if (base == nullptr)
+				return;
+#ifndef _WIN32
+			if (mapped) {
+				munmap((void*) base, size);
+				return;
+			}
+#endif
+			NeuralMemory::deallocate((void*) base);
+		}
+	};
 	Knowledge& NeuralKnowledge::getWeights(const NeuralLayer& layer) {
 		return weights.at(layer.getId());
 	}
@@ -19,19 +99,349 @@ namespace tgr {
 	const Knowledge& NeuralKnowledge::getBiasWeights(const NeuralLayer& layer) const {
 		return biasWeights.at(layer.getId());
 	}
+	std::string NeuralKnowledge::getLayerName(int layerId) const {
+		const std::map<int, std::string>& names = isMapped() ? mapping->layerNames : layerNames;
+		auto it = names.find(layerId);
+		return (it != names.end()) ? it->second : std::string();
+	}
+	std::vector<KnowledgeTensor> NeuralKnowledge::getTensors() const {
+		if (isMapped()) {
+			return mapping->tensors;
+		}
+		std::set<int> ids;
+		for (const auto& pr : weights) {
+			ids.insert(pr.first);
+		}
+		for (const auto& pr : biasWeights) {
+			ids.insert(pr.first);
+		}
+		std::vector<KnowledgeTensor> tensors;
+		auto addAll = [&tensors](int id, ChannelType type, const std::map<int, Knowledge>& from) {
+			auto it = from.find(id);
+			if (it == from.end())
+				return;
+			for (size_t i = 0; i < it->second.size(); i++) {
+				const Vec1f& v = it->second[i];
+				KnowledgeTensor t;
+				t.layerId = id;
+				t.type = type;
+				t.index = (int) i;
+				t.count = v.size();
+				t.data = reinterpret_cast<const float*>(v.data.data());
+				tensors.push_back(t);
+			}
+		};
+		for (int id : ids) {
+			addAll(id, ChannelType::weight, weights);
+			addAll(id, ChannelType::bias, biasWeights);
+		}
+		return tensors;
+	}
+	std::vector<KnowledgeTensor> NeuralKnowledge::getOptimizerTensors() const {
+		return isMapped() ? mapping->stateTensors : std::vector<KnowledgeTensor>();
+	}
+	std::string NeuralKnowledge::getOptimizerName() const {
+		return isMapped() ? getLayerName(OptimizerLayerId) : std::string();
+	}
+	NeuralKnowledge NeuralKnowledge::materialize() const {
+		NeuralKnowledge copy(name);
+		copy.file = file;
+		for (const KnowledgeTensor& t : getTensors()) {
+			Knowledge& k = (t.type == ChannelType::bias) ? copy.biasWeights[t.layerId] : copy.weights[t.layerId];
+			Vec1f v;
+			v.resize(t.count);
+			std::memcpy(v.data.data(), t.data, t.count * sizeof(float));
+			k.push_back(v);
+			copy.layerNames[t.layerId] = getLayerName(t.layerId);
+		}
+		return copy;
+	}
 	void NeuralKnowledge::add(const NeuralLayer& layer) {
-		//weights[layer.getId()].data = layer.getWeights();
-		//biasWeights[layer.getId()].data = layer.getBiasWeights();
+		if (isMapped()) {
+			*this = materialize();
+		}
+		int id = layer.getId();
+		weights.erase(id);
+		biasWeights.erase(id);
+		for (const SignalPtr& sig : layer.getInputSignals()) {
+			if (sig.get() == nullptr || !isTrainableWeight(sig->type) || sig->value.size() == 0)
+				continue;
+			const Storage& w = sig->value.front();
+			Vec1f v;
+			v.resize(w.size());
+			std::memcpy(v.data.data(), w.data(), w.size() * sizeof(float));
+			if (sig->type == ChannelType::bias) {
+				biasWeights[id].push_back(v);
+			} else {
+				weights[id].push_back(v);
+			}
+		}
+		layerNames[id] = layer.getName();
+	}
+	std::vector<float*> NeuralKnowledge::allocate(const std::vector<KnowledgeTensor>& layout, const std::map<int, std::string>& names) {
+		clear();
+		layerNames = names;
+		//every vector is sized before any pointer is taken
+		for (const KnowledgeTensor& t : layout) {
+			Knowledge& k = (t.type == ChannelType::bias) ? biasWeights[t.layerId] : weights[t.layerId];
+			if (k.size() <= (size_t) t.index) {
+				k.resize(t.index + 1);
+			}
+			k[t.index].resize(t.count);
+		}
+		std::vector<float*> data;
+		for (const KnowledgeTensor& t : layout) {
+			Knowledge& k = (t.type == ChannelType::bias) ? biasWeights[t.layerId] : weights[t.layerId];
+			data.push_back(reinterpret_cast<float*>(k[t.index].data.data()));
+		}
+		return data;
 	}
 	void NeuralKnowledge::set(const NeuralSystem& sys) {
-		weights.clear();
+		clear();
 		for (NeuralLayerPtr layer : sys.getLayers()) {
 			add(*layer);
 		}
 	}
+	void NeuralKnowledge::writeContainer(const std::string& outFile) const {
+		WriteWeightContainer(outFile, name, getTensors(), isMapped() ? mapping->layerNames : layerNames);
+	}
+	void WriteWeightContainer(const std::string& outFile, const std::string& name, const std::vector<KnowledgeTensor>& tensors,
+			const std::map<int, std::string>& layerNames, bool parallel) {
+		auto getLayerName = [&layerNames](int id) {
+			auto it = layerNames.find(id);
+			return (it != layerNames.end()) ? it->second : std::string();
+		};
+		std::vector<ContainerLayer> layers;
+		std::vector<ContainerTensor> entries(tensors.size());
+		std::string strings = name;
+		for (size_t i = 0; i < tensors.size(); i++) {
+			const KnowledgeTensor& t = tensors[i];
+			if (layers.size() == 0 || layers.back().id != t.layerId) {
+				std::string layerName = getLayerName(t.layerId);
+				ContainerLayer l;
+				l.id = t.layerId;
+				l.firstTensor = (uint32_t) i;
+				l.tensorCount = 0;
+				l.nameLength = (uint32_t) layerName.size();
+				l.nameOffset = strings.size();
+				strings += layerName;
+				layers.push_back(l);
+			}
+			layers.back().tensorCount++;
+			entries[i].layerId = t.layerId;
+			entries[i].type = static_cast<int32_t>(t.type);
+			entries[i].index = t.index;
+			entries[i].slot = t.slot;
+			entries[i].count = t.count;
+		}
+		ContainerHeader header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, ContainerMagic, sizeof(ContainerMagic));
+		header.version = ContainerVersion;
+		header.byteOrder = ContainerByteOrder;
+		header.layerCount = (uint32_t) layers.size();
+		header.tensorCount = (uint32_t) entries.size();
+		header.nameLength = (uint32_t) name.size();
+		header.layerOffset = sizeof(ContainerHeader);
+		header.tensorOffset = header.layerOffset + layers.size() * sizeof(ContainerLayer);
+		header.stringOffset = header.tensorOffset + entries.size() * sizeof(ContainerTensor);
+		uint64_t offset = AlignUp(header.stringOffset + strings.size());
+		for (ContainerTensor& e : entries) {
+			e.offset = offset;
+			offset = AlignUp(offset + e.count * sizeof(float));
+		}
+		header.fileBytes = offset;
+		for (ContainerLayer& l : layers) {
+			l.nameOffset += header.stringOffset;
+		}
+		//everything before the first payload is written in one piece
+		std::vector<char> head((size_t) header.stringOffset + strings.size());
+		std::memcpy(head.data(), &header, sizeof(header));
+		if (layers.size() > 0)
+			std::memcpy(head.data() + header.layerOffset, layers.data(), layers.size() * sizeof(ContainerLayer));
+		if (entries.size() > 0)
+			std::memcpy(head.data() + header.tensorOffset, entries.data(), entries.size() * sizeof(ContainerTensor));
+		std::memcpy(head.data() + header.stringOffset, strings.data(), strings.size());
+		//write a temporary file and rename it, so processes mapping the old
+		//file keep their pages and readers never see a partial container
+		std::string tmpFile = outFile + ".tmp";
+#ifndef _WIN32
+		int fd = ::open(tmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			throw std::runtime_error("Could not write weight container " + tmpFile);
+		}
+		auto writeAt = [fd](const char* data, size_t bytes, uint64_t at) {
+			while (bytes > 0) {
+				ssize_t n = ::pwrite(fd, data, bytes, (off_t) at);
+				if (n <= 0)
+					return false;
+				data += n;
+				bytes -= (size_t) n;
+				at += (uint64_t) n;
+			}
+			return true;
+		};
+		std::atomic<bool> ok(::ftruncate(fd, (off_t) header.fileBytes) == 0);
+		ok = ok && writeAt(head.data(), head.size(), 0);
+		auto writeTensor = [&](size_t i) {
+			if (ok && !writeAt(reinterpret_cast<const char*>(tensors[i].data), tensors[i].count * sizeof(float), entries[i].offset)) {
+				ok = false;
+			}
+		};
+		if (parallel) {
+			NeuralThreadPool::parallelForEach(0, tensors.size(), writeTensor, 1);
+		} else {
+			for (size_t i = 0; i < tensors.size(); i++) {
+				writeTensor(i);
+			}
+		}
+		ok = (::close(fd) == 0) && ok;
+#else
+		bool ok;
+		{
+			std::ofstream os(tmpFile, std::ios::binary);
+			os.write(head.data(), head.size());
+			for (size_t i = 0; i < tensors.size(); i++) {
+				os.seekp((std::streamoff) entries[i].offset);
+				os.write(reinterpret_cast<const char*>(tensors[i].data), tensors[i].count * sizeof(float));
+			}
+			//pad the last payload so the file size matches the header
+			if (header.fileBytes > 0) {
+				os.seekp((std::streamoff) header.fileBytes - 1);
+				os.put(0);
+			}
+			ok = os.good();
+		}
+#endif
+		if (!ok) {
+			std::remove(tmpFile.c_str());
+			throw std::runtime_error("Could not write weight container " + tmpFile);
+		}
+		if (std::rename(tmpFile.c_str(), outFile.c_str()) != 0) {
+			std::remove(tmpFile.c_str());
+			throw std::runtime_error("Could not write weight container " + outFile);
+		}
+	}
+	static void ParseContainer(KnowledgeMapping& m, const std::string& inFile, std::string& name) {
+		auto fail = [&inFile](const std::string& msg) {
+			throw std::runtime_error("Invalid weight container " + inFile + ": " + msg);
+		};
+		if (m.size < sizeof(ContainerHeader)) {
+			fail("file is truncated.");
+		}
+		ContainerHeader header;
+		std::memcpy(&header, m.base, sizeof(header));
+		if (std::memcmp(header.magic, ContainerMagic, sizeof(ContainerMagic)) != 0) {
+			fail("bad magic number.");
+		}
+		if (header.byteOrder != ContainerByteOrder) {
+			fail("written with a different byte order.");
+		}
+		if (header.version < 1 || header.version > ContainerVersion) {
+			fail("unsupported version " + std::to_string(header.version) + ".");
+		}
+		if (header.fileBytes != m.size) {
+			fail("file is truncated.");
+		}
+		auto inRange = [&m](uint64_t offset, uint64_t bytes) {
+			return (offset <= m.size && bytes <= m.size - offset);
+		};
+		if (!inRange(header.layerOffset, (uint64_t) header.layerCount * sizeof(ContainerLayer))
+				|| !inRange(header.tensorOffset, (uint64_t) header.tensorCount * sizeof(ContainerTensor))
+				|| !inRange(header.stringOffset, header.nameLength)
+				|| header.layerOffset % 8 != 0 || header.tensorOffset % 8 != 0) {
+			fail("tables out of range.");
+		}
+		name.assign(m.base + header.stringOffset, header.nameLength);
+		const ContainerLayer* layers = reinterpret_cast<const ContainerLayer*>(m.base + header.layerOffset);
+		for (uint32_t i = 0; i < header.layerCount; i++) {
+			const ContainerLayer& l = layers[i];
+			if (!inRange(l.nameOffset, l.nameLength)) {
+				fail("layer name out of range.");
+			}
+			m.layerNames[l.id].assign(m.base + l.nameOffset, l.nameLength);
+		}
+		const ContainerTensor* entries = reinterpret_cast<const ContainerTensor*>(m.base + header.tensorOffset);
+		for (uint32_t i = 0; i < header.tensorCount; i++) {
+			const ContainerTensor& e = entries[i];
+			if (e.offset % ContainerAlignment != 0 || e.count > m.size / sizeof(float)
+					|| !inRange(e.offset, e.count * sizeof(float))) {
+				fail("tensor " + std::to_string(i) + " out of range.");
+			}
+			KnowledgeTensor t;
+			t.layerId = e.layerId;
+			t.type = static_cast<ChannelType>(e.type);
+			t.index = e.index;
+			t.count = (size_t) e.count;
+			t.data = reinterpret_cast<const float*>(m.base + e.offset);
+			t.slot = (header.version >= 2) ? e.slot : 0;
+			if (t.slot == 0 && t.layerId != OptimizerLayerId) {
+				m.tensors.push_back(t);
+			} else {
+				m.stateTensors.push_back(t);
+			}
+		}
+	}
+	void NeuralKnowledge::mapContainer(const std::string& inFile) {
+		std::shared_ptr<KnowledgeMapping> m(new KnowledgeMapping());
+#ifndef _WIN32
+		int fd = ::open(inFile.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw std::runtime_error("Could not open weight container " + inFile);
+		}
+		struct stat st;
+		if (::fstat(fd, &st) != 0) {
+			::close(fd);
+			throw std::runtime_error("Could not open weight container " + inFile);
+		}
+		m->size = (size_t) st.st_size;
+		if (m->size > 0) {
+			//pages are faulted in on first use and shared with other mappings
+			void* ptr = ::mmap(nullptr, m->size, PROT_READ, MAP_SHARED, fd, 0);
+			if (ptr != MAP_FAILED) {
+				m->base = (const char*) ptr;
+				m->mapped = true;
+			}
+		}
+		::close(fd);
+		if (m->base == nullptr) {
+			throw std::runtime_error("Could not map weight container " + inFile);
+		}
+#else
+		std::ifstream is(inFile, std::ios::binary | std::ios::ate);
+		if (!is.is_open()) {
+			throw std::runtime_error("Could not open weight container " + inFile);
+		}
+		m->size = (size_t) is.tellg();
+		char* buffer = (char*) NeuralMemory::allocate(std::max(m->size, (size_t) 1));
+		m->base = buffer;
+		is.seekg(0);
+		is.read(buffer, m->size);
+		if (!is.good()) {
+			throw std::runtime_error("Could not read weight container " + inFile);
+		}
+#endif
+		std::string containerName;
+		ParseContainer(*m, inFile, containerName);
+		clear();
+		name = containerName;
+		file = inFile;
+		mapping = m;
+	}
+	bool IsWeightContainer(const std::string& file) {
+		std::ifstream is(file, std::ios::binary);
+		char magic[sizeof(ContainerMagic)];
+		return (is.read(magic, sizeof(magic)) && std::memcmp(magic, ContainerMagic, sizeof(magic)) == 0);
+	}
 	void WriteNeuralKnowledgeToFile(const std::string& file, const NeuralKnowledge& params) {
 		std::string ext = GetFileExtension(file);
-		if (ext == "json") {
+		if (ext == "tgw") {
+			params.writeContainer(file);
+		}
+		else if (ext == "tgq") {
+			ExportNeuralKnowledge(file, params);
+		}
+		else if (ext == "json") {
 			std::ofstream os(file);
 			cereal::JSONOutputArchive archive(os);
 			archive(cereal::make_nvp("tigernet", params));
@@ -49,7 +459,13 @@ namespace tgr {
 	}
 	void ReadNeuralKnowledgeFromFile(const std::string& file, NeuralKnowledge& params) {
 		std::string ext = GetFileExtension(file);
-		if (ext == "json") {
+		if (ext == "tgw" || IsWeightContainer(file)) {
+			params.mapContainer(file);
+		}
+		else if (ext == "tgq" || IsExportedKnowledge(file)) {
+			ImportNeuralKnowledge(file, params);
+		}
+		else if (ext == "json") {
 			std::ifstream os(file);
 			cereal::JSONInputArchive archive(os);
 			archive(cereal::make_nvp("tigernet", params));
@@ -19,15 +19,16 @@
  * THE SOFTWARE.
  */
 #include "NeuralLayer.h"
-#include "AlloyUnits.h"
-#include "AlloyDrawUtil.h"
-#include "TigerApp.h"
-#include "NeuralFlowPane.h"
+#include "NeuralNuma.h"
+#include "NeuralPlan.h"
 #include <cereal/archives/xml.hpp>
 #include <cereal/archives/json.hpp>
 #include <cereal/archives/portable_binary.hpp>
 using namespace aly;
 namespace tgr {
+static const int SignalSite = NeuralMemory::registerSite("signals");
+static const int KernelSite = NeuralMemory::registerSite("layer kernels");
+static const int OptimizerSite = NeuralMemory::registerSite("optimizer");
 std::string MakeID(int len) {
 	std::stringstream ss;
 	static const char lookUp[33] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ012345";
@@ -102,6 +103,7 @@ NeuralLayer::NeuralLayer(const std::string& name,
 	trainable = true;
 	visited = false;
 	parallelize = false;
+	grainSize = 0;
 	sys = nullptr;
 	weightInitFunc=[this](Storage& data, int fanIn, int fanOut)  {
 		float weight_base = std::sqrt(6.0f / (fanIn + fanOut));
@@ -128,43 +130,6 @@ void NeuralLayer::setRegionDirty(bool b) {
 	}
 }
 
-bool NeuralLayer::isVisible() const {
-	if (layerRegion.get() != nullptr && layerRegion->parent != nullptr) {
-		return layerRegion->isVisible();
-	} else {
-		return false;
-	}
-}
-aly::NeuralLayerRegionPtr NeuralLayer::getRegion() {
-	if (layerRegion.get() == nullptr) {
-		aly::dim3 outDims = getOutputSize();
-
-		float2 dims = float2(240.0f * outDims.z,
-				240.0f * outDims.y / outDims.x);
-		if (dims.x > 2048.0f) {
-			dims /= 2048.0f;
-		}
-		dims += NeuralLayerRegion::getPadding();
-
-		layerRegion = NeuralLayerRegionPtr(
-				new NeuralLayerRegion(name, this,
-						CoordPerPX(0.5f, 0.5f, -dims.x * 0.5f, -dims.y * 0.5f),
-						CoordPX(dims.x, dims.y)));
-		if (hasChildren()) {
-			layerRegion->setExpandable(true);
-			for (auto child : getOutputLayers()) {
-				child->getRegion();
-			}
-		}
-		layerRegion->onHide = [this]() {
-			sys->getFlow()->update();
-		};
-		layerRegion->onExpand = [this]() {
-			expand();
-		};
-	}
-	return layerRegion;
-}
 template<typename Result, typename T, typename Pred>
 std::vector<Result> map_(const std::vector<T> &vec, Pred p) {
 	std::vector<Result> res(vec.size());
@@ -173,10 +138,44 @@ std::vector<Result> map_(const std::vector<T> &vec, Pred p) {
 	}
 	return res;
 }
+bool NeuralLayer::restoreTables() {
+	std::shared_ptr<const NeuralPlan> plan = NeuralPlan::getActive();
+	if (plan.get() == nullptr) {
+		return false;
+	}
+	std::shared_ptr<const PlanTable> table = plan->getTable(getTableKey());
+	if (table.get() == nullptr) {
+		return false;
+	}
+	setTables(*table);
+	return true;
+}
+uint64_t NeuralLayer::getMultiplyAdds() const {
+	uint64_t count = 0;
+	std::vector<aly::dim3> dims = getOutputDimensions();
+	for (size_t i = 0; i < dims.size(); i++) {
+		if (outputTypes[i] == ChannelType::data) {
+			count += (uint64_t) dims[i].x * dims[i].y * dims[i].z;
+		}
+	}
+	return count;
+}
 void NeuralLayer::setSampleCount(size_t sample_count) {
+	MemorySiteScope site(SignalSite);
 	// increase the size if necessary - but do not decrease
 	auto resize = [sample_count](Tensor*tensor) {
-		tensor->resize(sample_count,(*tensor)[0]);
+		size_t old_count = tensor->size();
+		if (sample_count <= old_count || NeuralNuma::getNodeCount() < 2) {
+			tensor->resize(sample_count,(*tensor)[0]);
+			return;
+		}
+		// on NUMA machines new samples are first touched by pool workers,
+		// which are the threads that later read and write them
+		tensor->resize(sample_count);
+		NeuralThreadPool::parallelForEach(old_count, sample_count, [tensor](size_t s) {
+			MemorySiteScope workerSite(SignalSite);
+			(*tensor)[s] = (*tensor)[0];
+		}, 1);
 	};
 	for (size_t i = 0; i < inputChannels; i++) {
 		if (!isTrainableWeight(inputTypes[i])) {
@@ -193,6 +192,9 @@ void NeuralLayer::setSampleCount(size_t sample_count) {
 	}
 }
 void NeuralLayer::forward() {
+	ProfileScope scope(this, ProfilePhase::Forward);
+	MemorySiteScope site(KernelSite);
+	GrainScope grain(grainSize);
 	// the computational graph
 	fowardInData.resize(inputChannels);
 	fowardInGradient.resize(outputChannels);
@@ -221,6 +223,9 @@ void NeuralLayer::forward() {
 }
 
 void NeuralLayer::backward() {
+	ProfileScope scope(this, ProfilePhase::Backward);
+	MemorySiteScope site(KernelSite);
+	GrainScope grain(grainSize);
 	backwardInData.resize(inputChannels);
 	backwardInGradient.resize(inputChannels);
 	backwardOutData.resize(outputChannels);
@@ -502,12 +507,6 @@ void NeuralLayer::clearGradients() {
 		getInput(i)->clearGradients();
 	}
 }
-float NeuralLayer::getAspect() {
-	aly::dim3 dims = getOutputSize();
-	return (dims.x * dims.z * NeuralLayerRegion::GlyphSize
-			+ (dims.z - 1) * NeuralLayerRegion::GlyphSpacing)
-			/ (float) (dims.y * NeuralLayerRegion::GlyphSize);
-}
 size_t NeuralLayer::getInputDataSize() const {
  	size_t n = 0;
 	for (size_t i = 0; i < inputChannels; i++) {
@@ -528,6 +527,8 @@ size_t NeuralLayer::getOutputDataSize() const {
 void NeuralLayer::updateWeights(
 		NeuralOptimizer& optimizer,
 		int batch_size) {
+	ProfileScope scope(this, ProfilePhase::Update);
+	MemorySiteScope site(OptimizerSite);
 	float_t rcp_batch_size = float_t(1) / float_t(batch_size);
 	auto &diff = weightDifference;
 	for (int i = 0; i < inputChannels; i++) {
@@ -647,33 +648,6 @@ void NeuralLayer::setup(bool reset_weight) {
 	}
 }
 
-void NeuralLayer::expand() {
-	std::shared_ptr<NeuralFlowPane> flowPane = sys->getFlow();
-	box2px bounds = layerRegion->getBounds();
-	int N = int(getOutputLayers().size());
-	float layoutWidth = 0.0f;
-	int C = 1;
-	float width = 120.0f;
-	const float MAX_WIDTH = 2048.0f;
-	for (auto child : getOutputLayers()) {
-		int c = child->getOutputSize().z;
-		C = std::max(c, C);
-		layoutWidth += (10.0f + std::min(width * c, MAX_WIDTH));
-	}
-	layoutWidth -= 10.0f;
-	for (auto child : getOutputLayers()) {
-		int c = child->getOutputSize().z;
-		float offset = aly::round(0.5f * std::min(width * c, MAX_WIDTH));
-		float height = child->getRegion()->setSize(
-				std::min(width * c, MAX_WIDTH));
-		float2 pos = pixel2(
-				aly::round(bounds.position.x + bounds.dimensions.x * 0.5f- layoutWidth * 0.5f + offset),
-				aly::round(bounds.position.y + bounds.dimensions.y + 0.5f * height + 10.0f));
-		flowPane->add(child.get(), pos);
-		offset += width * c + 10.0f;
-	}
-	flowPane->update();
-}
 bool NeuralLayer::isRoot() const {
 	for (SignalPtr signal : inputs) {
 		if (signal.get() != nullptr && signal->hasInput())
@@ -727,39 +701,4 @@ void NeuralLayer::getNeuron(const aly::int3& pos, Neuron& neuron) {
 		}
 	}
 }
-void NeuralLayer::initialize(const aly::ExpandTreePtr& tree,
-		const aly::TreeItemPtr& parent) {
-	TreeItemPtr item;
-	parent->addItem(item = TreeItemPtr(new TreeItem(getName(), 0x0f20e)));
-	const float fontSize = 20;
-	const int lines = getInputDimensionSize() + getOutputDimensionSize();
-	item->addItem(
-			LeafItemPtr(
-					new LeafItem(
-							[this,fontSize](AlloyContext* context, const box2px& bounds) {
-								NVGcontext* nvg = context->nvgContext;
-								float yoff = 2 + bounds.position.y;
-								nvgFontSize(nvg, fontSize);
-								nvgFontFaceId(nvg, context->getFontHandle(FontType::Normal));
-								std::string label;
-								std::vector<dim3> dims=getInputDimensions();
-								for(int i=0;i<dims.size();i++) {
-									label = MakeString() << "in."<<this->inputTypes[i]<<" "<<dims[i];
-									drawText(nvg, bounds.position.x, yoff, label.c_str(), FontStyle::Normal, context->theme.LIGHTER);
-									yoff += fontSize + 2;
-								}
-								dims=getOutputDimensions();
-								for(int i=0;i<dims.size();i++) {
-									label = MakeString() << "out."<<this->outputTypes[i]<<" "<<dims[i];
-									drawText(nvg, bounds.position.x, yoff, label.c_str(), FontStyle::Normal, context->theme.LIGHTER);
-									yoff += fontSize + 2;
-								}
-							}, pixel2(180, lines * (fontSize + 2) + 2))));
-	item->onSelect = [this](TreeItem* item, const InputEvent& e) {
-		sys->getFlow()->setSelected(this,e);
-	};
-	for (auto child : getOutputLayers()) {
-		child->initialize(tree, item);
-	}
-}
 }
@@ -23,7 +23,9 @@
 #include "AlloyDrawUtil.h"
 #include "AlloyApplication.h"
 #include "NeuralLayer.h"
+#include "NeuralSystem.h"
 using namespace tgr;
+using namespace aly;
 namespace aly {
 const float NeuralLayerRegion::fontSize = 24.0f;
 const float NeuralLayerRegion::GlyphSpacing = 4.0f;
@@ -397,3 +399,112 @@ void NeuralLayerRegion::setScale(float s, pixel2 cursor) {
 }
 
 }
+// NeuralLayer's view of itself in the flow graph and the layer tree. These
+// live with the widgets so that the neural core links without the UI.
+namespace tgr {
+bool NeuralLayer::isVisible() const {
+	if (layerRegion.get() != nullptr && layerRegion->parent != nullptr) {
+		return layerRegion->isVisible();
+	} else {
+		return false;
+	}
+}
+aly::NeuralLayerRegionPtr NeuralLayer::getRegion() {
+	if (layerRegion.get() == nullptr) {
+		aly::dim3 outDims = getOutputSize();
+
+		float2 dims = float2(240.0f * outDims.z,
+				240.0f * outDims.y / outDims.x);
+		if (dims.x > 2048.0f) {
+			dims /= 2048.0f;
+		}
+		dims += NeuralLayerRegion::getPadding();
+
+		layerRegion = NeuralLayerRegionPtr(
+				new NeuralLayerRegion(name, this,
+						CoordPerPX(0.5f, 0.5f, -dims.x * 0.5f, -dims.y * 0.5f),
+						CoordPX(dims.x, dims.y)));
+		if (hasChildren()) {
+			layerRegion->setExpandable(true);
+			for (auto child : getOutputLayers()) {
+				child->getRegion();
+			}
+		}
+		layerRegion->onHide = [this]() {
+			sys->getFlow()->update();
+		};
+		layerRegion->onExpand = [this]() {
+			expand();
+		};
+	}
+	return layerRegion;
+}
+float NeuralLayer::getAspect() {
+	aly::dim3 dims = getOutputSize();
+	return (dims.x * dims.z * NeuralLayerRegion::GlyphSize
+			+ (dims.z - 1) * NeuralLayerRegion::GlyphSpacing)
+			/ (float) (dims.y * NeuralLayerRegion::GlyphSize);
+}
+void NeuralLayer::expand() {
+	std::shared_ptr<NeuralFlowPane> flowPane = sys->getFlow();
+	box2px bounds = layerRegion->getBounds();
+	int N = int(getOutputLayers().size());
+	float layoutWidth = 0.0f;
+	int C = 1;
+	float width = 120.0f;
+	const float MAX_WIDTH = 2048.0f;
+	for (auto child : getOutputLayers()) {
+		int c = child->getOutputSize().z;
+		C = std::max(c, C);
+		layoutWidth += (10.0f + std::min(width * c, MAX_WIDTH));
+	}
+	layoutWidth -= 10.0f;
+	for (auto child : getOutputLayers()) {
+		int c = child->getOutputSize().z;
+		float offset = aly::round(0.5f * std::min(width * c, MAX_WIDTH));
+		float height = child->getRegion()->setSize(
+				std::min(width * c, MAX_WIDTH));
+		float2 pos = pixel2(
+				aly::round(bounds.position.x + bounds.dimensions.x * 0.5f- layoutWidth * 0.5f + offset),
+				aly::round(bounds.position.y + bounds.dimensions.y + 0.5f * height + 10.0f));
+		flowPane->add(child.get(), pos);
+		offset += width * c + 10.0f;
+	}
+	flowPane->update();
+}
+void NeuralLayer::initialize(const aly::ExpandTreePtr& tree,
+		const aly::TreeItemPtr& parent) {
+	TreeItemPtr item;
+	parent->addItem(item = TreeItemPtr(new TreeItem(getName(), 0x0f20e)));
+	const float fontSize = 20;
+	const int lines = getInputDimensionSize() + getOutputDimensionSize();
+	item->addItem(
+			LeafItemPtr(
+					new LeafItem(
+							[this,fontSize](AlloyContext* context, const box2px& bounds) {
+								NVGcontext* nvg = context->nvgContext;
+								float yoff = 2 + bounds.position.y;
+								nvgFontSize(nvg, fontSize);
+								nvgFontFaceId(nvg, context->getFontHandle(FontType::Normal));
+								std::string label;
+								std::vector<dim3> dims=getInputDimensions();
+								for(int i=0;i<dims.size();i++) {
+									label = MakeString() << "in."<<this->inputTypes[i]<<" "<<dims[i];
+									drawText(nvg, bounds.position.x, yoff, label.c_str(), FontStyle::Normal, context->theme.LIGHTER);
+									yoff += fontSize + 2;
+								}
+								dims=getOutputDimensions();
+								for(int i=0;i<dims.size();i++) {
+									label = MakeString() << "out."<<this->outputTypes[i]<<" "<<dims[i];
+									drawText(nvg, bounds.position.x, yoff, label.c_str(), FontStyle::Normal, context->theme.LIGHTER);
+									yoff += fontSize + 2;
+								}
+							}, pixel2(180, lines * (fontSize + 2) + 2))));
+	item->onSelect = [this](TreeItem* item, const InputEvent& e) {
+		sys->getFlow()->setSelected(this,e);
+	};
+	for (auto child : getOutputLayers()) {
+		child->initialize(tree, item);
+	}
+}
+}
@@ -6,7 +6,71 @@
  */
 
 #include "NeuralLossFunction.h"
+#include <algorithm>
+#include <numeric>
+#include <cmath>
 namespace tgr {
+static const int LossSite = NeuralMemory::registerSite("loss");
+void NeuralLossFunction::Interface::dfInPlace(const Storage &y,
+		const Storage &t, Storage& d) const {
+	Storage g = df(y, t);
+	std::copy(g.begin(), g.end(), d.begin());
+}
+float NeuralLossFunction::Interface::fSparse(const Storage &y,
+		int label) const {
+	Storage t(y.size(), 0.0f);
+	t[label] = 1.0f;
+	return f(y, t);
+}
+void NeuralLossFunction::Interface::dfSparse(const Storage &y, int label,
+		Storage& d) const {
+	Storage t(y.size(), 0.0f);
+	t[label] = 1.0f;
+	dfInPlace(y, t, d);
+}
+static void ApplyCost(Storage& d, const Storage* t_cost, size_t sample) {
+	if (t_cost == nullptr)
+		return;
+	const Storage& cost = t_cost[sample];
+	if (cost.size() == d.size()) {
+		for (size_t i = 0; i < d.size(); i++) {
+			d[i] *= cost[i];
+		}
+	}
+}
+void NeuralLossFunction::gradient(const Tensor& y, const Tensor& t,
+		const Storage* t_cost, Tensor& dy, bool parallelize) const {
+	assert(y.size() == t.size() && dy.size() >= y.size());
+	const Interface* func = impl.get();
+	tiny_dnn::for_i(parallelize, y.size(), [&](size_t sample) {
+		assert(y[sample].size() == t[sample].size());
+		Storage& d = dy[sample];
+		d.resize(y[sample].size());
+		func->dfInPlace(y[sample], t[sample], d);
+		ApplyCost(d, t_cost, sample);
+	});
+}
+void NeuralLossFunction::gradient(const Tensor& y, const int* labels,
+		const Storage* t_cost, Tensor& dy, bool parallelize) const {
+	assert(dy.size() >= y.size());
+	const Interface* func = impl.get();
+	tiny_dnn::for_i(parallelize, y.size(), [&](size_t sample) {
+		assert(labels[sample] >= 0 && labels[sample] < (int)y[sample].size());
+		Storage& d = dy[sample];
+		d.resize(y[sample].size());
+		func->dfSparse(y[sample], labels[sample], d);
+		ApplyCost(d, t_cost, sample);
+	});
+}
+float NeuralLossFunction::loss(const Tensor& y, const int* labels,
+		bool parallelize) const {
+	std::vector<float> losses(y.size());
+	const Interface* func = impl.get();
+	tiny_dnn::for_i(parallelize, y.size(), [&](size_t sample) {
+		losses[sample] = func->fSparse(y[sample], labels[sample]);
+	});
+	return std::accumulate(losses.begin(), losses.end(), 0.0f);
+}
 Storage NeuralLossFunction::gradientLossFunction(const Storage &y,
 		const Storage &t) const {
 	assert(y.size() == t.size());
@@ -33,8 +97,9 @@ std::vector<Tensor> NeuralLossFunction::gradient(const std::vector<Tensor>& y,
 	CNN_UNREFERENCED_PARAMETER(channel_count);
 	assert(y.size() == t.size());
 	assert(t_cost.empty() || t_cost.size() == t.size());
-	// @todo add parallelism
-	for (int sample = 0; sample < sample_count; ++sample) {
+	MemorySiteScope site(LossSite);
+	tiny_dnn::for_i(true, sample_count, [&](size_t sample) {
+		MemorySiteScope workerSite(LossSite);
 		assert(y[sample].size() == channel_count);
 		assert(t[sample].size() == channel_count);
 		assert(
@@ -44,7 +109,7 @@ std::vector<Tensor> NeuralLossFunction::gradient(const std::vector<Tensor>& y,
 		if (sample < t_cost.size()) {
 			ApplyCostIfDefined(gradients[sample], t_cost[sample]);
 		}
-	}
+	});
 	return gradients;
 }
 std::vector<Storage> NeuralLossFunction::gradientLossFunction(
@@ -74,6 +139,27 @@ Storage MSELossFunction::df(const Storage &y, const Storage &t) const {
 		d[i] = factor * (y[i] - t[i]);
 	return d;
 }
+void MSELossFunction::dfInPlace(const Storage &y, const Storage &t,
+		Storage& d) const {
+	assert(y.size() == t.size() && d.size() == y.size());
+	const float factor = float(2) / static_cast<float>(t.size());
+	for (size_t i = 0; i < y.size(); ++i)
+		d[i] = factor * (y[i] - t[i]);
+}
+float MSELossFunction::fSparse(const Storage &y, int label) const {
+	float d { 0.0 };
+	for (size_t i = 0; i < y.size(); ++i)
+		d += y[i] * y[i];
+	d += float(1) - float(2) * y[label];
+	return d / static_cast<float>(y.size());
+}
+void MSELossFunction::dfSparse(const Storage &y, int label, Storage& d) const {
+	assert(d.size() == y.size());
+	const float factor = float(2) / static_cast<float>(y.size());
+	for (size_t i = 0; i < y.size(); ++i)
+		d[i] = factor * y[i];
+	d[label] -= factor;
+}
 float AbsoluteLossFunction::f(const Storage &y, const Storage &t) const {
 	assert(y.size() == t.size());
 	float d { 0 };
@@ -100,6 +186,29 @@ Storage AbsoluteLossFunction::df(const Storage &y, const Storage &t) const {
 
 	return d;
 }
+static inline float SignedStep(float diff, float eps, float factor) {
+	return (diff < -eps) ? -factor : ((diff > eps) ? factor : 0.0f);
+}
+void AbsoluteLossFunction::dfInPlace(const Storage &y, const Storage &t,
+		Storage& d) const {
+	assert(y.size() == t.size() && d.size() == y.size());
+	const float factor = float(1) / static_cast<float>(t.size());
+	for (size_t i = 0; i < y.size(); ++i)
+		d[i] = SignedStep(y[i] - t[i], 0.0f, factor);
+}
+float AbsoluteLossFunction::fSparse(const Storage &y, int label) const {
+	float d { 0 };
+	for (size_t i = 0; i < y.size(); ++i)
+		d += std::abs(y[i] - (((int) i == label) ? 1.0f : 0.0f));
+	return d / static_cast<float>(y.size());
+}
+void AbsoluteLossFunction::dfSparse(const Storage &y, int label,
+		Storage& d) const {
+	assert(d.size() == y.size());
+	const float factor = float(1) / static_cast<float>(y.size());
+	for (size_t i = 0; i < y.size(); ++i)
+		d[i] = SignedStep(y[i] - (((int) i == label) ? 1.0f : 0.0f), 0.0f, factor);
+}
 float AbsoluteEpsLossFunction::f(const Storage &y, const Storage &t) const {
 	assert(y.size() == t.size());
 	float d { 0 };
@@ -129,6 +238,32 @@ Storage AbsoluteEpsLossFunction::df(const Storage &y, const Storage &t) const {
 	}
 	return d;
 }
+void AbsoluteEpsLossFunction::dfInPlace(const Storage &y, const Storage &t,
+		Storage& d) const {
+	assert(y.size() == t.size() && d.size() == y.size());
+	const float factor = float(1) / static_cast<float>(t.size());
+	const float eps = float(1) / fraction;
+	for (size_t i = 0; i < y.size(); ++i)
+		d[i] = SignedStep(y[i] - t[i], eps, factor);
+}
+float AbsoluteEpsLossFunction::fSparse(const Storage &y, int label) const {
+	float d { 0 };
+	const float eps = float(1) / fraction;
+	for (size_t i = 0; i < y.size(); ++i) {
+		float diff = std::abs(y[i] - (((int) i == label) ? 1.0f : 0.0f));
+		if (diff > eps)
+			d += diff;
+	}
+	return d / static_cast<float>(y.size());
+}
+void AbsoluteEpsLossFunction::dfSparse(const Storage &y, int label,
+		Storage& d) const {
+	assert(d.size() == y.size());
+	const float factor = float(1) / static_cast<float>(y.size());
+	const float eps = float(1) / fraction;
+	for (size_t i = 0; i < y.size(); ++i)
+		d[i] = SignedStep(y[i] - (((int) i == label) ? 1.0f : 0.0f), eps, factor);
+}
 float CrossEntropyLossFunction::f(const Storage &y, const Storage &t) const {
 	assert(y.size() == t.size());
 	float d { 0 };
@@ -148,6 +283,24 @@ Storage CrossEntropyLossFunction::df(const Storage &y, const Storage &t) const {
 
 	return d;
 }
+void CrossEntropyLossFunction::dfInPlace(const Storage &y, const Storage &t,
+		Storage& d) const {
+	assert(y.size() == t.size() && d.size() == y.size());
+	for (size_t i = 0; i < y.size(); ++i)
+		d[i] = (y[i] - t[i]) / (y[i] * (float(1) - y[i]));
+}
+float CrossEntropyLossFunction::fSparse(const Storage &y, int label) const {
+	float d { 0 };
+	for (size_t i = 0; i < y.size(); ++i)
+		d -= std::log(((int) i == label) ? y[i] : float(1) - y[i]);
+	return d;
+}
+void CrossEntropyLossFunction::dfSparse(const Storage &y, int label,
+		Storage& d) const {
+	assert(d.size() == y.size());
+	for (size_t i = 0; i < y.size(); ++i)
+		d[i] = ((int) i == label) ? -float(1) / y[i] : float(1) / (float(1) - y[i]);
+}
 float CrossEntropyMultiClassLossFunction::f(const Storage &y,
 		const Storage &t) const {
 	assert(y.size() == t.size());
@@ -168,6 +321,75 @@ Storage CrossEntropyMultiClassLossFunction::df(const Storage &y,
 
 	return d;
 }
+void CrossEntropyMultiClassLossFunction::dfInPlace(const Storage &y,
+		const Storage &t, Storage& d) const {
+	assert(y.size() == t.size() && d.size() == y.size());
+	for (size_t i = 0; i < y.size(); ++i)
+		d[i] = -t[i] / y[i];
+}
+float CrossEntropyMultiClassLossFunction::fSparse(const Storage &y,
+		int label) const {
+	return -std::log(y[label]);
+}
+void CrossEntropyMultiClassLossFunction::dfSparse(const Storage &y, int label,
+		Storage& d) const {
+	assert(d.size() == y.size());
+	std::fill(d.begin(), d.end(), 0.0f);
+	d[label] = -float(1) / y[label];
+}
+// softmax(y) and log(sum(exp(y))), shifted by max(y) for stability
+static float Softmax(const Storage &y, Storage& p) {
+	const float mx = *std::max_element(y.begin(), y.end());
+	float sum { 0 };
+	for (size_t i = 0; i < y.size(); ++i) {
+		p[i] = std::exp(y[i] - mx);
+		sum += p[i];
+	}
+	const float scale = float(1) / sum;
+	for (size_t i = 0; i < y.size(); ++i)
+		p[i] *= scale;
+	return mx + std::log(sum);
+}
+static float LogSumExp(const Storage &y) {
+	const float mx = *std::max_element(y.begin(), y.end());
+	float sum { 0 };
+	for (size_t i = 0; i < y.size(); ++i)
+		sum += std::exp(y[i] - mx);
+	return mx + std::log(sum);
+}
+float SoftmaxCrossEntropyLossFunction::f(const Storage &y,
+		const Storage &t) const {
+	assert(y.size() == t.size());
+	const float lse = LogSumExp(y);
+	float d { 0 };
+	for (size_t i = 0; i < y.size(); ++i)
+		d += t[i] * (lse - y[i]);
+	return d;
+}
+Storage SoftmaxCrossEntropyLossFunction::df(const Storage &y,
+		const Storage &t) const {
+	Storage d(y.size());
+	dfInPlace(y, t, d);
+	return d;
+}
+void SoftmaxCrossEntropyLossFunction::dfInPlace(const Storage &y,
+		const Storage &t, Storage& d) const {
+	assert(y.size() == t.size() && d.size() == y.size());
+	Softmax(y, d);
+	const float tsum = std::accumulate(t.begin(), t.end(), 0.0f);
+	for (size_t i = 0; i < y.size(); ++i)
+		d[i] = d[i] * tsum - t[i];
+}
+float SoftmaxCrossEntropyLossFunction::fSparse(const Storage &y,
+		int label) const {
+	return LogSumExp(y) - y[label];
+}
+void SoftmaxCrossEntropyLossFunction::dfSparse(const Storage &y, int label,
+		Storage& d) const {
+	assert(d.size() == y.size());
+	Softmax(y, d);
+	d[label] -= float(1);
+}
 void ApplyCostIfDefined(std::vector<Storage> &sample_gradient,
 		const std::vector<Storage> &sample_cost) {
 	if (sample_gradient.size() == sample_cost.size()) {
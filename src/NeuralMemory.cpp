@@ -0,0 +1,404 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralMemory.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <mutex>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+namespace tgr {
+struct BlockHeader {
+	uint32_t magic;
+	int32_t sizeClass; //-1 for blocks that bypass the pool
+	int32_t site;
+	int32_t hugePage;
+	uint64_t bytes; //requested bytes
+	uint64_t total; //bytes reserved for the block, including this header
+	uint64_t padding[4];
+};
+static_assert(sizeof(BlockHeader) == NeuralMemory::ALIGNMENT,
+		"Block header must preserve alignment.");
+static const uint32_t BLOCK_MAGIC = 0x4D454D54;
+static const int MAX_EXPONENT = 30; //larger blocks are not pooled
+static const int CLASS_COUNT = 4 + (MAX_EXPONENT - 8) * 4;
+static const int MAX_SITES = 64;
+static const size_t THREAD_CACHE_BYTES = 16 * 1024 * 1024;
+static const size_t THREAD_CACHE_COUNT = 64;
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+/**
+ * Classes 0-3 cover 64 to 256 bytes in steps of 64, then each power of two
+ * is split into four classes.
+ */
+static int SizeClass(size_t bytes) {
+	if (bytes <= 256) {
+		return (int) ((bytes + 63) / 64) - 1;
+	}
+	int e = 0;
+	while (((size_t) 1 << (e + 1)) < bytes) {
+		e++;
+	}
+	int c = 4 + (e - 8) * 4 + (int) ((bytes - 1 - ((size_t) 1 << e)) >> (e - 2));
+	return (c < CLASS_COUNT) ? c : -1;
+}
+static size_t ClassSize(int c) {
+	if (c < 4) {
+		return (size_t) (c + 1) * 64;
+	}
+	int e = (c - 4) / 4 + 8;
+	return ((size_t) 1 << e) + (size_t) ((c - 4) % 4 + 1) * ((size_t) 1 << (e - 2));
+}
+struct SiteStats {
+	std::string name;
+	std::atomic<uint64_t> live;
+	std::atomic<uint64_t> peak;
+	std::atomic<uint64_t> allocations;
+	SiteStats() :
+			live(0), peak(0), allocations(0) {
+	}
+};
+/**
+ * Never destroyed, so blocks freed by static destructors or exiting threads
+ * still find the pool.
+ */
+struct GlobalPool {
+	std::mutex locks[CLASS_COUNT];
+	std::vector<BlockHeader*> blocks[CLASS_COUNT];
+	std::atomic<uint64_t> cached;
+	std::atomic<uint64_t> reserved;
+	std::atomic<uint64_t> huge;
+	std::atomic<uint64_t> live;
+	std::atomic<uint64_t> peak;
+	std::atomic<uint64_t> allocations;
+	std::atomic<uint64_t> hits;
+	std::atomic<size_t> cacheLimit;
+	std::atomic<size_t> hugeThreshold;
+	std::atomic<bool> pooling;
+	std::mutex siteLock;
+	SiteStats sites[MAX_SITES];
+	std::atomic<int> siteCount;
+	GlobalPool() :
+			cached(0), reserved(0), huge(0), live(0), peak(0), allocations(0), hits(
+					0), cacheLimit((size_t) 256 << 20), hugeThreshold(
+					HUGE_PAGE_SIZE), pooling(true), siteCount(1) {
+		sites[0].name = "unattributed";
+	}
+};
+static GlobalPool& GetPool() {
+	static GlobalPool* pool = new GlobalPool();
+	return *pool;
+}
+static void UpdatePeak(std::atomic<uint64_t>& peak, uint64_t value) {
+	uint64_t current = peak.load(std::memory_order_relaxed);
+	while (value > current
+			&& !peak.compare_exchange_weak(current, value,
+					std::memory_order_relaxed)) {
+	}
+}
+static BlockHeader* MapBlock(size_t total) {
+	GlobalPool& pool = GetPool();
+	BlockHeader* block = nullptr;
+	bool hugePage = false;
+#ifdef __linux__
+	if (total >= pool.hugeThreshold.load(std::memory_order_relaxed)) {
+		total = (total + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+		//over map so the block can start on a huge page boundary
+		void* ptr = mmap(nullptr, total + HUGE_PAGE_SIZE,
+				PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr != MAP_FAILED) {
+			uintptr_t start = (uintptr_t) ptr;
+			uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1)
+					& ~(HUGE_PAGE_SIZE - 1);
+			if (aligned > start) {
+				munmap(ptr, aligned - start);
+			}
+			uintptr_t end = start + total + HUGE_PAGE_SIZE;
+			if (end > aligned + total) {
+				munmap((void*) (aligned + total), end - (aligned + total));
+			}
+#ifdef MADV_HUGEPAGE
+			madvise((void*) aligned, total, MADV_HUGEPAGE);
+#endif
+			block = (BlockHeader*) aligned;
+			hugePage = true;
+		}
+	}
+#endif
+	if (block == nullptr) {
+#ifdef _WIN32
+		block = (BlockHeader*) _aligned_malloc(total, NeuralMemory::ALIGNMENT);
+#else
+		void* ptr = nullptr;
+		if (posix_memalign(&ptr, NeuralMemory::ALIGNMENT, total) == 0) {
+			block = (BlockHeader*) ptr;
+		}
+#endif
+	}
+	if (block == nullptr) {
+		throw std::bad_alloc();
+	}
+	block->magic = BLOCK_MAGIC;
+	block->total = total;
+	block->hugePage = hugePage;
+	pool.reserved += total;
+	if (hugePage) {
+		pool.huge += total;
+	}
+	return block;
+}
+static void UnmapBlock(BlockHeader* block) {
+	GlobalPool& pool = GetPool();
+	pool.reserved -= block->total;
+	block->magic = 0;
+	if (block->hugePage) {
+		pool.huge -= block->total;
+#ifdef __linux__
+		munmap(block, block->total);
+#endif
+	} else {
+#ifdef _WIN32
+		_aligned_free(block);
+#else
+		free(block);
+#endif
+	}
+}
+static void ReleaseToPool(BlockHeader* block) {
+	GlobalPool& pool = GetPool();
+	int c = block->sizeClass;
+	if (pool.cached.load(std::memory_order_relaxed) + block->total
+			<= pool.cacheLimit.load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> lockMe(pool.locks[c]);
+		pool.blocks[c].push_back(block);
+		pool.cached += block->total;
+	} else {
+		UnmapBlock(block);
+	}
+}
+struct ThreadCache {
+	std::vector<BlockHeader*> blocks[CLASS_COUNT];
+	size_t bytes = 0;
+};
+/**
+ * Flushes the thread's cache into the global pool when the thread exits.
+ * The cache is reached through a plain pointer that is cleared first, so
+ * frees during later thread_local destructors go straight to the pool.
+ */
+struct ThreadCacheHandle {
+	ThreadCache cache;
+	ThreadCache*& pointer;
+	ThreadCacheHandle(ThreadCache*& pointer) :
+			pointer(pointer) {
+		pointer = &cache;
+	}
+	~ThreadCacheHandle() {
+		pointer = nullptr;
+		for (int c = 0; c < CLASS_COUNT; c++) {
+			for (BlockHeader* block : cache.blocks[c]) {
+				ReleaseToPool(block);
+			}
+		}
+	}
+};
+static thread_local ThreadCache* CurrentCache = nullptr;
+static thread_local bool CacheCreated = false;
+static thread_local int CurrentSite = 0;
+static ThreadCache* GetThreadCache() {
+	if (!CacheCreated) {
+		CacheCreated = true;
+		static thread_local ThreadCacheHandle handle(CurrentCache);
+	}
+	return CurrentCache;
+}
+void* NeuralMemory::allocate(size_t bytes) {
+	GlobalPool& pool = GetPool();
+	size_t total = bytes + sizeof(BlockHeader);
+	int c = pool.pooling.load(std::memory_order_relaxed) ? SizeClass(total) : -1;
+	BlockHeader* block = nullptr;
+	if (c >= 0) {
+		ThreadCache* cache = GetThreadCache();
+		if (cache != nullptr && cache->blocks[c].size() > 0) {
+			block = cache->blocks[c].back();
+			cache->blocks[c].pop_back();
+			cache->bytes -= block->total;
+		} else {
+			std::lock_guard<std::mutex> lockMe(pool.locks[c]);
+			if (pool.blocks[c].size() > 0) {
+				block = pool.blocks[c].back();
+				pool.blocks[c].pop_back();
+				pool.cached -= block->total;
+			}
+		}
+		if (block != nullptr) {
+			pool.hits++;
+		} else {
+			block = MapBlock(ClassSize(c));
+		}
+	} else {
+		block = MapBlock(total);
+	}
+	block->sizeClass = c;
+	block->bytes = bytes;
+	block->site = CurrentSite;
+	UpdatePeak(pool.peak, pool.live += bytes);
+	pool.allocations++;
+	SiteStats& site = pool.sites[block->site];
+	UpdatePeak(site.peak, site.live += bytes);
+	site.allocations++;
+	return block + 1;
+}
+void NeuralMemory::deallocate(void* ptr) {
+	if (ptr == nullptr) {
+		return;
+	}
+	GlobalPool& pool = GetPool();
+	BlockHeader* block = static_cast<BlockHeader*>(ptr) - 1;
+	if (block->magic != BLOCK_MAGIC) {
+		throw std::runtime_error("Freed memory that was not allocated by NeuralMemory.");
+	}
+	pool.live -= block->bytes;
+	pool.sites[block->site].live -= block->bytes;
+	int c = block->sizeClass;
+	if (c < 0) {
+		UnmapBlock(block);
+		return;
+	}
+	ThreadCache* cache = GetThreadCache();
+	if (cache != nullptr && cache->blocks[c].size() < THREAD_CACHE_COUNT
+			&& cache->bytes + block->total <= THREAD_CACHE_BYTES) {
+		cache->blocks[c].push_back(block);
+		cache->bytes += block->total;
+	} else {
+		ReleaseToPool(block);
+	}
+}
+int NeuralMemory::registerSite(const std::string& name) {
+	GlobalPool& pool = GetPool();
+	std::lock_guard<std::mutex> lockMe(pool.siteLock);
+	int count = pool.siteCount.load();
+	for (int i = 0; i < count; i++) {
+		if (pool.sites[i].name == name) {
+			return i;
+		}
+	}
+	if (count == MAX_SITES) {
+		return 0;
+	}
+	pool.sites[count].name = name;
+	pool.siteCount.store(count + 1);
+	return count;
+}
+int NeuralMemory::getSite() {
+	return CurrentSite;
+}
+int NeuralMemory::setSite(int site) {
+	int previous = CurrentSite;
+	CurrentSite = (site >= 0 && site < MAX_SITES) ? site : 0;
+	return previous;
+}
+std::vector<MemorySiteStats> NeuralMemory::getSiteStats() {
+	GlobalPool& pool = GetPool();
+	std::lock_guard<std::mutex> lockMe(pool.siteLock);
+	std::vector<MemorySiteStats> stats;
+	for (int i = 0; i < pool.siteCount.load(); i++) {
+		MemorySiteStats s;
+		s.name = pool.sites[i].name;
+		s.liveBytes = pool.sites[i].live.load();
+		s.peakBytes = pool.sites[i].peak.load();
+		s.allocations = pool.sites[i].allocations.load();
+		stats.push_back(s);
+	}
+	return stats;
+}
+MemoryPoolStats NeuralMemory::getStats() {
+	GlobalPool& pool = GetPool();
+	MemoryPoolStats stats;
+	stats.liveBytes = pool.live.load();
+	stats.peakBytes = pool.peak.load();
+	stats.reservedBytes = pool.reserved.load();
+	stats.cachedBytes = pool.cached.load();
+	stats.hugePageBytes = pool.huge.load();
+	stats.allocations = pool.allocations.load();
+	stats.poolHits = pool.hits.load();
+	return stats;
+}
+void NeuralMemory::resetPeaks() {
+	GlobalPool& pool = GetPool();
+	pool.peak.store(pool.live.load());
+	for (int i = 0; i < pool.siteCount.load(); i++) {
+		pool.sites[i].peak.store(pool.sites[i].live.load());
+	}
+}
+void NeuralMemory::setPooling(bool enabled) {
+	GetPool().pooling.store(enabled);
+}
+bool NeuralMemory::isPooling() {
+	return GetPool().pooling.load();
+}
+void NeuralMemory::setCacheLimit(size_t bytes) {
+	GetPool().cacheLimit.store(bytes);
+}
+void NeuralMemory::setHugePageThreshold(size_t bytes) {
+	GetPool().hugeThreshold.store(bytes);
+}
+void NeuralMemory::trim() {
+	GlobalPool& pool = GetPool();
+	for (int c = 0; c < CLASS_COUNT; c++) {
+		std::vector<BlockHeader*> blocks;
+		{
+			std::lock_guard<std::mutex> lockMe(pool.locks[c]);
+			blocks.swap(pool.blocks[c]);
+		}
+		for (BlockHeader* block : blocks) {
+			pool.cached -= block->total;
+			UnmapBlock(block);
+		}
+	}
+}
+void NeuralMemory::printStats(std::ostream& out) {
+	const double MB = 1.0 / (1024.0 * 1024.0);
+	MemoryPoolStats stats = getStats();
+	out << std::left << std::setw(32) << "Allocation Site" << std::right
+			<< std::setw(12) << "Live(MB)" << std::setw(12) << "Peak(MB)"
+			<< std::setw(14) << "Allocations" << std::endl;
+	out << std::fixed << std::setprecision(3);
+	for (const MemorySiteStats& s : getSiteStats()) {
+		out << std::left << std::setw(32) << s.name.substr(0, 31) << std::right
+				<< std::setw(12) << MB * s.liveBytes << std::setw(12)
+				<< MB * s.peakBytes << std::setw(14) << s.allocations
+				<< std::endl;
+	}
+	out << "Live " << MB * stats.liveBytes << " MB, peak "
+			<< MB * stats.peakBytes << " MB, reserved "
+			<< MB * stats.reservedBytes << " MB (" << MB * stats.hugePageBytes
+			<< " MB huge pages), pooled " << MB * stats.cachedBytes
+			<< " MB, hit rate "
+			<< ((stats.allocations > 0) ?
+					100.0 * stats.poolHits / stats.allocations : 0.0) << "%"
+			<< std::endl;
+	out.unsetf(std::ios_base::floatfield);
+}
+}
@@ -0,0 +1,385 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralNuma.h"
+#include "NeuralSystem.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+namespace tgr {
+#ifdef __linux__
+//from linux/mempolicy.h, declared here so libnuma headers are not needed
+static const int MPOL_DEFAULT_MODE = 0;
+static const int MPOL_PREFERRED_MODE = 1;
+static const int MPOL_BIND_MODE = 2;
+static const int MPOL_INTERLEAVE_MODE = 3;
+static const unsigned MPOL_MF_MOVE_FLAG = (1 << 1);
+#endif
+//bits in the node masks handed to the kernel
+static const int MAX_NODES = 1024;
+static const int MASK_WORDS = MAX_NODES / (8 * sizeof(unsigned long));
+thread_local int ThreadNode = -1;
+std::string GetNumaPolicyName(NumaPolicy policy) {
+	switch (policy) {
+	case NumaPolicy::Local:
+		return "local";
+	case NumaPolicy::Interleave:
+		return "interleave";
+	case NumaPolicy::Replicate:
+		return "replicate";
+	default:
+		return "unknown";
+	}
+}
+std::ostream& operator<<(std::ostream& os, NumaPolicy policy) {
+	return os << GetNumaPolicyName(policy);
+}
+//parses "0-3,8,10-11"
+static std::vector<int> ParseCpuList(const std::string& str) {
+	std::vector<int> cpus;
+	std::stringstream ss(str);
+	std::string range;
+	while (std::getline(ss, range, ',')) {
+		if (range.size() == 0 || range[0] == '\n')
+			continue;
+		size_t dash = range.find('-');
+		int first = std::atoi(range.c_str());
+		int last = (dash == std::string::npos) ?
+				first : std::atoi(range.c_str() + dash + 1);
+		for (int c = first; c <= last; c++) {
+			cpus.push_back(c);
+		}
+	}
+	return cpus;
+}
+static std::vector<NumaNode> DiscoverNodes() {
+	std::vector<NumaNode> nodes;
+#ifdef __linux__
+	const std::string root = "/sys/devices/system/node";
+	DIR* dir = opendir(root.c_str());
+	if (dir != nullptr) {
+		struct dirent* entry;
+		while ((entry = readdir(dir)) != nullptr) {
+			std::string name = entry->d_name;
+			if (name.compare(0, 4, "node") != 0 || name.size() < 5
+					|| !std::isdigit((unsigned char) name[4]))
+				continue;
+			NumaNode node;
+			node.id = std::atoi(name.c_str() + 4);
+			node.memoryBytes = 0;
+			std::ifstream cpulist(root + "/" + name + "/cpulist");
+			std::string line;
+			if (std::getline(cpulist, line)) {
+				node.cpus = ParseCpuList(line);
+			}
+			//"Node 0 MemTotal:       32768000 kB"
+			std::ifstream meminfo(root + "/" + name + "/meminfo");
+			while (std::getline(meminfo, line)) {
+				size_t pos = line.find("MemTotal:");
+				if (pos != std::string::npos) {
+					node.memoryBytes = 1024ULL
+							* std::strtoull(line.c_str() + pos + 9, nullptr, 10);
+					break;
+				}
+			}
+			//memory-only nodes have no CPUs to run workers on
+			if (node.cpus.size() > 0) {
+				nodes.push_back(node);
+			}
+		}
+		closedir(dir);
+	}
+#endif
+	std::sort(nodes.begin(), nodes.end(),
+			[](const NumaNode& a, const NumaNode& b) {
+				return a.id < b.id;
+			});
+	if (nodes.size() == 0) {
+		NumaNode node;
+		node.id = 0;
+		node.memoryBytes = 0;
+		int cpus = std::max(1, (int) std::thread::hardware_concurrency());
+		for (int c = 0; c < cpus; c++) {
+			node.cpus.push_back(c);
+		}
+		nodes.push_back(node);
+	}
+	return nodes;
+}
+static std::atomic<int> Policy(-1);
+static NumaPolicy ParsePolicy(const char* str) {
+	if (str != nullptr) {
+		std::string name = str;
+		if (name == "interleave")
+			return NumaPolicy::Interleave;
+		if (name == "replicate")
+			return NumaPolicy::Replicate;
+	}
+	return NumaPolicy::Local;
+}
+const std::vector<NumaNode>& NeuralNuma::getNodes() {
+	static const std::vector<NumaNode> nodes = DiscoverNodes();
+	return nodes;
+}
+int NeuralNuma::getNodeCount() {
+	return (int) getNodes().size();
+}
+int NeuralNuma::getCpuNode(int cpu) {
+	for (const NumaNode& node : getNodes()) {
+		if (std::find(node.cpus.begin(), node.cpus.end(), cpu)
+				!= node.cpus.end())
+			return node.id;
+	}
+	return getNodes().front().id;
+}
+int NeuralNuma::getCurrentNode() {
+#ifdef __linux__
+	int cpu = sched_getcpu();
+	if (cpu >= 0)
+		return getCpuNode(cpu);
+#endif
+	return getNodes().front().id;
+}
+int NeuralNuma::getThreadNode() {
+	return ThreadNode;
+}
+const std::vector<int>& NeuralNuma::getCpuOrder() {
+	static const std::vector<int> order = [] {
+		std::vector<int> cpus;
+		for (const NumaNode& node : getNodes()) {
+			cpus.insert(cpus.end(), node.cpus.begin(), node.cpus.end());
+		}
+		return cpus;
+	}();
+	return order;
+}
+void NeuralNuma::setPolicy(NumaPolicy policy) {
+	Policy = (int) policy;
+}
+NumaPolicy NeuralNuma::getPolicy() {
+	int p = Policy.load();
+	if (p < 0) {
+		NumaPolicy policy = ParsePolicy(std::getenv("TIGER_NUMA"));
+		int expected = -1;
+		Policy.compare_exchange_strong(expected, (int) policy);
+		p = Policy.load();
+	}
+	return (NumaPolicy) p;
+}
+#ifdef __linux__
+static bool PageRange(void* ptr, size_t bytes, uintptr_t& start,
+		size_t& length) {
+	static const uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+	uintptr_t begin = (uintptr_t) ptr;
+	uintptr_t end = begin + bytes;
+	start = (begin + page - 1) & ~(page - 1);
+	uintptr_t stop = end & ~(page - 1);
+	if (stop <= start)
+		return false;
+	length = stop - start;
+	return true;
+}
+static bool MBind(void* ptr, size_t bytes, int mode,
+		const std::vector<int>& nodes) {
+	uintptr_t start;
+	size_t length;
+	if (!PageRange(ptr, bytes, start, length))
+		return true; //smaller than a page, nothing to move
+	unsigned long mask[MASK_WORDS];
+	std::memset(mask, 0, sizeof(mask));
+	for (int n : nodes) {
+		if (n >= 0 && n < MAX_NODES)
+			mask[n / (8 * sizeof(unsigned long))] |= 1UL
+					<< (n % (8 * sizeof(unsigned long)));
+	}
+	return syscall(SYS_mbind, (void*) start, length, mode, mask,
+			(unsigned long) MAX_NODES + 1, MPOL_MF_MOVE_FLAG) == 0;
+}
+#endif
+bool NeuralNuma::interleave(void* ptr, size_t bytes) {
+#ifdef __linux__
+	if (getNodeCount() < 2)
+		return true;
+	std::vector<int> ids;
+	for (const NumaNode& node : getNodes()) {
+		ids.push_back(node.id);
+	}
+	return MBind(ptr, bytes, MPOL_INTERLEAVE_MODE, ids);
+#else
+	return true;
+#endif
+}
+bool NeuralNuma::bind(void* ptr, size_t bytes, int node) {
+#ifdef __linux__
+	if (getNodeCount() < 2)
+		return true;
+	return MBind(ptr, bytes, MPOL_BIND_MODE, std::vector<int> { node });
+#else
+	return true;
+#endif
+}
+template<typename Func> static void ForEachWeight(const NeuralSystem& sys,
+		Func func) {
+	for (const NeuralLayerPtr& layer : sys) {
+		for (const SignalPtr& sig : layer->getInputSignals()) {
+			if (sig.get() != nullptr && isTrainableWeight(sig->type)
+					&& sig->value.size() > 0) {
+				func(sig->value.front());
+			}
+		}
+	}
+}
+void NeuralNuma::placeWeights(NeuralSystem& sys) {
+	NumaPolicy policy = getPolicy();
+	if (getNodeCount() < 2 || policy == NumaPolicy::Local)
+		return;
+	int node = getThreadNode();
+	if (policy == NumaPolicy::Replicate && node < 0)
+		return;
+	ForEachWeight(sys, [&](const Storage& data) {
+		void* ptr = (void*) data.data();
+		size_t bytes = data.size() * sizeof(float);
+		if (policy == NumaPolicy::Interleave) {
+			interleave(ptr, bytes);
+		} else {
+			bind(ptr, bytes, node);
+		}
+	});
+}
+void NeuralNuma::copyWeights(const NeuralSystem& src, NeuralSystem& dst) {
+	std::vector<const Storage*> from;
+	std::vector<Storage*> to;
+	ForEachWeight(src, [&](const Storage& data) {
+		from.push_back(&data);
+	});
+	ForEachWeight(dst, [&](const Storage& data) {
+		to.push_back(const_cast<Storage*>(&data));
+	});
+	if (from.size() != to.size()) {
+		throw std::runtime_error("Replica does not match the master network.");
+	}
+	for (size_t i = 0; i < from.size(); i++) {
+		if (from[i]->size() != to[i]->size()) {
+			throw std::runtime_error(
+					"Replica weights do not match the master network.");
+		}
+		std::copy(from[i]->begin(), from[i]->end(), to[i]->begin());
+	}
+}
+std::vector<std::shared_ptr<NeuralSystem>> NeuralNuma::replicate(
+		const NeuralSystem& master,
+		const std::function<std::shared_ptr<NeuralSystem>()>& make) {
+	std::vector<std::shared_ptr<NeuralSystem>> replicas;
+	for (const NumaNode& node : getNodes()) {
+		NumaNodeScope scope(node.id);
+		std::shared_ptr<NeuralSystem> sys = make();
+		copyWeights(master, *sys);
+		if (getPolicy() == NumaPolicy::Replicate) {
+			placeWeights(*sys);
+		}
+		replicas.push_back(sys);
+	}
+	return replicas;
+}
+void NeuralNuma::print(std::ostream& out) {
+	out << "NUMA nodes: " << getNodeCount() << ", policy " << getPolicy()
+			<< std::endl;
+	for (const NumaNode& node : getNodes()) {
+		out << "  node " << node.id << ": " << node.cpus.size() << " cpus";
+		if (node.memoryBytes > 0) {
+			out << ", " << (node.memoryBytes >> 20) << " MB";
+		}
+		out << std::endl;
+	}
+}
+NumaNodeScope::NumaNodeScope(int node) :
+		previousNode(ThreadNode), previousMode(-1) {
+	const std::vector<NumaNode>& nodes = NeuralNuma::getNodes();
+	auto it = std::find_if(nodes.begin(), nodes.end(),
+			[node](const NumaNode& n) {return n.id == node;});
+	if (it == nodes.end()) {
+		throw std::runtime_error(
+				"Unknown NUMA node " + std::to_string(node) + ".");
+	}
+	ThreadNode = node;
+#ifdef __linux__
+	if (nodes.size() < 2)
+		return;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &set) == 0) {
+		for (int c = 0; c < CPU_SETSIZE; c++) {
+			if (CPU_ISSET(c, &set))
+				previousCpus.push_back(c);
+		}
+	}
+	CPU_ZERO(&set);
+	for (int c : it->cpus) {
+		if (c < CPU_SETSIZE)
+			CPU_SET(c, &set);
+	}
+	sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	int mode = 0;
+	previousMask.assign(MASK_WORDS, 0);
+	if (syscall(SYS_get_mempolicy, &mode, previousMask.data(),
+			(unsigned long) MAX_NODES + 1, nullptr, 0UL) == 0) {
+		previousMode = mode;
+	}
+	unsigned long mask[MASK_WORDS];
+	std::memset(mask, 0, sizeof(mask));
+	if (node < MAX_NODES)
+		mask[node / (8 * sizeof(unsigned long))] |= 1UL
+				<< (node % (8 * sizeof(unsigned long)));
+	syscall(SYS_set_mempolicy, MPOL_PREFERRED_MODE, mask,
+			(unsigned long) MAX_NODES + 1);
+#endif
+}
+NumaNodeScope::~NumaNodeScope() {
+	ThreadNode = previousNode;
+#ifdef __linux__
+	if (previousCpus.size() > 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int c : previousCpus) {
+			CPU_SET(c, &set);
+		}
+		sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	}
+	if (previousMode >= 0) {
+		syscall(SYS_set_mempolicy, previousMode,
+				(previousMode == MPOL_DEFAULT_MODE) ?
+						nullptr : previousMask.data(),
+				(unsigned long) MAX_NODES + 1);
+	}
+#endif
+}
+}
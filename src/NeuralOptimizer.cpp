@@ -6,15 +6,31 @@
  */
 #include "tiny_dnn/tiny_dnn.h"
 #include "NeuralOptimizer.h"
+#include "NeuralKernels.h"
+#include "NeuralThreadPool.h"
+#include <stdexcept>
 namespace tgr {
+//elements per task for the vectorized update kernels
+static const size_t UPDATE_GRAIN = 16384;
+template<typename Func> static void ForChunks(bool parallelize, size_t size,
+		const Func& func) {
+	if (size == 0)
+		return;
+	if (!parallelize) {
+		func(0, size);
+		return;
+	}
+	NeuralThreadPool::parallelFor(0, size, [&](size_t b, size_t e) {
+		func(b, e - b);
+	}, UPDATE_GRAIN);
+}
 AdagradOptimizer::AdagradOptimizer() :
 		alpha(float_t(0.01)), eps(float_t(1e-8)) {
 }
 void AdagradOptimizer::update(const Storage &dW, Storage &W, bool parallelize) {
 	Storage &g = get<0>(W);
-	tiny_dnn::for_i(parallelize, static_cast<int>(W.size()), [&](int i) {
-		g[i] += dW[i] * dW[i];
-		W[i] -= alpha * dW[i] / (std::sqrt(g[i]) + eps);
+	ForChunks(parallelize, W.size(), [&](size_t b, size_t n) {
+		NeuralKernels::get().adagrad(&W[b], &dW[b], &g[b], alpha, eps, n);
 	});
 }
 /**
@@ -29,9 +45,8 @@ RMSpropOptimizer::RMSpropOptimizer() :
 void RMSpropOptimizer::update(const Storage &dW, Storage &W, bool parallelize) {
 	Storage &g = get<0>(W);
 
-	tiny_dnn::for_i(parallelize, static_cast<int>(W.size()), [&](int i) {
-		g[i] = mu * g[i] + (1 - mu) * dW[i] * dW[i];
-		W[i] -= alpha * dW[i] / std::sqrt(g[i] + eps);
+	ForChunks(parallelize, W.size(), [&](size_t b, size_t n) {
+		NeuralKernels::get().rmsprop(&W[b], &dW[b], &g[b], alpha, mu, eps, n);
 	});
 }
 
@@ -52,14 +67,18 @@ void AdamOptimizer::update(const Storage &dW, Storage &W, bool parallelize) {
 	b1_t *= b1;
 	b2_t *= b2;
 
-	tiny_dnn::for_i(parallelize, static_cast<int>(W.size()), [&](int i) {
-		mt[i] = b1 * mt[i] + (float_t(1) - b1) * dW[i];
-		vt[i] = b2 * vt[i] + (float_t(1) - b2) * dW[i] * dW[i];
-
-		W[i] -= alpha * (mt[i] / (float_t(1) - b1_t)) /
-		std::sqrt((vt[i] / (float_t(1) - b2_t)) + eps);
+	ForChunks(parallelize, W.size(), [&](size_t b, size_t n) {
+		NeuralKernels::get().adam(&W[b], &dW[b], &mt[b], &vt[b], alpha, b1, b2,
+				b1_t, b2_t, eps, n);
 	});
 }
+void AdamOptimizer::setScalars(const std::vector<float_t>& scalars) {
+	if (scalars.size() != 2) {
+		throw std::runtime_error("Adam state needs two decay powers.");
+	}
+	b1_t = scalars[0];
+	b2_t = scalars[1];
+}
 
 /**
  * SGD without momentum
@@ -71,8 +90,9 @@ GradientDescentOptimizer::GradientDescentOptimizer() :
 }
 void GradientDescentOptimizer::update(const Storage &dW, Storage &W,
 		bool parallelize) {
-	tiny_dnn::for_i(parallelize, static_cast<int>(W.size()),
-			[&](int i) {W[i] = W[i] - alpha * (dW[i] + lambda * W[i]);});
+	ForChunks(parallelize, W.size(), [&](size_t b, size_t n) {
+		NeuralKernels::get().sgd(&W[b], &dW[b], alpha, lambda, n);
+	});
 }
 
 /**
@@ -92,10 +112,9 @@ void MomentumOptimizer::reset() {
 void MomentumOptimizer::update(const Storage &dW, Storage &W,
 		bool parallelize) {
 	Storage &dWprev = get<0>(W);
-	tiny_dnn::for_i(parallelize, static_cast<int>(W.size()), [&](int i) {
-		float_t V = mu * dWprev[i] - alpha * (dW[i] + W[i] * lambda);
-		W[i] += V;
-		dWprev[i] = V;
+	ForChunks(parallelize, W.size(), [&](size_t b, size_t n) {
+		NeuralKernels::get().momentum(&W[b], &dW[b], &dWprev[b], alpha, lambda,
+				mu, n);
 	});
 }
 }
@@ -0,0 +1,406 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralPlan.h"
+#include "NeuralSystem.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <typeinfo>
+#include <unordered_map>
+namespace tgr {
+static const char PlanMagic[8] = { 'T', 'I', 'G', 'E', 'R', 'P', 'L', 'N' };
+static const uint32_t PlanVersion = 1;
+static const uint32_t PlanByteOrder = 0x01020304;
+static thread_local std::shared_ptr<const NeuralPlan> ActivePlan;
+//FNV-1a, stable across runs unlike std::hash
+struct PlanHash {
+	uint64_t value = 0xcbf29ce484222325ULL;
+	void add(const void* data, size_t bytes) {
+		const uint8_t* ptr = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < bytes; i++) {
+			value = (value ^ ptr[i]) * 0x100000001b3ULL;
+		}
+	}
+	void add(int64_t v) {
+		add(&v, sizeof(v));
+	}
+	void add(const std::string& str) {
+		add((int64_t) str.size());
+		add(str.data(), str.size());
+	}
+	void add(const std::vector<aly::dim3>& dims) {
+		add((int64_t) dims.size());
+		for (const aly::dim3& d : dims) {
+			add((int64_t) d.x);
+			add((int64_t) d.y);
+			add((int64_t) d.z);
+		}
+	}
+};
+const std::vector<int>& PlanTable::next(size_t& index) const {
+	if (index >= arrays.size()) {
+		throw std::runtime_error("Plan table is missing arrays.");
+	}
+	return arrays[index++];
+}
+const std::vector<int>& PlanTable::next(size_t& index, size_t size,
+		int range) const {
+	const std::vector<int>& values = next(index);
+	if (values.size() != size) {
+		throw std::runtime_error("Plan table does not match the layer.");
+	}
+	for (int v : values) {
+		if (v < 0 || v >= range) {
+			throw std::runtime_error("Plan table index out of range.");
+		}
+	}
+	return values;
+}
+void PlanTable::checkOffsets(const std::vector<int>& offsets, size_t count,
+		size_t total) {
+	bool ok = (offsets.size() == count + 1 && offsets.front() == 0
+			&& offsets.back() == (int) total);
+	for (size_t r = 0; ok && r < count; r++) {
+		ok = (offsets[r + 1] >= offsets[r]);
+	}
+	if (!ok) {
+		throw std::runtime_error("Plan table does not match the layer.");
+	}
+}
+uint64_t NeuralPlan::GetSignature(const std::vector<NeuralLayerPtr>& input,
+		std::vector<NeuralLayerPtr>* visited) {
+	std::vector<NeuralLayerPtr> queue;
+	std::unordered_map<const NeuralLayer*, int> index;
+	for (const NeuralLayerPtr& layer : input) {
+		if (index.insert(std::make_pair(layer.get(), (int) queue.size())).second) {
+			queue.push_back(layer);
+		}
+	}
+	for (size_t i = 0; i < queue.size(); i++) {
+		for (const NeuralLayerPtr& next : queue[i]->getOutputLayers()) {
+			if (next.get() != nullptr
+					&& index.insert(std::make_pair(next.get(), (int) queue.size())).second) {
+				queue.push_back(next);
+			}
+		}
+	}
+	PlanHash hash;
+	hash.add((int64_t) input.size());
+	hash.add((int64_t) queue.size());
+	for (const NeuralLayerPtr& layer : queue) {
+		hash.add(std::string(typeid(*layer).name()));
+		hash.add(layer->getName());
+		hash.add(layer->getTableKey());
+		hash.add(layer->getInputDimensions());
+		hash.add(layer->getOutputDimensions());
+		for (const SignalPtr& sig : layer->getInputSignals()) {
+			//producer and which of its outputs, or -1 for weights and inputs
+			int64_t producer = -1, channel = -1;
+			if (sig.get() != nullptr && sig->input != nullptr) {
+				auto found = index.find(sig->input);
+				producer = (found != index.end()) ? found->second : -2;
+				const std::vector<SignalPtr>& outputs =
+						sig->input->getOutputSignals();
+				for (size_t c = 0; c < outputs.size(); c++) {
+					if (outputs[c].get() == sig.get()) {
+						channel = (int64_t) c;
+					}
+				}
+			}
+			hash.add(producer);
+			hash.add(channel);
+		}
+	}
+	if (visited != nullptr) {
+		*visited = queue;
+	}
+	return hash.value;
+}
+static PlanSignal FindSignal(const NeuralSignal* sig,
+		const std::unordered_map<const NeuralLayer*, int>& positions) {
+	if (sig->input != nullptr) {
+		auto found = positions.find(sig->input);
+		const std::vector<SignalPtr>& outputs = sig->input->getOutputSignals();
+		for (size_t c = 0; c < outputs.size() && found != positions.end(); c++) {
+			if (outputs[c].get() == sig) {
+				return {found->second, (int32_t) c};
+			}
+		}
+	}
+	for (const NeuralLayerPtr& layer : sig->outputs) {
+		auto found = positions.find(layer.get());
+		const std::vector<SignalPtr>& inputs = layer->getInputSignals();
+		for (size_t c = 0; c < inputs.size() && found != positions.end(); c++) {
+			if (inputs[c].get() == sig) {
+				return {found->second, -1 - (int32_t) c};
+			}
+		}
+	}
+	throw std::runtime_error("Aliased signal is not part of the system.");
+}
+void NeuralPlan::capture(const NeuralSystem& sys) {
+	std::vector<NeuralLayerPtr> visited;
+	signature = GetSignature(sys.getInputLayers(), &visited);
+	machine = NeuralTuner::getMachineKey();
+	std::unordered_map<const NeuralLayer*, int> visits, positions;
+	for (size_t i = 0; i < visited.size(); i++) {
+		visits[visited[i].get()] = (int) i;
+	}
+	const std::vector<NeuralLayerPtr>& layers = sys.getLayers();
+	if (layers.size() != visited.size()) {
+		throw std::runtime_error(
+				"Only systems built from their input layers can be planned.");
+	}
+	order.clear();
+	tunings.clear();
+	aliases.clear();
+	tables.clear();
+	for (size_t i = 0; i < layers.size(); i++) {
+		const NeuralLayerPtr& layer = layers[i];
+		auto found = visits.find(layer.get());
+		if (found == visits.end()) {
+			throw std::runtime_error(
+					"Only systems built from their input layers can be planned.");
+		}
+		order.push_back(found->second);
+		positions[layer.get()] = (int) i;
+		LayerTuning t;
+		t.backend = layer->getBackendType();
+		t.parallelize = layer->isParallel();
+		t.grainSize = layer->getGrainSize();
+		tunings.push_back(t);
+		std::string key = layer->getTableKey();
+		if (key.size() > 0 && tables.find(key) == tables.end()) {
+			std::shared_ptr<PlanTable> table(new PlanTable());
+			layer->getTables(*table);
+			tables[key] = table;
+		}
+	}
+	for (const SignalPtr& sig : sys.getAliases()) {
+		PlanAlias alias;
+		alias.signal = FindSignal(sig.get(), positions);
+		alias.parent = FindSignal(sig->alias, positions);
+		alias.offset = sig->aliasOffset;
+		aliases.push_back(alias);
+	}
+}
+std::shared_ptr<const PlanTable> NeuralPlan::getTable(
+		const std::string& key) const {
+	auto found = tables.find(key);
+	return (found != tables.end()) ?
+			found->second : std::shared_ptr<const PlanTable>();
+}
+std::shared_ptr<const NeuralPlan> NeuralPlan::getActive() {
+	return ActivePlan;
+}
+std::shared_ptr<const NeuralPlan> NeuralPlan::setActive(
+		const std::shared_ptr<const NeuralPlan>& plan) {
+	std::shared_ptr<const NeuralPlan> previous = ActivePlan;
+	ActivePlan = plan;
+	return previous;
+}
+struct PlanWriter {
+	std::vector<uint8_t> data;
+	void put(const void* ptr, size_t bytes) {
+		const uint8_t* src = static_cast<const uint8_t*>(ptr);
+		data.insert(data.end(), src, src + bytes);
+	}
+	template<typename T> void put(T value) {
+		put(&value, sizeof(T));
+	}
+	void put(const std::string& str) {
+		put((uint32_t) str.size());
+		put(str.data(), str.size());
+	}
+	void put(const std::vector<int>& values) {
+		put((uint64_t) values.size());
+		put(values.data(), values.size() * sizeof(int));
+	}
+};
+struct PlanReader {
+	const std::vector<uint8_t>& data;
+	const std::string& file;
+	size_t offset;
+	PlanReader(const std::vector<uint8_t>& data, const std::string& file) :
+			data(data), file(file), offset(0) {
+	}
+	void fail(const std::string& msg) const {
+		throw std::runtime_error("Invalid plan " + file + ": " + msg);
+	}
+	void get(void* ptr, size_t bytes) {
+		if (bytes > data.size() - offset) {
+			fail("file is truncated.");
+		}
+		std::memcpy(ptr, data.data() + offset, bytes);
+		offset += bytes;
+	}
+	template<typename T> T get() {
+		T value;
+		get(&value, sizeof(T));
+		return value;
+	}
+	//a count of elements that must fit in what is left of the file
+	size_t getCount(size_t elementBytes) {
+		uint64_t count = get<uint64_t>();
+		if (count > (data.size() - offset) / std::max(elementBytes, (size_t) 1)) {
+			fail("file is truncated.");
+		}
+		return (size_t) count;
+	}
+	std::string getString() {
+		uint32_t size = get<uint32_t>();
+		if (size > data.size() - offset) {
+			fail("file is truncated.");
+		}
+		std::string str(reinterpret_cast<const char*>(data.data() + offset), size);
+		offset += size;
+		return str;
+	}
+	void getValues(std::vector<int>& values) {
+		values.resize(getCount(sizeof(int)));
+		get(values.data(), values.size() * sizeof(int));
+	}
+};
+static_assert(sizeof(int) == 4, "Plan tables are stored as 32-bit ints.");
+void NeuralPlan::write(const std::string& file) const {
+	PlanWriter out;
+	out.put(PlanMagic, sizeof(PlanMagic));
+	out.put(PlanVersion);
+	out.put(PlanByteOrder);
+	out.put(signature);
+	out.put(machine);
+	out.put((uint64_t) order.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		const LayerTuning& t = tunings[i];
+		out.put((int32_t) order[i]);
+		out.put((int32_t) t.backend);
+		out.put((int32_t) (t.parallelize ? 1 : 0));
+		out.put((uint64_t) t.grainSize);
+	}
+	out.put((uint64_t) aliases.size());
+	for (const PlanAlias& alias : aliases) {
+		out.put(alias.signal.layer);
+		out.put(alias.signal.channel);
+		out.put(alias.parent.layer);
+		out.put(alias.parent.channel);
+		out.put(alias.offset);
+	}
+	out.put((uint64_t) tables.size());
+	for (const auto& pr : tables) {
+		out.put(pr.first);
+		out.put((uint64_t) pr.second->arrays.size());
+		for (const std::vector<int>& values : pr.second->arrays) {
+			out.put(values);
+		}
+	}
+	std::string tmpFile = file + ".tmp";
+	bool ok;
+	{
+		std::ofstream os(tmpFile, std::ios::binary);
+		os.write(reinterpret_cast<const char*>(out.data.data()), out.data.size());
+		ok = os.good();
+	}
+	if (!ok || std::rename(tmpFile.c_str(), file.c_str()) != 0) {
+		std::remove(tmpFile.c_str());
+		throw std::runtime_error("Could not write plan " + file);
+	}
+}
+void NeuralPlan::read(const std::string& file) {
+	std::vector<uint8_t> data;
+	{
+		std::ifstream is(file, std::ios::binary | std::ios::ate);
+		if (!is.good()) {
+			throw std::runtime_error("Could not open plan " + file);
+		}
+		data.resize((size_t) is.tellg());
+		is.seekg(0);
+		is.read(reinterpret_cast<char*>(data.data()), data.size());
+		if (!is.good()) {
+			throw std::runtime_error("Could not read plan " + file);
+		}
+	}
+	PlanReader in(data, file);
+	char magic[sizeof(PlanMagic)];
+	in.get(magic, sizeof(magic));
+	if (std::memcmp(magic, PlanMagic, sizeof(magic)) != 0) {
+		in.fail("not a plan file.");
+	}
+	if (in.get<uint32_t>() != PlanVersion) {
+		in.fail("unsupported version.");
+	}
+	if (in.get<uint32_t>() != PlanByteOrder) {
+		in.fail("written with a different byte order.");
+	}
+	signature = in.get<uint64_t>();
+	machine = in.getString();
+	size_t count = in.getCount(20);
+	order.resize(count);
+	tunings.resize(count);
+	std::vector<uint8_t> seen(count, 0);
+	for (size_t i = 0; i < count; i++) {
+		order[i] = in.get<int32_t>();
+		if (order[i] < 0 || order[i] >= (int) count || seen[order[i]]) {
+			in.fail("layer order is not a permutation.");
+		}
+		seen[order[i]] = 1;
+		LayerTuning& t = tunings[i];
+		t.backend = (BackendType) in.get<int32_t>();
+		t.parallelize = (in.get<int32_t>() != 0);
+		t.grainSize = (size_t) in.get<uint64_t>();
+	}
+	aliases.resize(in.getCount(24));
+	for (PlanAlias& alias : aliases) {
+		alias.signal.layer = in.get<int32_t>();
+		alias.signal.channel = in.get<int32_t>();
+		alias.parent.layer = in.get<int32_t>();
+		alias.parent.channel = in.get<int32_t>();
+		alias.offset = in.get<uint64_t>();
+		if (alias.signal.layer < 0 || alias.signal.layer >= (int) count
+				|| alias.parent.layer < 0 || alias.parent.layer >= (int) count) {
+			in.fail("alias refers to a missing layer.");
+		}
+	}
+	tables.clear();
+	size_t tableCount = in.getCount(12);
+	for (size_t i = 0; i < tableCount; i++) {
+		std::string key = in.getString();
+		std::shared_ptr<PlanTable> table(new PlanTable());
+		table->arrays.resize(in.getCount(8));
+		for (std::vector<int>& values : table->arrays) {
+			in.getValues(values);
+		}
+		tables[key] = table;
+	}
+	if (in.offset != data.size()) {
+		in.fail("unexpected data after the tables.");
+	}
+}
+void WriteNeuralPlanToFile(const std::string& file, const NeuralPlan& plan) {
+	plan.write(file);
+}
+std::shared_ptr<NeuralPlan> ReadNeuralPlanFromFile(const std::string& file) {
+	std::shared_ptr<NeuralPlan> plan(new NeuralPlan());
+	plan->read(file);
+	return plan;
+}
+}
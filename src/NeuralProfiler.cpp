@@ -0,0 +1,372 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralProfiler.h"
+#include "NeuralLayer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <tuple>
+namespace tgr {
+std::atomic<bool> NeuralProfiler::enabled(false);
+std::atomic<size_t> NeuralProfiler::capacity(1 << 16);
+std::mutex NeuralProfiler::bufferLock;
+std::vector<std::shared_ptr<ProfileBuffer>> NeuralProfiler::buffers;
+static int NextThreadId = 0;
+static const std::chrono::steady_clock::time_point ProfileEpoch =
+		std::chrono::steady_clock::now();
+/**
+ * Hands the thread's buffer back when the thread exits, so short lived
+ * threads reuse rings instead of growing the buffer list.
+ */
+struct ProfileThreadHandle {
+	std::shared_ptr<ProfileBuffer> buffer;
+	~ProfileThreadHandle();
+};
+static std::vector<std::shared_ptr<ProfileBuffer>> RetiredBuffers;
+ProfileThreadHandle::~ProfileThreadHandle() {
+	if (buffer.get() != nullptr) {
+		std::lock_guard<std::mutex> lockMe(NeuralProfiler::getLock());
+		RetiredBuffers.push_back(buffer);
+	}
+}
+std::ostream &operator<<(std::ostream &os, ProfilePhase phase) {
+	switch (phase) {
+	case ProfilePhase::Forward:
+		os << "forward";
+		break;
+	case ProfilePhase::Backward:
+		os << "backward";
+		break;
+	case ProfilePhase::Update:
+		os << "update";
+		break;
+	}
+	return os;
+}
+void ProfileBuffer::copyTo(std::vector<ProfileEvent>& out) const {
+	uint64_t h = head.load(std::memory_order_acquire);
+	uint64_t t = tail.load(std::memory_order_relaxed);
+	if (h > events.size()) {
+		t = std::max(t, h - events.size());
+	}
+	for (uint64_t i = t; i < h; i++) {
+		out.push_back(events[i % events.size()]);
+	}
+}
+std::mutex& NeuralProfiler::getLock() {
+	return bufferLock;
+}
+ProfileBuffer* NeuralProfiler::getThreadBuffer() {
+	thread_local ProfileThreadHandle handle;
+	if (handle.buffer.get() == nullptr) {
+		std::lock_guard<std::mutex> lockMe(bufferLock);
+		if (RetiredBuffers.size() > 0) {
+			handle.buffer = RetiredBuffers.back();
+			RetiredBuffers.pop_back();
+			handle.buffer->threadId = NextThreadId++;
+		} else {
+			handle.buffer = std::shared_ptr<ProfileBuffer>(
+					new ProfileBuffer(std::max(capacity.load(), (size_t) 1),
+							NextThreadId++));
+			buffers.push_back(handle.buffer);
+		}
+	}
+	return handle.buffer.get();
+}
+void NeuralProfiler::setCapacity(size_t c) {
+	capacity.store(c);
+}
+uint64_t NeuralProfiler::now() {
+	return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - ProfileEpoch).count();
+}
+static uint64_t TensorBytes(const Tensor& t) {
+	uint64_t count = 0;
+	for (const Storage& s : t) {
+		count += s.size();
+	}
+	return count * sizeof(float);
+}
+uint64_t NeuralProfiler::countBytes(const NeuralLayer* layer,
+		ProfilePhase phase) {
+	uint64_t bytes = 0;
+	for (const SignalPtr& sig : layer->getInputSignals()) {
+		if (sig.get() == nullptr) {
+			continue;
+		}
+		switch (phase) {
+		case ProfilePhase::Forward:
+			bytes += TensorBytes(sig->value);
+			break;
+		case ProfilePhase::Backward:
+			bytes += TensorBytes(sig->value) + TensorBytes(sig->change);
+			break;
+		case ProfilePhase::Update:
+			if (layer->isTrainable() && isTrainableWeight(sig->type)) {
+				bytes += TensorBytes(sig->value) + TensorBytes(sig->change);
+			}
+			break;
+		}
+	}
+	if (phase != ProfilePhase::Update) {
+		for (const SignalPtr& sig : layer->getOutputSignals()) {
+			if (sig.get() == nullptr) {
+				continue;
+			}
+			bytes += TensorBytes(sig->value);
+			if (phase == ProfilePhase::Backward) {
+				bytes += TensorBytes(sig->change);
+			}
+		}
+	}
+	return bytes;
+}
+void NeuralProfiler::record(const NeuralLayer* layer, ProfilePhase phase,
+		uint64_t start, uint64_t end, uint64_t bytes,
+		const CounterValues* counters) {
+	ProfileBuffer* buffer = getThreadBuffer();
+	ProfileEvent e;
+	const std::string& name = layer->getName();
+	size_t len = std::min(name.size(), (size_t) ProfileEvent::MAX_NAME - 1);
+	std::memcpy(e.name, name.data(), len);
+	e.name[len] = '\0';
+	e.layerId = layer->getId();
+	e.phase = phase;
+	e.threadId = buffer->threadId;
+	e.start = start;
+	e.end = end;
+	e.bytes = bytes;
+	e.hasCounters = (counters != nullptr);
+	if (e.hasCounters) {
+		e.counters = *counters;
+	} else {
+		std::memset(e.counters.values, 0, sizeof(e.counters.values));
+	}
+	buffer->push(e);
+}
+std::vector<ProfileEvent> NeuralProfiler::getEvents() {
+	std::vector<ProfileEvent> events;
+	{
+		std::lock_guard<std::mutex> lockMe(bufferLock);
+		for (const std::shared_ptr<ProfileBuffer>& buffer : buffers) {
+			buffer->copyTo(events);
+		}
+	}
+	std::sort(events.begin(), events.end(),
+			[](const ProfileEvent& a, const ProfileEvent& b) {
+				return a.start < b.start;
+			});
+	return events;
+}
+void NeuralProfiler::clear() {
+	std::lock_guard<std::mutex> lockMe(bufferLock);
+	for (const std::shared_ptr<ProfileBuffer>& buffer : buffers) {
+		buffer->tail.store(buffer->head.load(std::memory_order_acquire),
+				std::memory_order_relaxed);
+	}
+}
+static double Percentile(const std::vector<double>& sorted, double q) {
+	//nearest rank
+	size_t rank = (size_t) std::ceil(q * sorted.size());
+	return sorted[std::min(std::max(rank, (size_t) 1), sorted.size()) - 1];
+}
+std::vector<ProfileSummary> NeuralProfiler::getSummary() {
+	return getSummary(0, std::numeric_limits<uint64_t>::max());
+}
+std::vector<ProfileSummary> NeuralProfiler::getSummary(uint64_t startTime,
+		uint64_t endTime) {
+	//layers can share a name, so group by id as well
+	std::map<std::tuple<int, std::string, int>, std::vector<const ProfileEvent*>> groups;
+	std::vector<ProfileEvent> events = getEvents();
+	for (const ProfileEvent& e : events) {
+		if (e.start < startTime || e.end > endTime) {
+			continue;
+		}
+		groups[std::make_tuple(e.layerId, std::string(e.name), (int) e.phase)].push_back(
+				&e);
+	}
+	std::vector<ProfileSummary> summary;
+	for (auto& pr : groups) {
+		std::vector<double> times;
+		uint64_t bytes = 0;
+		size_t counted = 0;
+		CounterValues counters;
+		std::memset(counters.values, 0, sizeof(counters.values));
+		for (const ProfileEvent* e : pr.second) {
+			times.push_back(e->getDuration());
+			bytes += e->bytes;
+			if (e->hasCounters) {
+				for (int c = 0; c < HARDWARE_COUNTER_COUNT; c++) {
+					counters.values[c] += e->counters.values[c];
+				}
+				counted++;
+			}
+		}
+		std::sort(times.begin(), times.end());
+		ProfileSummary s;
+		s.layerId = std::get<0>(pr.first);
+		s.name = std::get<1>(pr.first);
+		s.phase = (ProfilePhase) std::get<2>(pr.first);
+		s.count = times.size();
+		s.total = 0.0;
+		for (double t : times) {
+			s.total += t;
+		}
+		s.mean = s.total / s.count;
+		s.p50 = Percentile(times, 0.5);
+		s.p99 = Percentile(times, 0.99);
+		s.min = times.front();
+		s.max = times.back();
+		s.bytes = bytes / s.count;
+		s.hasCounters = (counted > 0);
+		for (int c = 0; c < HARDWARE_COUNTER_COUNT; c++) {
+			s.counters.values[c] = (counted > 0) ? counters.values[c] / counted : 0;
+		}
+		summary.push_back(s);
+	}
+	std::sort(summary.begin(), summary.end(),
+			[](const ProfileSummary& a, const ProfileSummary& b) {
+				return a.total > b.total;
+			});
+	return summary;
+}
+static std::string EscapeJSON(const std::string& str) {
+	std::string out;
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			out += '\\';
+		}
+		out += c;
+	}
+	return out;
+}
+void NeuralProfiler::writeChromeTrace(std::ostream& out) {
+	std::vector<ProfileEvent> events = getEvents();
+	std::vector<int> threads;
+	for (const ProfileEvent& e : events) {
+		threads.push_back(e.threadId);
+	}
+	std::sort(threads.begin(), threads.end());
+	threads.erase(std::unique(threads.begin(), threads.end()), threads.end());
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	for (int tid : threads) {
+		out << (first ? "\n" : ",\n");
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << tid
+				<< ",\"args\":{\"name\":\"thread " << tid << "\"}}";
+		first = false;
+	}
+	out << std::fixed << std::setprecision(3);
+	for (const ProfileEvent& e : events) {
+		std::stringstream phase;
+		phase << e.phase;
+		out << (first ? "\n" : ",\n");
+		out << "{\"name\":\"" << EscapeJSON(e.name) << "\",\"cat\":\""
+				<< phase.str() << "\",\"ph\":\"X\",\"pid\":0,\"tid\":"
+				<< e.threadId << ",\"ts\":" << 1E-3 * e.start << ",\"dur\":"
+				<< 1E-3 * (e.end - e.start) << ",\"args\":{\"layer\":"
+				<< e.layerId << ",\"bytes\":" << e.bytes;
+		if (e.hasCounters) {
+			for (int c = 0; c < HARDWARE_COUNTER_COUNT; c++) {
+				out << ",\"" << GetCounterName(static_cast<HardwareCounter>(c))
+						<< "\":" << e.counters.values[c];
+			}
+		}
+		out << "}}";
+		first = false;
+	}
+	out << "\n]}\n";
+	out.unsetf(std::ios_base::floatfield);
+}
+void NeuralProfiler::writeChromeTrace(const std::string& file) {
+	std::ofstream out(file);
+	if (!out.is_open()) {
+		throw std::runtime_error(
+				std::string("Could not open ") + file + " for writing.");
+	}
+	writeChromeTrace(out);
+}
+void NeuralProfiler::printSummary(std::ostream& out) {
+	std::vector<ProfileSummary> summary = getSummary();
+	out << std::left << std::setw(32) << "Layer" << std::setw(10) << "Phase"
+			<< std::right << std::setw(8) << "Calls" << std::setw(12)
+			<< "Total(ms)" << std::setw(12) << "Mean(ms)" << std::setw(12)
+			<< "p50(ms)" << std::setw(12) << "p99(ms)" << std::setw(12)
+			<< "Max(ms)" << std::setw(10) << "MB/call" << std::setw(10)
+			<< "GB/s" << std::endl;
+	out << std::fixed << std::setprecision(3);
+	for (const ProfileSummary& s : summary) {
+		std::stringstream phase;
+		phase << s.phase;
+		double mb = s.bytes / (1024.0 * 1024.0);
+		double gbs = (s.mean > 0.0) ? (s.bytes / (1E6 * s.mean)) : 0.0;
+		std::stringstream name;
+		name << s.name.substr(0, 24) << " [" << s.layerId << "]";
+		out << std::left << std::setw(32) << name.str()
+				<< std::setw(10) << phase.str() << std::right << std::setw(8)
+				<< s.count << std::setw(12) << s.total << std::setw(12)
+				<< s.mean << std::setw(12) << s.p50 << std::setw(12) << s.p99
+				<< std::setw(12) << s.max << std::setw(10) << mb
+				<< std::setw(10) << gbs << std::endl;
+	}
+	bool hasCounters = false;
+	for (const ProfileSummary& s : summary) {
+		hasCounters |= s.hasCounters;
+	}
+	if (hasCounters) {
+		//misses per thousand instructions
+		out << std::endl << std::left << std::setw(32) << "Layer"
+				<< std::setw(10) << "Phase" << std::right << std::setw(12)
+				<< "Mcycles" << std::setw(12) << "Minstr" << std::setw(8)
+				<< "IPC" << std::setw(12) << "L1D MPKI" << std::setw(12)
+				<< "LLC MPKI" << std::setw(12) << "Br MPKI" << std::endl;
+		for (const ProfileSummary& s : summary) {
+			if (!s.hasCounters) {
+				continue;
+			}
+			std::stringstream phase;
+			phase << s.phase;
+			std::stringstream name;
+			name << s.name.substr(0, 24) << " [" << s.layerId << "]";
+			double kinstr = 1E-3 * s.counters[HardwareCounter::Instructions];
+			auto mpki = [=](HardwareCounter c) {
+				return (kinstr > 0.0) ? s.counters[c] / kinstr : 0.0;
+			};
+			out << std::left << std::setw(32) << name.str() << std::setw(10)
+					<< phase.str() << std::right << std::setw(12)
+					<< 1E-6 * s.counters[HardwareCounter::Cycles]
+					<< std::setw(12)
+					<< 1E-6 * s.counters[HardwareCounter::Instructions]
+					<< std::setw(8) << s.getIPC() << std::setw(12)
+					<< mpki(HardwareCounter::L1DMisses) << std::setw(12)
+					<< mpki(HardwareCounter::LLCMisses) << std::setw(12)
+					<< mpki(HardwareCounter::BranchMisses) << std::endl;
+		}
+	}
+	out.unsetf(std::ios_base::floatfield);
+}
+}
@@ -23,9 +23,9 @@
 #include <fstream>
 #include <ostream>
 #include <random>
-#include <omp.h>
 using namespace aly;
 namespace tgr {
+static const int BatchSite = NeuralMemory::registerSite("batch");
 NeuralListener::~NeuralListener() {
 
 }
@@ -57,19 +57,39 @@ void NeuralRuntime::trainOneBatch(NeuralOptimizer &optimizer,
 		const NeuralLossFunction& loss, const Tensor *in, const Tensor *t,
 		int batch_size, const int num_tasks, const Tensor *t_cost) {
 	CNN_UNREFERENCED_PARAMETER(num_tasks);
+	MemorySiteScope site(BatchSite);
 	in_batch.resize(batch_size);
 	t_batch.resize(batch_size);
 	std::copy(&in[0], &in[0] + batch_size, &in_batch[0]);
 	std::copy(&t[0], &t[0] + batch_size, &t_batch[0]);
-	std::vector<Tensor> t_cost_batch =
-			t_cost ?
-					std::vector<Tensor>(&t_cost[0], &t_cost[0] + batch_size) :
-					std::vector<Tensor>();
+	//assign() copies into the existing tensors, so their storage is reused
+	if (t_cost) {
+		t_cost_batch.assign(&t_cost[0], &t_cost[0] + batch_size);
+	} else {
+		t_cost_batch.clear();
+	}
 	//Perform forward and backward pass on in_batch
 	sys->bprop(loss, sys->fprop(in_batch), t_batch, t_cost_batch);
 	sys->updateWeights(optimizer, batch_size);
 }
+/**
+ * trains on one minibatch of class labels. The loss gradient is computed
+ * from the labels directly and written into the output layer.
+ */
+void NeuralRuntime::trainOneBatch(NeuralOptimizer &optimizer,
+		const NeuralLossFunction& loss, const Tensor *in, const int *labels,
+		int batch_size, const Storage *t_cost) {
+	MemorySiteScope site(BatchSite);
+	in_batch.resize(batch_size);
+	std::copy(&in[0], &in[0] + batch_size, &in_batch[0]);
+	sys->forward(in_batch);
+	sys->bprop(loss, labels, t_cost);
+	sys->updateWeights(optimizer, batch_size);
+}
 float NeuralRuntime::getLoss(const NeuralLossFunction& loss) {
+	if (!labels.empty()) {
+		return sys->getLoss(loss, inputs, labels);
+	}
 	return sys->getLoss(loss, inputs, desiredOutputs);
 }
 
@@ -79,22 +99,26 @@ void NeuralRuntime::setData(const std::vector<Tensor>& inputs,
 	this->inputs = inputs;
 	this->desiredOutputs = desiredOutputs;
 	this->t_costs = t_cost;
+	labels.clear();
+	labelCosts.clear();
 }
 void NeuralRuntime::setData(const std::vector<Storage> &inputs,
 		const std::vector<int> &class_labels,
 		const std::vector<Storage>& t_cost) {
 	sys->normalize(inputs, this->inputs);
-	sys->normalize(class_labels, this->desiredOutputs);
-	if (!t_cost.empty())
-		sys->normalize(t_cost, this->t_costs);
+	desiredOutputs.clear();
+	t_costs.clear();
+	labels = class_labels;
+	labelCosts = t_cost;
 }
 void NeuralRuntime::setData(const std::vector<Tensor> &inputs,
 		const std::vector<int> &class_labels,
 		const std::vector<Storage>& t_cost) {
 	this->inputs = inputs;
-	sys->normalize(class_labels, this->desiredOutputs);
-	if (!t_cost.empty())
-		sys->normalize(t_cost, this->t_costs);
+	desiredOutputs.clear();
+	t_costs.clear();
+	labels = class_labels;
+	labelCosts = t_cost;
 }
 const Tensor* NeuralRuntime::get_target_cost_sample_pointer(
 		const std::vector<Tensor> &t_cost, size_t i) {
@@ -164,6 +188,9 @@ bool NeuralRuntime::init(bool reset_weights) {
 		case 4:
 			loss = CrossEntropyMultiClassLossFunction();
 			break;
+		case 5:
+			loss = SoftmaxCrossEntropyLossFunction();
+			break;
 		default:
 			throw std::runtime_error("No loss function specified.");
 			break;
@@ -185,6 +212,41 @@ bool NeuralRuntime::init(bool reset_weights) {
 }
 void NeuralRuntime::cleanup() {
 	sys->setPhase(NetPhase::Test);
+	if (checkpointer.get() != nullptr) {
+		checkpointer->flush();
+	}
+}
+void NeuralRuntime::setCheckpointing(const CheckpointOptions& options) {
+	if (checkpointer.get() != nullptr) {
+		checkpointer->flush();
+	}
+	if (options.interval > 0) {
+		checkpointer.reset(new NeuralCheckpointer(options));
+		//checkpoints become frames of the cache, loaded when scrubbed to
+		std::shared_ptr<NeuralCache> frames = cache;
+		checkpointer->onWritten = [frames](int iteration, const std::string& file) {
+			frames->setFile(iteration, file);
+		};
+	} else {
+		checkpointer.reset();
+	}
+}
+void NeuralRuntime::setHistory(bool enabled, const HistoryOptions& options) {
+	if (enabled) {
+		std::shared_ptr<NeuralHistory> h(new NeuralHistory(options));
+		history = h;
+		//checkpoints of the same epoch are plain files and load as before
+		cache->setLoader([h](int frame, const std::string& file, NeuralKnowledge& knowledge) {
+			if (h->has(frame)) {
+				h->reconstruct(frame, knowledge);
+			} else {
+				ReadNeuralKnowledgeFromFile(file, knowledge);
+			}
+		});
+	} else {
+		history.reset();
+		cache->setLoader(nullptr);
+	}
 }
 void NeuralRuntime::setSampleRange(int mn, int mx) {
 	minSample.setValue(mn);
@@ -204,7 +266,8 @@ void NeuralRuntime::setup(const aly::ParameterPanePtr& controls) {
 					"Adagrad", "RMSprop" }, 6.0f);
 	controls->addSelectionField("Error Metric", lossFunction,
 			std::vector<std::string> { "MSE", "Absolute", "Absolute Epsilon",
-					"Cross Entropy", "Cross Class Entropy" }, 6.0f);
+					"Cross Entropy", "Cross Class Entropy",
+					"Softmax Cross Entropy" }, 6.0f);
 	controls->addNumberField("Epochs", iterationsPerEpoch);
 	controls->addRangeField("Samples", lowerSample, upperSample, minSample,
 			maxSample);
@@ -217,6 +280,8 @@ void NeuralRuntime::setup(const aly::ParameterPanePtr& controls) {
 	controls->addNumberField("Weight Decay", weightDecay, Float(0.0f),
 			Float(1.0f));
 	controls->addNumberField("Momentum", momentum, Float(0.0f), Float(1.0f));
+	controls->addCheckBox("Profile Layers", profile);
+	controls->addCheckBox("Hardware Counters", profileCounters);
 }
 bool NeuralRuntime::step() {
 	static std::random_device rd;
@@ -224,10 +289,25 @@ bool NeuralRuntime::step() {
 	bool ret = true;
 	double res = 0;
 	int batch_size = batchSize.toInteger();
+	NeuralProfiler::setEnabled(profile);
+	bool counters = profile && profileCounters;
+	if (counters != NeuralCounters::isEnabled()) {
+		if (!NeuralCounters::setEnabled(counters)) {
+			std::cerr
+					<< "Hardware counters unavailable, check /proc/sys/kernel/perf_event_paranoid."
+					<< std::endl;
+			profileCounters = false;
+		}
+	}
 	for (size_t i = lowerSample.toInteger(); i <= upperSample.toInteger() && running; i += batch_size) {
 		int sz = std::min(batch_size,(int) (upperSample.toInteger() + 1 - i));
 		if (sz > 0) {
-			trainOnce(optimizer, loss, &inputs[i], &desiredOutputs[i], sz, threads, get_target_cost_sample_pointer(t_costs, i));
+			if (!labels.empty()) {
+				trainOneBatch(optimizer, loss, &inputs[i], &labels[i], sz,
+						labelCosts.empty() ? nullptr : &labelCosts[i]);
+			} else {
+				trainOnce(optimizer, loss, &inputs[i], &desiredOutputs[i], sz, threads, get_target_cost_sample_pointer(t_costs, i));
+			}
 			if (onBatchEnumerate)
 				onBatchEnumerate();
 		}
@@ -236,6 +316,14 @@ bool NeuralRuntime::step() {
 	float err = getLoss(loss);
 	sys->getGraph()->points.push_back(float2(iteration, err));
 	std::cout << "Error Loss " << err << std::endl;
+	if (profile) {
+		NeuralProfiler::printSummary(std::cout);
+		NeuralMemory::printStats(std::cout);
+		if (profileFile.size() > 0) {
+			NeuralProfiler::writeChromeTrace(profileFile);
+		}
+		NeuralProfiler::clear();
+	}
 	ret=(iter<getMaxIteration()-1);
 	if (onEpochEnumerate)
 		onEpochEnumerate();
@@ -243,11 +331,14 @@ bool NeuralRuntime::step() {
 		onUpdate(iter,!ret);
 	}
 	iteration++;
-	//sys->updateKnowledge();
-	//NeuralKnowledge& k = sys->getKnowledge();
-	//k.setFile(MakeString() << GetDesktopDirectory() << ALY_PATH_SEPARATOR<< "tiger" << std::setw(5) << std::setfill('0') << iteration << ".bin");
-	//k.setName("tiger");
-	//cache->set(iteration, k);
+	if (checkpointer.get() != nullptr) {
+		//only the copy happens here, the file is written in the background
+		checkpointer->checkpoint(*sys, iteration, !ret, &optimizer);
+	}
+	if (history.get() != nullptr) {
+		history->record(*sys, iteration);
+		cache->setFile(iteration, history->getRecordFile(iteration));
+	}
 	std::cout<<iteration<<"/"<<getMaxIteration()<<" "<<ret<<std::endl;
 	return ret;
 }
@@ -255,6 +346,8 @@ NeuralRuntime::NeuralRuntime(const std::shared_ptr<tgr::NeuralSystem>& system) :
 		RecurrentTask([this](uint64_t iteration) {return step();}, 5), paused(
 				false), sys(system) {
 	optimizationMethod = -1;
+	profile = false;
+	profileCounters = false;
 	iterationsPerEpoch = Integer(200);
 	iterationsPerStep = Integer(10);
 	batchSize = Integer(32);
@@ -266,7 +359,7 @@ NeuralRuntime::NeuralRuntime(const std::shared_ptr<tgr::NeuralSystem>& system) :
 	weightDecay = Float(0.0f);
 	momentum = Float(0.9f);
 	learningRateDelta = Float(0.9f);
-	threads = omp_get_max_threads();
+	threads = NeuralThreadPool::getThreadCount();
 	cache.reset(new NeuralCache());
 }
 }
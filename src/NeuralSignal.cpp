@@ -36,9 +36,8 @@ bool Terminal::operator >(const Terminal & r) const {
 			< std::make_tuple(r.x, r.y, (layer) ? layer->getId() : -1));
 }
 bool isTrainableWeight(ChannelType vtype) {
-	return (static_cast<int>(vtype)
-			& static_cast<int>(ChannelType::weight)
-					== static_cast<int>(ChannelType::weight));
+	return ((static_cast<int>(vtype) & static_cast<int>(ChannelType::weight))
+			== static_cast<int>(ChannelType::weight));
 }
 float* NeuralSignal::getValuePtr(const aly::int3& pos) {
 	return &(value[0][dimensions(pos)]);
@@ -56,7 +55,44 @@ NeuralSignal::NeuralSignal(NeuralLayer* input, aly::dim3 dimensions,
 		ChannelType type) :
 		type(type), id(-1), dimensions(dimensions), value(
 				{ Storage(dimensions.volume(), 0.0f) }), change(
-				{ Storage(dimensions.volume(), 0.0f) }), input(input) {
+				{ Storage(dimensions.volume(), 0.0f) }), input(input), alias(
+				nullptr), aliasOffset(0) {
+}
+void NeuralSignal::setAlias(NeuralSignal* parent, size_t offset) {
+	if (parent != nullptr
+			&& offset + dimensions.volume() > parent->dimensions.volume()) {
+		throw std::runtime_error("Signal alias exceeds parent bounds.");
+	}
+	alias = parent;
+	aliasOffset = offset;
+}
+static void BindView(Storage& store, Storage& parent, size_t offset,
+		size_t size) {
+	float* ptr = parent.data() + offset;
+	if (store.data() == ptr && store.size() == size)
+		return;
+	Storage view(ptr, ptr + size, StorageAllocator<float, 64>(ptr, size));
+	store.swap(view);
+}
+void NeuralSignal::bindAlias(size_t sample_count) {
+	if (alias == nullptr)
+		return;
+	//Views always point into the signal at the root of the alias chain.
+	NeuralSignal* root = alias;
+	size_t offset = aliasOffset;
+	while (root->alias != nullptr) {
+		offset += root->aliasOffset;
+		root = root->alias;
+	}
+	size_t sz = dimensions.volume();
+	root->value.resize(sample_count, root->value[0]);
+	root->change.resize(sample_count, root->change[0]);
+	value.resize(sample_count, value[0]);
+	change.resize(sample_count, change[0]);
+	for (size_t s = 0; s < sample_count; s++) {
+		BindView(value[s], root->value[s], offset, sz);
+		BindView(change[s], root->change[s], offset, sz);
+	}
 }
 void NeuralSignal::clearGradients() {
 	for (Storage& store : change) {
@@ -68,13 +104,14 @@ void NeuralSignal::mergeGradients(Storage& dst) {
 	size_t sz = grad_head.size();
 	dst.resize(sz);
 	std::copy(grad_head.begin(), grad_head.end(), &dst[0]);
-#pragma omp parallel for
-	for (int i = 0; i < sz; i++) {
-		for (size_t sample = 1; sample < (int) change.size(); ++sample) {
-			Storage& cur = change[sample];
-			dst[i] += cur[i];
+	NeuralThreadPool::parallelFor(0, sz, [&](size_t begin, size_t end) {
+		for (size_t sample = 1; sample < change.size(); ++sample) {
+			const Storage& cur = change[sample];
+			for (size_t i = begin; i < end; i++) {
+				dst[i] += cur[i];
+			}
 		}
-	}
+	}, 4096);
 }
 void NeuralSignal::setValue(const aly::Image1f& data) {
 	value[0].assign(data.data.begin(), data.data.end());
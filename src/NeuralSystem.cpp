@@ -19,13 +19,14 @@
  * THE SOFTWARE.
  */
 #include "NeuralSystem.h"
-#include "NeuralFlowPane.h"
+#include <cstring>
+#include <map>
 
 using namespace aly;
 namespace tgr {
 
 NeuralSystem::NeuralSystem(const std::string& name,const std::shared_ptr<aly::NeuralFlowPane>& pane) :
-		name(name), initialized(false), flowPane(pane) {
+		name(name), initialized(false), flowPane(pane), planned(false), trunk(0) {
 	graph = GraphDataPtr(new GraphData(name));
 }
 
@@ -33,6 +34,70 @@ NeuralKnowledge& NeuralSystem::updateKnowledge() {
 	knowledge.set(*this);
 	return knowledge;
 }
+//weights of the layer signal a saved tensor was taken from
+static Storage* FindWeights(const std::map<int, NeuralLayerPtr>& layerMap, const KnowledgeTensor& t) {
+	auto it = layerMap.find(t.layerId);
+	if (it == layerMap.end()) {
+		throw std::runtime_error(MakeString() << "Knowledge has weights for unknown layer " << t.layerId << ".");
+	}
+	int index = 0;
+	for (const SignalPtr& sig : it->second->getInputSignals()) {
+		if (sig.get() != nullptr && sig->type == t.type && index++ == t.index) {
+			return &sig->value.front();
+		}
+	}
+	throw std::runtime_error(MakeString() << "Knowledge does not match the weights of " << it->second->getName() << ".");
+}
+void NeuralSystem::setKnowledge(const NeuralKnowledge& k) {
+	std::map<int, NeuralLayerPtr> layerMap;
+	for (NeuralLayerPtr layer : layers) {
+		layerMap[layer->getId()] = layer;
+	}
+	//match every tensor to its signal before touching any weights
+	std::vector<KnowledgeTensor> tensors = k.getTensors();
+	std::vector<Storage*> targets(tensors.size());
+	for (size_t i = 0; i < tensors.size(); i++) {
+		targets[i] = FindWeights(layerMap, tensors[i]);
+		if (targets[i]->size() != tensors[i].count) {
+			throw std::runtime_error(MakeString() << "Knowledge does not match the weights of " << layerMap[tensors[i].layerId]->getName() << ".");
+		}
+	}
+	NeuralThreadPool::parallelForEach(0, tensors.size(), [&](size_t i) {
+		std::memcpy(targets[i]->data(), tensors[i].data, tensors[i].count * sizeof(float));
+	}, 1);
+	knowledge = k;
+}
+bool NeuralSystem::setOptimizerState(const NeuralKnowledge& k, NeuralOptimizer& optimizer) {
+	std::vector<KnowledgeTensor> tensors = k.getOptimizerTensors();
+	if (tensors.size() == 0) {
+		return false;
+	}
+	if (k.getOptimizerName() != optimizer.getName()) {
+		throw std::runtime_error(MakeString() << "Saved state belongs to optimizer " << k.getOptimizerName() << ", not " << optimizer.getName() << ".");
+	}
+	std::map<int, NeuralLayerPtr> layerMap;
+	for (NeuralLayerPtr layer : layers) {
+		layerMap[layer->getId()] = layer;
+	}
+	std::vector<Storage*> targets;
+	std::vector<KnowledgeTensor> moments;
+	for (const KnowledgeTensor& t : tensors) {
+		if (t.layerId == OptimizerLayerId) {
+			optimizer.setScalars(std::vector<float_t>(t.data, t.data + t.count));
+			continue;
+		}
+		Storage* state = (t.slot <= optimizer.getStateCount()) ? optimizer.getState(*FindWeights(layerMap, t), t.slot - 1) : nullptr;
+		if (state == nullptr || state->size() != t.count) {
+			throw std::runtime_error(MakeString() << "Saved optimizer state does not match the weights of " << layerMap[t.layerId]->getName() << ".");
+		}
+		targets.push_back(state);
+		moments.push_back(t);
+	}
+	NeuralThreadPool::parallelForEach(0, moments.size(), [&](size_t i) {
+		std::memcpy(targets[i]->data(), moments[i].data, moments[i].count * sizeof(float));
+	}, 1);
+	return true;
+}
 Storage NeuralSystem::predict(const Storage &in) {
 	std::vector<Tensor> a(1);
 	a[0].emplace_back(in);
@@ -89,8 +154,12 @@ void NeuralSystem::backward(const std::vector<Tensor> &out_grad) {
 	for (size_t i = 0; i < output_channel_count; i++) {
 		outputLayers[i]->setOutputGradients( { reordered_grad[i] });
 	}
-	for (auto l = layers.rbegin(); l != layers.rend(); l++) {
-		(*l)->backward();
+	backward();
+}
+void NeuralSystem::backward() {
+	//frozen layers are never updated, so nothing needs their gradients
+	for (size_t l = layers.size(); l > trunk; l--) {
+		layers[l - 1]->backward();
 	}
 }
 std::vector<Tensor> NeuralSystem::mergeOutputs() {
@@ -112,7 +181,7 @@ std::vector<Tensor> NeuralSystem::mergeOutputs() {
 	}
 	return merged;
 }
-std::vector<Tensor> NeuralSystem::forward(const std::vector<Tensor> &in_data) {
+size_t NeuralSystem::setInputData(const std::vector<Tensor> &in_data) {
 	size_t input_data_channel_count = in_data[0].size();
 	if (input_data_channel_count != inputLayers.size()) {
 		throw std::runtime_error("input size mismatch");
@@ -123,16 +192,116 @@ std::vector<Tensor> NeuralSystem::forward(const std::vector<Tensor> &in_data) {
 	for (size_t channel_index = 0; channel_index < input_data_channel_count; channel_index++) {
 		inputLayers[channel_index]->setInputData({reordered_data[channel_index]});
 	}
+	return in_data.size();
+}
+std::vector<Tensor> NeuralSystem::forward(const std::vector<Tensor> &in_data) {
+	bindAliases(setInputData(in_data));
 	for (auto l : layers) {
 		l->forward();
 	}
 	return mergeOutputs();
 }
+size_t NeuralSystem::getFrozenTrunkSize() const {
+	size_t count = 0;
+	bool frozen = false;
+	for (const NeuralLayerPtr& layer : layers) {
+		bool weighted = false;
+		for (int c = 0; c < layer->inputChannels; c++) {
+			SignalPtr sig = layer->getInput(c);
+			weighted |= (sig.get() != nullptr && isTrainableWeight(sig->type));
+		}
+		if (weighted && layer->isTrainable()) {
+			break;
+		}
+		if (std::find(outputLayers.begin(), outputLayers.end(), layer)
+				!= outputLayers.end()) {
+			break;
+		}
+		frozen |= weighted;
+		count++;
+	}
+	return frozen ? count : 0;
+}
+std::vector<SignalPtr> NeuralSystem::getTrunkOutputs(size_t count) const {
+	std::unordered_map<const NeuralLayer*, size_t> order;
+	for (size_t i = 0; i < layers.size(); i++) {
+		order[layers[i].get()] = i;
+	}
+	std::vector<SignalPtr> outputs;
+	for (size_t i = count; i < layers.size(); i++) {
+		const NeuralLayerPtr& layer = layers[i];
+		if (std::find(inputLayers.begin(), inputLayers.end(), layer)
+				!= inputLayers.end()) {
+			throw std::runtime_error(
+					MakeString() << "Input layer " << layer->getName()
+							<< " comes after the trunk.");
+		}
+		for (int c = 0; c < layer->inputChannels; c++) {
+			SignalPtr sig = layer->getInput(c);
+			if (sig.get() == nullptr || isTrainableWeight(sig->type)
+					|| sig->input == nullptr) {
+				continue;
+			}
+			auto pos = order.find(sig->input);
+			if (pos != order.end() && pos->second < count
+					&& std::find(outputs.begin(), outputs.end(), sig)
+							== outputs.end()) {
+				outputs.push_back(sig);
+			}
+		}
+	}
+	return outputs;
+}
+void NeuralSystem::setTrunk(size_t count) {
+	if (count > getFrozenTrunkSize()) {
+		throw std::runtime_error(
+				MakeString() << "Only the first " << getFrozenTrunkSize()
+						<< " layers of " << name << " are frozen.");
+	}
+	trunkOutputs = getTrunkOutputs(count);
+	trunk = count;
+}
+void NeuralSystem::forwardTrunk(const std::vector<Tensor> &in_data) {
+	bindAliases(setInputData(in_data));
+	for (size_t l = 0; l < trunk; l++) {
+		layers[l]->forward();
+	}
+}
+void NeuralSystem::bindTrunkOutputs(size_t sample_count) {
+	bindAliases(sample_count);
+	for (SignalPtr sig : trunkOutputs) {
+		//views of a concat output already have their size
+		if (!sig->isAlias()) {
+			size_t count = sig->dimensions.volume();
+			sig->value.resize(sample_count);
+			sig->change.resize(sample_count);
+			for (size_t s = 0; s < sample_count; s++) {
+				sig->value[s].resize(count);
+				sig->change[s].resize(count);
+			}
+		}
+		//the trunk would have cleared them in forward()
+		sig->clearGradients();
+	}
+}
+std::vector<Tensor> NeuralSystem::forwardHead() {
+	for (size_t l = trunk; l < layers.size(); l++) {
+		layers[l]->forward();
+	}
+	return mergeOutputs();
+}
 void NeuralSystem::evaluate() {
+	if (inputLayers.size() > 0) {
+		bindAliases(inputLayers.front()->getInput(0)->value.size());
+	}
 	for (auto l : layers) {
 		l->forward();
 	}
 }
+std::vector<TuneResult> NeuralSystem::tune(const std::vector<Tensor> &in,
+		const TuneOptions& options) {
+	return NeuralTuner::tune(*this, in, options);
+}
 size_t NeuralSystem::getInputDataSize() const {
 	return layers.front()->getInputDataSize();
 }
@@ -242,6 +411,16 @@ float NeuralSystem::getLoss(const NeuralLossFunction& loss,
 	return sum_loss;
 }
 
+float NeuralSystem::getLoss(const NeuralLossFunction& loss,
+		const std::vector<Tensor> &in, const std::vector<int> &labels) {
+	assert(in.size() == labels.size());
+	float sum_loss = float(0);
+	for (size_t i = 0; i < in.size(); i++) {
+		const Tensor predicted = predict(in[i]);
+		sum_loss += loss.fSparse(predicted[0], labels[i]);
+	}
+	return sum_loss;
+}
 Storage NeuralSystem::fprop(const Storage &in) {
 	// a workaround to reduce memory consumption by skipping wrapper
 	// function
@@ -318,11 +497,64 @@ void NeuralSystem::bprop(const NeuralLossFunction& loss,
 	bprop(loss, std::vector<Tensor> { out }, std::vector<Tensor> { t },
 			std::vector<Tensor> { t_cost });
 }
+// output signal whose change buffer receives the loss gradient
+static SignalPtr GetDataOutput(const NeuralLayerPtr& layer) {
+	std::vector<ChannelType> types = layer->getOutputTypes();
+	for (size_t i = 0; i < types.size(); i++) {
+		if (types[i] == ChannelType::data) {
+			return layer->getOutput(i);
+		}
+	}
+	throw std::runtime_error(
+			MakeString() << "Layer " << layer->getName()
+					<< " has no data output.");
+}
 void NeuralSystem::bprop(const NeuralLossFunction& loss,
 		const std::vector<Tensor> &out, const std::vector<Tensor> &t,
 		const std::vector<Tensor> &t_cost) {
-	std::vector<Tensor> delta = loss.gradient(out, t, t_cost);
-	backward(delta);
+	const size_t sample_count = out.size();
+	const size_t output_channel_count = outputLayers.size();
+	if (sample_count == 0 || out[0].size() != output_channel_count
+			|| t.size() != sample_count) {
+		throw std::runtime_error("input size mismatch");
+	}
+	// write gradients straight into the output change buffers
+	std::vector<Tensor*> changes(output_channel_count);
+	bool parallel = false;
+	for (size_t c = 0; c < output_channel_count; c++) {
+		changes[c] = &GetDataOutput(outputLayers[c])->change;
+		changes[c]->resize(sample_count);
+		parallel |= outputLayers[c]->isParallel();
+	}
+	tiny_dnn::for_i(parallel, sample_count, [&](size_t sample) {
+		for (size_t c = 0; c < output_channel_count; c++) {
+			Storage& d = (*changes[c])[sample];
+			d.resize(out[sample][c].size());
+			loss.dfInPlace(out[sample][c], t[sample][c], d);
+			if (sample < t_cost.size() && c < t_cost[sample].size()) {
+				const Storage& cost = t_cost[sample][c];
+				if (cost.size() == d.size()) {
+					for (size_t i = 0; i < d.size(); i++) {
+						d[i] *= cost[i];
+					}
+				}
+			}
+		}
+	});
+	backward();
+}
+void NeuralSystem::bprop(const NeuralLossFunction& loss, const int* labels,
+		const Storage* t_cost) {
+	if (outputLayers.size() != 1) {
+		throw std::runtime_error(
+				"Class labels require a network with a single output layer.");
+	}
+	NeuralLayerPtr layer = outputLayers.front();
+	SignalPtr output = GetDataOutput(layer);
+	output->change.resize(output->value.size());
+	loss.gradient(output->value, labels, t_cost, output->change,
+			layer->isParallel());
+	backward();
 }
 bool NeuralSystem::gradientCheck(const NeuralLossFunction& loss,
 		const std::vector<Tensor> &in, const std::vector<std::vector<int>> &t,
@@ -378,6 +610,13 @@ bool NeuralSystem::gradientCheck(const NeuralLossFunction& loss,
 
 void NeuralSystem::build(const std::vector<NeuralLayerPtr> &input,
 		const std::vector<NeuralLayerPtr> &output) {
+	trunk = 0;
+	trunkOutputs.clear();
+	std::shared_ptr<const NeuralPlan> plan = NeuralPlan::getActive();
+	planned = (plan.get() != nullptr && buildFromPlan(*plan, input, output));
+	if (planned) {
+		return;
+	}
 	std::vector<NeuralLayerPtr> sorted;
 	std::vector<NeuralLayerPtr> input_nodes(input.begin(), input.end());
 	std::unordered_map<NeuralLayerPtr, std::vector<uint8_t>> removed_edge;
@@ -416,11 +655,127 @@ void NeuralSystem::build(const std::vector<NeuralLayerPtr> &input,
 		}
 	}
 	for (auto &n : sorted) {
+		if (n->getId() < 0) {
+			n->setId((int) layers.size());
+		}
 		layers.push_back(n);
 	}
 	inputLayers = input;
 	outputLayers = output;
 	setup(false);
+	planAliases();
+}
+static SignalPtr GetPlanSignal(const std::vector<NeuralLayerPtr>& layers,
+		const PlanSignal& ref) {
+	const NeuralLayerPtr& layer = layers[ref.layer];
+	int channel = (ref.channel >= 0) ? ref.channel : -1 - ref.channel;
+	int count = (ref.channel >= 0) ?
+			layer->outputChannels : layer->inputChannels;
+	SignalPtr sig;
+	if (channel < count) {
+		sig = (ref.channel >= 0) ?
+				layer->getOutput(channel) : layer->getInput(channel);
+	}
+	if (sig.get() == nullptr) {
+		throw std::runtime_error("Plan aliases do not match the system.");
+	}
+	return sig;
+}
+// Same as the topological sort below, with the order read from the plan. The
+// graph is only hashed, so a plan captured for another network is rejected
+// before anything changes.
+bool NeuralSystem::buildFromPlan(const NeuralPlan& plan,
+		const std::vector<NeuralLayerPtr> &input,
+		const std::vector<NeuralLayerPtr> &output) {
+	std::vector<NeuralLayerPtr> visited;
+	if (NeuralPlan::GetSignature(input, &visited) != plan.getSignature()
+			|| visited.size() != plan.getOrder().size()) {
+		return false;
+	}
+	layers.clear();
+	roots.clear();
+	for (int index : plan.getOrder()) {
+		NeuralLayerPtr curr = visited[index];
+		curr->setSystem(this);
+		if (curr->isRoot()) {
+			roots.push_back(curr);
+		}
+		if (curr->getId() < 0) {
+			curr->setId((int) layers.size());
+		}
+		layers.push_back(curr);
+	}
+	inputLayers = input;
+	outputLayers = output;
+	setup(false);
+	std::vector<std::pair<SignalPtr, SignalPtr>> restored;
+	for (const PlanAlias& alias : plan.getAliases()) {
+		restored.push_back(std::make_pair(GetPlanSignal(layers, alias.signal),
+				GetPlanSignal(layers, alias.parent)));
+	}
+	for (SignalPtr sig : aliases) {
+		sig->setAlias(nullptr, 0);
+	}
+	aliases.clear();
+	for (size_t i = 0; i < restored.size(); i++) {
+		SignalPtr sig = restored[i].first;
+		sig->setAlias(restored[i].second.get(),
+				(size_t) plan.getAliases()[i].offset);
+		aliases.push_back(sig);
+	}
+	//tuned settings only hold on the machine they were timed on
+	if (plan.getMachine() == NeuralTuner::getMachineKey()) {
+		for (size_t i = 0; i < layers.size(); i++) {
+			NeuralTuner::apply(*layers[i], plan.getTunings()[i]);
+		}
+	}
+	return true;
+}
+// Channel concat and channel slice only move memory around, so their
+// producers/consumers are planned to share one buffer instead. Concat inputs
+// become views into the concat output, and slice outputs become views into the
+// slice input. Signals that feed more than one layer keep their own storage,
+// and a slice only aliases an input it is the sole consumer of, since another
+// consumer would write its gradient into the same buffer the views share.
+void NeuralSystem::planAliases() {
+	for (SignalPtr sig : aliases) {
+		sig->setAlias(nullptr, 0);
+	}
+	aliases.clear();
+	for (NeuralLayerPtr layer : layers) {
+		if (ConcatLayer* concat = dynamic_cast<ConcatLayer*>(layer.get())) {
+			SignalPtr parent = concat->getOutput(0);
+			size_t offset = 0;
+			for (int i = 0; i < concat->inputChannels; i++) {
+				SignalPtr sig = concat->getInput(i);
+				if (sig->hasInput() && sig->outputs.size() == 1
+						&& !sig->isAlias() && sig.get() != parent.get()) {
+					sig->setAlias(parent.get(), offset);
+					aliases.push_back(sig);
+				}
+				offset += sig->dimensions.volume();
+			}
+		} else if (SliceLayer* slice = dynamic_cast<SliceLayer*>(layer.get())) {
+			if (slice->getSliceType() != SliceType::slice_channels)
+				continue;
+			SignalPtr parent = slice->getInput(0);
+			if (parent->outputs.size() != 1)
+				continue;
+			size_t area = parent->dimensions.area();
+			for (int i = 0; i < slice->outputChannels; i++) {
+				SignalPtr sig = slice->getOutput(i);
+				if (!sig->isAlias()) {
+					sig->setAlias(parent.get(), slice->getChannelOffset(i) * area);
+					aliases.push_back(sig);
+				}
+			}
+		}
+	}
+}
+void NeuralSystem::bindAliases(size_t sample_count) {
+	for (SignalPtr sig : aliases) {
+		sig->bindAlias(sample_count);
+	}
 }
 void NeuralSystem::updateWeights(NeuralOptimizer& opt, int batch_size) {
 	for (auto l : layers) {
@@ -433,13 +788,5 @@ void NeuralSystem::reset(){
 void NeuralSystem::initialize() {
 	setup(true);
 }
-void NeuralSystem::initialize(const aly::ExpandTreePtr& tree) {
-	TreeItemPtr root = TreeItemPtr(new TreeItem("Neural Layers"));
-	tree->addItem(root);
-	root->setExpanded(true);
-	for (NeuralLayerPtr n : roots) {
-		n->initialize(tree, root);
-	}
-}
 
 }
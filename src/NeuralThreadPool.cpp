@@ -0,0 +1,527 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralThreadPool.h"
+#include "NeuralNuma.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+namespace tgr {
+namespace {
+typedef std::function<void()> Task;
+struct WorkerQueue {
+	std::mutex lock;
+	std::deque<Task> tasks;
+};
+//tasks only workers pinned to one NUMA node may take
+struct NodeQueue {
+	WorkerQueue queue;
+	std::atomic<int> queued;
+	int workers;
+	NodeQueue() :
+			queued(0), workers(0) {
+	}
+};
+//index of the current thread's queue, -1 for threads outside the pool
+thread_local int WorkerIndex = -1;
+thread_local int ParallelDepth = 0;
+//set by GrainScope, 0 when not overridden
+thread_local size_t GrainOverride = 0;
+class PoolState {
+public:
+	std::mutex configLock;
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<WorkerQueue>> queues;
+	WorkerQueue injection;
+	//indexed by node id, empty unless workers are pinned on several nodes
+	std::vector<std::unique_ptr<NodeQueue>> nodeQueues;
+	std::vector<int> workerNodes;
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	std::atomic<int> queued;
+	std::atomic<int> sleeping;
+	std::atomic<bool> stopping;
+	std::atomic<bool> started;
+	std::atomic<int> threadCount;
+	std::atomic<bool> pinning;
+	std::atomic<int> nestedPolicy;
+	std::atomic<size_t> grainSize;
+	PoolState() :
+			queued(0), sleeping(0), stopping(false), started(false), threadCount(
+					0), pinning(false), nestedPolicy(
+					(int) NestedPolicy::Serial), grainSize(1) {
+		int threads = 0;
+		const char* env = std::getenv("TIGER_THREADS");
+		if (env != nullptr) {
+			threads = std::atoi(env);
+		}
+		if (threads <= 0) {
+			threads = (int) std::thread::hardware_concurrency();
+		}
+		threadCount = std::max(1, threads);
+		env = std::getenv("TIGER_PIN");
+		pinning = (env != nullptr && std::strcmp(env, "0") != 0);
+	}
+	~PoolState() {
+		stop();
+	}
+	//node whose workers should run tasks submitted by this thread, -1 for any
+	int getRouteNode() const {
+		int node = NeuralNuma::getThreadNode();
+		if (WorkerIndex >= 0 || node < 0 || node >= (int) nodeQueues.size()
+				|| nodeQueues[node]->workers == 0)
+			return -1;
+		return node;
+	}
+	int getNodeWorkers(int node) const {
+		return nodeQueues[node]->workers;
+	}
+	void push(const Task& task) {
+		int node = getRouteNode();
+		if (node >= 0) {
+			NodeQueue& nq = *nodeQueues[node];
+			{
+				std::lock_guard<std::mutex> lockMe(nq.queue.lock);
+				nq.queue.tasks.push_back(task);
+			}
+			nq.queued++;
+			//sleepers from other nodes cannot take it, so wake everyone
+			if (sleeping.load() > 0) {
+				std::lock_guard<std::mutex> lockMe(sleepLock);
+				wake.notify_all();
+			}
+			return;
+		}
+		WorkerQueue& q =
+				(WorkerIndex >= 0 && WorkerIndex < (int) queues.size()) ?
+						*queues[WorkerIndex] : injection;
+		{
+			std::lock_guard<std::mutex> lockMe(q.lock);
+			q.tasks.push_back(task);
+		}
+		queued++;
+		if (sleeping.load() > 0) {
+			std::lock_guard<std::mutex> lockMe(sleepLock);
+			wake.notify_one();
+		}
+	}
+	bool popBack(WorkerQueue& q, Task& task) {
+		std::lock_guard<std::mutex> lockMe(q.lock);
+		if (q.tasks.empty())
+			return false;
+		task = std::move(q.tasks.back());
+		q.tasks.pop_back();
+		return true;
+	}
+	bool popFront(WorkerQueue& q, Task& task) {
+		std::lock_guard<std::mutex> lockMe(q.lock);
+		if (q.tasks.empty())
+			return false;
+		task = std::move(q.tasks.front());
+		q.tasks.pop_front();
+		return true;
+	}
+	int getNode(int index) const {
+		if (index >= 0 && index < (int) workerNodes.size())
+			return workerNodes[index];
+		return (index < 0) ? getRouteNode() : -1;
+	}
+	bool hasWork(int index) const {
+		if (queued.load() > 0)
+			return true;
+		int node = getNode(index);
+		return (node >= 0 && node < (int) nodeQueues.size()
+				&& nodeQueues[node]->queued.load() > 0);
+	}
+	//own queue newest first, then tasks for this worker's node, then the
+	//injection queue, then steal the oldest task from another worker
+	bool take(int index, Task& task) {
+		int N = (int) queues.size();
+		bool own = (index >= 0 && index < N);
+		if (own && queued.load() > 0 && popBack(*queues[index], task)) {
+			queued--;
+			return true;
+		}
+		int node = getNode(index);
+		if (node >= 0 && node < (int) nodeQueues.size()) {
+			NodeQueue& nq = *nodeQueues[node];
+			if (nq.queued.load() > 0 && popFront(nq.queue, task)) {
+				nq.queued--;
+				return true;
+			}
+		}
+		if (queued.load() <= 0)
+			return false;
+		bool found = popFront(injection, task);
+		for (int n = 1; n <= N && !found; n++) {
+			int victim = (std::max(index, 0) + n) % N;
+			if (victim != index)
+				found = popFront(*queues[victim], task);
+		}
+		if (found)
+			queued--;
+		return found;
+	}
+	//the slot-th CPU with CPUs grouped node by node, so consecutive workers
+	//share a socket
+	static int getPinnedCpu(int slot) {
+		const std::vector<int>& cpus = NeuralNuma::getCpuOrder();
+		return cpus[slot % cpus.size()];
+	}
+	void pin(int slot) {
+#ifdef __linux__
+		int cpu = getPinnedCpu(slot);
+		if (cpu >= CPU_SETSIZE)
+			return;
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+#endif
+	}
+	void run(int index) {
+		WorkerIndex = index;
+		if (pinning)
+			pin(index + 1);
+		Task task;
+		while (!stopping) {
+			if (take(index, task)) {
+				task();
+				task = nullptr;
+				continue;
+			}
+			//spin briefly before sleeping, since loops are issued back to back
+			bool spun = false;
+			for (int n = 0; n < 64 && !spun; n++) {
+				std::this_thread::yield();
+				spun = (hasWork(index) || stopping);
+			}
+			if (spun)
+				continue;
+			std::unique_lock<std::mutex> lockMe(sleepLock);
+			sleeping++;
+			wake.wait(lockMe, [this, index] {
+				return hasWork(index) || stopping.load();
+			});
+			sleeping--;
+		}
+	}
+	void start() {
+		if (started)
+			return;
+		std::lock_guard<std::mutex> lockMe(configLock);
+		if (started)
+			return;
+		int N = threadCount - 1;
+		stopping = false;
+		queues.clear();
+		for (int i = 0; i < N; i++) {
+			queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+		}
+		//pinned workers serve the NUMA node of their CPU, slot 0 is left to
+		//the submitting thread
+		workerNodes.assign(N, -1);
+		nodeQueues.clear();
+		if (pinning && NeuralNuma::getNodeCount() > 1) {
+			int maxNode = 0;
+			for (const NumaNode& node : NeuralNuma::getNodes()) {
+				maxNode = std::max(maxNode, node.id);
+			}
+			for (int n = 0; n <= maxNode; n++) {
+				nodeQueues.push_back(std::unique_ptr<NodeQueue>(new NodeQueue()));
+			}
+			for (int i = 0; i < N; i++) {
+				workerNodes[i] = NeuralNuma::getCpuNode(getPinnedCpu(i + 1));
+				nodeQueues[workerNodes[i]]->workers++;
+			}
+		}
+		for (int i = 0; i < N; i++) {
+			workers.push_back(std::thread([this, i] {
+				run(i);
+			}));
+		}
+		started = true;
+	}
+	void stop() {
+		std::lock_guard<std::mutex> lockMe(configLock);
+		if (!started)
+			return;
+		{
+			std::lock_guard<std::mutex> lockSleep(sleepLock);
+			stopping = true;
+			wake.notify_all();
+		}
+		for (std::thread& t : workers) {
+			t.join();
+		}
+		workers.clear();
+		//finish anything left behind so no task group waits forever
+		Task task;
+		for (auto& q : queues) {
+			while (popFront(*q, task)) {
+				queued--;
+				task();
+			}
+		}
+		for (auto& nq : nodeQueues) {
+			while (popFront(nq->queue, task)) {
+				nq->queued--;
+				task();
+			}
+		}
+		queues.clear();
+		nodeQueues.clear();
+		workerNodes.clear();
+		started = false;
+	}
+};
+PoolState& GetPool() {
+	static PoolState pool;
+	return pool;
+}
+/**
+ * Chunks of one parallelFor(). Chunks are claimed through an atomic counter,
+ * so helpers that start late simply find nothing left and return.
+ */
+struct ForJob {
+	size_t begin;
+	size_t end;
+	size_t chunk;
+	size_t chunks;
+	const RangeFunction* f;
+	std::atomic<size_t> next;
+	std::atomic<size_t> finished;
+	std::mutex lock;
+	std::condition_variable done;
+	std::exception_ptr error;
+	ForJob(size_t begin, size_t end, size_t chunk, size_t chunks,
+			const RangeFunction* f) :
+			begin(begin), end(end), chunk(chunk), chunks(chunks), f(f), next(
+					0), finished(0) {
+	}
+	void work() {
+		ParallelDepth++;
+		for (size_t c = next++; c < chunks; c = next++) {
+			size_t b = begin + c * chunk;
+			try {
+				(*f)(b, std::min(end, b + chunk));
+			} catch (...) {
+				std::lock_guard<std::mutex> lockMe(lock);
+				if (!error)
+					error = std::current_exception();
+			}
+			if (++finished == chunks) {
+				std::lock_guard<std::mutex> lockMe(lock);
+				done.notify_all();
+			}
+		}
+		ParallelDepth--;
+	}
+	void wait() {
+		std::unique_lock<std::mutex> lockMe(lock);
+		done.wait(lockMe, [this] {
+			return finished.load() == chunks;
+		});
+	}
+};
+}
+void NeuralThreadPool::setThreadCount(int threads) {
+	PoolState& pool = GetPool();
+	if (threads <= 0) {
+		threads = (int) std::thread::hardware_concurrency();
+	}
+	threads = std::max(1, threads);
+	if (threads == pool.threadCount)
+		return;
+	if (isInParallelRegion()) {
+		throw std::runtime_error(
+				"Cannot resize thread pool from inside a parallel region.");
+	}
+	pool.stop();
+	pool.threadCount = threads;
+}
+int NeuralThreadPool::getThreadCount() {
+	return GetPool().threadCount;
+}
+void NeuralThreadPool::setPinning(bool pin) {
+	PoolState& pool = GetPool();
+	if (pin == pool.pinning)
+		return;
+	if (isInParallelRegion()) {
+		throw std::runtime_error(
+				"Cannot change thread pinning from inside a parallel region.");
+	}
+	//workers pin themselves when they start
+	pool.stop();
+	pool.pinning = pin;
+}
+bool NeuralThreadPool::isPinning() {
+	return GetPool().pinning;
+}
+void NeuralThreadPool::setNestedPolicy(NestedPolicy policy) {
+	GetPool().nestedPolicy = (int) policy;
+}
+NestedPolicy NeuralThreadPool::getNestedPolicy() {
+	return (NestedPolicy) GetPool().nestedPolicy.load();
+}
+void NeuralThreadPool::setDefaultGrainSize(size_t grain) {
+	GetPool().grainSize = std::max((size_t) 1, grain);
+}
+size_t NeuralThreadPool::getDefaultGrainSize() {
+	return GetPool().grainSize;
+}
+GrainScope::GrainScope(size_t grainSize) :
+		previous(GrainOverride) {
+	if (grainSize != 0) {
+		GrainOverride = grainSize;
+	}
+}
+GrainScope::~GrainScope() {
+	GrainOverride = previous;
+}
+bool NeuralThreadPool::isWorkerThread() {
+	return (WorkerIndex >= 0);
+}
+bool NeuralThreadPool::isInParallelRegion() {
+	return (ParallelDepth > 0);
+}
+void NeuralThreadPool::submit(const std::function<void()>& task) {
+	PoolState& pool = GetPool();
+	pool.start();
+	pool.push(task);
+}
+bool NeuralThreadPool::runPendingTask() {
+	PoolState& pool = GetPool();
+	Task task;
+	if (!pool.take(WorkerIndex, task))
+		return false;
+	task();
+	return true;
+}
+void NeuralThreadPool::parallelFor(size_t begin, size_t end,
+		const RangeFunction& f, size_t grainSize) {
+	if (end <= begin)
+		return;
+	PoolState& pool = GetPool();
+	size_t N = end - begin;
+	size_t threads = (size_t) pool.threadCount.load();
+	bool nested = (ParallelDepth > 0
+			&& pool.nestedPolicy == (int) NestedPolicy::Serial);
+	if (GrainOverride != 0) {
+		grainSize = GrainOverride;
+	} else if (grainSize == 0) {
+		grainSize = pool.grainSize;
+	}
+	size_t chunk = std::max((size_t) 1,
+			std::min(grainSize, (N + threads - 1) / threads));
+	size_t chunks = (N + chunk - 1) / chunk;
+	if (threads <= 1 || chunks <= 1 || nested) {
+		ParallelDepth++;
+		try {
+			f(begin, end);
+		} catch (...) {
+			ParallelDepth--;
+			throw;
+		}
+		ParallelDepth--;
+		return;
+	}
+	pool.start();
+	std::shared_ptr<ForJob> job = std::make_shared<ForJob>(begin, end, chunk,
+			chunks, &f);
+	size_t helpers = std::min(threads - 1, chunks - 1);
+	//inside a NumaNodeScope only that node's workers help
+	int node = pool.getRouteNode();
+	if (node >= 0) {
+		helpers = std::min(helpers, (size_t) pool.getNodeWorkers(node));
+	}
+	for (size_t h = 0; h < helpers; h++) {
+		pool.push([job] {
+			job->work();
+		});
+	}
+	job->work();
+	job->wait();
+	if (job->error) {
+		std::rethrow_exception(job->error);
+	}
+}
+TaskGroup::TaskGroup() :
+		state(std::make_shared<State>()) {
+}
+TaskGroup::~TaskGroup() {
+	try {
+		wait();
+	} catch (...) {
+	}
+}
+void TaskGroup::run(const std::function<void()>& task) {
+	std::shared_ptr<State> s = state;
+	auto execute = [s, task] {
+		ParallelDepth++;
+		try {
+			task();
+		} catch (...) {
+			std::lock_guard<std::mutex> lockMe(s->lock);
+			if (!s->error)
+				s->error = std::current_exception();
+		}
+		ParallelDepth--;
+		if (--s->pending == 0) {
+			std::lock_guard<std::mutex> lockMe(s->lock);
+			s->done.notify_all();
+		}
+	};
+	state->pending++;
+	if (NeuralThreadPool::getThreadCount() <= 1) {
+		execute();
+	} else {
+		NeuralThreadPool::submit(execute);
+	}
+}
+void TaskGroup::wait() {
+	while (state->pending.load() > 0) {
+		if (NeuralThreadPool::runPendingTask())
+			continue;
+		//remaining tasks are running on other threads
+		std::unique_lock<std::mutex> lockMe(state->lock);
+		state->done.wait_for(lockMe, std::chrono::milliseconds(1), [this] {
+			return state->pending.load() == 0;
+		});
+	}
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lockMe(state->lock);
+		std::swap(error, state->error);
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+}
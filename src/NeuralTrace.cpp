@@ -0,0 +1,548 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralTrace.h"
+#include "NeuralSystem.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <tuple>
+namespace tgr {
+typedef std::chrono::high_resolution_clock Clock;
+static const char TraceMagic[8] = { 'T', 'I', 'G', 'E', 'R', 'T', 'R', 'C' };
+static const uint32_t TraceVersion = 1;
+static const uint32_t TraceByteOrder = 0x01020304;
+static const size_t BlockValues = 1 << 16; //values coded together
+static const uint64_t PadFlag = 1ULL << 63;
+/**
+ * Ring entry in front of the raw values of one tensor. The first word is the
+ * entry's size in words; with PadFlag set the entry is filler up to the end
+ * of the ring, so every tensor is contiguous.
+ */
+struct CaptureHeader {
+	uint64_t words;
+	int32_t iteration;
+	int32_t layerId;
+	int32_t slot;
+	int32_t channel;
+	int32_t dims[3];
+	int32_t samples;
+	uint64_t count;
+};
+static const uint64_t HeaderWords = sizeof(CaptureHeader) / sizeof(uint64_t);
+static_assert(sizeof(CaptureHeader) % sizeof(uint64_t) == 0,
+		"Capture header must be a whole number of words.");
+//frame header in a trace file
+struct TraceFrameHeader {
+	int32_t iteration;
+	int32_t layerId;
+	int32_t slot;
+	int32_t channel;
+	int32_t dims[3];
+	int32_t samples;
+	int32_t precision;
+	int32_t reserved;
+	uint64_t count;
+	uint64_t bytes;
+};
+static const size_t FrameHeaderBytes = sizeof(TraceFrameHeader);
+static_assert(FrameHeaderBytes == 56, "Unexpected trace frame header size.");
+struct TraceRecord: public TraceFrameHeader {
+	//blocks of BlockValues values, each preceded by its size in bytes
+	std::vector<uint8_t> data;
+	uint64_t getSize() const {
+		return data.size() + sizeof(TraceRecord);
+	}
+};
+std::ostream &operator<<(std::ostream &os, TraceSlot slot) {
+	switch (slot) {
+	case TraceSlot::Responses:
+		os << "responses";
+		break;
+	case TraceSlot::ResponseChanges:
+		os << "response changes";
+		break;
+	case TraceSlot::Weights:
+		os << "weights";
+		break;
+	case TraceSlot::WeightChanges:
+		os << "weight changes";
+		break;
+	}
+	return os;
+}
+static void DecodeRecord(const TraceRecord& r, TraceFrame& frame) {
+	frame.iteration = r.iteration;
+	frame.layerId = r.layerId;
+	frame.slot = static_cast<TraceSlot>(r.slot);
+	frame.channel = r.channel;
+	frame.dimensions = aly::dim3(r.dims[0], r.dims[1], r.dims[2]);
+	frame.samples = r.samples;
+	frame.values.resize(r.count);
+	const uint8_t* ptr = r.data.data();
+	const uint8_t* end = ptr + r.data.size();
+	for (uint64_t b = 0; b < r.count; b += BlockValues) {
+		uint32_t bytes;
+		if (end - ptr < (ptrdiff_t) sizeof(bytes)) {
+			throw std::runtime_error("Trace frame is corrupt.");
+		}
+		std::memcpy(&bytes, ptr, sizeof(bytes));
+		ptr += sizeof(bytes);
+		if ((uint64_t) (end - ptr) < bytes) {
+			throw std::runtime_error("Trace frame is corrupt.");
+		}
+		DecodeValues(ptr, bytes, static_cast<WeightPrecision>(r.precision),
+				frame.values.data() + b,
+				(size_t) std::min((uint64_t) BlockValues, r.count - b));
+		ptr += bytes;
+	}
+}
+NeuralTracer::NeuralTracer(const TraceOptions& options) :
+		options(options), ring(
+				std::max(options.captureBytes / sizeof(uint64_t),
+						(uint64_t) 1024)), head(0), tail(0), samples(0), dropped(
+				0), rawBytes(0), captureNanos(0), busy(false), stopping(false) {
+	worker = std::thread([this] {
+		run();
+	});
+}
+NeuralTracer::~NeuralTracer() {
+	{
+		std::lock_guard<std::mutex> lockMe(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	//the compressor drains the ring and spills what is left before it exits
+	worker.join();
+}
+bool NeuralTracer::isDue(int iteration) const {
+	return (options.interval > 0 && iteration % options.interval == 0);
+}
+bool NeuralTracer::isTraced(int layerId) const {
+	return (options.layers.size() == 0
+			|| std::find(options.layers.begin(), options.layers.end(), layerId)
+					!= options.layers.end());
+}
+bool NeuralTracer::record(const NeuralSystem& sys, int iteration) {
+	if (!isDue(iteration)) {
+		return false;
+	}
+	auto start = Clock::now();
+	struct Capture {
+		const Tensor* tensor;
+		int layerId;
+		TraceSlot slot;
+		int channel;
+		aly::dim3 dims;
+		int samples;
+		bool sum; //weight changes are accumulated per sample
+		uint64_t count;
+		uint64_t words;
+	};
+	std::vector<Capture> captures;
+	auto add = [&](const Tensor& tensor, const NeuralLayerPtr& layer,
+			TraceSlot slot, int channel, const aly::dim3& dims, bool perSample) {
+		if (tensor.size() == 0 || tensor.front().size() == 0) {
+			return;
+		}
+		Capture c;
+		c.tensor = &tensor;
+		c.layerId = layer->getId();
+		c.slot = slot;
+		c.channel = channel;
+		c.dims = dims;
+		c.samples = 1;
+		if (perSample) {
+			c.samples = (int) tensor.size();
+			if (options.maxSamples > 0) {
+				c.samples = std::min(c.samples, options.maxSamples);
+			}
+		}
+		c.sum = (slot == TraceSlot::WeightChanges);
+		c.count = (uint64_t) c.samples * tensor.front().size();
+		c.words = HeaderWords + (c.count + 1) / 2;
+		captures.push_back(c);
+	};
+	for (const NeuralLayerPtr& layer : sys) {
+		if (!isTraced(layer->getId())) {
+			continue;
+		}
+		for (int c = 0; c < layer->outputChannels; c++) {
+			SignalPtr sig = layer->getOutput(c);
+			if (sig.get() == nullptr || sig->type != ChannelType::data) {
+				continue;
+			}
+			if (options.responses) {
+				add(sig->value, layer, TraceSlot::Responses, c, sig->dimensions, true);
+			}
+			if (options.responseChanges) {
+				add(sig->change, layer, TraceSlot::ResponseChanges, c,
+						sig->dimensions, true);
+			}
+		}
+		for (int c = 0; c < layer->inputChannels; c++) {
+			SignalPtr sig = layer->getInput(c);
+			if (sig.get() == nullptr || !isTrainableWeight(sig->type)) {
+				continue;
+			}
+			if (options.weights) {
+				add(sig->value, layer, TraceSlot::Weights, c, sig->dimensions, false);
+			}
+			if (options.weightChanges) {
+				add(sig->change, layer, TraceSlot::WeightChanges, c,
+						sig->dimensions, false);
+			}
+		}
+	}
+	//a sample goes in whole or not at all
+	const uint64_t capacity = ring.size();
+	const uint64_t begin = head.load(std::memory_order_relaxed);
+	uint64_t pos = begin;
+	for (const Capture& c : captures) {
+		uint64_t offset = pos % capacity;
+		if (c.words > capacity) {
+			pos = std::numeric_limits<uint64_t>::max() / 2;
+			break;
+		}
+		if (offset + c.words > capacity) {
+			pos += capacity - offset;
+		}
+		pos += c.words;
+	}
+	if (pos - tail.load(std::memory_order_acquire) > capacity) {
+		dropped++;
+		return false;
+	}
+	pos = begin;
+	uint64_t bytes = 0;
+	for (const Capture& c : captures) {
+		uint64_t offset = pos % capacity;
+		if (offset + c.words > capacity) {
+			ring[offset] = PadFlag | (capacity - offset);
+			pos += capacity - offset;
+			offset = 0;
+		}
+		CaptureHeader h;
+		h.words = c.words;
+		h.iteration = iteration;
+		h.layerId = c.layerId;
+		h.slot = static_cast<int32_t>(c.slot);
+		h.channel = c.channel;
+		h.dims[0] = c.dims.x;
+		h.dims[1] = c.dims.y;
+		h.dims[2] = c.dims.z;
+		h.samples = c.samples;
+		h.count = c.count;
+		std::memcpy(&ring[offset], &h, sizeof(h));
+		float* dst = reinterpret_cast<float*>(&ring[offset + HeaderWords]);
+		const Tensor& tensor = *c.tensor;
+		size_t n = tensor.front().size();
+		if (c.sum) {
+			std::fill(dst, dst + n, 0.0f);
+			for (const Storage& s : tensor) {
+				size_t m = std::min(n, s.size());
+				for (size_t i = 0; i < m; i++) {
+					dst[i] += s[i];
+				}
+			}
+		} else {
+			for (int s = 0; s < c.samples; s++) {
+				size_t m = std::min(n, tensor[s].size());
+				std::memcpy(dst + s * n, tensor[s].data(), m * sizeof(float));
+				std::fill(dst + s * n + m, dst + (s + 1) * n, 0.0f);
+			}
+		}
+		pos += c.words;
+		bytes += c.count * sizeof(float);
+	}
+	head.store(pos, std::memory_order_release);
+	//not under the lock, so the compressor also polls in case this is missed
+	wake.notify_one();
+	samples++;
+	rawBytes += bytes;
+	captureNanos += (uint64_t) std::chrono::duration_cast<
+			std::chrono::nanoseconds>(Clock::now() - start).count();
+	return true;
+}
+void NeuralTracer::run() {
+	const uint64_t capacity = ring.size();
+	std::vector<uint8_t> block;
+	std::unique_lock<std::mutex> lockMe(lock);
+	while (true) {
+		uint64_t t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire)) {
+			busy = false;
+			drained.notify_all();
+			if (stopping) {
+				break;
+			}
+			wake.wait_for(lockMe, std::chrono::milliseconds(10));
+			continue;
+		}
+		busy = true;
+		lockMe.unlock();
+		uint64_t offset = t % capacity;
+		if (ring[offset] & PadFlag) {
+			tail.store(t + (ring[offset] & ~PadFlag), std::memory_order_release);
+			lockMe.lock();
+			continue;
+		}
+		auto start = Clock::now();
+		CaptureHeader h;
+		std::memcpy(&h, &ring[offset], sizeof(h));
+		std::shared_ptr<TraceRecord> record(new TraceRecord());
+		record->iteration = h.iteration;
+		record->layerId = h.layerId;
+		record->slot = h.slot;
+		record->channel = h.channel;
+		std::memcpy(record->dims, h.dims, sizeof(h.dims));
+		record->samples = h.samples;
+		record->precision = static_cast<int32_t>(options.precision);
+		record->reserved = 0;
+		record->count = h.count;
+		const float* values = reinterpret_cast<const float*>(&ring[offset
+				+ HeaderWords]);
+		for (uint64_t b = 0; b < h.count; b += BlockValues) {
+			size_t n = (size_t) std::min((uint64_t) BlockValues, h.count - b);
+			EncodeValues(values + b, n, options.precision, true, block);
+			uint32_t bytes = (uint32_t) block.size();
+			const uint8_t* size = reinterpret_cast<const uint8_t*>(&bytes);
+			record->data.insert(record->data.end(), size, size + sizeof(bytes));
+			record->data.insert(record->data.end(), block.begin(), block.end());
+		}
+		record->bytes = record->data.size();
+		//the slot is only handed back once its values are coded
+		tail.store(t + h.words, std::memory_order_release);
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		lockMe.lock();
+		stats.frames++;
+		stats.compressedBytes += record->bytes;
+		stats.compressTime += seconds;
+		stats.residentBytes += record->getSize();
+		resident.push_back(record);
+		std::vector<std::shared_ptr<TraceRecord>> expired;
+		while (stats.residentBytes > options.memoryBytes && resident.size() > 0) {
+			stats.residentBytes -= resident.front()->getSize();
+			expired.push_back(resident.front());
+			resident.pop_front();
+		}
+		if (expired.size() > 0) {
+			lockMe.unlock();
+			spill(expired);
+			lockMe.lock();
+		}
+	}
+	if (options.file.size() > 0 && resident.size() > 0) {
+		std::vector<std::shared_ptr<TraceRecord>> remaining(resident.begin(),
+				resident.end());
+		resident.clear();
+		stats.residentBytes = 0;
+		lockMe.unlock();
+		spill(remaining);
+		lockMe.lock();
+	}
+}
+void NeuralTracer::spill(
+		const std::vector<std::shared_ptr<TraceRecord>>& records) {
+	bool ok = (options.file.size() > 0);
+	if (ok && !spillFile.is_open()) {
+		spillFile.open(options.file, std::ios::binary | std::ios::trunc);
+		spillFile.write(TraceMagic, sizeof(TraceMagic));
+		spillFile.write(reinterpret_cast<const char*>(&TraceVersion),
+				sizeof(TraceVersion));
+		spillFile.write(reinterpret_cast<const char*>(&TraceByteOrder),
+				sizeof(TraceByteOrder));
+	}
+	if (ok) {
+		for (const std::shared_ptr<TraceRecord>& r : records) {
+			const TraceFrameHeader& header = *r;
+			spillFile.write(reinterpret_cast<const char*>(&header),
+					FrameHeaderBytes);
+			spillFile.write(reinterpret_cast<const char*>(r->data.data()),
+					r->data.size());
+		}
+		spillFile.flush();
+		ok = spillFile.good();
+		if (!ok) {
+			std::cerr << "Could not write trace " << options.file << std::endl;
+		}
+	}
+	std::lock_guard<std::mutex> lockMe(lock);
+	(ok ? stats.spilled : stats.discarded) += records.size();
+}
+void NeuralTracer::flush() {
+	std::unique_lock<std::mutex> lockMe(lock);
+	wake.notify_all();
+	drained.wait(lockMe, [this] {
+		return !busy && tail.load() == head.load();
+	});
+}
+std::vector<TraceFrame> NeuralTracer::getFrames(int layerId) const {
+	std::vector<std::shared_ptr<TraceRecord>> records;
+	{
+		std::lock_guard<std::mutex> lockMe(lock);
+		for (const std::shared_ptr<TraceRecord>& r : resident) {
+			if (layerId < 0 || r->layerId == layerId) {
+				records.push_back(r);
+			}
+		}
+	}
+	std::vector<TraceFrame> frames(records.size());
+	for (size_t i = 0; i < records.size(); i++) {
+		DecodeRecord(*records[i], frames[i]);
+	}
+	return frames;
+}
+TraceStats NeuralTracer::getStats() const {
+	TraceStats s;
+	{
+		std::lock_guard<std::mutex> lockMe(lock);
+		s = stats;
+	}
+	s.samples = samples.load();
+	s.dropped = dropped.load();
+	s.rawBytes = rawBytes.load();
+	s.captureTime = 1E-9 * captureNanos.load();
+	return s;
+}
+void NeuralTracer::printStats(std::ostream& out) const {
+	TraceStats s = getStats();
+	double ratio = (s.compressedBytes > 0) ?
+			(double) s.rawBytes / s.compressedBytes : 0.0;
+	out << "Trace: " << s.samples << " samples, " << s.dropped << " dropped, "
+			<< s.frames << " frames, " << (s.rawBytes >> 20) << " MB raw, "
+			<< ratio << "x compressed, " << s.spilled << " spilled, "
+			<< s.discarded << " discarded, capture "
+			<< 1000.0 * s.captureTime / std::max(s.samples, (uint64_t) 1)
+			<< " ms each" << std::endl;
+}
+std::vector<TraceFrame> ReadNeuralTraceFromFile(const std::string& file,
+		int layerId) {
+	std::ifstream in(file, std::ios::binary);
+	if (!in.is_open()) {
+		throw std::runtime_error("Could not open trace " + file);
+	}
+	char magic[sizeof(TraceMagic)];
+	uint32_t version = 0, byteOrder = 0;
+	in.read(magic, sizeof(magic));
+	in.read(reinterpret_cast<char*>(&version), sizeof(version));
+	in.read(reinterpret_cast<char*>(&byteOrder), sizeof(byteOrder));
+	if (!in.good() || std::memcmp(magic, TraceMagic, sizeof(magic)) != 0
+			|| version != TraceVersion || byteOrder != TraceByteOrder) {
+		throw std::runtime_error("Invalid trace " + file);
+	}
+	std::vector<TraceFrame> frames;
+	TraceRecord r;
+	//a frame cut short by a run that is still writing ends the list
+	while (in.read(reinterpret_cast<char*>(static_cast<TraceFrameHeader*>(&r)),
+			FrameHeaderBytes)) {
+		if (r.precision < 0
+				|| r.precision > static_cast<int32_t>(WeightPrecision::Int8)
+				|| r.count > ((uint64_t) 1 << 40) || r.bytes > ((uint64_t) 1 << 40)) {
+			throw std::runtime_error("Invalid trace " + file);
+		}
+		if (layerId >= 0 && r.layerId != layerId) {
+			in.seekg((std::streamoff) r.bytes, std::ios::cur);
+			continue;
+		}
+		r.data.resize((size_t) r.bytes);
+		if (!in.read(reinterpret_cast<char*>(r.data.data()), r.data.size())) {
+			break;
+		}
+		frames.push_back(TraceFrame());
+		DecodeRecord(r, frames.back());
+	}
+	return frames;
+}
+std::vector<TraceUnitStats> GetTraceUnitStats(
+		const std::vector<TraceFrame>& frames, float saturation) {
+	struct Units {
+		TraceUnitStats stats;
+		std::vector<uint8_t> alive; //nonzero in some sample
+		std::vector<uint8_t> unsaturated; //below the threshold in some sample
+		double sumAbs = 0.0;
+		uint64_t count = 0;
+	};
+	std::map<std::tuple<int, int, int>, Units> groups;
+	for (const TraceFrame& f : frames) {
+		size_t units = (size_t) f.dimensions.x * f.dimensions.y * f.dimensions.z;
+		if (units == 0 || f.values.size() < units * f.samples) {
+			continue;
+		}
+		Units& g = groups[std::make_tuple(f.layerId, (int) f.slot, f.channel)];
+		if (g.alive.size() == 0) {
+			g.stats.layerId = f.layerId;
+			g.stats.slot = f.slot;
+			g.stats.channel = f.channel;
+			g.stats.frames = 0;
+			g.stats.units = (int) units;
+			g.alive.assign(units, 0);
+			g.unsaturated.assign(units, 0);
+		} else if (g.alive.size() != units) {
+			continue;
+		}
+		g.stats.frames++;
+		for (int s = 0; s < f.samples; s++) {
+			const float* v = f.values.data() + s * units;
+			for (size_t u = 0; u < units; u++) {
+				float a = std::abs(v[u]);
+				g.alive[u] |= (a > 0.0f);
+				g.unsaturated[u] |= (a < saturation);
+				g.sumAbs += a;
+			}
+			g.count += units;
+		}
+	}
+	std::vector<TraceUnitStats> result;
+	for (auto& pr : groups) {
+		Units& g = pr.second;
+		g.stats.deadUnits = (int) std::count(g.alive.begin(), g.alive.end(), 0);
+		g.stats.saturatedUnits = (int) std::count(g.unsaturated.begin(),
+				g.unsaturated.end(), 0);
+		g.stats.meanAbs = g.sumAbs / std::max(g.count, (uint64_t) 1);
+		result.push_back(g.stats);
+	}
+	return result;
+}
+void PrintTraceUnitStats(std::ostream& out,
+		const std::vector<TraceUnitStats>& stats) {
+	out << std::left << std::setw(8) << "Layer" << std::setw(18) << "Slot"
+			<< std::right << std::setw(8) << "Channel" << std::setw(8)
+			<< "Frames" << std::setw(10) << "Units" << std::setw(10) << "Dead(%)"
+			<< std::setw(10) << "Sat(%)" << std::setw(12) << "Mean|v|"
+			<< std::endl;
+	out << std::fixed << std::setprecision(3);
+	for (const TraceUnitStats& s : stats) {
+		std::stringstream slot;
+		slot << s.slot;
+		out << std::left << std::setw(8) << s.layerId << std::setw(18)
+				<< slot.str() << std::right << std::setw(8) << s.channel
+				<< std::setw(8) << s.frames << std::setw(10) << s.units
+				<< std::setw(10) << 100.0 * s.deadUnits / std::max(s.units, 1)
+				<< std::setw(10) << 100.0 * s.saturatedUnits / std::max(s.units, 1)
+				<< std::setw(12) << s.meanAbs << std::endl;
+	}
+	out.unsetf(std::ios_base::floatfield);
+}
+}
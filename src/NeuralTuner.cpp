@@ -0,0 +1,322 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralTuner.h"
+#include "NeuralKernels.h"
+#include "NeuralSystem.h"
+#include "NeuralThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <typeinfo>
+namespace tgr {
+typedef std::chrono::high_resolution_clock Clock;
+static const char* CacheHeader = "# tiger tuning cache v1";
+//grain sizes tried for parallel execution, 0 keeps the kernels' own
+static const size_t GrainSizes[] = { 0, 1, 4, 16 };
+//upper bound on timed calls per candidate, for layers that take microseconds
+static const int MaxIterations = 1000;
+static bool SameTuning(const LayerTuning& a, const LayerTuning& b) {
+	return (a.backend == b.backend && a.parallelize == b.parallelize
+			&& a.grainSize == b.grainSize);
+}
+static std::vector<LayerTuning> GetCandidates(const NeuralLayer& layer,
+		const TuneOptions& options) {
+	LayerTuning current;
+	current.backend = layer.getBackendType();
+	current.parallelize = layer.isParallel();
+	current.grainSize = layer.getGrainSize();
+	//the current settings come first and serve as the baseline
+	std::vector<LayerTuning> candidates = { current };
+	std::vector<BackendType> backends = { current.backend };
+	for (BackendType b : { BackendType::internal, BackendType::avx,
+#ifdef CNN_USE_NNPACK
+			BackendType::nnpack,
+#endif
+	}) {
+		if (std::find(backends.begin(), backends.end(), b) == backends.end()) {
+			backends.push_back(b);
+		}
+	}
+	auto add = [&](const LayerTuning& t) {
+		for (const LayerTuning& c : candidates) {
+			if (SameTuning(c, t))
+				return;
+		}
+		candidates.push_back(t);
+	};
+	for (BackendType b : backends) {
+		LayerTuning t;
+		t.backend = b;
+		t.parallelize = false;
+		add(t);
+		if (options.parallelize) {
+			t.parallelize = true;
+			for (size_t grain : GrainSizes) {
+				t.grainSize = grain;
+				add(t);
+			}
+		}
+	}
+	return candidates;
+}
+static void RunLayer(NeuralLayer& layer, bool backward) {
+	layer.forward();
+	if (backward) {
+		layer.backward();
+	}
+}
+//fastest call in milliseconds
+static double TimeLayer(NeuralLayer& layer, const TuneOptions& options) {
+	//one untimed call warms the caches and lets the kernels allocate
+	RunLayer(layer, options.backward);
+	double best = std::numeric_limits<double>::max();
+	int iterations = 0;
+	auto start = Clock::now();
+	double elapsed = 0.0;
+	while (iterations < MaxIterations
+			&& (iterations < options.minIterations || elapsed < options.minTime)) {
+		auto t0 = Clock::now();
+		RunLayer(layer, options.backward);
+		auto t1 = Clock::now();
+		best = std::min(best,
+				std::chrono::duration<double, std::milli>(t1 - t0).count());
+		elapsed = std::chrono::duration<double>(t1 - start).count();
+		iterations++;
+	}
+	return best;
+}
+std::string NeuralTuner::getSignature(const NeuralLayer& layer, int batchSize,
+		bool backward) {
+	std::stringstream ss;
+	ss << typeid(layer).name() << "|in";
+	for (const aly::dim3& d : layer.getInputDimensions()) {
+		ss << " " << d.x << "x" << d.y << "x" << d.z;
+	}
+	ss << "|out";
+	for (const aly::dim3& d : layer.getOutputDimensions()) {
+		ss << " " << d.x << "x" << d.y << "x" << d.z;
+	}
+	ss << "|macs " << layer.getMultiplyAdds() << "|batch " << batchSize << "|"
+			<< (backward ? "train" : "inference");
+	return ss.str();
+}
+std::string NeuralTuner::getMachineKey() {
+	const CpuFeatures& cpu = NeuralKernels::getCpuFeatures();
+	std::stringstream ss;
+	if (cpu.brand.size() > 0) {
+		ss << cpu.brand;
+	} else if (cpu.vendor.size() > 0) {
+		ss << cpu.vendor;
+	} else {
+		ss << "unknown";
+	}
+	ss << "|" << NeuralKernels::getIsa() << "|"
+			<< NeuralThreadPool::getThreadCount() << " threads";
+	return ss.str();
+}
+void NeuralTuner::apply(NeuralLayer& layer, const LayerTuning& tuning) {
+	layer.setBackendType(tuning.backend);
+	layer.setParallelize(tuning.parallelize);
+	layer.setGrainSize(tuning.grainSize);
+}
+std::map<std::string, LayerTuning> NeuralTuner::readCache(
+		const std::string& file) {
+	std::map<std::string, LayerTuning> entries;
+	std::ifstream in(file);
+	if (!in.is_open()) {
+		return entries;
+	}
+	std::string line;
+	if (!std::getline(in, line) || line != CacheHeader) {
+		//older or foreign format, start over
+		return entries;
+	}
+	while (std::getline(in, line)) {
+		if (line.size() == 0 || line[0] == '#')
+			continue;
+		//key <tab> backend <tab> parallel <tab> grain <tab> time
+		std::vector<std::string> fields;
+		std::stringstream ss(line);
+		std::string field;
+		while (std::getline(ss, field, '\t')) {
+			fields.push_back(field);
+		}
+		if (fields.size() != 5)
+			continue;
+		LayerTuning t;
+		t.backend = (BackendType) std::atoi(fields[1].c_str());
+		t.parallelize = (std::atoi(fields[2].c_str()) != 0);
+		t.grainSize = (size_t) std::strtoull(fields[3].c_str(), nullptr, 10);
+		t.time = std::atof(fields[4].c_str());
+		entries[fields[0]] = t;
+	}
+	return entries;
+}
+void NeuralTuner::writeCache(const std::string& file,
+		const std::map<std::string, LayerTuning>& entries) {
+	//write a temporary file and rename it, so concurrent readers never see
+	//a partial cache
+	std::string tmpFile = file + ".tmp";
+	{
+		std::ofstream out(tmpFile);
+		if (!out.is_open()) {
+			throw std::runtime_error("Could not write tuning cache " + tmpFile);
+		}
+		out << CacheHeader << "\n";
+		for (const auto& pr : entries) {
+			const LayerTuning& t = pr.second;
+			out << pr.first << "\t" << (int) t.backend << "\t"
+					<< (t.parallelize ? 1 : 0) << "\t" << t.grainSize << "\t"
+					<< t.time << "\n";
+		}
+		if (!out.good()) {
+			throw std::runtime_error("Could not write tuning cache " + tmpFile);
+		}
+	}
+	if (std::rename(tmpFile.c_str(), file.c_str()) != 0) {
+		std::remove(tmpFile.c_str());
+		throw std::runtime_error("Could not write tuning cache " + file);
+	}
+}
+std::vector<TuneResult> NeuralTuner::tune(NeuralSystem& sys,
+		const std::vector<Tensor>& input, const TuneOptions& options) {
+	std::vector<TuneResult> results;
+	if (input.size() == 0) {
+		throw std::runtime_error("Tuning needs at least one input sample.");
+	}
+	std::map<std::string, LayerTuning> cache;
+	if (options.cacheFile.size() > 0) {
+		cache = readCache(options.cacheFile);
+	}
+	const int batchSize = (int) input.size();
+	const std::string machine = getMachineKey();
+	bool dirty = false;
+	bool evaluated = false;
+	for (NeuralLayerPtr layer : sys) {
+		TuneResult result;
+		result.layerId = layer->getId();
+		result.name = layer->getName();
+		result.signature = getSignature(*layer, batchSize, options.backward);
+		result.cached = false;
+		std::string key = machine + "|" + result.signature;
+		auto hit = cache.find(key);
+		if (hit != cache.end() && !options.retune) {
+			apply(*layer, hit->second);
+			result.tuning = hit->second;
+			result.baseline = hit->second.time;
+			result.cached = true;
+			results.push_back(result);
+			continue;
+		}
+		if (!evaluated) {
+			//layers are timed in place, so every signal needs its batch shape
+			sys.forward(input);
+			if (options.backward) {
+				sys.backward();
+			}
+			evaluated = true;
+		}
+		std::vector<LayerTuning> candidates = GetCandidates(*layer, options);
+		LayerTuning best = candidates.front();
+		double bestTime = std::numeric_limits<double>::max();
+		double baseline = -1.0;
+		for (size_t c = 0; c < candidates.size(); c++) {
+			apply(*layer, candidates[c]);
+			double t;
+			try {
+				t = TimeLayer(*layer, options);
+			} catch (std::exception&) {
+				//backend not available for this layer
+				continue;
+			}
+			if (c == 0) {
+				baseline = t;
+			}
+			if (t < bestTime) {
+				bestTime = t;
+				best = candidates[c];
+			}
+		}
+		//backends that share kernels time the same, so only switch when the
+		//gain is larger than the noise
+		if (baseline >= 0.0 && bestTime > baseline * (1.0 - options.threshold)) {
+			best = candidates.front();
+			bestTime = baseline;
+		}
+		if (bestTime == std::numeric_limits<double>::max()) {
+			bestTime = 0.0;
+		}
+		best.time = bestTime;
+		apply(*layer, best);
+		result.tuning = best;
+		result.baseline = (baseline >= 0.0) ? baseline : bestTime;
+		results.push_back(result);
+		cache[key] = best;
+		dirty = true;
+	}
+	if (evaluated) {
+		sys.clearGradients();
+	}
+	if (dirty && options.cacheFile.size() > 0) {
+		writeCache(options.cacheFile, cache);
+	}
+	return results;
+}
+static std::string LayerLabel(const std::string& name, int id) {
+	std::stringstream ss;
+	ss << name.substr(0, 24) << " [" << id << "]";
+	return ss.str();
+}
+void NeuralTuner::print(std::ostream& out,
+		const std::vector<TuneResult>& results) {
+	out << "Tuning for " << getMachineKey() << std::endl;
+	out << std::left << std::setw(32) << "Layer" << std::setw(10) << "Backend"
+			<< std::setw(14) << "Mode" << std::right << std::setw(10)
+			<< "Time(ms)" << std::setw(10) << "Base(ms)" << std::setw(10)
+			<< "Speedup" << std::setw(8) << "Source" << std::endl;
+	out << std::fixed << std::setprecision(3);
+	for (const TuneResult& r : results) {
+		std::stringstream backend, mode;
+		backend << r.tuning.backend;
+		if (r.tuning.parallelize) {
+			mode << "parallel";
+			if (r.tuning.grainSize > 0) {
+				mode << " g" << r.tuning.grainSize;
+			}
+		} else {
+			mode << "serial";
+		}
+		double speedup =
+				(r.tuning.time > 0.0) ? r.baseline / r.tuning.time : 1.0;
+		out << std::left << std::setw(32) << LayerLabel(r.name, r.layerId)
+				<< std::setw(10) << backend.str() << std::setw(14)
+				<< mode.str() << std::right << std::setw(10) << r.tuning.time
+				<< std::setw(10) << r.baseline << std::setw(10) << speedup
+				<< std::setw(8) << (r.cached ? "cache" : "tuned") << std::endl;
+	}
+	out.unsetf(std::ios_base::floatfield);
+}
+}
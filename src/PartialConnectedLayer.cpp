@@ -7,118 +7,290 @@
 
 #include "PartialConnectedLayer.h"
 #include "tiny_dnn/util/util.h"
+#include "NeuralKernels.h"
+#include "NeuralPlan.h"
 namespace tgr {
+// rows handled by one task, and samples that share one decode of the indices
+static const int SPARSE_ROW_BLOCK = 64;
+static const int SPARSE_SAMPLE_TILE = 4;
+
+static int BitWidth(int range) {
+	int bits = 0;
+	while (bits < 32 && (int64_t(1) << bits) < range)
+		bits++;
+	return bits;
+}
+void PackedConnectionTable::build(int rows, int first_range, int second_range,
+		const std::vector<std::array<int, 3>>& coo) {
+	shift = BitWidth(second_range);
+	if (shift + BitWidth(first_range) > 32) {
+		throw std::runtime_error(
+				"Connection table ids do not fit in a packed 32-bit index.");
+	}
+	mask = (shift >= 32) ? 0xFFFFFFFFu : ((uint32_t(1) << shift) - 1);
+	// counting sort by row
+	offsets.assign(rows + 1, 0);
+	for (const std::array<int, 3>& c : coo) {
+		offsets[c[0] + 1]++;
+	}
+	for (int r = 0; r < rows; r++) {
+		offsets[r + 1] += offsets[r];
+	}
+	packed.resize(coo.size());
+	std::vector<int> cursor(offsets.begin(), offsets.end() - 1);
+	for (const std::array<int, 3>& c : coo) {
+		packed[cursor[c[0]]++] = (uint32_t(c[1]) << shift) | uint32_t(c[2]);
+	}
+}
+void PackedConnectionTable::write(PlanTable& table) const {
+	table.add(offsets);
+	table.add(std::vector<int>(packed.begin(), packed.end()));
+	table.add(std::vector<int> { shift, static_cast<int>(mask) });
+}
+void PackedConnectionTable::read(const PlanTable& table, size_t& index,
+		int rows, int first_range, int second_range) {
+	const std::vector<int>& rowOffsets = table.next(index);
+	const std::vector<int>& entries = table.next(index);
+	const std::vector<int>& params = table.next(index);
+	int bits = BitWidth(second_range);
+	uint32_t bitMask = (bits >= 32) ? 0xFFFFFFFFu : ((uint32_t(1) << bits) - 1);
+	if ((int) rowOffsets.size() != rows + 1 || rowOffsets.front() != 0
+			|| rowOffsets.back() != (int) entries.size() || params.size() != 2
+			|| params[0] != bits || static_cast<uint32_t>(params[1]) != bitMask) {
+		throw std::runtime_error("Plan connection table does not match the layer.");
+	}
+	for (int r = 0; r < rows; r++) {
+		if (rowOffsets[r + 1] < rowOffsets[r]) {
+			throw std::runtime_error("Plan connection table does not match the layer.");
+		}
+	}
+	for (int e : entries) {
+		uint32_t entry = static_cast<uint32_t>(e);
+		if ((int64_t) (entry >> bits) >= first_range
+				|| (int64_t) (entry & bitMask) >= second_range) {
+			throw std::runtime_error("Plan connection table index out of range.");
+		}
+	}
+	offsets = rowOffsets;
+	packed.assign(entries.begin(), entries.end());
+	shift = bits;
+	mask = bitMask;
+}
+int PackedConnectionTable::maxRowSize() const {
+	int sz = 0;
+	for (int r = 0; r < rows(); r++) {
+		sz = std::max(sz, size(r));
+	}
+	return sz;
+}
+/**
+ * Computes result[s] = sum_k a[s][first(k)] * b[s][second(k)] over one row of
+ * the table for a tile of samples. Indices are decoded once per tile. When
+ * shared_a is set, a[0] is used for every sample (i.e. the weights).
+ */
+static inline void SparseDotTile(const PackedConnectionTable& table, int row,
+		const float* const * a, const float* const * b, bool shared_a,
+		int count, float* result) {
+	NeuralKernels::get().sparseDot(table.data(), table.begin(row),
+			table.end(row), table.getShift(), table.getMask(), a, b, shared_a,
+			count, result);
+}
+/**
+ * Runs func(sample_begin, sample_count, row_begin, row_end) over blocks of
+ * samples x rows. Each block writes a disjoint part of the output, so blocks
+ * run in parallel without synchronization.
+ */
+template<typename Func> static void ForSparseBlocks(bool parallelize,
+		size_t sample_count, int rows, Func func) {
+	const int sample_tiles = static_cast<int>((sample_count
+			+ SPARSE_SAMPLE_TILE - 1) / SPARSE_SAMPLE_TILE);
+	const int row_blocks = (rows + SPARSE_ROW_BLOCK - 1) / SPARSE_ROW_BLOCK;
+	tiny_dnn::for_i(parallelize, sample_tiles * row_blocks, [&](size_t task) {
+		int tile = static_cast<int>(task) / row_blocks;
+		int block = static_cast<int>(task) % row_blocks;
+		int s0 = tile * SPARSE_SAMPLE_TILE;
+		int count = std::min(SPARSE_SAMPLE_TILE, static_cast<int>(sample_count) - s0);
+		int r0 = block * SPARSE_ROW_BLOCK;
+		int r1 = std::min(rows, r0 + SPARSE_ROW_BLOCK);
+		func(s0, count, r0, r1);
+	}, 1);
+}
 PartialConnectedLayer::PartialConnectedLayer(const std::string& name,int in_dim, int out_dim,
 		size_t weight_dim, size_t bias_dim,float scale_factor) :
 		NeuralLayer(name, ChannelOrder(bias_dim > 0), {
-				ChannelType::data }), weight2io(weight_dim), out2wi(out_dim), in2wo(
-				in_dim), bias2out(bias_dim), out2bias(out_dim), scale_factor(
+				ChannelType::data }), in_count(in_dim), out_count(out_dim), weight_count(
+				static_cast<int>(weight_dim)), bias_count(
+				static_cast<int>(bias_dim)), out2bias(out_dim), scale_factor(
 				scale_factor) {
 }
 size_t PartialConnectedLayer::param_size() const {
 	size_t total_param = 0;
-	for (auto w : weight2io)
-		if (w.size() > 0)
+	for (int w = 0; w < weight2io.rows(); w++)
+		if (weight2io.size(w) > 0)
 			total_param++;
-	for (auto b : bias2out)
-		if (b.size() > 0)
+	for (int b = 0; b < bias2out.rows(); b++)
+		if (bias2out.size(b) > 0)
 			total_param++;
 	return total_param;
 }
 
 int PartialConnectedLayer::getFanInSize() const {
-	return tiny_dnn::max_size(out2wi);
+	return out2wi.maxRowSize();
 }
 
 int PartialConnectedLayer::getFanOutSize() const {
-	return tiny_dnn::max_size(in2wo);
+	return in2wo.maxRowSize();
+}
+uint64_t PartialConnectedLayer::getMultiplyAdds() const {
+	return (uint64_t) out2wi.nonZeros();
 }
 
 void PartialConnectedLayer::connect_weight(int input_index, int output_index,
 		int weight_index) {
-	weight2io[weight_index].emplace_back(input_index, output_index);
-	out2wi[output_index].emplace_back(weight_index, input_index);
-	in2wo[input_index].emplace_back(weight_index, output_index);
+	pending_weights.push_back( { weight_index, input_index, output_index });
 }
 
 void PartialConnectedLayer::connect_bias(int bias_index, int output_index) {
 	out2bias[output_index] = bias_index;
-	bias2out[bias_index].push_back(output_index);
+	pending_biases.push_back( { bias_index, 0, output_index });
 }
-
-void PartialConnectedLayer::forwardPropagation(
-		const std::vector<Tensor *> &in_data, std::vector<Tensor *> &out_data) {
+void PartialConnectedLayer::compile_connections() {
+	std::vector<std::array<int, 3>> coo(pending_weights.size());
+	for (size_t i = 0; i < coo.size(); i++) {
+		const std::array<int, 3>& c = pending_weights[i];
+		coo[i] = {c[2], c[0], c[1]};
+	}
+	out2wi.build(out_count, weight_count, in_count, coo);
+	for (size_t i = 0; i < coo.size(); i++) {
+		const std::array<int, 3>& c = pending_weights[i];
+		coo[i] = {c[1], c[0], c[2]};
+	}
+	in2wo.build(in_count, weight_count, out_count, coo);
+	for (size_t i = 0; i < coo.size(); i++) {
+		const std::array<int, 3>& c = pending_weights[i];
+		coo[i] = {c[0], c[1], c[2]};
+	}
+	weight2io.build(weight_count, in_count, out_count, coo);
+	bias2out.build(bias_count, 1, out_count, pending_biases);
+	pending_weights.clear();
+	pending_weights.shrink_to_fit();
+	pending_biases.clear();
+	pending_biases.shrink_to_fit();
+}
+void PartialConnectedLayer::getTables(PlanTable& table) const {
+	out2wi.write(table);
+	in2wo.write(table);
+	weight2io.write(table);
+	bias2out.write(table);
+	table.add(out2bias);
+}
+void PartialConnectedLayer::setTables(const PlanTable& table) {
+	size_t index = 0;
+	out2wi.read(table, index, out_count, weight_count, in_count);
+	in2wo.read(table, index, in_count, weight_count, out_count);
+	weight2io.read(table, index, weight_count, in_count, out_count);
+	bias2out.read(table, index, bias_count, 1, out_count);
+	table.get(index, out2bias, out_count, std::max(bias_count, 1));
+	pending_weights.clear();
+	pending_biases.clear();
+}
+void PartialConnectedLayer::sparse_forward(const std::vector<Tensor *> &in_data,
+		std::vector<Tensor *> &out_data, float scale, bool parallel) {
 	const Tensor &in = *in_data[0];
 	const Storage &W = (*in_data[1])[0];
-	const Storage &b = (*in_data[2])[0];
+	const float* b = (bias_count > 0) ? (*in_data[2])[0].data() : nullptr;
 	Tensor &out = *out_data[0];
-
-	// @todo revise the parallelism strategy
-	for (int sample = 0, sample_count = static_cast<int>(in.size());
-			sample < sample_count; ++sample) {
-		Storage &out_sample = out[sample];
-		tiny_dnn::for_i(out2wi.size(), [&](size_t i) {
-			const wi_connections &connections = out2wi[i];
-
-			float &out_element = out_sample[i];
-
-			out_element = float {0};
-
-			for (auto connection : connections)
-			out_element += W[connection.first] * in[sample][connection.second];
-
-			out_element *= scale_factor;
-			out_element += b[out2bias[i]];
-		});
-	}
+	ForSparseBlocks(parallel, in.size(), out2wi.rows(),
+			[&](int s0, int count, int r0, int r1) {
+				const float* a[SPARSE_SAMPLE_TILE];
+				const float* x[SPARSE_SAMPLE_TILE];
+				float sum[SPARSE_SAMPLE_TILE];
+				for (int s = 0; s < count; s++) {
+					a[s] = W.data();
+					x[s] = in[s0 + s].data();
+				}
+				for (int r = r0; r < r1; r++) {
+					SparseDotTile(out2wi, r, a, x, true, count, sum);
+					float bias = (b != nullptr) ? b[out2bias[r]] : 0.0f;
+					for (int s = 0; s < count; s++) {
+						out[s0 + s][r] = sum[s] * scale + bias;
+					}
+				}
+			});
 }
-
-void PartialConnectedLayer::backwardPropagation(
-		const std::vector<Tensor *> &in_data,
-		const std::vector<Tensor *> &out_data, std::vector<Tensor *> &out_grad,
-		std::vector<Tensor *> &in_grad) {
+void PartialConnectedLayer::sparse_backward(const std::vector<Tensor *> &in_data,
+		std::vector<Tensor *> &out_grad, std::vector<Tensor *> &in_grad,
+		float scale, bool parallel) {
 	const Tensor &prev_out = *in_data[0];
 	const Storage &W = (*in_data[1])[0];
-	Storage &dW = (*in_grad[1])[0];
-	Storage &db = (*in_grad[2])[0];
 	Tensor &prev_delta = *in_grad[0];
-	Tensor &curr_delta = *out_grad[0];
-
-	// @todo revise the parallelism strategy
-	for (int sample = 0, sample_count = static_cast<int>(prev_out.size());
-			sample < sample_count; ++sample) {
-		tiny_dnn::for_i(in2wo.size(),
-				[&](size_t i) {
-					const wo_connections &connections = in2wo[i];
-					float delta (0);
-
-					for (auto connection : connections)
-					delta += W[connection.first] * curr_delta[sample][connection.second];
-
-					prev_delta[sample][i] = delta * scale_factor;
+	Tensor &dW = *in_grad[1];
+	const Tensor &curr_delta = *out_grad[0];
+	const size_t sample_count = prev_out.size();
+	// gradients are accumulated per sample and merged in updateWeights()
+	ForSparseBlocks(parallel, sample_count, in2wo.rows(),
+			[&](int s0, int count, int r0, int r1) {
+				const float* a[SPARSE_SAMPLE_TILE];
+				const float* d[SPARSE_SAMPLE_TILE];
+				float sum[SPARSE_SAMPLE_TILE];
+				for (int s = 0; s < count; s++) {
+					a[s] = W.data();
+					d[s] = curr_delta[s0 + s].data();
+				}
+				for (int r = r0; r < r1; r++) {
+					SparseDotTile(in2wo, r, a, d, true, count, sum);
+					for (int s = 0; s < count; s++) {
+						prev_delta[s0 + s][r] = sum[s] * scale;
+					}
+				}
+			});
+	ForSparseBlocks(parallel, sample_count, weight2io.rows(),
+			[&](int s0, int count, int r0, int r1) {
+				const float* x[SPARSE_SAMPLE_TILE];
+				const float* d[SPARSE_SAMPLE_TILE];
+				float sum[SPARSE_SAMPLE_TILE];
+				for (int s = 0; s < count; s++) {
+					x[s] = prev_out[s0 + s].data();
+					d[s] = curr_delta[s0 + s].data();
+				}
+				for (int r = r0; r < r1; r++) {
+					SparseDotTile(weight2io, r, x, d, false, count, sum);
+					for (int s = 0; s < count; s++) {
+						dW[s0 + s][r] += sum[s] * scale;
+					}
+				}
+			});
+	if (bias_count > 0) {
+		Tensor &db = *in_grad[2];
+		const float one = 1.0f;
+		ForSparseBlocks(parallel, sample_count, bias2out.rows(),
+				[&](int s0, int count, int r0, int r1) {
+					const float* a[SPARSE_SAMPLE_TILE];
+					const float* d[SPARSE_SAMPLE_TILE];
+					float sum[SPARSE_SAMPLE_TILE];
+					for (int s = 0; s < count; s++) {
+						a[s] = &one;
+						d[s] = curr_delta[s0 + s].data();
+					}
+					for (int r = r0; r < r1; r++) {
+						SparseDotTile(bias2out, r, a, d, true, count, sum);
+						for (int s = 0; s < count; s++) {
+							db[s0 + s][r] += sum[s];
+						}
+					}
 				});
-
-		tiny_dnn::for_i(weight2io.size(), [&](size_t i) {
-			const io_connections &connections = weight2io[i];
-			float diff (0);
-
-			for (auto connection : connections)
-			diff += prev_out[sample][connection.first] *
-			curr_delta[sample][connection.second];
-
-			dW[i] += diff * scale_factor;
-		});
-
-		for (size_t i = 0; i < bias2out.size(); i++) {
-			const std::vector<int> &outs = bias2out[i];
-			float diff ( 0 );
-
-			for (auto o : outs)
-				diff += curr_delta[sample][o];
-
-			db[i] += diff;
-		}
 	}
 }
+void PartialConnectedLayer::forwardPropagation(
+		const std::vector<Tensor *> &in_data, std::vector<Tensor *> &out_data) {
+	sparse_forward(in_data, out_data, scale_factor, true);
 }
 
+void PartialConnectedLayer::backwardPropagation(
+		const std::vector<Tensor *> &in_data,
+		const std::vector<Tensor *> &out_data, std::vector<Tensor *> &out_grad,
+		std::vector<Tensor *> &in_grad) {
+	CNN_UNREFERENCED_PARAMETER(out_data);
+	sparse_backward(in_data, out_grad, in_grad, scale_factor, true);
+}
+}
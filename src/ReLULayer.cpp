@@ -0,0 +1,49 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "ReLULayer.h"
+namespace tgr {
+
+void ReLULayer::forward_activation(const Storage &x, Storage &y) {
+	forward_elements(x.data(), y.data(), x.size());
+}
+void ReLULayer::forward_elements(const float* x, float* y, size_t n) {
+	const float slope = negativeSlope;
+	for (size_t i = 0; i < n; i++) {
+		y[i] = (x[i] > 0.0f) ? x[i] : slope * x[i];
+	}
+}
+
+void ReLULayer::backward_activation(const Storage &x, const Storage &y,
+		Storage &dx, const Storage &dy) {
+	backward_elements(x.data(), y.data(), dx.data(), dy.data(), x.size());
+}
+void ReLULayer::backward_elements(const float* x, const float* y, float* dx,
+		const float* dy, size_t n) {
+	const float slope = negativeSlope;
+	for (size_t i = 0; i < n; i++) {
+		dx[i] = (x[i] > 0.0f) ? dy[i] : slope * dy[i];
+	}
+}
+
+std::pair<float_t, float_t> ReLULayer::scale() const {
+	return std::make_pair(float_t(0.1), float_t(0.9));
+}
+}
@@ -90,8 +90,10 @@ void SliceLayer::slice_channels_forward(const Tensor &in_data,
 		for (int s = 0; s < num_samples; s++) {
 			float *out = &(*out_data[i])[s][0];
 			const float *in = &in_data[s][0] + channel_idx * spatial_dim;
-
-			std::copy(in, in + slice_size[i] * spatial_dim, out);
+			//outputs planned as views of the input are already in place
+			if (in != out) {
+				std::copy(in, in + slice_size[i] * spatial_dim, out);
+			}
 		}
 		channel_idx += slice_size[i];
 	}
@@ -107,13 +109,24 @@ void SliceLayer::slice_channels_backward(std::vector<Tensor *> &out_grad,
 		for (int s = 0; s < num_samples; s++) {
 			const float *out = &(*out_grad[i])[s][0];
 			float *in = &in_grad[s][0] + channel_idx * spatial_dim;
-
-			std::copy(out, out + slice_size[i] * spatial_dim, in);
+			if (in != out) {
+				std::copy(out, out + slice_size[i] * spatial_dim, in);
+			}
 		}
 		channel_idx += slice_size[i];
 	}
 }
 
+int SliceLayer::getChannelOffset(int index) const {
+	if (slice_type != SliceType::slice_channels) {
+		throw std::runtime_error("Channel offset only defined for channel slices");
+	}
+	int channel_idx = 0;
+	for (int i = 0; i < index; i++) {
+		channel_idx += slice_size[i];
+	}
+	return channel_idx;
+}
 void SliceLayer::setSampleCount(size_t sample_count) {
 	if (slice_type == SliceType::slice_samples) {
 		if (num_outputs == 0)
@@ -6,20 +6,24 @@
  */
 
 #include "TanhLayer.h"
+#include "NeuralKernels.h"
 namespace tgr {
 
 void TanhLayer::forward_activation(const Storage &x, Storage &y) {
-	for (int j = 0; j < x.size(); j++) {
-		y[j] = std::tanh(x[j]);
-	}
+	forward_elements(x.data(), y.data(), x.size());
+}
+void TanhLayer::forward_elements(const float* x, float* y, size_t n) {
+	NeuralKernels::get().tanhForward(x, y, n);
 }
 
 void TanhLayer::backward_activation(const Storage &x, const Storage &y,
 		Storage &dx, const Storage &dy) {
-	for (int j = 0; j < x.size(); j++) {
-		// dx = dy * (gradient of tanh)
-		dx[j] = dy[j] * (1.0f - y[j] * y[j]);
-	}
+	backward_elements(x.data(), y.data(), dx.data(), dy.data(), x.size());
+}
+void TanhLayer::backward_elements(const float* x, const float* y, float* dx,
+		const float* dy, size_t n) {
+	// dx = dy * (gradient of tanh)
+	NeuralKernels::get().tanhBackward(y, dy, dx, n);
 }
 
 std::pair<float_t, float_t> TanhLayer::scale() const {
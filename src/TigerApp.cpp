@@ -49,8 +49,11 @@ void TigerApp::setSampleIndex(int idx) {
 	sys->predict(trainInputData[idx]);
 }
 void TigerApp::setNeuralTime(int idx) {
-	auto elem = worker->getCache()->get(idx);
-	if (elem.get() != nullptr) {
+	std::shared_ptr<NeuralCache> cache = worker->getCache();
+	auto elem = cache->get(idx);
+	//neighbours are loaded in the background so scrubbing stays smooth
+	cache->prefetch(idx, 2);
+	if (elem.get() != nullptr && elem->isLoaded()) {
 		//sys->setKnowledge(*elem->getKnowledge());
 		//sys->evaluate();
 	}
@@ -0,0 +1,343 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralTrainer.h"
+#include "MNIST.h"
+#include "NeuralNuma.h"
+#include "NeuralCheckpoint.h"
+#include "NeuralExport.h"
+#include "NeuralPlan.h"
+#include "tiny_dnn/util/random.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+namespace tgr {
+typedef std::chrono::steady_clock Clock;
+static void MakeDirectory(const std::string& dir) {
+#ifdef _WIN32
+	_mkdir(dir.c_str());
+#else
+	mkdir(dir.c_str(), 0755);
+#endif
+}
+void WriteCheckpointToFile(const std::string& file, const NeuralSystem& sys) {
+	NeuralKnowledge knowledge(sys.getName());
+	knowledge.set(sys);
+	knowledge.writeContainer(file);
+}
+bool ReadCheckpointFromFile(const std::string& file, NeuralSystem& sys,
+		NeuralOptimizer* optimizer) {
+	NeuralKnowledge knowledge;
+	knowledge.mapContainer(file);
+	sys.setKnowledge(knowledge);
+	return (optimizer != nullptr && sys.setOptimizerState(knowledge, *optimizer));
+}
+NeuralTrainer::NeuralTrainer(const TrainConfig& config) :
+		config(config), generator(config.seed) {
+}
+void NeuralTrainer::loadData() {
+	if (config.trainImages.size() == 0 || config.trainLabels.size() == 0) {
+		throw std::runtime_error("train.images and train.labels are required.");
+	}
+	parse_mnist_images(config.trainImages, trainInputs, config.scaleMin,
+			config.scaleMax, config.padding, config.padding);
+	parse_mnist_labels(config.trainLabels, trainLabels);
+	if (trainInputs.size() != trainLabels.size()) {
+		throw std::runtime_error("Training images and labels differ in size.");
+	}
+	if (config.maxSamples > 0
+			&& (size_t) config.maxSamples < trainInputs.size()) {
+		trainInputs.resize(config.maxSamples);
+		trainLabels.resize(config.maxSamples);
+	}
+	if (config.testImages.size() > 0 && config.testLabels.size() > 0) {
+		parse_mnist_images(config.testImages, testInputs, config.scaleMin,
+				config.scaleMax, config.padding, config.padding);
+		parse_mnist_labels(config.testLabels, testLabels);
+		if (testInputs.size() != testLabels.size()) {
+			throw std::runtime_error("Test images and labels differ in size.");
+		}
+	}
+	std::cout << "Loaded " << trainInputs.size() << " training and "
+			<< testInputs.size() << " test samples." << std::endl;
+}
+void NeuralTrainer::build() {
+	if (trainInputs.size() == 0) {
+		throw std::runtime_error("No training data loaded.");
+	}
+	//MNIST images are square and single channel
+	int side = (int) std::round(std::sqrt((double) trainInputs[0][0].size()));
+	tiny_dnn::set_random_seed(config.seed);
+	std::shared_ptr<NeuralPlan> plan;
+	if (config.plan.size() > 0 && std::ifstream(config.plan).good()) {
+		try {
+			plan = ReadNeuralPlanFromFile(config.plan);
+		} catch (std::exception& e) {
+			std::cerr << "Ignoring plan: " << e.what() << std::endl;
+		}
+	}
+	{
+		NeuralPlanScope scope(plan);
+		sys = MakeSystem(config, aly::dim3(side, side, 1));
+	}
+	if (plan.get() != nullptr) {
+		std::cout << (sys->isPlanned() ? "Restored plan " : "Stale plan ")
+				<< config.plan << std::endl;
+	}
+	optimizer = MakeOptimizer(config);
+	loss = MakeLossFunction(config);
+	optimizer.reset();
+	if (config.resume.size() > 0) {
+		bool state = ReadCheckpointFromFile(config.resume, *sys, &optimizer);
+		std::cout << "Resumed from " << config.resume
+				<< (state ? " with optimizer state" : "") << std::endl;
+	}
+	if (config.freeze > 0) {
+		int frozen = 0;
+		for (const NeuralLayerPtr& layer : *sys) {
+			if (frozen < config.freeze && layer->getInputWeights().size() > 0) {
+				layer->setTrainable(false);
+				frozen++;
+			}
+		}
+		//nothing before the first trained layer needs gradients
+		sys->setTrunk(sys->getFrozenTrunkSize());
+		std::cout << "Froze " << frozen << " layers, " << sys->getTrunk()
+				<< " of " << sys->size() << " layers only run forward"
+				<< std::endl;
+	}
+	NeuralNuma::placeWeights(*sys);
+	if (config.tune) {
+		tune();
+	}
+	if (config.plan.size() > 0 && (!sys->isPlanned() || config.tune)) {
+		NeuralPlan captured;
+		captured.capture(*sys);
+		WriteNeuralPlanToFile(config.plan, captured);
+		std::cout << "Wrote plan " << config.plan << std::endl;
+	}
+}
+void NeuralTrainer::cacheFeatures() {
+	FeatureCacheOptions options;
+	options.precision = ParsePrecision(config.freezePrecision);
+	options.batchSize = config.batchSize;
+	MakeDirectory(config.outputDir);
+	std::string file = config.outputDir + "/" + config.name + ".tgf";
+	auto start = Clock::now();
+	bool reused = features.open(*sys, trainInputs, file, options);
+	std::cout << (reused ? "Reused " : "Built ") << "feature cache " << file
+			<< " (" << ((features.size() * features.getSampleBytes()) >> 20)
+			<< " MB) in "
+			<< std::chrono::duration<double>(Clock::now() - start).count()
+			<< " s, training layers " << features.getTrunkSize() << " to "
+			<< sys->size() - 1 << std::endl;
+}
+void NeuralTrainer::tune() {
+	TuneOptions options;
+	options.parallelize = config.parallelize;
+	options.cacheFile = config.tuneCache;
+	if (options.cacheFile.size() == 0) {
+		MakeDirectory(config.outputDir);
+		options.cacheFile = config.outputDir + "/tuning.cache";
+	}
+	size_t count = std::min(trainInputs.size(), (size_t) config.batchSize);
+	std::vector<Tensor> batch(trainInputs.begin(), trainInputs.begin() + count);
+	sys->setPhase(NetPhase::Train);
+	std::vector<TuneResult> results = sys->tune(batch, options);
+	NeuralTuner::print(std::cout, results);
+}
+float NeuralTrainer::trainEpoch(int epoch) {
+	std::vector<int> order(trainInputs.size());
+	std::iota(order.begin(), order.end(), 0);
+	if (config.shuffle) {
+		std::shuffle(order.begin(), order.end(), generator);
+	}
+	const NeuralLayerPtr& outputLayer = sys->getOutputLayers().front();
+	const int batchCount = (int) ((order.size() + config.batchSize - 1)
+			/ config.batchSize);
+	std::vector<Tensor> batch;
+	std::vector<int> labels;
+	double lossSum = 0.0;
+	size_t sampleCount = 0;
+	auto logStart = Clock::now();
+	size_t logSamples = 0;
+	sys->setPhase(NetPhase::Train);
+	for (int b = 0; b < batchCount; b++) {
+		size_t start = (size_t) b * config.batchSize;
+		size_t end = std::min(order.size(), start + config.batchSize);
+		const size_t count = end - start;
+		labels.resize(count);
+		for (size_t i = start; i < end; i++) {
+			labels[i - start] = trainLabels[order[i]];
+		}
+		if (features.isOpen()) {
+			features.forward(*sys, order.data() + start, count);
+		} else {
+			batch.resize(count);
+			for (size_t i = start; i < end; i++) {
+				batch[i - start] = trainInputs[order[i]];
+			}
+			sys->forward(batch);
+		}
+		lossSum += loss.loss(outputLayer->getOutput(0)->value, labels.data(),
+				config.parallelize);
+		sys->bprop(loss, labels.data());
+		//gradients are only valid until the update, so sample them here
+		if (tracer.get() != nullptr) {
+			tracer->record(*sys, iteration);
+		}
+		iteration++;
+		sys->updateWeights(optimizer, (int) count);
+		sampleCount += count;
+		logSamples += count;
+		if (config.logEvery > 0 && (b + 1) % config.logEvery == 0) {
+			double t = std::chrono::duration<double>(Clock::now() - logStart).count();
+			std::cout << "epoch " << epoch << " batch " << (b + 1) << "/"
+					<< batchCount << " loss " << lossSum / sampleCount << " "
+					<< (int) (logSamples / std::max(t, 1E-9)) << " samples/s"
+					<< std::endl;
+			logStart = Clock::now();
+			logSamples = 0;
+		}
+	}
+	return (float) (lossSum / std::max(sampleCount, (size_t) 1));
+}
+void NeuralTrainer::evaluate(float& testLoss, float& accuracy) {
+	testLoss = 0.0f;
+	accuracy = 0.0f;
+	if (testInputs.size() == 0) {
+		return;
+	}
+	sys->setPhase(NetPhase::Test);
+	std::vector<Tensor> batch;
+	double lossSum = 0.0;
+	size_t correct = 0;
+	for (size_t start = 0; start < testInputs.size(); start +=
+			config.batchSize) {
+		size_t end = std::min(testInputs.size(), start + config.batchSize);
+		batch.assign(testInputs.begin() + start, testInputs.begin() + end);
+		std::vector<Tensor> out = sys->forward(batch);
+		for (size_t i = 0; i < out.size(); i++) {
+			const Storage& y = out[i].front();
+			int label = testLabels[start + i];
+			lossSum += loss.fSparse(y, label);
+			if (std::max_element(y.begin(), y.end()) - y.begin() == label) {
+				correct++;
+			}
+		}
+	}
+	testLoss = (float) (lossSum / testInputs.size());
+	accuracy = (float) correct / testInputs.size();
+	sys->setPhase(NetPhase::Train);
+}
+void NeuralTrainer::run() {
+	MakeDirectory(config.outputDir);
+	std::string progressFile = config.outputDir + "/progress.csv";
+	bool append = (config.resume.size() > 0);
+	progress.open(progressFile,
+			append ? (std::ios::out | std::ios::app) : std::ios::out);
+	if (!progress.is_open()) {
+		throw std::runtime_error(
+				std::string("Could not open ") + progressFile + " for writing.");
+	}
+	if (!append) {
+		progress
+				<< "epoch,seconds,samples_per_second,train_loss,test_loss,test_accuracy"
+				<< std::endl;
+	}
+	CheckpointOptions options;
+	options.directory = config.outputDir;
+	options.prefix = config.name;
+	options.interval = config.checkpointEvery;
+	options.keep = config.checkpointKeep;
+	NeuralCheckpointer checkpointer(options);
+	if (config.freeze > 0 && config.freezeCache) {
+		cacheFeatures();
+	}
+	if (config.traceEvery > 0) {
+		TraceOptions trace;
+		trace.interval = config.traceEvery;
+		trace.layers = config.traceLayers;
+		trace.memoryBytes = (uint64_t) config.traceMemory << 20;
+		trace.weights = config.traceWeights;
+		trace.weightChanges = config.traceWeights;
+		trace.file = config.traceFile;
+		if (trace.file.size() == 0) {
+			trace.file = config.outputDir + "/trace.tgt";
+		}
+		tracer.reset(new NeuralTracer(trace));
+	}
+	for (int epoch = 1; epoch <= config.epochs; epoch++) {
+		auto start = Clock::now();
+		EpochResult result;
+		result.epoch = epoch;
+		result.trainLoss = trainEpoch(epoch);
+		result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		result.samplesPerSecond = trainInputs.size()
+				/ std::max(result.seconds, 1E-9);
+		evaluate(result.testLoss, result.testAccuracy);
+		progress << result.epoch << "," << result.seconds << ","
+				<< result.samplesPerSecond << "," << result.trainLoss << ","
+				<< result.testLoss << "," << result.testAccuracy << std::endl;
+		std::cout << "epoch " << epoch << "/" << config.epochs << " "
+				<< result.seconds << " s, " << (int) result.samplesPerSecond
+				<< " samples/s, train loss " << result.trainLoss
+				<< ", test loss " << result.testLoss << ", accuracy "
+				<< 100.0f * result.testAccuracy << "%" << std::endl;
+		//the weights are copied here and written while the next epoch runs
+		bool last = (epoch == config.epochs);
+		if (checkpointer.checkpoint(*sys, epoch, last, &optimizer)) {
+			std::cout << "Checkpoint " << checkpointer.getFile(epoch)
+					<< std::endl;
+		}
+	}
+	checkpointer.flush();
+	checkpointer.printStats(std::cout);
+	if (tracer.get() != nullptr) {
+		tracer->printStats(std::cout);
+		std::string file = tracer->getOptions().file;
+		bool written = (tracer->getStats().samples > 0);
+		//destroying the tracer writes the frames still in memory
+		tracer.reset();
+		if (written) {
+			PrintTraceUnitStats(std::cout,
+					GetTraceUnitStats(ReadNeuralTraceFromFile(file)));
+		}
+	}
+	if (config.exportPrecision.size() > 0) {
+		std::string file = config.outputDir + "/" + config.name + ".tgq";
+		NeuralKnowledge knowledge(sys->getName());
+		knowledge.set(*sys);
+		ExportOptions options;
+		options.precision = ParsePrecision(config.exportPrecision);
+		ExportNeuralKnowledge(file, knowledge, options);
+		std::cout << "Exported " << file << std::endl;
+	}
+	progress.close();
+	NeuralMemory::printStats(std::cout);
+}
+}
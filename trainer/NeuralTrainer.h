@@ -0,0 +1,85 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef NEURALTRAINER_H_
+#define NEURALTRAINER_H_
+#include "TrainConfig.h"
+#include "NeuralTrace.h"
+#include "NeuralFeatureCache.h"
+#include <fstream>
+#include <random>
+namespace tgr {
+struct EpochResult {
+	int epoch;
+	double seconds;
+	double samplesPerSecond;
+	float trainLoss; //mean over the epoch's batches
+	float testLoss;
+	float testAccuracy;
+};
+/**
+ * Runs a TrainConfig to completion on the calling thread with no window,
+ * no rendering and no delay between batches. Progress is appended to
+ * <output>/progress.csv after every epoch and weight checkpoints are
+ * written to <output>/<name>_<epoch>.tgw in the background.
+ */
+class NeuralTrainer {
+protected:
+	TrainConfig config;
+	std::shared_ptr<NeuralSystem> sys;
+	NeuralOptimizer optimizer;
+	NeuralLossFunction loss;
+	std::vector<Tensor> trainInputs;
+	std::vector<int> trainLabels;
+	std::vector<Tensor> testInputs;
+	std::vector<int> testLabels;
+	std::ofstream progress;
+	std::mt19937 generator;
+	std::unique_ptr<NeuralTracer> tracer;
+	NeuralFeatureCache features;
+	int iteration = 0; //batches trained since the start of run()
+	float trainEpoch(int epoch);
+	void tune();
+	void cacheFeatures();
+	void evaluate(float& testLoss, float& accuracy);
+public:
+	NeuralTrainer(const TrainConfig& config);
+	void loadData();
+	void build();
+	void run();
+	const std::shared_ptr<NeuralSystem>& getSystem() const {
+		return sys;
+	}
+};
+/**
+ * Weights of every trainable layer as a NeuralKnowledge weight container,
+ * with layer ids and sizes so a mismatched network is rejected on load. The
+ * file is written next to its destination and renamed, so a checkpoint is
+ * never left half written.
+ */
+void WriteCheckpointToFile(const std::string& file, const NeuralSystem& sys);
+/**
+ * Loads the weights, and the optimizer state if the checkpoint has it and
+ * an optimizer is given. Returns true if optimizer state was restored.
+ */
+bool ReadCheckpointFromFile(const std::string& file, NeuralSystem& sys,
+		NeuralOptimizer* optimizer = nullptr);
+}
+#endif
@@ -0,0 +1,392 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "TrainConfig.h"
+#include "NeuralExport.h"
+#include "NeuralCaffe.h"
+#include "DropOutLayer.h"
+#include "GlobalAveragePoolingLayer.h"
+#include "LocalResponseNormLayer.h"
+#include "PowerLayer.h"
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+namespace tgr {
+//connection table [Y.Lecun, 1998 Table.1]
+#define O true
+#define X false
+static const bool LENET_TABLE[] = {
+	O, X, X, X, O, O, O, X, X, O, O, O, O, X, O, O,
+	O, O, X, X, X, O, O, O, X, X, O, O, O, O, X, O,
+	O, O, O, X, X, X, O, O, O, X, X, O, X, O, O, O,
+	X, O, O, O, X, X, O, O, O, O, X, X, O, X, O, O,
+	X, X, O, O, O, X, X, O, O, O, O, X, O, O, X, O,
+	X, X, X, O, O, O, X, X, O, O, O, O, X, O, O, O
+};
+#undef O
+#undef X
+static std::string Trim(const std::string& str) {
+	size_t start = str.find_first_not_of(" \t\r\n");
+	if (start == std::string::npos) {
+		return "";
+	}
+	size_t end = str.find_last_not_of(" \t\r\n");
+	return str.substr(start, end - start + 1);
+}
+static std::runtime_error ConfigError(int line, const std::string& msg) {
+	std::stringstream ss;
+	ss << "Config line " << line << ": " << msg;
+	return std::runtime_error(ss.str());
+}
+std::string LayerConfig::get(const std::string& key,
+		const std::string& def) const {
+	auto it = params.find(key);
+	return (it != params.end()) ? it->second : def;
+}
+int LayerConfig::getInt(const std::string& key, int def) const {
+	auto it = params.find(key);
+	return (it != params.end()) ? std::atoi(it->second.c_str()) : def;
+}
+float LayerConfig::getFloat(const std::string& key, float def) const {
+	auto it = params.find(key);
+	return (it != params.end()) ? (float) std::atof(it->second.c_str()) : def;
+}
+bool LayerConfig::getBool(const std::string& key, bool def) const {
+	auto it = params.find(key);
+	if (it == params.end()) {
+		return def;
+	}
+	return (it->second == "true" || it->second == "1" || it->second == "yes");
+}
+static bool ParseBool(const std::string& value) {
+	return (value == "true" || value == "1" || value == "yes");
+}
+void ReadTrainConfigFromFile(const std::string& file, TrainConfig& config) {
+	std::ifstream in(file);
+	if (!in.is_open()) {
+		throw std::runtime_error(std::string("Could not open ") + file);
+	}
+	std::string text;
+	int lineNumber = 0;
+	while (std::getline(in, text)) {
+		lineNumber++;
+		size_t comment = text.find('#');
+		if (comment != std::string::npos) {
+			text = text.substr(0, comment);
+		}
+		text = Trim(text);
+		if (text.size() == 0) {
+			continue;
+		}
+		if (text.compare(0, 6, "layer ") == 0) {
+			std::stringstream ss(text.substr(6));
+			LayerConfig layer;
+			layer.line = lineNumber;
+			ss >> layer.type;
+			std::string token;
+			while (ss >> token) {
+				size_t eq = token.find('=');
+				if (eq == std::string::npos) {
+					throw ConfigError(lineNumber,
+							"expected key=value, found \"" + token + "\"");
+				}
+				layer.params[token.substr(0, eq)] = token.substr(eq + 1);
+			}
+			config.layers.push_back(layer);
+			continue;
+		}
+		size_t eq = text.find('=');
+		if (eq == std::string::npos) {
+			throw ConfigError(lineNumber, "expected key = value");
+		}
+		std::string key = Trim(text.substr(0, eq));
+		std::string value = Trim(text.substr(eq + 1));
+		if (key == "name") {
+			config.name = value;
+		} else if (key == "train.images") {
+			config.trainImages = value;
+		} else if (key == "train.labels") {
+			config.trainLabels = value;
+		} else if (key == "test.images") {
+			config.testImages = value;
+		} else if (key == "test.labels") {
+			config.testLabels = value;
+		} else if (key == "data.min") {
+			config.scaleMin = (float) std::atof(value.c_str());
+		} else if (key == "data.max") {
+			config.scaleMax = (float) std::atof(value.c_str());
+		} else if (key == "data.padding") {
+			config.padding = std::atoi(value.c_str());
+		} else if (key == "data.max_samples") {
+			config.maxSamples = std::atoi(value.c_str());
+		} else if (key == "backend") {
+			config.backend = value;
+		} else if (key == "parallelize") {
+			config.parallelize = ParseBool(value);
+		} else if (key == "threads") {
+			config.threads = std::atoi(value.c_str());
+		} else if (key == "pin") {
+			config.pin = ParseBool(value);
+		} else if (key == "tune") {
+			config.tune = ParseBool(value);
+		} else if (key == "tune.cache") {
+			config.tuneCache = value;
+		} else if (key == "plan") {
+			config.plan = value;
+		} else if (key == "optimizer") {
+			config.optimizer = value;
+		} else if (key == "optimizer.learning_rate") {
+			config.learningRate = (float) std::atof(value.c_str());
+		} else if (key == "optimizer.weight_decay") {
+			config.weightDecay = (float) std::atof(value.c_str());
+		} else if (key == "optimizer.momentum") {
+			config.momentum = (float) std::atof(value.c_str());
+		} else if (key == "loss") {
+			config.loss = value;
+		} else if (key == "batch") {
+			config.batchSize = std::max(1, std::atoi(value.c_str()));
+		} else if (key == "epochs") {
+			config.epochs = std::max(0, std::atoi(value.c_str()));
+		} else if (key == "seed") {
+			config.seed = (unsigned int) std::atoi(value.c_str());
+		} else if (key == "shuffle") {
+			config.shuffle = ParseBool(value);
+		} else if (key == "output") {
+			config.outputDir = value;
+		} else if (key == "checkpoint.every") {
+			config.checkpointEvery = std::max(0, std::atoi(value.c_str()));
+		} else if (key == "checkpoint.keep") {
+			config.checkpointKeep = std::max(0, std::atoi(value.c_str()));
+		} else if (key == "log.every") {
+			config.logEvery = std::max(0, std::atoi(value.c_str()));
+		} else if (key == "resume") {
+			config.resume = value;
+		} else if (key == "freeze") {
+			config.freeze = std::max(0, std::atoi(value.c_str()));
+		} else if (key == "freeze.cache") {
+			config.freezeCache = ParseBool(value);
+		} else if (key == "freeze.precision") {
+			ParsePrecision(value);
+			config.freezePrecision = value;
+		} else if (key == "trace.every") {
+			config.traceEvery = std::max(0, std::atoi(value.c_str()));
+		} else if (key == "trace.layers") {
+			std::stringstream ids(value);
+			std::string id;
+			config.traceLayers.clear();
+			while (std::getline(ids, id, ',')) {
+				if (Trim(id).size() > 0) {
+					config.traceLayers.push_back(std::atoi(id.c_str()));
+				}
+			}
+		} else if (key == "trace.memory") {
+			config.traceMemory = std::max(1, std::atoi(value.c_str()));
+		} else if (key == "trace.weights") {
+			config.traceWeights = ParseBool(value);
+		} else if (key == "trace.file") {
+			config.traceFile = value;
+		} else if (key == "caffe.net") {
+			config.caffeNet = value;
+		} else if (key == "caffe.weights") {
+			config.caffeWeights = value;
+		} else if (key == "export.precision") {
+			ParsePrecision(value);
+			config.exportPrecision = value;
+		} else {
+			throw ConfigError(lineNumber, "unknown setting \"" + key + "\"");
+		}
+	}
+	bool caffe = (config.caffeNet.size() > 0 || config.caffeWeights.size() > 0);
+	if (config.layers.size() == 0 && !caffe) {
+		throw std::runtime_error(file + " does not define any layers.");
+	}
+	if (config.layers.size() > 0 && caffe) {
+		throw std::runtime_error(file + " defines layers and a Caffe network.");
+	}
+}
+BackendType ParseBackendType(const std::string& name) {
+	if (name == "default") {
+		return DefaultEngine();
+	} else if (name == "internal") {
+		return BackendType::internal;
+	} else if (name == "avx") {
+		return BackendType::avx;
+	} else if (name == "nnpack") {
+		return BackendType::nnpack;
+	} else if (name == "libdnn") {
+		return BackendType::libdnn;
+	} else if (name == "opencl") {
+		return BackendType::opencl;
+	}
+	throw std::runtime_error("Unknown backend " + name);
+}
+NeuralOptimizer MakeOptimizer(const TrainConfig& config) {
+	const std::string& name = config.optimizer;
+	if (name == "sgd") {
+		GradientDescentOptimizer g;
+		g.alpha = config.learningRate;
+		g.lambda = config.weightDecay;
+		return g;
+	} else if (name == "momentum") {
+		MomentumOptimizer m;
+		m.alpha = config.learningRate;
+		m.lambda = config.weightDecay;
+		m.mu = config.momentum;
+		return m;
+	} else if (name == "adam") {
+		AdamOptimizer ad;
+		ad.alpha = config.learningRate;
+		return ad;
+	} else if (name == "adagrad") {
+		AdagradOptimizer ag;
+		ag.alpha = config.learningRate;
+		return ag;
+	} else if (name == "rmsprop") {
+		RMSpropOptimizer ro;
+		ro.alpha = config.learningRate;
+		return ro;
+	}
+	throw std::runtime_error("Unknown optimizer " + name);
+}
+NeuralLossFunction MakeLossFunction(const TrainConfig& config) {
+	const std::string& name = config.loss;
+	if (name == "mse") {
+		return MSELossFunction();
+	} else if (name == "absolute") {
+		return AbsoluteLossFunction();
+	} else if (name == "absolute_eps") {
+		return AbsoluteEpsLossFunction();
+	} else if (name == "cross_entropy") {
+		return CrossEntropyLossFunction();
+	} else if (name == "cross_entropy_multiclass") {
+		return CrossEntropyMultiClassLossFunction();
+	} else if (name == "softmax_cross_entropy") {
+		return SoftmaxCrossEntropyLossFunction();
+	}
+	throw std::runtime_error("Unknown loss function " + name);
+}
+static Padding ParsePadding(const LayerConfig& lc) {
+	std::string pad = lc.get("padding", "valid");
+	if (pad == "valid") {
+		return Padding::Valid;
+	} else if (pad == "same") {
+		return Padding::Same;
+	}
+	throw ConfigError(lc.line, "unknown padding " + pad);
+}
+static NeuralLayerPtr MakeLayer(const LayerConfig& lc,
+		const NeuralLayerPtr& prev, BackendType backend) {
+	aly::dim3 in = prev->getOutputDimensions(0);
+	int size = (int) in.volume();
+	const std::string& type = lc.type;
+	if (type == "conv") {
+		int kernel = lc.getInt("kernel", 3);
+		int stride = lc.getInt("stride", 1);
+		return std::make_shared<ConvolutionLayer>(in.x, in.y, kernel, in.z,
+				lc.getInt("out", in.z), ParsePadding(lc),
+				lc.getBool("bias", true), stride, stride, backend);
+	} else if (type == "deconv") {
+		int kernel = lc.getInt("kernel", 3);
+		int stride = lc.getInt("stride", 1);
+		int out = lc.getInt("out", in.z);
+		tiny_dnn::core::ConnectionTable table;
+		if (lc.get("table", "full") == "lenet") {
+			if (in.z != 6 || out != 16) {
+				throw ConfigError(lc.line, "table=lenet connects 6 to 16 channels");
+			}
+			table = tiny_dnn::core::ConnectionTable(LENET_TABLE, 6, 16);
+		}
+		return std::make_shared<DeconvolutionLayer>(in.x, in.y, kernel, in.z,
+				out, table, ParsePadding(lc), lc.getBool("bias", true), stride,
+				stride, backend);
+	} else if (type == "avepool") {
+		int pool = lc.getInt("size", 2);
+		return std::make_shared<AveragePoolingLayer>(in.x, in.y, in.z, pool,
+				lc.getInt("stride", pool));
+	} else if (type == "maxpool") {
+		int pool = lc.getInt("size", 2);
+		int stride = lc.getInt("stride", pool);
+		return std::make_shared<MaxPoolingLayer>(in.x, in.y, in.z, pool, pool,
+				stride, stride, ParsePadding(lc), backend);
+	} else if (type == "fc") {
+		if (!lc.has("out")) {
+			throw ConfigError(lc.line, "fc requires out=<size>");
+		}
+		return std::make_shared<FullyConnectedLayer>(size, lc.getInt("out", 0),
+				lc.getBool("bias", true), backend);
+	} else if (type == "tanh") {
+		return std::make_shared<TanhLayer>(in.x, in.y, in.z);
+	} else if (type == "relu") {
+		return std::make_shared<ReLULayer>(in.x, in.y, in.z,
+				lc.getFloat("slope", 0.0f));
+	} else if (type == "dropout") {
+		return std::make_shared<DropOutLayer>(size, lc.getFloat("rate", 0.5f));
+	} else if (type == "lrn") {
+		return std::make_shared<LocalResponseNormLayer>(in,
+				lc.getInt("size", 5), lc.getFloat("alpha", 1.0f),
+				lc.getFloat("beta", 5.0f));
+	} else if (type == "batchnorm") {
+		return std::make_shared<BatchNormalizationLayer>(*prev,
+				lc.getFloat("epsilon", 1E-5f), lc.getFloat("momentum", 0.999f));
+	} else if (type == "gap") {
+		return std::make_shared<GlobalAveragePoolingLayer>(in, backend);
+	} else if (type == "linear") {
+		return std::make_shared<LinearLayer>(size, lc.getFloat("scale", 1.0f),
+				lc.getFloat("bias", 0.0f));
+	} else if (type == "power") {
+		return std::make_shared<PowerLayer>(in, lc.getFloat("factor", 1.0f),
+				lc.getFloat("scale", 1.0f));
+	}
+	throw ConfigError(lc.line, "unknown layer type " + type);
+}
+std::shared_ptr<NeuralSystem> MakeSystem(const TrainConfig& config,
+		const aly::dim3& inputShape) {
+	BackendType backend = ParseBackendType(config.backend);
+	if (config.caffeNet.size() > 0 || config.caffeWeights.size() > 0) {
+		std::shared_ptr<NeuralSystem> sys = ReadCaffeModel(config.caffeNet,
+				config.caffeWeights, backend);
+		aly::dim3 shape = sys->getInputLayers().front()->getOutputDimensions(0);
+		if (shape.x != inputShape.x || shape.y != inputShape.y
+				|| shape.z != inputShape.z) {
+			throw std::runtime_error("The Caffe network does not take "
+					"the training images as input.");
+		}
+		for (NeuralLayerPtr layer : *sys) {
+			layer->setParallelize(config.parallelize);
+		}
+		return sys;
+	}
+	std::shared_ptr<NeuralSystem> sys(new NeuralSystem(config.name, nullptr));
+	NeuralLayerPtr input = std::make_shared<InputLayer>(inputShape);
+	NeuralLayerPtr prev = input;
+	for (const LayerConfig& lc : config.layers) {
+		NeuralLayerPtr layer = MakeLayer(lc, prev,
+				lc.has("backend") ?
+						ParseBackendType(lc.get("backend", "")) : backend);
+		Connect(prev, layer, 0, 0);
+		prev = layer;
+	}
+	sys->build(input, prev);
+	for (NeuralLayerPtr layer : *sys) {
+		layer->setParallelize(config.parallelize);
+	}
+	return sys;
+}
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef TRAINCONFIG_H_
+#define TRAINCONFIG_H_
+#include "NeuralSystem.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+namespace tgr {
+/**
+ * One "layer <type> key=value ..." line. Input shapes are inferred from the
+ * previous layer, so only the parameters of the layer itself are given.
+ */
+struct LayerConfig {
+	std::string type;
+	std::map<std::string, std::string> params;
+	int line = 0;
+	bool has(const std::string& key) const {
+		return params.find(key) != params.end();
+	}
+	std::string get(const std::string& key, const std::string& def) const;
+	int getInt(const std::string& key, int def) const;
+	float getFloat(const std::string& key, float def) const;
+	bool getBool(const std::string& key, bool def) const;
+};
+/**
+ * Declarative description of a training run. The file is a list of
+ * "key = value" settings plus "layer" lines that build a sequential
+ * network from the input shape. '#' starts a comment. See
+ * trainer/lenet5.cfg for an example.
+ */
+struct TrainConfig {
+	std::string name = "tiger";
+	std::string trainImages;
+	std::string trainLabels;
+	std::string testImages;
+	std::string testLabels;
+	float scaleMin = 0.0f;
+	float scaleMax = 1.0f;
+	int padding = 0;
+	std::string backend = "default";
+	bool parallelize = true;
+	int threads = 0; //0 keeps the thread pool default
+	bool pin = false; //pin pool workers to cores
+	bool tune = false; //autotune layer backends before training
+	std::string tuneCache; //empty uses <output>/tuning.cache
+	//compiled plan restored at startup if it matches, written otherwise
+	std::string plan;
+	std::string optimizer = "momentum";
+	float learningRate = 0.01f;
+	float weightDecay = 0.0f;
+	float momentum = 0.9f;
+	std::string loss = "softmax_cross_entropy";
+	int batchSize = 32;
+	int epochs = 10;
+	int maxSamples = 0; //0 uses the whole training set
+	unsigned int seed = 1234;
+	bool shuffle = true;
+	std::string outputDir = "./train_output";
+	int checkpointEvery = 1; //epochs, 0 only writes the final weights
+	int checkpointKeep = 0; //newest checkpoints kept, 0 keeps all
+	int logEvery = 100; //batches
+	std::string resume; //checkpoint to load before training
+	//layers with weights kept fixed, counted from the input
+	int freeze = 0;
+	//trains on cached outputs of the frozen layers, see NeuralFeatureCache
+	bool freezeCache = true;
+	std::string freezePrecision = "fp16";
+	int traceEvery = 0; //batches between trace samples, 0 disables tracing
+	std::vector<int> traceLayers; //layer ids, empty traces every layer
+	int traceMemory = 32; //MB of compressed frames kept before spilling
+	bool traceWeights = false; //also trace weights and their gradients
+	std::string traceFile; //empty uses <output>/trace.tgt
+	//fp32, fp16, bf16 or int8 also writes <output>/<name>.tgq, empty skips it
+	std::string exportPrecision;
+	//Caffe network replacing the layer lines, see ReadCaffeModel
+	std::string caffeNet;
+	std::string caffeWeights;
+	std::vector<LayerConfig> layers;
+};
+void ReadTrainConfigFromFile(const std::string& file, TrainConfig& config);
+BackendType ParseBackendType(const std::string& name);
+NeuralOptimizer MakeOptimizer(const TrainConfig& config);
+NeuralLossFunction MakeLossFunction(const TrainConfig& config);
+/**
+ * Builds the configured layers in order starting from an input layer of
+ * the given shape, or imports the configured Caffe network, which must
+ * take inputs of that shape.
+ */
+std::shared_ptr<NeuralSystem> MakeSystem(const TrainConfig& config,
+		const aly::dim3& inputShape);
+}
+#endif
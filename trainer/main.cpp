@@ -0,0 +1,95 @@
+/*
+ * Copyright(C) 2016, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "NeuralTrainer.h"
+#include "NeuralExport.h"
+#include "NeuralNuma.h"
+#include <cstdlib>
+#include <iostream>
+using namespace tgr;
+static void PrintUsage() {
+	std::cout << "Usage: tiger-train <config> [options]\n"
+			<< "  --epochs <n>        override the number of epochs\n"
+			<< "  --batch <n>         override the batch size\n"
+			<< "  --output <dir>      override the output directory\n"
+			<< "  --resume <file>     load a checkpoint before training\n"
+			<< "  --export <type>     also write the final weights as fp16, bf16 or int8\n"
+			<< "  --serial            disable parallel kernels\n"
+			<< "  --threads <n>       thread pool size, including the main thread\n"
+			<< "  --tune              time layer backends and keep the fastest\n"
+			<< "  --isa <level>       cap kernels at generic, sse42, avx2 or avx512\n"
+			<< "  --pin               pin thread pool workers to cores\n";
+}
+int main(int argc, char *argv[]) {
+	if (argc < 2 || std::string(argv[1]) == "--help") {
+		PrintUsage();
+		return (argc < 2) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	try {
+		TrainConfig config;
+		ReadTrainConfigFromFile(argv[1], config);
+		for (int i = 2; i < argc; i++) {
+			std::string arg = argv[i];
+			bool hasValue = (i + 1 < argc);
+			if (arg == "--epochs" && hasValue) {
+				config.epochs = std::max(0, std::atoi(argv[++i]));
+			} else if (arg == "--batch" && hasValue) {
+				config.batchSize = std::max(1, std::atoi(argv[++i]));
+			} else if (arg == "--output" && hasValue) {
+				config.outputDir = argv[++i];
+			} else if (arg == "--resume" && hasValue) {
+				config.resume = argv[++i];
+			} else if (arg == "--export" && hasValue) {
+				config.exportPrecision = argv[++i];
+				ParsePrecision(config.exportPrecision);
+			} else if (arg == "--serial") {
+				config.parallelize = false;
+			} else if (arg == "--threads" && hasValue) {
+				config.threads = std::max(1, std::atoi(argv[++i]));
+			} else if (arg == "--pin") {
+				config.pin = true;
+			} else if (arg == "--tune") {
+				config.tune = true;
+			} else if (arg == "--isa" && hasValue) {
+				NeuralKernels::setIsa(ParseIsaLevel(argv[++i]));
+			} else {
+				PrintUsage();
+				return EXIT_FAILURE;
+			}
+		}
+		if (config.threads > 0) {
+			NeuralThreadPool::setThreadCount(config.threads);
+		}
+		NeuralThreadPool::setPinning(config.pin);
+		std::cout << "Kernels: " << NeuralKernels::getIsa() << ", threads: "
+				<< NeuralThreadPool::getThreadCount() << std::endl;
+		if (NeuralNuma::getNodeCount() > 1) {
+			NeuralNuma::print(std::cout);
+		}
+		NeuralTrainer trainer(config);
+		trainer.loadData();
+		trainer.build();
+		trainer.run();
+	} catch (std::exception& e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}